@@ -0,0 +1,161 @@
+/********************************************************************************
+* adaptive_rate.hpp: Contains an adaptive control rate for servos that are
+*                    settled most of the time. A servo with an adaptive rate is
+*                    only regulated every period ticks of the fleet, where the
+*                    period doubles each time the error has stayed within a
+*                    deadband for a number of regulations, up to a longest
+*                    period. An error outside the deadband snaps the period
+*                    back to a single tick, i.e. the fast rate.
+*
+*                    The output is held between regulations, so the PID
+*                    controller is updated with the number of ticks elapsed
+*                    as time step, which integrates and differentiates the
+*                    error as if it had been constant over the skipped ticks.
+*                    While slowed down, an error within the deadband also
+*                    holds the output, like the error deadband of industrial
+*                    PID controllers. Otherwise the shaft settles completely
+*                    between regulations at a long period, where the
+*                    proportional action of a position loop is marginally
+*                    stable at kp = 1 and unstable above. A disturbance
+*                    arriving while the servo is slowed down is first seen at
+*                    its next regulation, so the reaction latency is at most
+*                    the longest period minus one tick.
+********************************************************************************/
+#ifndef ADAPTIVE_RATE_HPP_
+#define ADAPTIVE_RATE_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+
+/********************************************************************************
+* adaptive_rate: Struct for implementation of a per-servo control period that
+*                grows while the servo is settled. The rate is disabled by
+*                default, in which case the servo is regulated every tick.
+********************************************************************************/
+struct adaptive_rate
+{
+   bool enabled              = false; /* Indicates if the period adapts. */
+   double deadband           = 0.5;   /* Largest error of a settled servo in degrees. */
+   std::size_t settle_cycles = 4;     /* Settled regulations before the period doubles. */
+   std::size_t max_period    = 16;    /* Longest period in ticks. */
+
+   std::size_t period      = 1; /* Current period in ticks. */
+   std::size_t elapsed     = 0; /* Ticks since the last regulation. */
+   std::size_t calm        = 0; /* Settled regulations at the current period. */
+   std::size_t ticks       = 0; /* Number of ticks seen. */
+   std::size_t regulations = 0; /* Number of ticks the servo was due. */
+   std::size_t snaps       = 0; /* Number of snaps back to the fast rate. */
+
+   /********************************************************************************
+   * init: Enables the adaptive rate with specified settings and clears the
+   *       state.
+   *
+   *       - band   : Largest error of a settled servo in degrees.
+   *       - longest: Longest period in ticks.
+   *       - settle : Settled regulations before the period doubles (default = 4).
+   ********************************************************************************/
+   void init(const double band,
+             const std::size_t longest,
+             const std::size_t settle = 4)
+   {
+      enabled = true;
+      deadband = band;
+      max_period = longest > 0 ? longest : 1;
+      settle_cycles = settle;
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Returns to the fast rate and clears the counters.
+   ********************************************************************************/
+   void reset(void)
+   {
+      period = 1;
+      elapsed = 0;
+      calm = 0;
+      ticks = 0;
+      regulations = 0;
+      snaps = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * tick: Counts a tick of the fleet and returns true if the servo is due for
+   *       regulation, i.e. a period has elapsed since the last regulation.
+   ********************************************************************************/
+   bool tick(void)
+   {
+      ticks++;
+      return ++elapsed >= period;
+   }
+
+   /********************************************************************************
+   * dt: Returns the time step of the coming regulation in ticks, i.e. the
+   *     ticks elapsed since the last regulation, at least one tick.
+   ********************************************************************************/
+   double dt(void) const
+   {
+      return elapsed > 1 ? static_cast<double>(elapsed) : 1.0;
+   }
+
+   /********************************************************************************
+   * settled: Indicates if the servo runs at a slow rate and specified error is
+   *          within the deadband, so the output is held.
+   *
+   *          - error: Error of the coming regulation in degrees.
+   ********************************************************************************/
+   bool settled(const double error) const
+   {
+      return period > 1 && std::fabs(error) <= deadband;
+   }
+
+   /********************************************************************************
+   * update: Adapts the period to the error of a regulation. An error outside
+   *         the deadband snaps back to the fast rate, while settle_cycles
+   *         regulations in a row within the deadband double the period.
+   *
+   *         - error: Error of the PID controller in degrees.
+   ********************************************************************************/
+   void update(const double error)
+   {
+      elapsed = 0;
+      regulations++;
+
+      if (!(std::fabs(error) <= deadband))
+      {
+         if (period > 1) snaps++;
+         period = 1;
+         calm = 0;
+      }
+      else if (++calm >= settle_cycles && period < max_period)
+      {
+         period = period * 2 < max_period ? period * 2 : max_period;
+         calm = 0;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * fast: Returns to the fast rate without counting a regulation, for instance
+   *       while autotuning.
+   ********************************************************************************/
+   void fast(void)
+   {
+      elapsed = 0;
+      period = 1;
+      calm = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * ratio: Returns the share of ticks regulated, between 0 and 1.
+   ********************************************************************************/
+   double ratio(void) const
+   {
+      return ticks ? static_cast<double>(regulations) / ticks : 1.0;
+   }
+};
+
+#endif /* ADAPTIVE_RATE_HPP_ */
\ No newline at end of file
@@ -0,0 +1,245 @@
+/********************************************************************************
+* autotuner.hpp: Contains a relay feedback autotuner (Astrom-Hagglund) for
+*                PID controllers. While active, the autotuner replaces the PID
+*                regulation with a relay, which switches the output between
+*                target + amplitude and target - amplitude depending on the
+*                sign of the error. This makes the loop oscillate at its
+*                ultimate period, from which the ultimate gain is derived via
+*                the amplitude of the oscillation. The PID parameters are then
+*                calculated with a Ziegler-Nichols type tuning rule.
+*
+*                The autotuner only holds a few counters and running values,
+*                so that it costs a few operations per cycle and can be run
+*                for every servo of a large fleet at once.
+********************************************************************************/
+#ifndef AUTOTUNER_HPP_
+#define AUTOTUNER_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include "pid_controller.hpp"
+
+/********************************************************************************
+* relay_autotuner: Struct for implementation of relay feedback autotuning of
+*                  a PID controller with bounded number of cycles.
+********************************************************************************/
+struct relay_autotuner
+{
+   /********************************************************************************
+   * state: Enumeration of the states of the autotuner.
+   ********************************************************************************/
+   enum class state { idle, running, done, failed };
+
+   /********************************************************************************
+   * rule: Enumeration of tuning rules used to calculate the PID parameters
+   *       from the ultimate gain and period, from aggressive to cautious.
+   ********************************************************************************/
+   enum class rule { ziegler_nichols, some_overshoot, no_overshoot };
+
+   double amplitude         = 10.0; /* Relay amplitude around the target in degrees. */
+   double hysteresis        = 0.5;  /* Error hysteresis of the relay in degrees. */
+   std::size_t max_cycles   = 400;  /* Maximum number of cycles before giving up. */
+   std::size_t skip_periods = 2;    /* Oscillation periods ignored while settling. */
+   std::size_t num_periods  = 3;    /* Oscillation periods averaged for the result. */
+   rule tuning_rule         = rule::no_overshoot; /* Rule for calculating the gains. */
+
+   state status           = state::idle; /* Current state of the autotuner. */
+   std::size_t cycles     = 0;           /* Number of cycles run so far. */
+   std::size_t periods    = 0;           /* Number of completed oscillation periods. */
+   std::size_t measured   = 0;           /* Number of periods added to the sums. */
+   std::size_t last_rise  = 0;           /* Cycle of the last switch to positive output. */
+   double relay_sign      = 0;           /* Current relay direction (1 or -1). */
+   double input_max       = 0;           /* Highest input of the current period. */
+   double input_min       = 0;           /* Lowest input of the current period. */
+   double period_sum      = 0;           /* Sum of the measured periods in cycles. */
+   double amplitude_sum   = 0;           /* Sum of the measured input amplitudes. */
+   double ultimate_gain   = 0;           /* Measured ultimate gain. */
+   double ultimate_period = 0;           /* Measured ultimate period in cycles. */
+
+   /********************************************************************************
+   * start: Starts a new autotuning run, clearing earlier measurements.
+   ********************************************************************************/
+   void start(void)
+   {
+      status = state::running;
+      cycles = 0;
+      periods = 0;
+      measured = 0;
+      last_rise = 0;
+      relay_sign = 0;
+      period_sum = 0;
+      amplitude_sum = 0;
+      ultimate_gain = 0;
+      ultimate_period = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * active: Returns true if an autotuning run is in progress.
+   ********************************************************************************/
+   bool active(void) const
+   {
+      return status == state::running;
+   }
+
+   /********************************************************************************
+   * regulate: Sets the output of referenced PID controller with the relay
+   *           instead of the PID parameters and updates the measurement of the
+   *           oscillation. When enough periods are measured, the new PID
+   *           parameters are installed in the controller and the controller
+   *           is reset. If the oscillation is not measured within the maximum
+   *           number of cycles, the controller keeps its previous parameters.
+   *
+   *           - pid      : Reference to the PID controller being tuned.
+   *           - new_input: New input value of the PID controller.
+   ********************************************************************************/
+   template<class T>
+   void regulate(basic_pid_controller<T>& pid,
+                 const T new_input)
+   {
+      const auto error = pid.target - new_input;
+      const auto value = numeric_value(new_input);
+      const auto last_sign = relay_sign;
+
+      if (error > hysteresis)
+      {
+         relay_sign = 1;
+      }
+      else if (error < -hysteresis)
+      {
+         relay_sign = -1;
+      }
+      else if (relay_sign == 0)
+      {
+         relay_sign = 1;
+      }
+
+      if (relay_sign > 0 && last_sign < 0)
+      {
+         if (periods >= skip_periods && last_rise > 0)
+         {
+            period_sum += static_cast<double>(cycles - last_rise);
+            amplitude_sum += (input_max - input_min) / 2.0;
+            measured++;
+         }
+
+         periods++;
+         last_rise = cycles;
+         input_max = value;
+         input_min = value;
+      }
+
+      if (value > input_max) input_max = value;
+      if (value < input_min) input_min = value;
+
+      pid.input = new_input;
+      pid.last_error = error;
+      pid.output = pid.target + relay_sign * amplitude;
+      pid.check_output();
+      cycles++;
+
+      if (measured >= num_periods)
+      {
+         finish(pid);
+      }
+      else if (cycles >= max_cycles)
+      {
+         status = state::failed;
+         pid.reset();
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * gains: Returns the PID parameters calculated from the measured ultimate
+   *        gain and period with the selected tuning rule. The integral and
+   *        derivate constants are scaled to the per cycle update of the PID
+   *        controller, i.e. ki = kp / Ti and kd = kp * Td with Ti and Td in
+   *        cycles.
+   ********************************************************************************/
+   pid_gains gains(void) const
+   {
+      auto kp = 0.0, ti = 0.0, td = 0.0;
+
+      if (tuning_rule == rule::ziegler_nichols)
+      {
+         kp = 0.6 * ultimate_gain;
+         ti = ultimate_period / 2.0;
+         td = ultimate_period / 8.0;
+      }
+      else if (tuning_rule == rule::some_overshoot)
+      {
+         kp = 0.33 * ultimate_gain;
+         ti = ultimate_period / 2.0;
+         td = ultimate_period / 3.0;
+      }
+      else
+      {
+         kp = 0.2 * ultimate_gain;
+         ti = ultimate_period / 2.0;
+         td = ultimate_period / 3.0;
+      }
+      return pid_gains{ kp, ti > 0 ? kp / ti : 0, kp * td };
+   }
+
+   /********************************************************************************
+   * finish: Calculates the ultimate gain and period from the measured periods,
+   *         installs the resulting PID parameters in referenced controller
+   *         and resets the controller. The ultimate gain is calculated with
+   *         describing function analysis of the relay, where the hysteresis
+   *         is compensated for.
+   *
+   *         - pid: Reference to the PID controller being tuned.
+   ********************************************************************************/
+   template<class T>
+   void finish(basic_pid_controller<T>& pid)
+   {
+      const auto pi = 3.14159265358979323846;
+      const auto count = measured ? static_cast<double>(measured) : 1.0;
+      const auto oscillation = amplitude_sum / count;
+      const auto effective = oscillation > hysteresis ?
+         std::sqrt(oscillation * oscillation - hysteresis * hysteresis) : oscillation;
+
+      ultimate_period = period_sum / count;
+      ultimate_gain = effective > 0 ? 4.0 * amplitude / (pi * effective) : 0;
+
+      if (ultimate_gain > 0 && ultimate_period > 0)
+      {
+         status = state::done;
+         pid.set_gains(gains());
+      }
+      else
+      {
+         status = state::failed;
+      }
+
+      pid.reset();
+      return;
+   }
+
+   /********************************************************************************
+   * print: Prints the state and measurements of the autotuner in the terminal.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      const auto result = gains();
+      ostream << std::fixed << std::setprecision(4);
+      ostream << "--------------------------------------------------------------------------------\n";
+      ostream << "Autotune status:\t\t" << (status == state::done ? "done" :
+         (status == state::failed ? "failed" : (status == state::running ? "running" : "idle"))) << "\n";
+      ostream << "Cycles used:\t\t\t" << cycles << "\n";
+      ostream << "Ultimate gain:\t\t\t" << ultimate_gain << "\n";
+      ostream << "Ultimate period:\t\t" << ultimate_period << " cycles\n";
+      ostream << "Gains:\t\t\t\tkp = " << result.kp << ", ki = " << result.ki
+              << ", kd = " << result.kd << "\n";
+      ostream << "--------------------------------------------------------------------------------\n\n";
+      return;
+   }
+};
+
+#endif /* AUTOTUNER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,443 @@
+/********************************************************************************
+* calibration.hpp: Contains calibration of nonlinear TOF sensors. A calibration
+*                  curve maps raw sensor readings to linearized values and is
+*                  given by points loaded from a text file, interpolated
+*                  piecewise linearly or with a monotone cubic. Each curve is
+*                  compiled into a lookup table of equally wide segments over
+*                  the sensor range, where each segment holds the line of the
+*                  curve within it. Applying the table then costs an index
+*                  calculation and a single access to the segment.
+*
+*                  The tables are published to the sensors through atomic
+*                  pointers, so that a calibration file can be reloaded while
+*                  the control loop runs. A reloaded table replaces the old
+*                  one at the next sample, while the old table is retired and
+*                  kept alive by the store, since a sensor may still be
+*                  applying it. If the thread reading the sensors counts its
+*                  ticks in a counter attached to the store, a retired table
+*                  is freed once the counter has moved on, i.e. after the
+*                  next tick boundary. Otherwise every retired table is kept
+*                  until the store is destroyed, unless a number of retained
+*                  tables is set, which is unsafe, since a sensor preempted
+*                  while applying a table may then read freed memory.
+*
+*                  The calibration file holds one section per sensor, started
+*                  by a line with the name of the sensor, left or right, and the
+*                  interpolation, linear or cubic, followed by one line per
+*                  point with the raw reading and the linearized value. Lines
+*                  starting with # are comments:
+*
+*                  # Left sensor, raw reading and linearized value.
+*                  left cubic
+*                  102.3 0
+*                  180.5 63.9
+*                  ...
+********************************************************************************/
+#ifndef CALIBRATION_HPP_
+#define CALIBRATION_HPP_
+
+/* Include directives: */
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "pid_controller.hpp"
+
+/********************************************************************************
+* calibration_point: Struct holding a point of a calibration curve.
+********************************************************************************/
+struct calibration_point
+{
+   double raw   = 0; /* Raw sensor reading. */
+   double value = 0; /* Linearized value of the reading. */
+};
+
+/********************************************************************************
+* calibration_table: Struct for implementation of a compiled calibration curve
+*                    with NUM_SEGMENTS equally wide segments between the lowest
+*                    and highest raw reading of the curve. Readings outside
+*                    the curve are extrapolated along the first or last
+*                    segment.
+********************************************************************************/
+struct calibration_table
+{
+   static constexpr std::size_t NUM_SEGMENTS = 256; /* Number of segments of the table. */
+
+   /********************************************************************************
+   * segment: Struct holding the line of the curve within a segment, stored as
+   *          intercept and slope, so that a segment is read in one access.
+   ********************************************************************************/
+   struct segment
+   {
+      double intercept = 0; /* Linearized value at raw reading 0. */
+      double slope     = 1; /* Linearized value per raw unit. */
+   };
+
+   double min   = 0;                /* Lowest raw reading of the curve. */
+   double scale = 0;                /* Segments per raw unit. */
+   segment segments[NUM_SEGMENTS]; /* Line of the curve in each segment. */
+
+   /********************************************************************************
+   * apply: Returns the linearized value of specified raw reading. A reading
+   *        that is not a number is looked up in the first segment, so the
+   *        index stays within the table.
+   *
+   *        - raw: Raw sensor reading.
+   ********************************************************************************/
+   template<class T>
+   T apply(const T raw) const
+   {
+      const auto position = (numeric_value(raw) - min) * scale;
+      const auto index = !(position > 0) ? std::size_t{ 0 } :
+         (position >= NUM_SEGMENTS - 1 ? NUM_SEGMENTS - 1 : static_cast<std::size_t>(position));
+      const auto& line = segments[index];
+      return line.intercept + line.slope * raw;
+   }
+
+   /********************************************************************************
+   * compile: Compiles specified calibration points into referenced table, with
+   *          monotone cubic interpolation if specified, otherwise piecewise
+   *          linear. The points must be sorted by strictly increasing raw
+   *          readings. Returns false if there are less than two points or the
+   *          points are not sorted.
+   *
+   *          - points: Reference to calibration points.
+   *          - cubic : Interpolates with a monotone cubic if true.
+   *          - table : Reference to the compiled table.
+   ********************************************************************************/
+   static bool compile(const std::vector<calibration_point>& points,
+                       const bool cubic,
+                       calibration_table& table)
+   {
+      if (points.size() < 2) return false;
+
+      for (std::size_t i = 1; i < points.size(); ++i)
+      {
+         if (!(points[i].raw > points[i - 1].raw)) return false;
+      }
+
+      const auto tangents = cubic ? monotone_tangents(points) : std::vector<double>();
+      const auto width = (points.back().raw - points.front().raw) / NUM_SEGMENTS;
+      table.min = points.front().raw;
+      table.scale = 1.0 / width;
+
+      for (std::size_t i = 0; i < NUM_SEGMENTS; ++i)
+      {
+         const auto x0 = table.min + i * width;
+         const auto x1 = i + 1 < NUM_SEGMENTS ? x0 + width : points.back().raw;
+         const auto y0 = interpolate(points, tangents, x0);
+         const auto y1 = interpolate(points, tangents, x1);
+         table.segments[i].slope = (y1 - y0) / (x1 - x0);
+         table.segments[i].intercept = y0 - table.segments[i].slope * x0;
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * monotone_tangents: Returns the tangents of a monotone cubic through specified
+   *                    points (Fritsch-Carlson), which does not overshoot
+   *                    between the points, so a monotone curve stays monotone.
+   *
+   *                    - points: Reference to calibration points.
+   ********************************************************************************/
+   static std::vector<double> monotone_tangents(const std::vector<calibration_point>& points)
+   {
+      const auto n = points.size();
+      std::vector<double> secants(n - 1), tangents(n);
+
+      for (std::size_t i = 0; i + 1 < n; ++i)
+      {
+         secants[i] = (points[i + 1].value - points[i].value) / (points[i + 1].raw - points[i].raw);
+      }
+
+      tangents[0] = secants[0];
+      tangents[n - 1] = secants[n - 2];
+
+      for (std::size_t i = 1; i + 1 < n; ++i)
+      {
+         tangents[i] = secants[i - 1] * secants[i] <= 0 ? 0.0 : (secants[i - 1] + secants[i]) / 2.0;
+      }
+
+      for (std::size_t i = 0; i + 1 < n; ++i)
+      {
+         if (secants[i] == 0)
+         {
+            tangents[i] = 0;
+            tangents[i + 1] = 0;
+            continue;
+         }
+
+         const auto a = tangents[i] / secants[i];
+         const auto b = tangents[i + 1] / secants[i];
+         const auto length = a * a + b * b;
+
+         if (length > 9.0)
+         {
+            const auto factor = 3.0 / std::sqrt(length);
+            tangents[i] = factor * a * secants[i];
+            tangents[i + 1] = factor * b * secants[i];
+         }
+      }
+      return tangents;
+   }
+
+   /********************************************************************************
+   * interpolate: Returns the value of the curve through specified points at
+   *              specified raw reading, interpolated with specified tangents
+   *              (Hermite) or linearly if no tangents are specified. Readings
+   *              outside the points are extrapolated linearly.
+   *
+   *              - points  : Reference to calibration points.
+   *              - tangents: Reference to tangents at the points, may be empty.
+   *              - raw     : Raw sensor reading.
+   ********************************************************************************/
+   static double interpolate(const std::vector<calibration_point>& points,
+                             const std::vector<double>& tangents,
+                             const double raw)
+   {
+      std::size_t i = 0;
+      while (i + 2 < points.size() && raw > points[i + 1].raw) ++i;
+
+      const auto& p0 = points[i];
+      const auto& p1 = points[i + 1];
+      const auto width = p1.raw - p0.raw;
+      const auto t = (raw - p0.raw) / width;
+
+      if (tangents.empty() || t < 0 || t > 1)
+      {
+         return p0.value + (p1.value - p0.value) * t;
+      }
+
+      const auto t2 = t * t, t3 = t2 * t;
+      return (2 * t3 - 3 * t2 + 1) * p0.value + (t3 - 2 * t2 + t) * width * tangents[i] +
+         (-2 * t3 + 3 * t2) * p1.value + (t3 - t2) * width * tangents[i + 1];
+   }
+};
+
+/********************************************************************************
+* calibration_store: Struct for loading calibration files and publishing the
+*                    compiled tables of the left and right sensor. The file can
+*                    be reloaded at any time, for instance by a thread polling
+*                    for changes, while the sensors keep reading the slots.
+********************************************************************************/
+struct calibration_store
+{
+   /********************************************************************************
+   * retired_table: Struct holding a table replaced by a reload, along with the
+   *                tick count at which it was replaced.
+   ********************************************************************************/
+   struct retired_table
+   {
+      std::unique_ptr<calibration_table> table; /* Replaced table. */
+      std::uint64_t tick;                       /* Tick count when replaced. */
+   };
+
+   std::atomic<const calibration_table*> left{ nullptr };  /* Table of the left sensor, read by the sensor. */
+   std::atomic<const calibration_table*> right{ nullptr }; /* Table of the right sensor, read by the sensor. */
+   std::string filepath;                                   /* Path to the calibration file. */
+   std::string error;                                      /* Description of the last load error. */
+   std::size_t generation = 0;                             /* Number of successful loads. */
+   std::int64_t stamp     = -1;                            /* Modification time of the loaded file. */
+   std::unique_ptr<calibration_table> left_table;          /* Table published to the left sensor. */
+   std::unique_ptr<calibration_table> right_table;         /* Table published to the right sensor. */
+   std::vector<retired_table> retired;                     /* Replaced tables, kept while readers may hold them. */
+   const std::atomic<std::uint64_t>* ticks = nullptr;      /* Tick counter of the reading thread, none if nullptr. */
+   std::size_t retained   = 0;                             /* Retired tables kept without a tick counter, 0 = all. */
+   std::mutex lock;                                        /* Serializes loads. */
+
+   calibration_store(void) = default;
+   calibration_store(const calibration_store&) = delete;
+   calibration_store& operator=(const calibration_store&) = delete;
+
+   /********************************************************************************
+   * load: Loads and compiles the calibration file at specified path and
+   *       publishes the tables of the sensors found in the file. Sensors
+   *       missing from the file keep their current table. Returns false and
+   *       keeps every current table if the file can't be read or holds an
+   *       invalid line, a section of an unknown sensor or interpolation, i.e.
+   *       other than left or right and linear or cubic, or an invalid curve,
+   *       where the reason is stored in error.
+   *
+   *       - new_filepath: Path to the calibration file.
+   ********************************************************************************/
+   bool load(const std::string& new_filepath)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      filepath = new_filepath;
+      stamp = modification_time(filepath);
+      std::ifstream file(filepath);
+      std::unique_ptr<calibration_table> new_left, new_right;
+      std::vector<calibration_point> points;
+      std::string line, section, mode;
+      std::size_t line_number = 0;
+
+      if (!file)
+      {
+         error = "Could not open " + filepath;
+         return false;
+      }
+
+      while (true)
+      {
+         const auto more = static_cast<bool>(std::getline(file, line));
+         line_number++;
+         std::istringstream stream(line);
+         std::string word;
+         const auto empty = !(stream >> word) || word[0] == '#';
+         if (more && empty) continue;
+
+         if (!more || (!std::isdigit(static_cast<unsigned char>(word[0])) && word[0] != '-' && word[0] != '.'))
+         {
+            if (!section.empty())
+            {
+               std::unique_ptr<calibration_table> table(new calibration_table());
+
+               if (!calibration_table::compile(points, mode == "cubic", *table))
+               {
+                  error = "Invalid curve of sensor " + section + " in " + filepath;
+                  return false;
+               }
+
+               if (section == "left") new_left = std::move(table);
+               else if (section == "right") new_right = std::move(table);
+            }
+
+            if (!more) break;
+            section = word;
+            mode.clear();
+            stream >> mode;
+            points.clear();
+
+            if ((section != "left" && section != "right") || (mode != "linear" && mode != "cubic"))
+            {
+               error = "Invalid section at line " + std::to_string(line_number) + " in " + filepath;
+               return false;
+            }
+            continue;
+         }
+
+         calibration_point point;
+         std::istringstream values(line);
+
+         if (section.empty() || !(values >> point.raw >> point.value))
+         {
+            error = "Invalid line " + std::to_string(line_number) + " in " + filepath;
+            return false;
+         }
+         points.push_back(point);
+      }
+
+      publish(left, left_table, new_left);
+      publish(right, right_table, new_right);
+      release();
+      generation++;
+      error.clear();
+      return true;
+   }
+
+   /********************************************************************************
+   * reload_if_changed: Reloads the calibration file if its modification time
+   *                    differs from the loaded file. Returns true if the file
+   *                    was reloaded.
+   ********************************************************************************/
+   bool reload_if_changed(void)
+   {
+      std::string path;
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         if (filepath.empty() || modification_time(filepath) == stamp) return false;
+         path = filepath;
+      }
+      return load(path);
+   }
+
+   /********************************************************************************
+   * collect: Frees the retired tables no reader can hold anymore, for instance
+   *          when polled by the thread reloading the file.
+   ********************************************************************************/
+   void collect(void)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      release();
+      return;
+   }
+
+   /********************************************************************************
+   * publish: Publishes specified table in referenced slot, where the store
+   *          takes over the table and retires the table published before.
+   *          Nothing is published if the table is empty. The slot is stored
+   *          and the tick count loaded sequentially consistent, so a reader
+   *          still applying the old table hasn't passed its next tick yet.
+   *
+   *          - slot   : Reference to the slot read by a sensor.
+   *          - current: Reference to the table published in the slot.
+   *          - table  : Reference to the new table.
+   ********************************************************************************/
+   void publish(std::atomic<const calibration_table*>& slot,
+                std::unique_ptr<calibration_table>& current,
+                std::unique_ptr<calibration_table>& table)
+   {
+      if (!table) return;
+      slot.store(table.get(), std::memory_order_seq_cst);
+
+      if (current)
+      {
+         const auto tick = ticks ? ticks->load(std::memory_order_seq_cst) : 0;
+         retired.push_back(retired_table{ std::move(current), tick });
+      }
+
+      current = std::move(table);
+      return;
+   }
+
+   /********************************************************************************
+   * release: Frees the retired tables whose tick has passed if a tick counter
+   *          is attached. Otherwise every retired table but the last retained
+   *          is freed if a number of retained tables is set, regardless of a
+   *          sensor still applying one, while none is freed by default. The
+   *          lock must be held.
+   ********************************************************************************/
+   void release(void)
+   {
+      if (!ticks)
+      {
+         if (retained && retired.size() > retained) retired.erase(retired.begin(), retired.end() - retained);
+         return;
+      }
+
+      const auto now = ticks->load(std::memory_order_seq_cst);
+      retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                   [now](const retired_table& i) { return i.tick != now; }), retired.end());
+      return;
+   }
+
+   /********************************************************************************
+   * modification_time: Returns the modification time of the file at specified
+   *                    path in nanoseconds, or -1 if the file doesn't exist.
+   *
+   *                    - path: Path to the file.
+   ********************************************************************************/
+   static std::int64_t modification_time(const std::string& path)
+   {
+#ifdef _WIN32
+      struct _stat64 status;
+      if (_stat64(path.c_str(), &status) != 0) return -1;
+      return static_cast<std::int64_t>(status.st_mtime) * 1000000000;
+#else
+      struct stat status;
+      if (stat(path.c_str(), &status) != 0) return -1;
+      return static_cast<std::int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+   }
+};
+
+#endif /* CALIBRATION_HPP_ */
\ No newline at end of file
@@ -0,0 +1,2536 @@
+/********************************************************************************
+* commands.hpp: Contains the command line tools of the emulator, such as the
+*               offline PID tuner. A tool is selected by passing its name as
+*               the first command line argument, followed by optional
+*               arguments of the tool. Without arguments, the emulator is run
+*               interactively in the terminal.
+********************************************************************************/
+#ifndef COMMANDS_HPP_
+#define COMMANDS_HPP_
+
+/* Include directives: */
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "coroutine_task.hpp"
+#include "fleet_config.hpp"
+#include "frequency_response.hpp"
+#include "gradient_tuner.hpp"
+#include "lane_evaluator.hpp"
+#include "pareto.hpp"
+#include "prefix_cache.hpp"
+#include "realtime.hpp"
+#include "timer_wheel.hpp"
+#include "tuner.hpp"
+
+/********************************************************************************
+* commands: Namespace containing the command line tools.
+********************************************************************************/
+namespace commands
+{
+   /********************************************************************************
+   * argument: Returns command line argument at specified index converted to
+   *           a number, or specified default value if the argument is missing.
+   *
+   *           - argc         : Number of command line arguments.
+   *           - argv         : Command line arguments.
+   *           - index        : Index of the argument.
+   *           - default_value: Value returned if the argument is missing.
+   ********************************************************************************/
+   inline double argument(const int argc,
+                          char** argv,
+                          const int index,
+                          const double default_value)
+   {
+      return index < argc ? std::atof(argv[index]) : default_value;
+   }
+
+   /********************************************************************************
+   * default_servo: Returns the servo configuration used by the emulator, i.e.
+   *                target angle 90 degrees, angle range 30 - 150 degrees and
+   *                sensor range 0 - 1023.
+   ********************************************************************************/
+   inline servo default_servo(void)
+   {
+      return servo(90, 30, 150, 0, 1023);
+   }
+
+   /********************************************************************************
+   * tune: Tunes the PID parameters of the default servo against the default
+   *       plant model and scenario suite and prints the result along with the
+   *       cost of the default parameters for comparison.
+   *
+   *       If a cache file is specified, simulation results are kept in the file
+   *       and reused by later runs.
+   *
+   *       Usage: tune [simplexes] [iterations] [cache file]
+   ********************************************************************************/
+   inline int tune(const int argc,
+                   char** argv)
+   {
+      const auto num_simplexes = static_cast<std::size_t>(argument(argc, argv, 2, 8));
+      const auto max_iterations = static_cast<std::size_t>(argument(argc, argv, 3, 150));
+      tuner optimizer(default_servo());
+      result_cache cache;
+
+      if (argc > 4 && cache.open(argv[4]))
+      {
+         optimizer.cache = &cache;
+      }
+      metrics initial;
+      const auto initial_cost = optimizer.evaluate(pid_gains(), &initial);
+
+      std::cout << "Tuning with " << num_simplexes << " simplexes on "
+                << optimizer.num_threads << " threads...\n\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(4);
+      std::cout << "Default gains:\t\t\tkp = " << pid_gains().kp << ", ki = "
+                << pid_gains().ki << ", kd = " << pid_gains().kd << "\n";
+      std::cout << "Cost:\t\t\t\t" << initial_cost << "\n";
+      initial.print();
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+
+      const auto result = optimizer.optimize(pid_gains(), num_simplexes, max_iterations);
+      result.print();
+      if (optimizer.cache) cache.print();
+      return 0;
+   }
+
+   /********************************************************************************
+   * grid_search: Evaluates every candidate of referenced grid against referenced
+   *              traces with the lane evaluator, spread across all cores, and
+   *              stores the cost of each candidate. Returns the duration in
+   *              seconds.
+   *
+   *              - evaluator : Reference to lane evaluator.
+   *              - candidates: Reference to candidate PID parameters.
+   *              - traces    : Reference to traces to replay.
+   *              - cost      : Reference to cost function.
+   *              - costs     : Reference to vector for storage of the costs.
+   ********************************************************************************/
+   template<std::size_t N>
+   double grid_search(const lane_evaluator<N>& evaluator,
+                      const std::vector<pid_gains>& candidates,
+                      const std::vector<sensor_trace>& traces,
+                      const cost_function& cost,
+                      std::vector<double>& costs)
+   {
+      const auto t0 = std::chrono::steady_clock::now();
+      const auto num_blocks = (candidates.size() + N - 1) / N;
+      costs.resize(candidates.size());
+
+      parallel::for_each_index(num_blocks, [&](const std::size_t block)
+         {
+            pid_gains gains[N];
+            metrics results[N];
+
+            for (std::size_t l = 0; l < N; ++l)
+            {
+               const auto index = block * N + l;
+               gains[l] = candidates[index < candidates.size() ? index : candidates.size() - 1];
+            }
+
+            evaluator.evaluate(gains, traces, results);
+
+            for (std::size_t l = 0; l < N && block * N + l < candidates.size(); ++l)
+            {
+               costs[block * N + l] = cost(results[l]);
+            }
+         });
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+   }
+
+   /********************************************************************************
+   * grid: Runs a grid search of PID parameters against sensor traces recorded
+   *       from the default scenario suite with sensor noise, or against a
+   *       trace file if specified. The grid is evaluated both with the lane
+   *       evaluator and with one scalar replay per candidate, and the
+   *       candidates per second of both are printed along with the best gains.
+   *       The costs of both must agree up to rounding.
+   *
+   *       Usage: grid [points per axis] [lanes (8 or 16)] [trace file]
+   ********************************************************************************/
+   inline int grid(const int argc,
+                   char** argv)
+   {
+      const auto points = static_cast<std::size_t>(argument(argc, argv, 2, 16));
+      const auto lanes = static_cast<std::size_t>(argument(argc, argv, 3, 8));
+      const auto config = default_servo();
+      const cost_function cost;
+      const auto tolerance = 1e-6;
+      plant_model plant;
+      std::vector<sensor_trace> traces;
+      std::vector<pid_gains> candidates;
+      std::vector<double> lane_costs, scalar_costs(points * points * points);
+
+      if (points == 0)
+      {
+         std::cout << "Usage: grid [points per axis, at least 1] [lanes (8 or 16)] [trace file]\n\n";
+         return 1;
+      }
+
+      plant.sensor_noise = 2.0;
+
+      if (argc > 4)
+      {
+         sensor_trace trace;
+
+         if (!trace.load(argv[4]))
+         {
+            std::cout << "Could not load trace file " << argv[4] << "!\n\n";
+            return 1;
+         }
+         traces.push_back(trace);
+      }
+      else
+      {
+         for (const auto& i : scenario::default_suite())
+         {
+            traces.push_back(sensor_trace::record(config, plant, i));
+         }
+      }
+
+      for (std::size_t i = 0; i < points; ++i)
+      {
+         for (std::size_t j = 0; j < points; ++j)
+         {
+            for (std::size_t k = 0; k < points; ++k)
+            {
+               const auto step = points > 1 ? 1.0 / (points - 1) : 0.0;
+               candidates.push_back(pid_gains{ std::pow(10.0, -1.0 + 2.0 * i * step),
+                                               std::pow(10.0, -3.0 + 3.0 * j * step),
+                                               std::pow(10.0, -2.0 + 2.5 * k * step) });
+            }
+         }
+      }
+
+      const auto lane_seconds = lanes == 16 ?
+         grid_search(lane_evaluator<16>(config, plant), candidates, traces, cost, lane_costs) :
+         grid_search(lane_evaluator<8>(config, plant), candidates, traces, cost, lane_costs);
+
+      const auto t0 = std::chrono::steady_clock::now();
+      parallel::for_each_index(candidates.size(), [&](const std::size_t i)
+         {
+            auto candidate = config;
+            candidate.pid.set_gains(candidates[i]);
+            metrics total;
+
+            for (const auto& j : traces)
+            {
+               total.combine(replay(candidate, plant, j));
+            }
+            scalar_costs[i] = cost(total);
+         });
+      const auto scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+      std::size_t best = 0;
+      auto max_difference = 0.0;
+
+      for (std::size_t i = 0; i < candidates.size(); ++i)
+      {
+         if (lane_costs[i] < lane_costs[best]) best = i;
+         max_difference = std::max(max_difference, std::fabs(lane_costs[i] - scalar_costs[i]));
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Candidates:\t\t\t" << candidates.size() << " (" << traces.size() << " traces)\n";
+      std::cout << std::fixed << std::setprecision(4);
+      std::cout << "Best gains:\t\t\tkp = " << candidates[best].kp << ", ki = "
+                << candidates[best].ki << ", kd = " << candidates[best].kd << "\n";
+      std::cout << "Cost:\t\t\t\t" << lane_costs[best] << "\n";
+      std::cout << "Max lane/scalar difference:\t" << std::scientific << max_difference << "\n";
+      std::cout << std::fixed << std::setprecision(0);
+      std::cout << "Lane candidates per second:\t" << candidates.size() / lane_seconds
+                << " (" << (lanes == 16 ? 16 : 8) << " lanes)\n";
+      std::cout << "Scalar candidates per second:\t" << candidates.size() / scalar_seconds << "\n";
+      std::cout << std::setprecision(1);
+      std::cout << "Speedup:\t\t\t" << scalar_seconds / lane_seconds << "x\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+
+      if (max_difference > tolerance)
+      {
+         std::cout << "Lane and scalar costs differ by more than " << std::scientific << tolerance << "!\n\n";
+         return 1;
+      }
+      return 0;
+   }
+
+   /********************************************************************************
+   * autotune: Emulates a fleet of servos with varying plant models, where every
+   *           servo tunes itself at startup with the relay autotuner. The
+   *           servos are run in parallel on all cores. The number of cycles
+   *           used, the tuning time per servo and the cost of the tuned gains
+   *           on the default scenario suite compared to the default gains
+   *           are printed.
+   *
+   *           Usage: autotune [servos]
+   ********************************************************************************/
+   inline int autotune(const int argc,
+                       char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000));
+      const auto suite = scenario::default_suite();
+      const cost_function cost;
+      std::vector<relay_autotuner> results(num_servos);
+      std::vector<double> default_costs(num_servos), tuned_costs(num_servos);
+      std::vector<double> tune_seconds(num_servos);
+
+      parallel::for_each_index(num_servos, [&](const std::size_t i)
+         {
+            auto config = default_servo();
+            plant_model plant;
+            plant.inertia = 0.6 + 0.9 * ((i * 7) % 11) / 10.0;
+            plant.damping = 0.4 + 0.4 * ((i * 3) % 7) / 6.0;
+            plant.sensor_noise = 1.0;
+            plant.seed = i + 1;
+
+            const auto t0 = std::chrono::steady_clock::now();
+            simulation startup(config, plant);
+            startup.device.autotune();
+
+            while (startup.device.autotuner.active())
+            {
+               startup.step(0);
+            }
+
+            tune_seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            results[i] = startup.device.autotuner;
+            default_costs[i] = cost(simulate(config, plant, suite));
+            config.pid.set_gains(startup.device.pid.gains());
+            tuned_costs[i] = cost(simulate(config, plant, suite));
+         });
+
+      std::size_t num_done = 0;
+      auto cycles = 0.0, seconds = 0.0, default_cost = 0.0, tuned_cost = 0.0;
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         if (results[i].status == relay_autotuner::state::done) num_done++;
+         cycles += results[i].cycles;
+         seconds += tune_seconds[i];
+         default_cost += default_costs[i];
+         tuned_cost += tuned_costs[i];
+      }
+
+      const auto n = num_servos > 0 ? static_cast<double>(num_servos) : 1.0;
+      if (num_servos > 0) results[0].print();
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Servos tuned:\t\t\t" << num_done << " of " << num_servos << "\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Mean cycles used:\t\t" << cycles / n << "\n";
+      std::cout << std::setprecision(2);
+      std::cout << "Mean tuning time:\t\t" << seconds / n * 1e6 << " us per servo\n";
+      std::cout << std::setprecision(4);
+      std::cout << "Mean cost, default gains:\t" << default_cost / n << "\n";
+      std::cout << "Mean cost, autotuned gains:\t" << tuned_cost / n << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return 0;
+   }
+
+   /********************************************************************************
+   * pareto: Runs a multi-objective search of PID parameters for the default
+   *         servo and prints the non-dominated set with its metrics, along
+   *         with the cache hit rate and the duration of the search.
+   *
+   *         Usage: pareto [population] [generations]
+   ********************************************************************************/
+   inline int pareto(const int argc,
+                     char** argv)
+   {
+      pareto_search search(default_servo());
+      result_cache cache;
+
+      if (argc > 4 && cache.open(argv[4]))
+      {
+         search.persistent_cache = &cache;
+      }
+
+      search.population_size = static_cast<std::size_t>(argument(argc, argv, 2, 32));
+      search.generations = static_cast<std::size_t>(argument(argc, argv, 3, 40));
+      const auto front = search.run();
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "kp\tki\tkd\tSettling\tOvershoot\tEffort/cycle\tMean abs error\n";
+
+      for (const auto& i : front)
+      {
+         const auto n = i.result.cycles > 0 ? static_cast<double>(i.result.cycles) : 1.0;
+         std::cout << std::fixed << std::setprecision(3);
+         std::cout << i.gains.kp << "\t" << i.gains.ki << "\t" << i.gains.kd << "\t";
+         std::cout << std::setprecision(0) << i.objectives[0] << "\t\t";
+         std::cout << std::setprecision(2) << i.objectives[1] << "\t\t" << i.objectives[2]
+                   << "\t\t" << i.result.iae / n << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Non-dominated candidates:\t" << front.size() << "\n";
+      std::cout << "Simulated candidates:\t\t" << search.evaluations << "\n";
+      std::cout << std::setprecision(1);
+      std::cout << "Cache hit rate:\t\t\t" << search.hit_rate() * 100 << " %\n";
+      std::cout << std::setprecision(3);
+      std::cout << "Duration:\t\t\t" << search.seconds << " s\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      if (search.persistent_cache) cache.print();
+      return 0;
+   }
+
+   /********************************************************************************
+   * prefix: Runs a sweep of PID parameters over a suite where every scenario
+   *         starts with the same warm-up segment, both with every scenario
+   *         run from the start and with the warm-up shared through forked
+   *         simulation states. The number of simulated cycles and the
+   *         duration of both are printed. If a snapshot file is specified,
+   *         the states at the branch points are saved in the file and
+   *         restored by later runs.
+   *
+   *         Usage: prefix [candidates] [snapshot file]
+   ********************************************************************************/
+   inline int prefix(const int argc,
+                     char** argv)
+   {
+      const auto num_candidates = static_cast<std::size_t>(argument(argc, argv, 2, 32));
+      const auto config = default_servo();
+      const auto warmup = scenario::sine("Warm-up", 300, 100, 10);
+      const double steps[] = { -40, -20, -10, 10, 20, 40 };
+      plant_model plant;
+      snapshot_store store;
+      prefix_runner runner;
+      std::vector<scenario> suite;
+      std::size_t num_mismatches = 0;
+
+      plant.sensor_noise = 1.0;
+
+      for (const auto i : steps)
+      {
+         suite.push_back(scenario::join("Warm-up and step", warmup, scenario::step("Step", 150, 0, i)));
+      }
+
+      suite.push_back(scenario::join("Warm-up and drift", warmup, scenario::ramp("Drift", 150, 0, 100, 30)));
+      suite.push_back(scenario::join("Warm-up and sine", warmup, scenario::sine("Sine", 150, 40, 15)));
+
+      if (argc > 3)
+      {
+         store.open(argv[3]);
+         runner.store = &store;
+      }
+
+      std::vector<pid_gains> candidates;
+
+      for (std::size_t i = 0; i < num_candidates; ++i)
+      {
+         candidates.push_back(pid_gains{ 0.2 + 0.05 * (i % 16), 0.05 + 0.05 * (i / 16 % 8), 0.1 });
+      }
+
+      const auto t0 = std::chrono::steady_clock::now();
+      std::vector<std::vector<metrics>> plain(num_candidates);
+
+      for (std::size_t i = 0; i < num_candidates; ++i)
+      {
+         auto candidate = config;
+         candidate.pid.set_gains(candidates[i]);
+
+         for (const auto& j : suite)
+         {
+            plain[i].push_back(simulate(candidate, plant, j));
+         }
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_candidates; ++i)
+      {
+         auto candidate = config;
+         candidate.pid.set_gains(candidates[i]);
+         const auto shared = runner.run(candidate, plant, suite);
+
+         for (std::size_t j = 0; j < suite.size(); ++j)
+         {
+            if (std::memcmp(&shared[j], &plain[i][j], sizeof(metrics)) != 0) num_mismatches++;
+         }
+      }
+
+      const auto t2 = std::chrono::steady_clock::now();
+      const auto plain_seconds = std::chrono::duration<double>(t1 - t0).count();
+      const auto shared_seconds = std::chrono::duration<double>(t2 - t1).count();
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Candidates:\t\t\t" << num_candidates << " (" << suite.size() << " scenarios)\n";
+      std::cout << "Cycles, plain runs:\t\t" << runner.total_cycles << "\n";
+      std::cout << "Cycles, shared prefixes:\t" << runner.simulated_cycles << "\n";
+      std::cout << "Cycles restored from file:\t" << runner.restored_cycles << "\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Cycles saved:\t\t\t" << runner.shared_fraction() * 100 << " %\n";
+      std::cout << "Mismatching results:\t\t" << num_mismatches << "\n";
+      std::cout << std::setprecision(4);
+      std::cout << "Duration, plain runs:\t\t" << plain_seconds << " s\n";
+      std::cout << "Duration, shared prefixes:\t" << shared_seconds << " s\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return num_mismatches == 0 ? 0 : 1;
+   }
+
+   /********************************************************************************
+   * gradient: Compares the gradient of the cost at the default PID parameters
+   *           calculated with dual numbers against central finite differences,
+   *           both in value and in duration, and then runs the gradient
+   *           descent tuner with each of them from the default parameters.
+   *
+   *           Usage: gradient [iterations]
+   ********************************************************************************/
+   inline int gradient(const int argc,
+                       char** argv)
+   {
+      const auto max_iterations = static_cast<std::size_t>(argument(argc, argv, 2, 100));
+      const auto start = tuner::to_point(pid_gains());
+      const std::size_t repetitions = 10;
+      gradient_tuner optimizer(default_servo());
+      gradient_tuner::gradient exact{}, estimate{};
+
+      const auto t0 = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < repetitions; ++i) optimizer.derivative(start, exact);
+      const auto t1 = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < repetitions; ++i) optimizer.difference(start, estimate);
+      const auto t2 = std::chrono::steady_clock::now();
+      const auto dual_seconds = std::chrono::duration<double>(t1 - t0).count() / repetitions;
+      const auto difference_seconds = std::chrono::duration<double>(t2 - t1).count() / repetitions;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Gradient at default gains, d(cost) / d(log10 gain):\n";
+      std::cout << std::fixed << std::setprecision(4);
+      std::cout << "Dual numbers:\t\t\tkp = " << exact[0] << ", ki = " << exact[1]
+                << ", kd = " << exact[2] << "\n";
+      std::cout << "Finite differences:\t\tkp = " << estimate[0] << ", ki = " << estimate[1]
+                << ", kd = " << estimate[2] << "\n";
+      std::cout << std::setprecision(3);
+      std::cout << "Duration, dual numbers:\t\t" << dual_seconds * 1e3 << " ms\n";
+      std::cout << "Duration, finite differences:\t" << difference_seconds * 1e3 << " ms\n";
+      std::cout << std::setprecision(2);
+      std::cout << "Speedup:\t\t\t" << difference_seconds / dual_seconds << "x\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+
+      std::cout << "Gradient descent with dual numbers:\n";
+      optimizer.optimize(pid_gains(), max_iterations).print();
+      std::cout << "Gradient descent with finite differences:\n";
+      optimizer.finite_differences = true;
+      optimizer.optimize(pid_gains(), max_iterations).print();
+      return 0;
+   }
+
+   /********************************************************************************
+   * analyze: Analyzes the servo loop of the default servo with specified PID
+   *          parameters in the z-domain and prints the closed-loop poles, the
+   *          stability margins and the predicted metrics of a step, next to
+   *          the metrics of a full simulation of the same step. The tuner is
+   *          then run with and without the analysis as pre-filter.
+   *
+   *          Usage: analyze [kp] [ki] [kd]
+   ********************************************************************************/
+   inline int analyze(const int argc,
+                      char** argv)
+   {
+      const pid_gains gains{ argument(argc, argv, 2, pid_gains().kp),
+                             argument(argc, argv, 3, pid_gains().ki),
+                             argument(argc, argv, 4, pid_gains().kd) };
+      const auto test = scenario::step("Step 10 degrees right", 280, 0, 10);
+      const std::size_t repetitions = 10000;
+      const plant_model plant;
+      auto config = default_servo();
+      auto sink = 0.0;
+      config.pid.set_gains(gains);
+
+      const auto suite = scenario::default_suite();
+      const auto t0 = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < repetitions; ++i) sink += loop_analysis(gains, plant, false).spectral_radius;
+      const auto t1 = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < repetitions; ++i) sink += loop_analysis(gains, plant).gain_margin;
+      const auto t2 = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < repetitions / 100; ++i) sink += simulate(config, plant, suite).iae;
+      const auto t3 = std::chrono::steady_clock::now();
+
+      const loop_analysis analysis(gains, plant);
+      const auto predicted = analysis.predict_step(test.disturbance.back(), test.disturbance.size());
+      const auto simulated = simulate(config, plant, test);
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(4);
+      std::cout << "Gains:\t\t\t\tkp = " << gains.kp << ", ki = " << gains.ki << ", kd = " << gains.kd << "\n";
+      analysis.print();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Predicted, " << test.name << ":\n";
+      predicted.print();
+      std::cout << "\nSimulated, " << test.name << ":\n";
+      simulated.print();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::setprecision(2);
+      std::cout << "Duration, poles:\t\t" << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e6 << " us\n";
+      std::cout << "Duration, poles and margins:\t" << std::chrono::duration<double>(t2 - t1).count() / repetitions * 1e6 << " us\n";
+      std::cout << "Duration, simulated suite:\t" << std::chrono::duration<double>(t3 - t2).count() / (repetitions / 100) * 1e6
+                << " us\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+
+      tuner optimizer(default_servo());
+      std::cout << "Tuning with the analysis as pre-filter:\n";
+      optimizer.optimize(pid_gains()).print();
+      std::cout << "Tuning without pre-filter:\n";
+      optimizer.prefilter = false;
+      optimizer.optimize(pid_gains()).print();
+      return 0;
+   }
+
+   /********************************************************************************
+   * bode: Measures the frequency response of a fleet of servos with different
+   *       PID parameters with stepped sine sweeps in parallel. The Bode table
+   *       of the first servo is printed next to the response predicted by the
+   *       z-domain analysis, followed by the duration of the sweep. As default
+   *       the target is excited, pass "sensor" to excite the bearing instead.
+   *
+   *       Usage: bode [frequencies] [servos] [target|sensor]
+   ********************************************************************************/
+   inline int bode(const int argc,
+                   char** argv)
+   {
+      const auto num_frequencies = static_cast<std::size_t>(argument(argc, argv, 2, 16));
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 3, 64));
+      const auto frequencies = frequency_analyzer::frequencies(0.01, 3.0, num_frequencies > 1 ? num_frequencies : 2);
+      std::vector<servo> servos(num_servos > 0 ? num_servos : 1, default_servo());
+      frequency_analyzer analyzer;
+
+      if (argc > 4 && std::string(argv[4]) == "sensor")
+      {
+         analyzer.excitation = frequency_analyzer::input::sensor;
+      }
+
+      for (std::size_t i = 0; i < servos.size(); ++i)
+      {
+         servos[i].pid.set_gains(pid_gains{ 1.0 + 0.25 * (i % 8), 0.01 + 0.02 * (i / 8 % 8), 0.1 });
+      }
+
+      const auto t0 = std::chrono::steady_clock::now();
+      const auto responses = analyzer.sweep(servos, frequencies);
+      const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+      std::cout << "Frequency response of servo 0 (kp = " << servos[0].pid.kp << ", ki = " << servos[0].pid.ki
+                << ", kd = " << servos[0].pid.kd << "), excitation on the "
+                << (analyzer.excitation == frequency_analyzer::input::target ? "target" : "sensors") << ":\n";
+      analyzer.print(responses[0], loop_analysis(servos[0].pid.gains(), analyzer.plant));
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Servos swept:\t\t\t" << servos.size() << " at " << frequencies.size() << " frequencies\n";
+      std::cout << std::fixed << std::setprecision(3);
+      std::cout << "Duration:\t\t\t" << seconds << " s on " << analyzer.num_threads << " threads\n";
+      std::cout << std::setprecision(0);
+      std::cout << "Frequency points per second:\t" << servos.size() * frequencies.size() / seconds << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return 0;
+   }
+
+   /********************************************************************************
+   * robust: Tunes the PID parameters of the default servo both on the nominal
+   *         plant and on an ensemble of perturbed plants, where the percentile
+   *         cost across the ensemble is minimized. Both results are scored on
+   *         the ensemble and printed. The vectorized ensemble pass is checked
+   *         and timed against scalar simulations of every variant.
+   *
+   *         Usage: robust [variants] [percentile]
+   ********************************************************************************/
+   inline int robust(const int argc,
+                     char** argv)
+   {
+      const auto num_variants = static_cast<std::size_t>(argument(argc, argv, 2, 32));
+      const auto config = default_servo();
+      const auto suite = scenario::default_suite();
+      ensemble_evaluator evaluator(config, plant_ensemble::perturbed(plant_model(), num_variants > 0 ? num_variants : 1));
+      std::vector<metrics> variants;
+      auto max_difference = 0.0;
+      evaluator.percentile = argument(argc, argv, 3, 0.9);
+
+      const auto t0 = std::chrono::steady_clock::now();
+      evaluator.evaluate(pid_gains(), variants);
+      const auto t1 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < variants.size(); ++i)
+      {
+         const auto scalar = simulate(config, evaluator.ensemble.variant(i), suite);
+         max_difference = std::max(max_difference, std::fabs(evaluator.cost(scalar) - evaluator.cost(variants[i])));
+      }
+
+      const auto t2 = std::chrono::steady_clock::now();
+      tuner nominal(config);
+      tuner ensemble(config);
+      ensemble.ensemble = &evaluator;
+      const auto nominal_result = nominal.optimize(pid_gains());
+      const auto ensemble_result = ensemble.optimize(pid_gains());
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Variants:\t\t\t" << evaluator.ensemble.size() << "\n";
+      std::cout << std::fixed << std::setprecision(3);
+      std::cout << "Duration, ensemble pass:\t" << std::chrono::duration<double>(t1 - t0).count() * 1e3 << " ms\n";
+      std::cout << "Duration, scalar runs:\t\t" << std::chrono::duration<double>(t2 - t1).count() * 1e3 << " ms\n";
+      std::cout << std::scientific << std::setprecision(1);
+      std::cout << "Largest cost difference:\t" << max_difference << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(0);
+      std::cout << "Tuned on\tkp\tki\tkd\tNominal\tMean\tP" << evaluator.percentile * 100 << "\tWorst\n";
+
+      for (const auto* i : { &nominal_result, &ensemble_result })
+      {
+         const auto score = evaluator.score(i->gains);
+         std::cout << (i == &nominal_result ? "nominal" : "ensemble") << std::setprecision(3) << "\t"
+                   << i->gains.kp << "\t" << i->gains.ki << "\t" << i->gains.kd << "\t"
+                   << nominal.evaluate(i->gains) << "\t" << score.mean << "\t" << score.percentile << "\t"
+                   << score.worst << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Duration, nominal tuning:\t" << nominal_result.seconds << " s\n";
+      std::cout << "Duration, ensemble tuning:\t" << ensemble_result.seconds << " s\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return max_difference < 1e-9 ? 0 : 1;
+   }
+
+   /********************************************************************************
+   * filter: Runs a noisy sensor signal with single-sample spikes through each
+   *         sensor filter stage and the full pipeline, and prints the cost per
+   *         sample along with the remaining error. Each setting is then run in
+   *         closed loop on a step with spikes on the left sensor, where the
+   *         cost and the duration of a whole control cycle are printed, so the
+   *         filters can be budgeted against the loop period.
+   *
+   *         Usage: filter [samples] [window]
+   ********************************************************************************/
+   inline int filter(const int argc,
+                     char** argv)
+   {
+      const auto num_samples = static_cast<std::size_t>(argument(argc, argv, 2, 100000));
+      const auto window = static_cast<std::size_t>(argument(argc, argv, 3, 5));
+      const std::size_t spike_interval = 97;
+      const auto spike = [spike_interval](const std::size_t k)
+         { return (k + 1) % spike_interval ? 0.0 : (k / spike_interval % 2 ? 400.0 : -400.0); };
+      const struct { const char* name; unsigned stages; } settings[]{
+         { "none\t\t", 0 },
+         { "ema\t\t", sensor_filter::EMA },
+         { "median\t\t", sensor_filter::MEDIAN },
+         { "hampel\t\t", sensor_filter::HAMPEL },
+         { "hampel+median+ema", sensor_filter::HAMPEL | sensor_filter::MEDIAN | sensor_filter::EMA } };
+      const auto test = scenario::step("Step 10 degrees right", 280, 0, 10);
+      std::vector<double> clean(num_samples), raw(num_samples);
+      plant_model plant;
+      auto sink = 0.0;
+      plant.sensor_noise = 4.0;
+
+      for (std::size_t k = 0; k < num_samples; ++k)
+      {
+         clean[k] = 511.5 + 200.0 * std::sin(2.0 * 3.14159265358979323846 * k / 500.0);
+         raw[k] = std::min(std::max(clean[k] + plant.noise() + spike(k), 0.0), 1023.0);
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Samples:\t\t" << num_samples << ", window " << window << ", spike every "
+                << spike_interval << " samples\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Filter\t\t\tSample [ns]\tRMS error\tMax error\tLoop cost\tCycle [ns]\n";
+      std::cout << std::fixed;
+
+      for (const auto& setting : settings)
+      {
+         sensor_filter pipeline;
+         auto squared_error = 0.0, max_error = 0.0;
+         pipeline.init(setting.stages, window);
+
+         const auto t0 = std::chrono::steady_clock::now();
+         for (std::size_t k = 0; k < num_samples; ++k) sink += pipeline.add(raw[k]);
+         const auto t1 = std::chrono::steady_clock::now();
+
+         pipeline.reset();
+         for (std::size_t k = 0; k < num_samples; ++k)
+         {
+            const auto error = std::fabs(pipeline.add(raw[k]) - clean[k]);
+            squared_error += error * error;
+            max_error = std::max(max_error, error);
+         }
+
+         auto config = default_servo();
+         config.set_filter(setting.stages, window);
+         simulation run(config, plant);
+         const auto t2 = std::chrono::steady_clock::now();
+
+         for (std::size_t k = 0; k < test.disturbance.size(); ++k)
+         {
+            auto left = 0.0, right = 0.0;
+            run.sensor_values(run.plant.angle + test.disturbance[k], left, right);
+            run.step(test.disturbance[k], left + spike(k), right);
+         }
+
+         const auto t3 = std::chrono::steady_clock::now();
+         std::cout << setting.name << "\t" << std::setprecision(1)
+                   << std::chrono::duration<double>(t1 - t0).count() / num_samples * 1e9 << "\t\t"
+                   << std::setprecision(2) << std::sqrt(squared_error / num_samples) << "\t\t" << max_error << "\t\t"
+                   << cost_function()(run.result) << "\t\t" << std::setprecision(1)
+                   << std::chrono::duration<double>(t3 - t2).count() / test.disturbance.size() * 1e9 << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * fusion: Runs the default servo through the scenario suite with specified
+   *         noise on the left and right sensor, regulating on the raw mapped
+   *         input, on the Kalman fusion assuming equal sensor noise and on the
+   *         Kalman fusion with the actual noise of each sensor. The error of
+   *         the bearing the servo regulates on, the cost of the run and the
+   *         duration of a fusion update are printed.
+   *
+   *         Usage: fusion [left noise] [right noise]
+   ********************************************************************************/
+   inline int fusion(const int argc,
+                     char** argv)
+   {
+      const auto left_noise = argument(argc, argv, 2, 4.0);
+      const auto right_noise = argument(argc, argv, 3, 16.0);
+      const auto mean_noise = std::sqrt((left_noise * left_noise + right_noise * right_noise) / 2.0);
+      const struct { const char* name; bool enabled; double left, right; } settings[]{
+         { "raw mapping\t", false, 0.0, 0.0 },
+         { "kalman, equal noise", true, mean_noise, mean_noise },
+         { "kalman\t\t", true, left_noise, right_noise } };
+      const auto suite = scenario::default_suite();
+      const std::size_t repetitions = 1000000;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Sensor noise:\t\tleft " << left_noise << ", right " << right_noise << " sensor units\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Input\t\t\tRMS error [deg]\tEstimated [deg]\tCost\n";
+
+      for (const auto& setting : settings)
+      {
+         auto config = default_servo();
+         plant_model left_source, right_source;
+         metrics total;
+         auto squared_error = 0.0, variance = 0.0;
+         if (setting.enabled) config.fusion.init(setting.left, setting.right);
+         left_source.sensor_noise = left_noise;
+         right_source.sensor_noise = right_noise;
+         right_source.seed = 2;
+
+         for (const auto& test : suite)
+         {
+            simulation run(config, plant_model());
+
+            for (const auto& disturbance : test.disturbance)
+            {
+               const auto bearing = run.plant.angle + disturbance;
+               auto left = 0.0, right = 0.0;
+               run.sensor_values(bearing, left, right);
+               run.step(disturbance, left + left_source.noise(), right + right_source.noise());
+               const auto error = run.device.input_bearing() - bearing;
+               squared_error += error * error;
+               variance += setting.enabled ? run.device.fusion.variance() : 0.0;
+            }
+            total.combine(run.result);
+         }
+
+         std::cout << setting.name << "\t" << std::setprecision(3) << std::sqrt(squared_error / total.cycles)
+                   << "\t\t";
+         if (setting.enabled) std::cout << std::sqrt(variance / total.cycles);
+         else std::cout << "-";
+         std::cout << "\t\t" << cost_function()(total) << "\n";
+      }
+
+      bearing_fusion estimator;
+      auto sink = 0.0;
+      estimator.init(left_noise, right_noise);
+      const auto t0 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < repetitions; ++i)
+      {
+         const auto value = static_cast<double>(i % 64);
+         sink += estimator.update(90.0 + value * 0.01, 90.0 - value * 0.01, 90.0, 0.176);
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::setprecision(1);
+      std::cout << "Duration, fusion update:\t" << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9
+                << " ns\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * oversample: Runs the default servo through the scenario suite with noisy
+   *             sensors sampled at increasing multiples of the control rate,
+   *             decimated by CIC decimators with one stage (boxcar) up to
+   *             specified number of stages. The error of the decimated
+   *             bearing, the cost of the run, the duration of a decimator
+   *             sample and of a whole control cycle are printed.
+   *
+   *             Usage: oversample [noise] [stages]
+   ********************************************************************************/
+   inline int oversample(const int argc,
+                         char** argv)
+   {
+      const auto noise = argument(argc, argv, 2, 16.0);
+      const auto max_stages = static_cast<std::size_t>(argument(argc, argv, 3, 2));
+      const std::size_t ratios[]{ 1, 2, 4, 8, 16, 32 };
+      const std::size_t repetitions = 1000000;
+      const auto suite = scenario::default_suite();
+      plant_model plant;
+      auto sink = 0.0;
+      plant.sensor_noise = noise;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Sensor noise:\t\t" << noise << " sensor units\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Ratio\tStages\tRMS error [deg]\tCost\t\tSample [ns]\tCycle [ns]\n";
+
+      for (std::size_t stages = 1; stages <= max_stages && stages <= cic_decimator::MAX_ORDER; ++stages)
+      {
+         for (const auto ratio : ratios)
+         {
+            if (ratio == 1 && stages > 1) continue;
+            auto config = default_servo();
+            cic_decimator decimator;
+            metrics total;
+            auto squared_error = 0.0;
+            config.set_oversampling(ratio, stages);
+            decimator.init(ratio, stages);
+
+            const auto t0 = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < repetitions; ++i)
+            {
+               if (decimator.add(static_cast<double>(i % 1024))) sink += decimator.value;
+            }
+            const auto t1 = std::chrono::steady_clock::now();
+
+            for (const auto& test : suite)
+            {
+               simulation run(config, plant);
+
+               for (const auto& disturbance : test.disturbance)
+               {
+                  const auto bearing = run.plant.angle + disturbance;
+                  run.step(disturbance);
+                  const auto error = run.device.input_bearing() - bearing;
+                  squared_error += error * error;
+               }
+               total.combine(run.result);
+            }
+
+            const auto t2 = std::chrono::steady_clock::now();
+            std::cout << ratio << "\t" << stages << "\t" << std::setprecision(3)
+                      << std::sqrt(squared_error / total.cycles) << "\t\t" << cost_function()(total) << "\t\t"
+                      << std::setprecision(1) << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9
+                      << "\t\t" << std::chrono::duration<double>(t2 - t1).count() / total.cycles * 1e9 << "\n";
+         }
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * calibrate: Writes calibration curves of two simulated nonlinear sensors to
+   *            specified file, where the sensors are compressed towards both
+   *            ends of their range and the right sensor has an offset. The
+   *            default servo is run through the scenario suite without
+   *            calibration and with the curves compiled into piecewise linear
+   *            and monotone cubic tables. The error of the mapped input, the
+   *            cost and the duration of a sensor update are printed. Finally
+   *            the file is rewritten while the loop runs and a polling thread
+   *            reloads it, where the delay until the loop uses the new tables
+   *            is printed.
+   *
+   *            Usage: calibrate [file]
+   ********************************************************************************/
+   inline int calibrate(const int argc,
+                        char** argv)
+   {
+      const std::string filepath = argc > 2 ? argv[2] : "calibration.txt";
+      const auto distort = [](const double value, const bool left)
+         {
+            const auto t = value / tof_sensor::DEFAULT_MAX - 0.5;
+            const auto curvature = left ? 0.3 : 0.32;
+            return tof_sensor::DEFAULT_MAX * (0.5 + t * (1.0 - 4.0 * curvature * t * t)) + (left ? 0.0 : 12.0);
+         };
+      const auto write = [&](const char* mode)
+         {
+            std::ofstream file(filepath);
+            file << "# Calibration of simulated TOF sensors, raw reading and linearized value.\n";
+
+            for (const auto* sensor : { "left", "right" })
+            {
+               file << sensor << " " << mode << "\n";
+
+               for (auto i = 0; i <= 16; ++i)
+               {
+                  const auto value = tof_sensor::DEFAULT_MAX * i / 16.0;
+                  file << distort(value, sensor[0] == 'l') << " " << value << "\n";
+               }
+            }
+            return static_cast<bool>(file);
+         };
+      const auto suite = scenario::default_suite();
+      const std::size_t repetitions = 1000000;
+      calibration_store store;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Calibration\t\tRMS error [deg]\tCost\t\tUpdate [ns]\n";
+
+      for (const auto* mode : { "none", "linear", "cubic" })
+      {
+         auto config = default_servo();
+         metrics total;
+         auto squared_error = 0.0, sink = 0.0;
+
+         if (std::string(mode) != "none")
+         {
+            if (!write(mode) || !store.load(filepath))
+            {
+               std::cout << store.error << "\n";
+               return 1;
+            }
+            config.set_calibration(store);
+         }
+
+         for (const auto& test : suite)
+         {
+            simulation run(config, plant_model());
+
+            for (const auto& disturbance : test.disturbance)
+            {
+               const auto bearing = run.plant.angle + disturbance;
+               auto left = 0.0, right = 0.0;
+               run.sensor_values(bearing, left, right);
+               run.step(disturbance, distort(left, true), distort(right, false));
+               const auto error = run.device.input_bearing() - bearing;
+               squared_error += error * error;
+            }
+            total.combine(run.result);
+         }
+
+         const auto t0 = std::chrono::steady_clock::now();
+         for (std::size_t i = 0; i < repetitions; ++i)
+         {
+            config.left_sensor.update(static_cast<double>(i % 1024));
+            sink += config.left_sensor.val;
+         }
+         const auto t1 = std::chrono::steady_clock::now();
+
+         std::cout << mode << "\t\t\t" << std::fixed << std::setprecision(3) << std::sqrt(squared_error / total.cycles)
+                   << "\t\t" << cost_function()(total) << "\t\t" << std::setprecision(1)
+                   << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9 << (sink != sink ? "!" : "")
+                   << "\n";
+      }
+
+      auto config = default_servo();
+      config.set_calibration(store);
+      simulation run(config, plant_model());
+      std::atomic<bool> running{ true };
+      std::atomic<std::uint64_t> ticks{ 0 };
+      store.ticks = &ticks;
+      std::thread watcher([&]
+         {
+            while (running)
+            {
+               store.reload_if_changed();
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+         });
+
+      const auto generation = store.generation;
+      const auto old_table = store.left.load();
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      write("linear");
+      const auto t0 = std::chrono::steady_clock::now();
+      std::size_t cycles = 0;
+
+      while (store.left.load() == old_table && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(2))
+      {
+         run.step(suite.front().disturbance[cycles++ % suite.front().disturbance.size()]);
+         ticks.fetch_add(1);
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      running = false;
+      watcher.join();
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Hot reload:\t\t" << (store.generation > generation ? "new tables used after " : "not picked up after ")
+                << std::chrono::duration<double>(t1 - t0).count() * 1e3 << " ms, " << cycles
+                << " cycles run meanwhile\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return store.generation > generation ? 0 : 1;
+   }
+
+   /********************************************************************************
+   * array: Runs the default servo through the scenario suite with noisy sensors,
+   *        first with the left and right sensor pair and an array of two
+   *        sensors, which must give identical inputs and metrics, then with
+   *        arrays of up to specified number of sensors spread across a fan.
+   *        The error of the mapped input, the cost, the duration of a
+   *        difference estimate and of a whole control cycle are printed per
+   *        number of sensors.
+   *
+   *        Usage: array [noise] [max sensors]
+   ********************************************************************************/
+   inline int array(const int argc,
+                    char** argv)
+   {
+      const auto noise = argument(argc, argv, 2, 16.0);
+      const auto max_sensors = static_cast<std::size_t>(argument(argc, argv, 3, 16));
+      const std::size_t counts[]{ 2, 3, 4, 8, 12, 16 };
+      const std::size_t repetitions = 1000000;
+      const auto suite = scenario::default_suite();
+      auto pair = default_servo(), twin = default_servo();
+      plant_model plant;
+      std::size_t mismatches = 0;
+      auto sink = 0.0;
+      plant.sensor_noise = noise;
+      twin.set_sensors(2);
+
+      for (const auto& test : suite)
+      {
+         simulation pair_run(pair, plant), twin_run(twin, plant);
+
+         for (const auto& disturbance : test.disturbance)
+         {
+            pair_run.step(disturbance);
+            twin_run.step(disturbance);
+            if (pair_run.device.input_mapped() != twin_run.device.input_mapped()) mismatches++;
+         }
+         if (std::memcmp(&pair_run.result, &twin_run.result, sizeof(metrics)) != 0) mismatches++;
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Sensor noise:\t\t" << noise << " sensor units\n";
+      std::cout << "Two sensor array:\t" << (mismatches ? "differs from" : "identical to") << " the sensor pair ("
+                << mismatches << " mismatches)\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Sensors\tRMS error [deg]\tCost\t\tEstimate [ns]\tCycle [ns]\n";
+
+      for (const auto count : counts)
+      {
+         if (count > max_sensors || count > sensor_array::MAX_SENSORS) continue;
+         auto config = default_servo();
+         metrics total;
+         auto squared_error = 0.0;
+         config.set_sensors(count);
+         auto estimator = config.array;
+         std::size_t index = 0;
+
+         const auto t0 = std::chrono::steady_clock::now();
+         for (std::size_t i = 0; i < repetitions; ++i)
+         {
+            estimator.values[index] = static_cast<double>(i & 1023);
+            index = index + 1 < count ? index + 1 : 0;
+            sink += estimator.difference();
+         }
+         const auto t1 = std::chrono::steady_clock::now();
+
+         for (const auto& test : suite)
+         {
+            simulation run(config, plant);
+
+            for (const auto& disturbance : test.disturbance)
+            {
+               const auto bearing = run.plant.angle + disturbance;
+               run.step(disturbance);
+               const auto error = run.device.input_bearing() - bearing;
+               squared_error += error * error;
+            }
+            total.combine(run.result);
+         }
+
+         const auto t2 = std::chrono::steady_clock::now();
+         std::cout << count << "\t" << std::setprecision(3) << std::sqrt(squared_error / total.cycles) << "\t\t"
+                   << cost_function()(total) << "\t\t" << std::setprecision(1)
+                   << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9 << "\t\t"
+                   << std::chrono::duration<double>(t2 - t1).count() / total.cycles * 1e9 << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return mismatches || sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * health: Runs the default servo with noisy sensors through a sine shaped
+   *         disturbance, where a sensor fault is injected at specified cycle:
+   *         a dead left sensor reading beyond its maximum, a left sensor stuck
+   *         at its last reading, a burst of missing left readings and a right
+   *         sensor drifting off. Each fault is run without monitoring and with
+   *         the health monitor holding the output. The cycles until the fault
+   *         is detected, the largest error after the fault and the counters
+   *         of the monitor are printed, along with the duration of a check.
+   *
+   *         Usage: health [noise] [fault cycle]
+   ********************************************************************************/
+   inline int health(const int argc,
+                     char** argv)
+   {
+      const auto noise = argument(argc, argv, 2, 4.0);
+      const auto fault_cycle = static_cast<std::size_t>(argument(argc, argv, 3, 200));
+      const auto test = scenario::sine("Sine 15 degrees, period 80", 400, 80, 15);
+      const char* faults[]{ "none", "dead", "stuck", "dropout", "drift" };
+      const std::size_t repetitions = 1000000;
+      plant_model plant;
+      std::size_t false_alarms = 0;
+      plant.sensor_noise = noise;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Sensor noise:\t\t" << noise << " sensor units, fault at cycle " << fault_cycle << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Fault\tMonitor\tDetected [cycles]\tMax error [deg]\tFlags\n";
+
+      for (std::size_t fault = 0; fault < sizeof(faults) / sizeof(faults[0]); ++fault)
+      {
+         for (const auto monitored : { false, true })
+         {
+            auto config = default_servo();
+            if (monitored) config.health.init(true);
+            simulation run(config, plant);
+            auto stuck_value = 0.0, max_error = 0.0;
+            std::size_t detected = 0;
+            unsigned flags = 0;
+
+            for (std::size_t i = 0; i < test.disturbance.size(); ++i)
+            {
+               const auto disturbance = test.disturbance[i];
+               auto left = 0.0, right = 0.0;
+               run.sensor_values(run.plant.angle + disturbance, left, right);
+               if (i < fault_cycle) stuck_value = left;
+
+               if (i >= fault_cycle)
+               {
+                  if (fault == 1) left = 2000.0;
+                  else if (fault == 2) left = stuck_value;
+                  else if (fault == 3 && i < fault_cycle + 20) left = std::nan("");
+                  else if (fault == 4) right += 3.0 * (i - fault_cycle);
+               }
+
+               run.step(disturbance, left, right);
+               const auto error = std::fabs(run.device.target() - (run.plant.angle + disturbance));
+               if (i >= fault_cycle && !(error <= max_error) && !std::isnan(max_error)) max_error = error;
+               flags |= run.device.health.flags();
+
+               if (monitored && !detected && !run.device.health.healthy())
+               {
+                  detected = i + 1;
+                  if (i < fault_cycle) false_alarms++;
+               }
+            }
+
+            std::cout << faults[fault] << "\t" << (monitored ? "hold" : "off") << "\t";
+            if (detected) std::cout << static_cast<double>(detected) - fault_cycle << "\t\t\t";
+            else std::cout << "-\t\t\t";
+            std::cout << max_error << "\t\t" << flags << "\n";
+            if (monitored && fault == sizeof(faults) / sizeof(faults[0]) - 1) run.device.health.print();
+         }
+      }
+
+      health_monitor monitor;
+      unsigned sink = 0;
+      monitor.init(false);
+      const auto t0 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < repetitions; ++i)
+      {
+         const auto value = static_cast<double>(i & 1023);
+         sink += monitor.add(value, 1023.0 - value, value, 1023.0 - value, 0.0, 1023.0);
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Duration, health check:\t" << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9
+                << " ns (" << sink << " faulty samples)\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return false_alarms ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * stats: Runs a fleet of servos with counters of output saturation and
+   *        clamped sensor values through the scenario suite, where the gains
+   *        and sensor noise vary between the servos, so that some servos are
+   *        tuned too aggressively and some sensors clamp. The counters of the
+   *        fleet are aggregated and exported through the stats report, to
+   *        specified file if any. Finally the duration of a control cycle is
+   *        printed with the counters disabled and enabled.
+   *
+   *        Usage: stats [servos] [file]
+   ********************************************************************************/
+   inline int stats(const int argc,
+                    char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000));
+      const auto suite = scenario::default_suite();
+      const std::size_t repetitions = 200;
+      std::vector<saturation_stats> results(num_servos);
+      saturation_stats fleet;
+      stats_report report;
+      auto sink = 0.0;
+
+      parallel::for_each_index(num_servos, [&](const std::size_t i)
+         {
+            auto config = default_servo();
+            plant_model plant;
+            config.pid.set_gains(pid_gains{ 0.5 + 0.5 * (i % 8), 0.01, 0.1 + 0.1 * ((i * 3) % 5) });
+            config.set_stats(true);
+            plant.sensor_noise = 50.0 * ((i * 5) % 7);
+            plant.seed = i + 1;
+            auto totals = config;
+
+            for (const auto& test : suite)
+            {
+               simulation run(config, plant);
+               run.run(test);
+               totals.pid.saturation.combine(run.device.pid.saturation);
+               totals.left_sensor.clamping.combine(run.device.left_sensor.clamping);
+               totals.right_sensor.clamping.combine(run.device.right_sensor.clamping);
+            }
+            results[i].add(totals);
+         });
+
+      for (const auto& i : results)
+      {
+         fleet.combine(i);
+      }
+
+      report.add(fleet);
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Servos saturating:\t" << fleet.saturated_servos << " of " << num_servos << "\n";
+      std::cout << "Output saturated:\t" << fleet.output.ratio() * 100.0 << " % of cycles, " << fleet.output.events
+                << " events, mean " << fleet.output.mean_duration() << " cycles\n";
+      std::cout << "Servos clamping:\t" << fleet.clamped_servos << " of " << num_servos << "\n";
+      std::cout << "Sensors clamped:\t" << fleet.sensors.ratio() * 100.0 << " % of samples, " << fleet.sensors.events
+                << " events, worst " << fleet.sensors.worst << " sensor units\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+
+      if (argc > 3)
+      {
+         std::ofstream file(argv[3]);
+         report.write(file);
+         std::cout << "Stats written to " << argv[3] << "\n";
+      }
+      else
+      {
+         report.write();
+      }
+
+      sink += simulate(default_servo(), plant_model(), suite).iae;
+
+      for (const auto enabled : { false, true })
+      {
+         auto config = default_servo();
+         std::size_t cycles = 0;
+         config.set_stats(enabled);
+         const auto t0 = std::chrono::steady_clock::now();
+
+         for (std::size_t i = 0; i < repetitions; ++i)
+         {
+            const auto total = simulate(config, plant_model(), suite);
+            cycles += total.cycles;
+            sink += total.iae;
+         }
+
+         const auto t1 = std::chrono::steady_clock::now();
+         std::cout << "--------------------------------------------------------------------------------\n";
+         std::cout << std::fixed << std::setprecision(1);
+         std::cout << "Cycle, counters " << (enabled ? "enabled:\t" : "disabled:\t")
+                   << std::chrono::duration<double>(t1 - t0).count() / cycles * 1e9 << " ns\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * record: Runs the default servo with a flight recorder of specified capacity
+   *         through three anomalies: a dead left sensor caught by the health
+   *         monitor, aggressive gains saturating the output after a step
+   *         and, on POSIX systems, a SIGUSR1 raised during a healthy run.
+   *         Every dump is read back and the cycles around its trigger are
+   *         printed. Finally the duration of a control cycle is printed with
+   *         and without recorder.
+   *
+   *         Usage: record [capacity] [path prefix]
+   ********************************************************************************/
+   inline int record(const int argc,
+                     char** argv)
+   {
+      const auto capacity = static_cast<std::size_t>(argument(argc, argv, 2, 256));
+      const std::string prefix = argc > 3 ? argv[3] : "flight";
+      const char* reasons[]{ "none", "saturation", "fault", "signal", "manual" };
+      const auto test = scenario::sine("Sine 15 degrees, period 80", 400, 80, 15);
+      const auto suite = scenario::default_suite();
+      const std::size_t repetitions = 200;
+      const auto handler = flight_recorder::install_signal_handler();
+      std::size_t num_dumps = 0;
+      plant_model plant;
+      plant.sensor_noise = 4.0;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Anomaly\t\tDump\t\t\tReason\t\tTrigger\tRecords\n";
+
+      for (const auto* anomaly : { "dead sensor", "saturation", "signal" })
+      {
+         const std::string name = anomaly;
+         if (name == "signal" && !handler) continue;
+         auto config = default_servo();
+         flight_recorder recorder;
+         config.health.init(false);
+         if (name == "saturation") config.pid.set_gains(pid_gains{ 6.0, 0.05, 0.0 });
+         simulation run(config, plant);
+         recorder.init(capacity, prefix + "_" + name.substr(0, name.find(' ')));
+         recorder.saturation_streak = 3;
+         run.device.recorder = &recorder;
+         const auto& disturbances = name == "saturation" ? suite[1].disturbance : test.disturbance;
+
+         for (std::size_t i = 0; i < disturbances.size() && !recorder.dumps; ++i)
+         {
+            auto left = 0.0, right = 0.0;
+            run.sensor_values(run.plant.angle + disturbances[i], left, right);
+            if (name == "dead sensor" && i >= 200) left = 2000.0;
+            if (name == "signal" && i == 200) std::raise(SIGUSR1);
+            run.step(disturbances[i], left, right);
+         }
+
+         flight_recorder::header head{};
+         std::vector<cycle_record> entries;
+
+         if (!recorder.dumps || !flight_recorder::load(recorder.last_dump, head, entries))
+         {
+            std::cout << name << "\t" << "no dump written\n";
+            continue;
+         }
+
+         num_dumps++;
+         std::cout << name << "\t" << recorder.last_dump << "\t" << reasons[head.reason] << "\t"
+                   << (head.reason == 1 ? "" : "\t") << head.trigger_cycle << "\t" << head.count << "\n";
+
+         for (const auto& entry : entries)
+         {
+            if (entry.cycle + 2 < head.trigger_cycle || entry.cycle > head.trigger_cycle + 2) continue;
+            std::cout << std::fixed << std::setprecision(1) << "\t\tcycle " << entry.cycle << ": left "
+                      << entry.left << ", right " << entry.right << ", input " << entry.input << ", output "
+                      << entry.output << ", flags " << entry.flags << "\n";
+         }
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+
+      for (const auto recording : { false, true })
+      {
+         auto config = default_servo();
+         flight_recorder recorder;
+         std::size_t cycles = 0;
+         auto sink = 0.0;
+         recorder.init(capacity, prefix + "_timing");
+         recorder.on_fault = false;
+         if (recording) config.recorder = &recorder;
+         const auto t0 = std::chrono::steady_clock::now();
+
+         for (std::size_t i = 0; i < repetitions; ++i)
+         {
+            const auto total = simulate(config, plant_model(), suite);
+            cycles += total.cycles;
+            sink += total.iae;
+         }
+
+         const auto t1 = std::chrono::steady_clock::now();
+         std::cout << "Cycle, " << (recording ? "with recorder:\t\t" : "without recorder:\t")
+                   << std::chrono::duration<double>(t1 - t0).count() / cycles * 1e9 << " ns"
+                   << (sink != sink ? "!" : "") << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return num_dumps ? 0 : 1;
+   }
+
+   /********************************************************************************
+   * oscillate: Runs the default servo with specified aggressive gains and noisy
+   *            sensors after a step of the bearing, without oscillation
+   *            detection, with detection only and with detection and gain
+   *            backoff. The first detection, the number of detections, the
+   *            final gains and the error over the last fifth of the run are
+   *            printed, along with the duration of a detector update.
+   *
+   *            Usage: oscillate [kp] [kd] [cycles]
+   ********************************************************************************/
+   inline int oscillate(const int argc,
+                        char** argv)
+   {
+      const auto kp = argument(argc, argv, 2, 4.0);
+      const auto kd = argument(argc, argv, 3, 1.0);
+      const auto num_cycles = static_cast<std::size_t>(argument(argc, argv, 4, 4000));
+      const std::size_t repetitions = 10000000;
+      plant_model plant;
+      plant.sensor_noise = 2.0;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(2);
+      std::cout << "Gains:\t\t\tkp " << kp << ", ki 0.01, kd " << kd << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Detector\tFirst flag\tDetections\tkp\tkd\tRMS error, last fifth\n";
+
+      for (const auto* mode : { "off", "detect", "backoff" })
+      {
+         const std::string name = mode;
+         auto config = default_servo();
+         config.pid.set_gains(pid_gains{ kp, 0.01, kd });
+         if (name != "off") config.oscillation.init(name == "backoff");
+         simulation run(config, plant);
+         std::size_t first_flag = 0, tail_cycles = 0;
+         auto squared_error = 0.0;
+
+         for (std::size_t i = 0; i < num_cycles; ++i)
+         {
+            const auto disturbance = i < 20 ? 0.0 : 10.0;
+            run.step(disturbance);
+            const auto& detector = run.device.oscillation;
+            if (!first_flag && (detector.oscillating || detector.backoffs)) first_flag = i + 1;
+
+            if (i >= num_cycles - num_cycles / 5)
+            {
+               const auto error = run.device.target() - (run.plant.angle + disturbance);
+               squared_error += error * error;
+               tail_cycles++;
+            }
+         }
+
+         std::cout << name << "\t\t";
+         if (first_flag) std::cout << first_flag << "\t\t";
+         else std::cout << "-\t\t";
+         std::cout << run.device.oscillation.detections << "\t\t" << run.device.pid.kp << "\t" << run.device.pid.kd
+                   << "\t" << std::sqrt(squared_error / (tail_cycles ? tail_cycles : 1)) << "\n";
+      }
+
+      oscillation_detector detector;
+      std::size_t flagged = 0;
+      detector.init(false);
+      const auto t0 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < repetitions; ++i)
+      {
+         const auto error = (i & 4 ? 3.0 : -3.0) + static_cast<double>(i & 3) * 0.1;
+         if (detector.update(error)) flagged++;
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::setprecision(1);
+      std::cout << "Duration, detector update:\t" << std::chrono::duration<double>(t1 - t0).count() / repetitions * 1e9
+                << " ns (" << flagged << " cycles flagged)\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return 0;
+   }
+
+   /********************************************************************************
+   * rate: Runs a fleet of servos with noisy sensors, each hit by a step of the
+   *       bearing at its own cycle, at the fixed rate and with an adaptive
+   *       rate of specified longest period and deadband. The share of ticks
+   *       the servos are due, the duration of the fleet, the reaction
+   *       latency from each step to the first regulation seeing it and the
+   *       mean cost are printed.
+   *
+   *       Usage: rate [servos] [max period] [cycles] [deadband]
+   ********************************************************************************/
+   inline int rate(const int argc,
+                   char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000));
+      const auto max_period = static_cast<std::size_t>(argument(argc, argv, 3, 16));
+      const auto num_cycles = static_cast<std::size_t>(argument(argc, argv, 4, 2000));
+      const auto deadband = argument(argc, argv, 5, 0.5);
+      plant_model plant;
+      plant.sensor_noise = 1.0;
+      double durations[2]{}, costs[2]{};
+      auto sink = 0.0;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Fleet:\t\t\t" << num_servos << " servos, " << num_cycles << " cycles, deadband "
+                << deadband << " degrees\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Rate\t\tDue\t\tLatency, mean\tLatency, worst\tSnaps\tMean cost\n";
+
+      for (const auto adaptive : { false, true })
+      {
+         std::size_t ticks = 0, regulations = 0, snaps = 0, latency_sum = 0, latency_worst = 0;
+         auto cost = 0.0;
+         const auto t0 = std::chrono::steady_clock::now();
+
+         for (std::size_t i = 0; i < num_servos; ++i)
+         {
+            auto config = default_servo();
+            if (adaptive) config.rate.init(deadband, max_period);
+            plant.seed = i + 1;
+            simulation run(config, plant);
+            const auto step_cycle = 200 + (i * 7919) % (num_cycles > 400 ? num_cycles - 400 : 1);
+            const auto amplitude = (i % 2 ? 1.0 : -1.0) * (2.0 + static_cast<double>(i % 11));
+            std::size_t reaction = 0;
+            auto waiting = false;
+
+            for (std::size_t j = 0; j < num_cycles; ++j)
+            {
+               const auto regulations_before = run.device.rate.regulations;
+               run.step(j < step_cycle ? 0.0 : amplitude);
+               const auto regulated = !adaptive || run.device.rate.regulations != regulations_before;
+
+               if (j == step_cycle) waiting = true;
+               if (!waiting) continue;
+               if (regulated) waiting = false;
+               else reaction++;
+            }
+
+            latency_sum += reaction;
+            if (reaction > latency_worst) latency_worst = reaction;
+            ticks += num_cycles;
+            regulations += adaptive ? run.device.rate.regulations : num_cycles;
+            snaps += run.device.rate.snaps;
+            cost += cost_function()(run.result);
+         }
+
+         const auto t1 = std::chrono::steady_clock::now();
+         durations[adaptive] = std::chrono::duration<double>(t1 - t0).count();
+         costs[adaptive] = cost / num_servos;
+         sink += cost;
+         std::cout << std::setprecision(1) << (adaptive ? "adaptive\t" : "fixed\t\t")
+                   << static_cast<double>(regulations) / ticks * 100.0 << " %\t\t"
+                   << static_cast<double>(latency_sum) / num_servos << " cycles\t"
+                   << latency_worst << " cycles\t" << snaps << "\t" << std::setprecision(4) << costs[adaptive] << "\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::setprecision(1);
+      std::cout << "Duration, fixed rate:\t\t" << durations[0] * 1e3 << " ms\n";
+      std::cout << "Duration, adaptive rate:\t" << durations[1] * 1e3 << " ms ("
+                << (1.0 - durations[1] / durations[0]) * 100.0 << " % saved, plant included)\n";
+      std::cout << "Latency bound:\t\t\t" << max_period - 1 << " cycles\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * wheel: Runs a fleet of servos with mixed loop periods from a hierarchical
+   *        timer wheel ticking at 1 kHz, where a tenth of the servos run at
+   *        1 kHz, three tenths at 200 Hz, most at 20 Hz and a hundredth at
+   *        1 Hz, which exercises the higher levels of the wheel. The phases
+   *        are spread so that the batches of the ticks are balanced. Each
+   *        servo is a PID controller driving a plant model, which keeps a
+   *        million servos within a few hundred megabytes. The wheel first
+   *        runs a revolution of level 0, so that its lists have grown to
+   *        their size. The duration of adding the timers, of the ticks with
+   *        and without servo work and of scanning the whole fleet every tick
+   *        instead is printed, along with the number of servos dispatched
+   *        out of turn.
+   *
+   *        Usage: wheel [servos] [ticks] [threads]
+   ********************************************************************************/
+   inline int wheel(const int argc,
+                    char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000000));
+      const auto num_ticks = static_cast<std::size_t>(argument(argc, argv, 3, 200));
+      const auto threads = static_cast<std::size_t>(argument(argc, argv, 4, parallel::num_threads()));
+      const std::size_t chunk = 1024;
+      std::vector<std::uint32_t> periods(num_servos), delays(num_servos), counts(num_servos);
+      std::vector<pid_controller> controllers(num_servos, default_servo().pid);
+      std::vector<plant_model> plants(num_servos);
+      timer_wheel scheduler;
+      std::size_t mismatches = 0, min_batch = num_servos, max_batch = 0;
+      auto sink = 0.0;
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         const auto group = i % 100;
+         periods[i] = group < 10 ? 1 : (group < 40 ? 5 : (group < 99 ? 50 : 1000));
+         delays[i] = 1 + static_cast<std::uint32_t>((i / 100) % periods[i]);
+         plants[i].reset(90.0 + static_cast<double>(i % 7));
+      }
+
+      scheduler.reserve(num_servos);
+      const auto t0 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         scheduler.add(periods[i], delays[i]);
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      const auto count = [&](const std::uint32_t j) { counts[j]++; };
+
+      for (std::size_t i = 0; i < timer_wheel::SLOTS; ++i)
+      {
+         scheduler.dispatch(count, threads, chunk);
+      }
+
+      const auto warmup = scheduler.dispatched;
+      const auto t2 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_ticks; ++i)
+      {
+         const auto batch = scheduler.dispatch(count, threads, chunk);
+         if (batch < min_batch) min_batch = batch;
+         if (batch > max_batch) max_batch = batch;
+      }
+
+      const auto t3 = std::chrono::steady_clock::now();
+      const auto dispatched = scheduler.dispatched - warmup;
+      const auto total_ticks = num_ticks + timer_wheel::SLOTS;
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         const auto expected = delays[i] <= total_ticks ? 1 + (total_ticks - delays[i]) / periods[i] : 0;
+         if (counts[i] != expected) mismatches++;
+      }
+
+      const auto t4 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 1; i <= num_ticks; ++i)
+      {
+         for (std::size_t j = 0; j < num_servos; ++j)
+         {
+            if (i >= delays[j] && (i - delays[j]) % periods[j] == 0) counts[j]++;
+         }
+      }
+
+      const auto t5 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_ticks; ++i)
+      {
+         scheduler.dispatch([&](const std::uint32_t j)
+            {
+               controllers[j].regulate(plants[j].angle);
+               plants[j].step(controllers[j].output);
+            }, threads, chunk);
+      }
+
+      const auto t6 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_servos; i += 997)
+      {
+         sink += plants[i].angle + counts[i];
+      }
+
+      const auto seconds = [](const std::chrono::steady_clock::duration& duration)
+         {
+            return std::chrono::duration<double>(duration).count();
+         };
+      const auto tick_work = seconds(t6 - t5) / num_ticks;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Fleet:\t\t\t\t" << num_servos << " servos, " << num_ticks << " ticks of 1 ms, "
+                << threads << " threads\n";
+      std::cout << "Batch per tick:\t\t\t" << min_batch << " - " << max_batch << " servos\n";
+      std::cout << "Dispatched out of turn:\t\t" << mismatches << " servos\n";
+      std::cout << "Cascades:\t\t\t" << scheduler.cascades << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Duration, add:\t\t\t" << seconds(t1 - t0) / num_servos * 1e9 << " ns per servo\n";
+      std::cout << "Duration, tick without work:\t" << seconds(t3 - t2) / num_ticks * 1e6 << " us ("
+                << seconds(t3 - t2) / dispatched * 1e9 << " ns per servo)\n";
+      std::cout << "Duration, scan without work:\t" << seconds(t5 - t4) / num_ticks * 1e6 << " us\n";
+      std::cout << "Duration, tick with servos:\t" << tick_work * 1e6 << " us ("
+                << tick_work / (static_cast<double>(dispatched) / num_ticks) * 1e9 << " ns per servo, "
+                << tick_work * 1e5 << " % of the tick)\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return sink != sink ? 1 : 0;
+   }
+
+#ifdef __cpp_impl_coroutine
+   /********************************************************************************
+   * yield_loop: Runs a task that only yields to the other ready tasks, used to
+   *             measure the cost of a context switch.
+   *
+   *             - executor: Reference to the executor running the task.
+   ********************************************************************************/
+   inline coroutine_task yield_loop(task_executor& executor)
+   {
+      while (1)
+      {
+         co_await executor.yield();
+      }
+   }
+#endif
+
+   /********************************************************************************
+   * tasks: Runs a fleet of servos as coroutine tasks on a single thread, where
+   *        the samples of each servo arrive at their own rate, from every
+   *        tick to every fourth tick. The same fleet is run by calling every
+   *        servo directly when sampled, and the outputs of both runs are
+   *        compared. The duration of a regulation in both runs, the frames
+   *        allocated while running and the duration of a context switch,
+   *        i.e. suspending a task and resuming the next, are printed. The
+   *        tasks require C++20.
+   *
+   *        Usage: tasks [servos] [ticks]
+   ********************************************************************************/
+   inline int tasks(const int argc,
+                    char** argv)
+   {
+#ifdef __cpp_impl_coroutine
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 10000));
+      const auto num_ticks = static_cast<std::size_t>(argument(argc, argv, 3, 1000));
+      const std::size_t num_yielding = 1000, switches = 10000000;
+      auto& pool = frame_pool::local();
+      std::vector<servo> direct(num_servos, default_servo()), tasked(num_servos, default_servo());
+      std::vector<sample_channel> channels;
+      task_executor executor;
+      std::size_t regulations = 0, mismatches = 0;
+      channels.reserve(num_servos);
+
+      const auto sampled = [](const std::size_t tick, const std::size_t servo_index)
+         {
+            return (tick + servo_index) % (1 + servo_index % 4) == 0;
+         };
+      const auto bearing = [](const std::size_t tick, const std::size_t servo_index)
+         {
+            return static_cast<double>((tick * 7 + servo_index * 13) % 101) - 50.0;
+         };
+
+      const auto t0 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_ticks; ++i)
+      {
+         for (std::size_t j = 0; j < num_servos; ++j)
+         {
+            if (!sampled(i, j)) continue;
+            direct[j].update(511.5 + bearing(i, j), 511.5 - bearing(i, j));
+            regulations++;
+         }
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         channels.emplace_back(executor);
+         executor.spawn(servo_loop(executor, channels[i], tasked[i]));
+      }
+
+      const auto slabs = pool.slabs.size();
+      executor.run();
+      const auto t2 = std::chrono::steady_clock::now();
+
+      for (std::size_t i = 0; i < num_ticks; ++i)
+      {
+         for (std::size_t j = 0; j < num_servos; ++j)
+         {
+            if (sampled(i, j)) channels[j].post(511.5 + bearing(i, j), 511.5 - bearing(i, j));
+         }
+
+         executor.tick();
+         executor.run();
+      }
+
+      const auto t3 = std::chrono::steady_clock::now();
+      const auto resumes = executor.resumes;
+      const auto grown = pool.slabs.size() - slabs;
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         if (direct[i].output() != tasked[i].output() || channels[i].dropped) mismatches++;
+      }
+
+      task_executor switcher;
+
+      for (std::size_t i = 0; i < num_yielding; ++i)
+      {
+         switcher.spawn(yield_loop(switcher));
+      }
+
+      switcher.run(num_yielding);
+      const auto t4 = std::chrono::steady_clock::now();
+      switcher.run(switches);
+      const auto t5 = std::chrono::steady_clock::now();
+
+      const auto seconds = [](const std::chrono::steady_clock::duration& duration)
+         {
+            return std::chrono::duration<double>(duration).count();
+         };
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Fleet:\t\t\t\t" << num_servos << " servos, " << num_ticks << " ticks, "
+                << regulations << " regulations\n";
+      std::cout << "Mismatching servos:\t\t" << mismatches << "\n";
+      std::cout << "Resumes:\t\t\t" << resumes << "\n";
+      std::cout << "Frames:\t\t\t\t" << num_servos << " servo tasks, " << pool.unpooled << " unpooled, "
+                << grown << " slabs allocated while running\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Duration, direct call:\t\t" << seconds(t1 - t0) / regulations * 1e9 << " ns per regulation\n";
+      std::cout << "Duration, coroutine task:\t" << seconds(t3 - t2) / regulations * 1e9 << " ns per regulation\n";
+      std::cout << "Duration, context switch:\t" << seconds(t5 - t4) / switches * 1e9 << " ns ("
+                << num_yielding << " tasks)\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return mismatches ? 1 : 0;
+#else
+      (void)argc;
+      (void)argv;
+      std::cout << "Coroutine tasks require C++20!\n\n";
+      return 1;
+#endif
+   }
+
+   /********************************************************************************
+   * realtime: Runs a fleet of servos in a control loop paced at specified
+   *           period, first on an ordinary thread and then on a thread with
+   *           the real-time setup, i.e. pinned to specified core, raised to
+   *           SCHED_FIFO at specified priority, with the memory locked and
+   *           the stack, the fleet state and the telemetry rings prefaulted.
+   *           Every servo records each cycle in the ring of a flight
+   *           recorder, and the fleet and rings are allocated anew for each
+   *           run. The wake-up lateness histograms of both runs, the page
+   *           faults and overruns during the loops and the report of the
+   *           setup, including any privilege refused, are printed, and the
+   *           lateness is exported through the stats report.
+   *
+   *           Usage: realtime [servos] [cycles] [period us] [core] [priority]
+   ********************************************************************************/
+   inline int realtime(const int argc,
+                       char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000));
+      const auto num_cycles = static_cast<std::size_t>(argument(argc, argv, 3, 2000));
+      const auto period_us = argument(argc, argv, 4, 1000);
+      const auto core = static_cast<int>(argument(argc, argv, 5, static_cast<double>(parallel::num_threads() - 1)));
+      const auto priority = static_cast<int>(argument(argc, argv, 6, 80));
+      const std::size_t capacity = 1024;
+      paced_loop loops[2];
+      std::int64_t faults[2]{};
+      realtime_setup setup;
+      stats_report report;
+      auto sink = 0.0;
+
+      setup.cpus.push_back(core);
+      setup.priority = priority;
+      setup.lock_memory = true;
+
+      for (const auto rt : { false, true })
+      {
+         auto& loop = loops[rt];
+         std::vector<simulation> fleet;
+         std::vector<flight_recorder> rings(num_servos);
+         plant_model plant;
+         fleet.reserve(num_servos);
+         loop.period = std::chrono::nanoseconds(static_cast<std::int64_t>(period_us * 1e3));
+
+         for (std::size_t i = 0; i < num_servos; ++i)
+         {
+            plant.seed = i + 1;
+            fleet.push_back(simulation(default_servo(), plant));
+            rings[i].init(capacity, "realtime");
+            rings[i].on_fault = false;
+            rings[i].max_dumps = 0;
+            fleet[i].device.recorder = &rings[i];
+         }
+
+         std::thread worker([&](void)
+            {
+               if (rt)
+               {
+                  setup.apply();
+                  setup.prefault(fleet);
+
+                  for (auto& i : rings)
+                  {
+                     setup.prefault(i.records.get(), (i.mask + 1) * sizeof(cycle_record));
+                  }
+               }
+
+               const auto faults_before = realtime_setup::page_faults();
+
+               loop.run(num_cycles, [&](const std::size_t cycle)
+                  {
+                     const auto target = (cycle / 500) % 2 ? 20.0 : -20.0;
+
+                     for (auto& i : fleet)
+                     {
+                        i.step(target);
+                     }
+                  });
+
+               faults[rt] = faults_before < 0 ? -1 : realtime_setup::page_faults() - faults_before;
+            });
+
+         worker.join();
+
+         for (const auto& i : fleet)
+         {
+            sink += i.device.output();
+         }
+      }
+
+      for (const auto rt : { false, true })
+      {
+         std::cout << "--------------------------------------------------------------------------------\n";
+         std::cout << (rt ? "Real-time thread:\t" : "Ordinary thread:\t") << num_servos << " servos, "
+                   << num_cycles << " cycles of " << std::fixed << std::setprecision(0) << period_us << " us\n";
+         std::cout << "Page faults:\t\t" << faults[rt] << "\n";
+         std::cout << "Overruns:\t\t" << loops[rt].overruns << "\n";
+         loops[rt].lateness.print();
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      setup.print();
+      std::cout << "--------------------------------------------------------------------------------\n";
+      report.add("jitter_ordinary", loops[0].lateness);
+      report.add("jitter_ordinary_overruns", static_cast<double>(loops[0].overruns));
+      report.add("jitter_ordinary_page_faults", static_cast<double>(faults[0]));
+      report.add("jitter_realtime", loops[1].lateness);
+      report.add("jitter_realtime_overruns", static_cast<double>(loops[1].overruns));
+      report.add("jitter_realtime_page_faults", static_cast<double>(faults[1]));
+      report.add("jitter_realtime_denied", static_cast<double>(setup.denied.size()));
+      report.write();
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      setup.unlock();
+      return sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * control: Runs a fleet of servos in a control loop paced at specified
+   *          period, while another thread publishes specified number of
+   *          parameter sets to the control plane of the fleet at random
+   *          intervals, alternating the target between 70 and 110 degrees.
+   *          The derivate constant of each set encodes its number, from which
+   *          the other values of the set are derived, so every applied set is
+   *          checked for consistency. The histogram of the latency from
+   *          publishing a set to applying it is printed and exported through
+   *          the stats report. A publisher and a reader then race each other
+   *          without pacing for 200 ms, to count the reads overlapped by a
+   *          write and check that every set applied is consistent. Finally the duration of a
+   *          control cycle is printed with and without control plane.
+   *
+   *          Usage: control [servos] [cycles] [period us] [updates]
+   ********************************************************************************/
+   inline int control(const int argc,
+                      char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 1000));
+      const auto num_cycles = static_cast<std::size_t>(argument(argc, argv, 3, 2000));
+      const auto period_us = argument(argc, argv, 4, 1000);
+      const auto num_updates = static_cast<std::size_t>(argument(argc, argv, 5, 100));
+      const std::chrono::milliseconds race_time(200);
+      const std::size_t repetitions = 200;
+      control_plane plane;
+      std::vector<simulation> fleet;
+      std::vector<std::uint64_t> seen(num_servos);
+      latency_histogram latency;
+      paced_loop loop;
+      stats_report report;
+      std::uint64_t applied = 0, retries = 0, inconsistent = 0, published = 0;
+      auto sink = 0.0;
+
+      auto setpoint_of = [](const std::size_t number, pid_gains& gains, double& target)
+      {
+         gains.kp = 1.0 + 0.1 * (number % 5);
+         gains.ki = 0.01 * gains.kp;
+         gains.kd = 0.1 + 0.001 * number;
+         target = number % 2 ? 110.0 : 70.0;
+      };
+
+      auto consistent = [&](const control_setpoint& setpoint)
+      {
+         pid_gains gains;
+         double target = 0;
+         const auto number = static_cast<std::size_t>(std::llround((setpoint.gains.kd - 0.1) * 1000.0));
+         setpoint_of(number, gains, target);
+         return gains.kp == setpoint.gains.kp && gains.ki == setpoint.gains.ki &&
+            gains.kd == setpoint.gains.kd && target == setpoint.target;
+      };
+
+      fleet.reserve(num_servos);
+      loop.period = std::chrono::nanoseconds(static_cast<std::int64_t>(period_us * 1e3));
+
+      for (std::size_t i = 0; i < num_servos; ++i)
+      {
+         plant_model plant;
+         plant.seed = i + 1;
+         fleet.push_back(simulation(default_servo(), plant));
+         fleet[i].device.set_control(plane);
+      }
+
+      std::atomic<bool> running{ true };
+      std::thread publisher([&](void)
+         {
+            const auto span = period_us * num_cycles / (num_updates > 0 ? num_updates : 1);
+            std::uint64_t state = 12345;
+
+            for (std::size_t i = 1; i <= num_updates && running; ++i)
+            {
+               state = state * 6364136223846793005ull + 1442695040888963407ull;
+               const auto pause = span * (0.5 + static_cast<double>(state >> 11) / 9007199254740992.0);
+               std::this_thread::sleep_for(std::chrono::microseconds(static_cast<std::int64_t>(pause)));
+               pid_gains gains;
+               double target = 0;
+               setpoint_of(i, gains, target);
+               plane.publish(gains, target);
+               published++;
+            }
+         });
+
+      loop.run(num_cycles, [&](const std::size_t)
+         {
+            for (std::size_t i = 0; i < num_servos; ++i)
+            {
+               auto& device = fleet[i].device;
+               fleet[i].step(0.0);
+               if (device.control.updates == seen[i]) continue;
+               seen[i] = device.control.updates;
+               latency.add(static_cast<std::uint64_t>(device.control.latency > 0 ? device.control.latency : 0));
+               if (!consistent(device.control.applied)) inconsistent++;
+               applied++;
+            }
+         });
+
+      running = false;
+      publisher.join();
+
+      for (const auto& i : fleet)
+      {
+         retries += i.device.control.retries;
+         sink += i.device.output();
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Fleet:\t\t\t" << num_servos << " servos, " << num_cycles << " cycles of " << std::fixed
+                << std::setprecision(0) << period_us << " us\n";
+      std::cout << "Sets published:\t\t" << published << "\n";
+      std::cout << "Sets applied:\t\t" << applied << " (" << inconsistent << " inconsistent, " << retries
+                << " reads retried)\n";
+      std::cout << "Final target:\t\t" << fleet.front().device.target() << " degrees\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      latency.print();
+
+      control_plane race_plane;
+      control_link link;
+      pid_controller pid(90, 30, 150);
+      std::uint64_t reads = 0, race_applied = 0, race_inconsistent = 0;
+      running = true;
+      link.plane = &race_plane;
+
+      std::thread writer([&](void)
+         {
+            for (std::size_t i = 1; running; ++i)
+            {
+               pid_gains gains;
+               double target = 0;
+               setpoint_of(i % 100000, gains, target);
+               race_plane.publish(gains, target);
+            }
+         });
+
+      while (race_plane.version() == 0)
+      {
+         std::this_thread::yield();
+      }
+
+      const auto t0 = std::chrono::steady_clock::now();
+
+      while (std::chrono::steady_clock::now() - t0 < race_time)
+      {
+         for (std::size_t i = 0; i < 1000; ++i)
+         {
+            reads++;
+            if (!link.apply(pid)) continue;
+            race_applied++;
+            if (!consistent(link.applied)) race_inconsistent++;
+         }
+      }
+
+      running = false;
+      writer.join();
+      sink += pid.kp;
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Race, reads:\t\t" << reads << " in " << race_time.count() << " ms\n";
+      std::cout << "Race, sets applied:\t" << race_applied << " (" << race_inconsistent << " inconsistent, "
+                << link.retries << " reads retried)\n";
+
+      for (const auto attached : { false, true })
+      {
+         control_plane idle;
+         auto config = default_servo();
+         if (attached) config.set_control(idle);
+         plant_model plant;
+         const auto t2 = std::chrono::steady_clock::now();
+
+         for (std::size_t i = 0; i < repetitions; ++i)
+         {
+            simulation run(config, plant);
+
+            for (std::size_t j = 0; j < 1000; ++j)
+            {
+               run.step(0.0);
+            }
+            sink += run.device.output();
+         }
+
+         const auto t3 = std::chrono::steady_clock::now();
+         std::cout << (attached ? "Cycle, control plane:\t" : "Cycle, no plane:\t") << std::setprecision(1)
+                   << std::chrono::duration<double>(t3 - t2).count() / (repetitions * 1000) * 1e9 << " ns\n";
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      report.add("control_latency", latency);
+      report.add("control_published", static_cast<double>(published));
+      report.add("control_applied", static_cast<double>(applied));
+      report.add("control_inconsistent", static_cast<double>(inconsistent + race_inconsistent));
+      report.add("control_retries", static_cast<double>(retries));
+      report.add("control_race_applied", static_cast<double>(race_applied));
+      report.add("control_race_retries", static_cast<double>(link.retries));
+      report.write();
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return inconsistent || race_inconsistent || sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * fleet: Writes a fleet configuration file with one line per servo, with two
+   *        models and a calibration used by every tenth servo, and prints the
+   *        duration of loading it. The fleet is then run from the file, while
+   *        another thread edits the file four times: the target of servos
+   *        100 - 199, the gains of the fast model, an invalid line, which is
+   *        rejected, and a comment, which changes no servo. The file is
+   *        watched with inotify, or polled if specified or unavailable. For
+   *        every edit, the number of servos changed, which must equal the
+   *        number affected, and the latency from saving the file to applying
+   *        the changes are printed.
+   *
+   *        Usage: fleet [servos] [file] [poll]
+   ********************************************************************************/
+   inline int fleet(const int argc,
+                    char** argv)
+   {
+      const auto num_servos = static_cast<std::size_t>(argument(argc, argv, 2, 100000));
+      const std::string filepath = argc > 3 ? argv[3] : "fleet.cfg";
+      const auto force_polling = argc > 4 && std::string(argv[4]) == "poll";
+      const auto calibration_path = fleet_config::directory(filepath) + "fleet_calibration.txt";
+      const char* const edits[] = { "targets", "fast gains", "invalid", "comment" };
+      fleet_store store;
+      std::vector<simulation> devices;
+      std::atomic<std::int64_t> applied_stamp{ 0 };
+      std::atomic<std::size_t> applied_count{ 0 };
+      std::atomic<bool> running{ true };
+      std::mutex error_lock;
+      std::string last_error;
+      auto mismatches = 0;
+      auto sink = 0.0;
+
+      const auto write = [&](const std::size_t edit)
+         {
+            const auto temporary = filepath + ".tmp";
+            {
+               std::ofstream file(temporary);
+               file << "# Fleet of " << num_servos << " servos" << (edit == 4 ? ", comment edited" : "") << ".\n";
+               file << "model standard 30 150 0 1023 1 0.01 0.1\n";
+               file << "model fast 30 150 0 1023 " << (edit >= 2 ? "1.5" : "2") << " 0.02 0.15\n";
+               file << "calibration linear fleet_calibration.txt\n";
+               if (edit == 3) file << "servo 0 unknown 90\n";
+
+               for (std::size_t i = 0; i < num_servos; ++i)
+               {
+                  file << "servo " << i << (i % 4 == 3 ? " fast " : " standard ")
+                       << (edit >= 1 && i >= 100 && i < 200 ? 60 : 90) << (i % 10 == 0 ? " linear\n" : "\n");
+               }
+               if (!file) return false;
+            }
+            std::remove(filepath.c_str());
+            return std::rename(temporary.c_str(), filepath.c_str()) == 0;
+         };
+
+      {
+         std::ofstream file(calibration_path);
+         file << "left linear\n0 0\n1023 1023\nright linear\n0 0\n1023 1023\n";
+      }
+
+      if (!write(0))
+      {
+         std::cout << "Could not write " << filepath << "\n";
+         return 1;
+      }
+
+      const auto t0 = std::chrono::steady_clock::now();
+
+      if (!store.load(filepath, force_polling))
+      {
+         std::cout << store.error << "\n";
+         return 1;
+      }
+
+      const auto t1 = std::chrono::steady_clock::now();
+      devices.reserve(store.size());
+
+      for (std::size_t i = 0; i < store.size(); ++i)
+      {
+         plant_model plant;
+         plant.seed = i + 1;
+         auto config = default_servo();
+         store.settings[i].apply(config);
+         devices.push_back(simulation(config, plant));
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Loaded:\t\t\t" << store.size() << " servos in "
+                << std::chrono::duration<double>(t1 - t0).count() * 1e3 << " ms\n";
+      std::cout << "Watching:\t\t" << (store.watcher.polling ? "polling" : "inotify") << "\n";
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Edit\t\tChanged\tAffected\tLatency\n";
+
+      std::thread watcher([&](void)
+         {
+            while (running)
+            {
+               const auto rejected = store.rejected;
+               store.poll(10);
+               if (store.rejected == rejected) continue;
+               std::lock_guard<std::mutex> guard(error_lock);
+               last_error = store.error;
+            }
+         });
+
+      std::thread editor([&](void)
+         {
+            const std::size_t moved = num_servos > 200 ? 100 : (num_servos > 100 ? num_servos - 100 : 0);
+            const std::size_t affected[] = { moved, num_servos / 4, 0, 0 };
+
+            for (std::size_t edit = 1; edit <= 4; ++edit)
+            {
+               const auto expected = affected[edit - 1];
+               std::this_thread::sleep_for(std::chrono::milliseconds(50));
+               const auto generation = store.published.load();
+               applied_count = 0;
+               const auto saved = control_plane::now();
+               if (!write(edit)) break;
+               const auto timeout = std::chrono::milliseconds(expected ? 2000 : 500);
+               const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+               while (std::chrono::steady_clock::now() < deadline)
+               {
+                  if (expected && store.acknowledged.load() > generation) break;
+                  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+               }
+
+               const auto changed = applied_count.load();
+               if (changed != expected) mismatches++;
+               std::cout << edits[edit - 1] << (edit == 2 ? "\t" : "\t\t") << changed << "\t" << expected << "\t\t";
+
+               if (changed)
+               {
+                  std::cout << (applied_stamp - saved) / 1e6 << " ms\n";
+               }
+               else
+               {
+                  std::lock_guard<std::mutex> guard(error_lock);
+                  std::cout << "-" << (last_error.empty() ? "" : "\t(" + last_error + ")") << "\n";
+                  last_error.clear();
+               }
+            }
+            running = false;
+         });
+
+      std::size_t ticks = 0;
+
+      while (running)
+      {
+         const auto changed = store.apply([&](const std::size_t i, const servo_settings& settings)
+            {
+               settings.apply(devices[i].device);
+            });
+
+         if (changed)
+         {
+            applied_stamp = control_plane::now();
+            applied_count = changed;
+         }
+
+         for (auto& i : devices)
+         {
+            i.step(0.0);
+         }
+         ticks++;
+      }
+
+      editor.join();
+      watcher.join();
+
+      for (const auto& i : devices)
+      {
+         sink += i.device.output();
+      }
+
+      std::cout << "--------------------------------------------------------------------------------\n";
+      std::cout << "Ticks:\t\t\t" << ticks << "\n";
+      std::cout << "Reloads:\t\t" << store.reloads << " (" << store.rejected << " rejected)\n";
+      std::cout << "Servo 150, target:\t" << devices[150 % devices.size()].device.target() << " degrees, kp "
+                << devices[151 % devices.size()].device.pid.kp << " of servo 151\n";
+      std::cout << "--------------------------------------------------------------------------------\n\n";
+      return mismatches || sink != sink ? 1 : 0;
+   }
+
+   /********************************************************************************
+   * print_usage: Prints available command line tools in the terminal.
+   ********************************************************************************/
+   inline void print_usage(void)
+   {
+      std::cout << "Usage:\n";
+      std::cout << "   (no arguments)                Run the servo interactively.\n";
+      std::cout << "   tune [simplexes] [iters] [cache]\n";
+      std::cout << "                                 Tune PID parameters offline.\n";
+      std::cout << "   grid [points] [lanes] [trace] Grid search PID parameters in SIMD lanes.\n";
+      std::cout << "   autotune [servos]             Relay autotune a fleet of simulated servos.\n";
+      std::cout << "   pareto [population] [gens] [cache]\n";
+      std::cout << "                                 Multi-objective search of PID parameters.\n";
+      std::cout << "   prefix [candidates] [snapshots]\n";
+      std::cout << "                                 Share common scenario prefixes in a sweep.\n";
+      std::cout << "   gradient [iterations]         Gradient descent tuning with dual numbers.\n";
+      std::cout << "   analyze [kp] [ki] [kd]        Analyze the closed loop in the z-domain.\n";
+      std::cout << "   bode [freqs] [servos] [target|sensor]\n";
+      std::cout << "                                 Measure frequency responses with sine sweeps.\n";
+      std::cout << "   robust [variants] [percentile]\n";
+      std::cout << "                                 Tune across an ensemble of perturbed plants.\n";
+      std::cout << "   filter [samples] [window]     Benchmark the sensor filter pipeline.\n";
+      std::cout << "   fusion [left noise] [right noise]\n";
+      std::cout << "                                 Compare Kalman sensor fusion to raw input.\n";
+      std::cout << "   oversample [noise] [stages]   Decimate oversampled sensors per cycle.\n";
+      std::cout << "   calibrate [file]              Linearize sensors with reloadable tables.\n";
+      std::cout << "   array [noise] [max sensors]   Estimate the bearing from an array of sensors.\n";
+      std::cout << "   health [noise] [fault cycle]  Detect sensor faults and hold the output.\n";
+      std::cout << "   stats [servos] [file]         Count output saturation and sensor clamping.\n";
+      std::cout << "   record [capacity] [prefix]    Dump a flight recorder of the last cycles.\n";
+      std::cout << "   oscillate [kp] [kd] [cycles]  Detect limit cycles and back off the gains.\n";
+      std::cout << "   rate [servos] [max period]    Slow down settled servos in a fleet.\n";
+      std::cout << "   wheel [servos] [ticks]        Schedule mixed loop periods on a timer wheel.\n";
+      std::cout << "   tasks [servos] [ticks]        Run servos as coroutine tasks (C++20).\n";
+      std::cout << "   realtime [servos] [cycles]    Pace a fleet on a real-time thread.\n";
+      std::cout << "   control [servos] [cycles]     Publish gains and targets to a running fleet.\n";
+      std::cout << "   fleet [servos] [file] [poll]  Run a fleet from a hot-reloaded config file.\n\n";
+      return;
+   }
+
+   /********************************************************************************
+   * run: Runs the command line tool selected by the first command line argument
+   *      and returns the exit code of the tool.
+   *
+   *      - argc: Number of command line arguments.
+   *      - argv: Command line arguments.
+   ********************************************************************************/
+   inline int run(const int argc,
+                  char** argv)
+   {
+      const std::string command = argv[1];
+
+      if (command == "tune")
+      {
+         return tune(argc, argv);
+      }
+      else if (command == "grid")
+      {
+         return grid(argc, argv);
+      }
+      else if (command == "autotune")
+      {
+         return autotune(argc, argv);
+      }
+      else if (command == "pareto")
+      {
+         return pareto(argc, argv);
+      }
+      else if (command == "prefix")
+      {
+         return prefix(argc, argv);
+      }
+      else if (command == "gradient")
+      {
+         return gradient(argc, argv);
+      }
+      else if (command == "analyze")
+      {
+         return analyze(argc, argv);
+      }
+      else if (command == "bode")
+      {
+         return bode(argc, argv);
+      }
+      else if (command == "robust")
+      {
+         return robust(argc, argv);
+      }
+      else if (command == "filter")
+      {
+         return filter(argc, argv);
+      }
+      else if (command == "fusion")
+      {
+         return fusion(argc, argv);
+      }
+      else if (command == "oversample")
+      {
+         return oversample(argc, argv);
+      }
+      else if (command == "calibrate")
+      {
+         return calibrate(argc, argv);
+      }
+      else if (command == "array")
+      {
+         return array(argc, argv);
+      }
+      else if (command == "health")
+      {
+         return health(argc, argv);
+      }
+      else if (command == "stats")
+      {
+         return stats(argc, argv);
+      }
+      else if (command == "record")
+      {
+         return record(argc, argv);
+      }
+      else if (command == "oscillate")
+      {
+         return oscillate(argc, argv);
+      }
+      else if (command == "rate")
+      {
+         return rate(argc, argv);
+      }
+      else if (command == "wheel")
+      {
+         return wheel(argc, argv);
+      }
+      else if (command == "tasks")
+      {
+         return tasks(argc, argv);
+      }
+      else if (command == "realtime")
+      {
+         return realtime(argc, argv);
+      }
+      else if (command == "control")
+      {
+         return control(argc, argv);
+      }
+      else if (command == "fleet")
+      {
+         return fleet(argc, argv);
+      }
+      else
+      {
+         print_usage();
+         return 1;
+      }
+   }
+}
+
+#endif /* COMMANDS_HPP_ */
\ No newline at end of file
@@ -0,0 +1,209 @@
+/********************************************************************************
+* control_plane.hpp: Contains a control plane for changing the PID parameters
+*                    and the target angle of running servos from another
+*                    thread, without pausing the control loop. A publisher
+*                    writes a new parameter set into the plane, and every
+*                    servo attached to the plane picks it up at its next
+*                    regulation, i.e. at a tick boundary of its loop.
+*
+*                    The plane is a sequence lock: the sequence number is odd
+*                    while a set is written and advanced to the next even
+*                    number once written, so a reader seeing the same even
+*                    number before and after reading the values knows that it
+*                    read a consistent set. The values are atomics accessed
+*                    with relaxed ordering between the fences of the sequence
+*                    number, so a torn read is detected rather than undefined.
+*                    A servo reads the plane without locks and never waits:
+*                    an unchanged sequence number costs a single load, and a
+*                    set found in the middle of a write is retried at the
+*                    next regulation. Publishers are serialized by a mutex,
+*                    which the control thread never takes.
+*
+*                    Each set is stamped with the time it was published, so
+*                    the latency from publishing a set to applying it is
+*                    measured by the servo. Unlike the calibration tables,
+*                    which are published through pointers and kept alive,
+*                    a parameter set is copied, so publishing never allocates.
+********************************************************************************/
+#ifndef CONTROL_PLANE_HPP_
+#define CONTROL_PLANE_HPP_
+
+/* Include directives: */
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "pid_controller.hpp"
+
+/********************************************************************************
+* control_setpoint: Struct holding a parameter set of the control plane, i.e.
+*                   the PID parameters and the target angle, along with the
+*                   time it was published.
+********************************************************************************/
+struct control_setpoint
+{
+   pid_gains gains;         /* PID parameters. */
+   double target      = 90; /* Target angle in degrees. */
+   std::int64_t stamp = 0;  /* Publish time in ns of the steady clock. */
+};
+
+/********************************************************************************
+* control_plane: Struct for implementation of a sequence lock holding the
+*                parameter set published to a group of servos.
+********************************************************************************/
+struct control_plane
+{
+   std::atomic<std::uint64_t> sequence{ 0 }; /* Sequence number, odd while a set is written. */
+   std::atomic<double> kp{ 1.0 };            /* Proportional constant. */
+   std::atomic<double> ki{ 0.01 };           /* Integrate constant. */
+   std::atomic<double> kd{ 0.1 };            /* Derivate constant. */
+   std::atomic<double> target{ 90 };         /* Target angle in degrees. */
+   std::atomic<std::int64_t> stamp{ 0 };     /* Publish time in ns of the steady clock. */
+   std::mutex writers;                       /* Serializes publishers. */
+
+   control_plane(void) = default;
+   control_plane(const control_plane&) = delete;
+   control_plane& operator=(const control_plane&) = delete;
+
+   /********************************************************************************
+   * publish: Publishes specified PID parameters and target angle, stamped with
+   *          the current time. Returns the sequence number of the new set.
+   *
+   *          - gains       : New PID parameters.
+   *          - target_angle: New target angle in degrees.
+   ********************************************************************************/
+   std::uint64_t publish(const pid_gains& gains,
+                         const double target_angle)
+   {
+      std::lock_guard<std::mutex> guard(writers);
+      const auto start = sequence.load(std::memory_order_relaxed);
+      sequence.store(start + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      kp.store(gains.kp, std::memory_order_relaxed);
+      ki.store(gains.ki, std::memory_order_relaxed);
+      kd.store(gains.kd, std::memory_order_relaxed);
+      target.store(target_angle, std::memory_order_relaxed);
+      stamp.store(now(), std::memory_order_relaxed);
+      sequence.store(start + 2, std::memory_order_release);
+      return start + 2;
+   }
+
+   /********************************************************************************
+   * version: Returns the current sequence number, 0 if nothing is published.
+   ********************************************************************************/
+   std::uint64_t version(void) const
+   {
+      return sequence.load(std::memory_order_acquire);
+   }
+
+   /********************************************************************************
+   * try_read: Reads the current parameter set into referenced setpoint in a
+   *           single attempt. Returns the sequence number of the set read,
+   *           or 0 if nothing is published yet or a write overlapped the
+   *           read, in which case the setpoint must be discarded.
+   *
+   *           - setpoint: Reference to storage for the parameter set.
+   ********************************************************************************/
+   std::uint64_t try_read(control_setpoint& setpoint) const
+   {
+      const auto before = sequence.load(std::memory_order_acquire);
+      if (before == 0 || (before & 1)) return 0;
+      setpoint.gains.kp = kp.load(std::memory_order_relaxed);
+      setpoint.gains.ki = ki.load(std::memory_order_relaxed);
+      setpoint.gains.kd = kd.load(std::memory_order_relaxed);
+      setpoint.target = target.load(std::memory_order_relaxed);
+      setpoint.stamp = stamp.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return sequence.load(std::memory_order_relaxed) == before ? before : 0;
+   }
+
+   /********************************************************************************
+   * read: Reads the current parameter set into referenced setpoint, retrying
+   *       until no write overlaps the read. Returns the sequence number of the
+   *       set read, or 0 if nothing is published yet. Meant for threads that
+   *       may wait, not for the control thread.
+   *
+   *       - setpoint: Reference to storage for the parameter set.
+   ********************************************************************************/
+   std::uint64_t read(control_setpoint& setpoint) const
+   {
+      while (1)
+      {
+         const auto result = try_read(setpoint);
+         if (result || version() == 0) return result;
+      }
+   }
+
+   /********************************************************************************
+   * now: Returns the current time in ns of the steady clock.
+   ********************************************************************************/
+   static std::int64_t now(void)
+   {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+};
+
+/********************************************************************************
+* control_link: Struct holding the attachment of a servo to a control plane,
+*               i.e. the sequence number and the parameter set last applied,
+*               along with counters of the updates. No plane is attached by
+*               default, in which case the servo keeps its parameters.
+********************************************************************************/
+struct control_link
+{
+   const control_plane* plane = nullptr; /* Control plane of the servo, none if nullptr. */
+   std::uint64_t version      = 0;       /* Sequence number of the set last applied. */
+   control_setpoint applied;             /* Parameter set last applied. */
+   std::int64_t latency       = 0;       /* Latency in ns from publishing to applying the set. */
+   std::uint64_t updates      = 0;       /* Number of sets applied. */
+   std::uint64_t retries      = 0;       /* Number of reads overlapped by a write. */
+
+   /********************************************************************************
+   * apply: Applies the current parameter set of the plane to referenced PID
+   *        controller if a new set is published and read consistently, where
+   *        the integral and derivate values are kept. Returns true if a new
+   *        set was applied.
+   *
+   *        - pid: Reference to the PID controller.
+   ********************************************************************************/
+   template<class T>
+   bool apply(basic_pid_controller<T>& pid)
+   {
+      if (plane->version() == version) return false;
+      control_setpoint setpoint;
+      const auto result = plane->try_read(setpoint);
+
+      if (!result)
+      {
+         retries++;
+         return false;
+      }
+
+      version = result;
+      applied = setpoint;
+      updates++;
+      restore(pid);
+      latency = control_plane::now() - setpoint.stamp;
+      return true;
+   }
+
+   /********************************************************************************
+   * restore: Sets the parameter set last applied, if any, in referenced PID
+   *          controller, for instance after the controller was restored from
+   *          an earlier cycle.
+   *
+   *          - pid: Reference to the PID controller.
+   ********************************************************************************/
+   template<class T>
+   void restore(basic_pid_controller<T>& pid) const
+   {
+      if (!updates) return;
+      pid.set_gains(applied.gains);
+      pid.target = applied.target;
+      return;
+   }
+};
+
+#endif /* CONTROL_PLANE_HPP_ */
\ No newline at end of file
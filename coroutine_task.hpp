@@ -0,0 +1,464 @@
+/********************************************************************************
+* coroutine_task.hpp: Contains C++20 coroutine tasks for emulating many servos
+*                     on a single thread, where the sensor samples of each
+*                     servo arrive asynchronously. The loop of a servo is
+*                     written as a coroutine, see servo_loop:
+*
+*                     while (1)
+*                     {
+*                        const auto sample = co_await input.next_sample();
+*                        device.update(sample.left, sample.right);
+*                        co_await executor.next_tick();
+*                     }
+*
+*                     The executor resumes the tasks from an intrusive ready
+*                     queue, linked through the promises of the coroutines,
+*                     so suspending and resuming a task never allocates. The
+*                     coroutine frames are allocated from a pool of fixed
+*                     size blocks, so spawning a task only allocates when the
+*                     pool grows. Without coroutine support, i.e. before
+*                     C++20, the header is empty.
+********************************************************************************/
+#ifndef COROUTINE_TASK_HPP_
+#define COROUTINE_TASK_HPP_
+
+#ifdef __cpp_impl_coroutine
+
+/* Include directives: */
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+#include "servo.hpp"
+
+/********************************************************************************
+* frame_pool: Struct for implementation of a pool of coroutine frames. Frames
+*             are rounded up to a multiple of GRANULARITY bytes, where each
+*             size has its own free list, refilled with a slab of
+*             BLOCKS_PER_SLAB blocks when empty. Larger frames are allocated
+*             directly. A pool is only used by a single thread.
+********************************************************************************/
+struct frame_pool
+{
+   static constexpr std::size_t GRANULARITY     = 16;   /* Size step of the blocks in bytes. */
+   static constexpr std::size_t MAX_SIZE        = 4096; /* Largest pooled frame in bytes. */
+   static constexpr std::size_t BLOCKS_PER_SLAB = 256;  /* Blocks allocated at a time. */
+
+   /********************************************************************************
+   * block: Struct holding the link of a free block.
+   ********************************************************************************/
+   struct block
+   {
+      block* next; /* Next free block of the same size. */
+   };
+
+   block* free_lists[MAX_SIZE / GRANULARITY]{};         /* Free blocks of each size. */
+   std::vector<std::unique_ptr<unsigned char[]>> slabs; /* Memory of the blocks. */
+   std::size_t frames   = 0;                            /* Number of frames in use. */
+   std::size_t unpooled = 0;                            /* Number of frames allocated directly. */
+
+   /********************************************************************************
+   * allocate: Returns a block of at least specified size.
+   *
+   *           - size: Size of the frame in bytes.
+   ********************************************************************************/
+   void* allocate(const std::size_t size)
+   {
+      frames++;
+
+      if (size > MAX_SIZE)
+      {
+         unpooled++;
+         return ::operator new(size);
+      }
+
+      auto& list = free_lists[(size - 1) / GRANULARITY];
+      if (!list) refill(list, ((size - 1) / GRANULARITY + 1) * GRANULARITY);
+      auto* first = list;
+      list = first->next;
+      return first;
+   }
+
+   /********************************************************************************
+   * release: Returns specified block of specified size to its free list.
+   *
+   *          - frame: Pointer to the frame.
+   *          - size : Size of the frame in bytes.
+   ********************************************************************************/
+   void release(void* frame,
+                const std::size_t size)
+   {
+      frames--;
+
+      if (size > MAX_SIZE)
+      {
+         ::operator delete(frame);
+         return;
+      }
+
+      auto& list = free_lists[(size - 1) / GRANULARITY];
+      auto* released = static_cast<block*>(frame);
+      released->next = list;
+      list = released;
+      return;
+   }
+
+   /********************************************************************************
+   * refill: Allocates a slab of blocks of specified size onto referenced free
+   *         list.
+   *
+   *         - list      : Reference to the free list.
+   *         - block_size: Size of the blocks in bytes.
+   ********************************************************************************/
+   void refill(block*& list,
+               const std::size_t block_size)
+   {
+      slabs.emplace_back(new unsigned char[block_size * BLOCKS_PER_SLAB]);
+      auto* memory = slabs.back().get();
+
+      for (std::size_t i = BLOCKS_PER_SLAB; i > 0; --i)
+      {
+         auto* added = reinterpret_cast<block*>(memory + (i - 1) * block_size);
+         added->next = list;
+         list = added;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * local: Returns the pool of the calling thread.
+   ********************************************************************************/
+   static frame_pool& local(void)
+   {
+      static thread_local frame_pool pool;
+      return pool;
+   }
+};
+
+/********************************************************************************
+* coroutine_task: Struct holding a coroutine started by a task function, such
+*                 as servo_loop. The task starts suspended and is run by an
+*                 executor, see task_executor::spawn. The task owns its frame,
+*                 which is returned to the pool when the task is destroyed.
+********************************************************************************/
+struct coroutine_task
+{
+   /********************************************************************************
+   * promise_type: Struct holding the state of the coroutine, including the link
+   *               of the intrusive queue the task is waiting in.
+   ********************************************************************************/
+   struct promise_type
+   {
+      promise_type* next = nullptr; /* Next task in the queue. */
+
+      coroutine_task get_return_object(void)
+      {
+         return coroutine_task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend(void) noexcept { return {}; }
+      std::suspend_always final_suspend(void) noexcept { return {}; }
+      void return_void(void) { }
+      void unhandled_exception(void) { throw; }
+
+      static void* operator new(const std::size_t size) { return frame_pool::local().allocate(size); }
+      static void operator delete(void* frame, const std::size_t size) { frame_pool::local().release(frame, size); }
+   };
+
+   std::coroutine_handle<promise_type> handle; /* Handle of the coroutine, owned by the task. */
+
+   /********************************************************************************
+   * coroutine_task: Creates a task owning specified coroutine.
+   *
+   *                 - coroutine: Handle of the coroutine.
+   ********************************************************************************/
+   explicit coroutine_task(const std::coroutine_handle<promise_type> coroutine)
+      : handle(coroutine) { }
+
+   /********************************************************************************
+   * coroutine_task: Takes over the coroutine of referenced task.
+   *
+   *                 - other: Reference to the task.
+   ********************************************************************************/
+   coroutine_task(coroutine_task&& other) noexcept
+      : handle(other.handle)
+   {
+      other.handle = nullptr;
+      return;
+   }
+
+   coroutine_task(const coroutine_task&) = delete;
+   coroutine_task& operator=(const coroutine_task&) = delete;
+
+   /********************************************************************************
+   * ~coroutine_task: Destroys the coroutine, if any.
+   ********************************************************************************/
+   ~coroutine_task(void)
+   {
+      if (handle) handle.destroy();
+      return;
+   }
+
+   /********************************************************************************
+   * done: Indicates if the coroutine has returned.
+   ********************************************************************************/
+   bool done(void) const
+   {
+      return handle.done();
+   }
+};
+
+/********************************************************************************
+* task_queue: Struct for implementation of an intrusive first in first out
+*             queue of suspended tasks, linked through their promises.
+********************************************************************************/
+struct task_queue
+{
+   coroutine_task::promise_type* head = nullptr; /* First task in the queue. */
+   coroutine_task::promise_type* tail = nullptr; /* Last task in the queue. */
+
+   /********************************************************************************
+   * empty: Indicates if the queue is empty.
+   ********************************************************************************/
+   bool empty(void) const
+   {
+      return head == nullptr;
+   }
+
+   /********************************************************************************
+   * push: Adds referenced task last in the queue.
+   *
+   *       - task: Reference to the promise of the task.
+   ********************************************************************************/
+   void push(coroutine_task::promise_type& task)
+   {
+      task.next = nullptr;
+      if (tail) tail->next = &task;
+      else head = &task;
+      tail = &task;
+      return;
+   }
+
+   /********************************************************************************
+   * pop: Removes and returns the first task of the queue, which must not be
+   *      empty.
+   ********************************************************************************/
+   coroutine_task::promise_type& pop(void)
+   {
+      auto& first = *head;
+      head = first.next;
+      if (!head) tail = nullptr;
+      return first;
+   }
+
+   /********************************************************************************
+   * append: Moves every task of referenced queue last in this queue.
+   *
+   *         - other: Reference to the queue to empty.
+   ********************************************************************************/
+   void append(task_queue& other)
+   {
+      if (other.empty()) return;
+      if (tail) tail->next = other.head;
+      else head = other.head;
+      tail = other.tail;
+      other.head = nullptr;
+      other.tail = nullptr;
+      return;
+   }
+};
+
+/********************************************************************************
+* task_executor: Struct for implementation of a single threaded executor of
+*                coroutine tasks. Ready tasks are resumed in order from the
+*                ready queue, while tasks waiting for the next tick are kept
+*                in a separate queue, moved to the ready queue by tick.
+********************************************************************************/
+struct task_executor
+{
+   task_queue ready;                  /* Tasks ready to resume. */
+   task_queue ticking;                /* Tasks waiting for the next tick. */
+   std::vector<coroutine_task> tasks; /* Tasks owned by the executor. */
+   std::uint64_t ticks   = 0;         /* Number of ticks. */
+   std::uint64_t resumes = 0;         /* Number of tasks resumed. */
+
+   /********************************************************************************
+   * awaiter: Struct holding an awaitable that suspends the awaiting task into
+   *          a queue of the executor.
+   ********************************************************************************/
+   struct awaiter
+   {
+      task_queue& queue; /* Queue to wait in. */
+
+      bool await_ready(void) const noexcept { return false; }
+      void await_suspend(const std::coroutine_handle<coroutine_task::promise_type> task) noexcept
+      {
+         queue.push(task.promise());
+      }
+      void await_resume(void) const noexcept { }
+   };
+
+   /********************************************************************************
+   * spawn: Takes over referenced task and queues it for its first resume.
+   *
+   *        - task: Reference to the task, started suspended.
+   ********************************************************************************/
+   void spawn(coroutine_task&& task)
+   {
+      ready.push(task.handle.promise());
+      tasks.push_back(std::move(task));
+      return;
+   }
+
+   /********************************************************************************
+   * next_tick: Returns an awaitable resuming the task at the next tick.
+   ********************************************************************************/
+   awaiter next_tick(void)
+   {
+      return awaiter{ ticking };
+   }
+
+   /********************************************************************************
+   * yield: Returns an awaitable resuming the task after the tasks ready now.
+   ********************************************************************************/
+   awaiter yield(void)
+   {
+      return awaiter{ ready };
+   }
+
+   /********************************************************************************
+   * tick: Makes every task waiting for the next tick ready.
+   ********************************************************************************/
+   void tick(void)
+   {
+      ticks++;
+      ready.append(ticking);
+      return;
+   }
+
+   /********************************************************************************
+   * run: Resumes ready tasks until no task is ready or specified number of
+   *      tasks have been resumed and returns the number of tasks resumed.
+   *
+   *      - max_resumes: Largest number of tasks to resume (default = no limit).
+   ********************************************************************************/
+   std::size_t run(const std::size_t max_resumes = static_cast<std::size_t>(-1))
+   {
+      std::size_t count = 0;
+
+      while (!ready.empty() && count < max_resumes)
+      {
+         std::coroutine_handle<coroutine_task::promise_type>::from_promise(ready.pop()).resume();
+         count++;
+      }
+
+      resumes += count;
+      return count;
+   }
+};
+
+/********************************************************************************
+* sensor_sample: Struct holding a sample of the left and right TOF sensor.
+********************************************************************************/
+struct sensor_sample
+{
+   double left  = 0; /* Value of the left sensor. */
+   double right = 0; /* Value of the right sensor. */
+};
+
+/********************************************************************************
+* sample_channel: Struct for implementation of the asynchronous sensor input of
+*                 a servo task. A posted sample is kept until the task takes
+*                 it, where a newer sample replaces an unread one. A task
+*                 waiting for a sample is made ready by the post.
+********************************************************************************/
+struct sample_channel
+{
+   task_executor& executor;                         /* Executor of the waiting task. */
+   sensor_sample sample;                            /* Last sample posted. */
+   bool fresh                            = false;   /* Indicates if the sample is unread. */
+   coroutine_task::promise_type* waiting = nullptr; /* Task waiting for a sample, if any. */
+   std::size_t posted                    = 0;       /* Number of samples posted. */
+   std::size_t dropped                   = 0;       /* Number of samples replaced unread. */
+
+   /********************************************************************************
+   * sample_channel: Creates a channel waking tasks of referenced executor.
+   *
+   *                 - owner: Reference to the executor.
+   ********************************************************************************/
+   explicit sample_channel(task_executor& owner)
+      : executor(owner) { }
+
+   /********************************************************************************
+   * awaiter: Struct holding an awaitable returning the next sample, suspending
+   *          the task until a sample is posted unless one is unread.
+   ********************************************************************************/
+   struct awaiter
+   {
+      sample_channel& channel; /* Channel to read. */
+
+      bool await_ready(void) const noexcept { return channel.fresh; }
+      void await_suspend(const std::coroutine_handle<coroutine_task::promise_type> task) noexcept
+      {
+         channel.waiting = &task.promise();
+      }
+      sensor_sample await_resume(void) const noexcept
+      {
+         channel.fresh = false;
+         return channel.sample;
+      }
+   };
+
+   /********************************************************************************
+   * next_sample: Returns an awaitable returning the next sample.
+   ********************************************************************************/
+   awaiter next_sample(void)
+   {
+      return awaiter{ *this };
+   }
+
+   /********************************************************************************
+   * post: Posts a new sample, which makes a waiting task ready.
+   *
+   *       - left : Value of the left sensor.
+   *       - right: Value of the right sensor.
+   ********************************************************************************/
+   void post(const double left,
+             const double right)
+   {
+      if (fresh) dropped++;
+      sample = sensor_sample{ left, right };
+      fresh = true;
+      posted++;
+      if (!waiting) return;
+      executor.ready.push(*waiting);
+      waiting = nullptr;
+      return;
+   }
+};
+
+/********************************************************************************
+* servo_loop: Runs referenced servo as a task, regulating on every sample of
+*             referenced channel, at most once per tick of the executor.
+*
+*             - executor: Reference to the executor running the task.
+*             - input   : Reference to the sensor input of the servo.
+*             - device  : Reference to the servo.
+********************************************************************************/
+inline coroutine_task servo_loop(task_executor& executor,
+                                 sample_channel& input,
+                                 servo& device)
+{
+   while (1)
+   {
+      const auto sample = co_await input.next_sample();
+      device.update(sample.left, sample.right);
+      co_await executor.next_tick();
+   }
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* COROUTINE_TASK_HPP_ */
\ No newline at end of file
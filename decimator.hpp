@@ -0,0 +1,123 @@
+/********************************************************************************
+* decimator.hpp: Contains a CIC (cascaded integrator-comb) decimator for TOF
+*                sensors sampled at an integer multiple of the control rate.
+*                Every sensor sample passes the integrators, while the combs
+*                only run once per control cycle, so a sample costs one
+*                addition per stage regardless of the decimation ratio. With
+*                a single stage the decimator is a boxcar average over the
+*                samples of the control cycle, while more stages attenuate
+*                the noise further at the cost of a longer delay.
+*
+*                The samples are converted to fixed point and the stages run
+*                in unsigned integers, where wraparound of the integrators
+*                cancels in the combs. The result is therefore exact however
+*                long the decimator runs, which would not hold for floating
+*                point integrators.
+********************************************************************************/
+#ifndef DECIMATOR_HPP_
+#define DECIMATOR_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/********************************************************************************
+* cic_decimator: Struct for implementation of a CIC decimator with adjustable
+*                ratio and number of stages. The first sample after a reset is
+*                used as offset of the following samples, so the decimator
+*                starts out as if the input had been constant before.
+********************************************************************************/
+struct cic_decimator
+{
+   static constexpr std::size_t MAX_ORDER = 4;     /* Largest supported number of stages. */
+   static constexpr auto RESOLUTION       = 256.0; /* Fixed point steps per sensor unit. */
+
+   std::size_t ratio   = 1;                /* Number of samples per output. */
+   std::size_t order   = 1;                /* Number of stages, 1 = boxcar average. */
+   std::size_t phase   = 0;                /* Number of samples since the last output. */
+   bool started        = false;            /* Indicates if the offset has been set. */
+   std::int64_t offset = 0;                /* First sample after reset in fixed point. */
+   double gain         = 1;                /* Gain of the stages, i.e. ratio ^ order. */
+   double value        = 0;                /* Last output in sensor units. */
+   std::uint64_t integrators[MAX_ORDER]{}; /* Integrator states, updated every sample. */
+   std::uint64_t delays[MAX_ORDER]{};      /* Comb delay states, updated every output. */
+
+   /********************************************************************************
+   * init: Sets specified decimation ratio and number of stages, limited to at
+   *       least 1 and at most MAX_ORDER stages, and clears the state.
+   *
+   *       - decimation: Number of samples per output.
+   *       - stages    : Number of integrator and comb stages (default = 1).
+   ********************************************************************************/
+   void init(const std::size_t decimation,
+             const std::size_t stages = 1)
+   {
+      ratio = decimation > 0 ? decimation : 1;
+      order = stages < 1 ? 1 : (stages > MAX_ORDER ? MAX_ORDER : stages);
+      gain = std::pow(static_cast<double>(ratio), static_cast<double>(order));
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the state, so the next sample sets a new offset.
+   ********************************************************************************/
+   void reset(void)
+   {
+      phase = 0;
+      started = false;
+
+      for (std::size_t i = 0; i < MAX_ORDER; ++i)
+      {
+         integrators[i] = 0;
+         delays[i] = 0;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds a new sample and returns true if an output is ready, which is
+   *      then held by value.
+   *
+   *      - sample: New sample in sensor units.
+   ********************************************************************************/
+   bool add(const double sample)
+   {
+      const auto fixed = static_cast<std::int64_t>(std::llround(sample * RESOLUTION));
+      if (!started) offset = fixed;
+      started = true;
+
+      auto input = static_cast<std::uint64_t>(fixed - offset);
+
+      for (std::size_t i = 0; i < order; ++i)
+      {
+         integrators[i] += input;
+         input = integrators[i];
+      }
+
+      if (++phase < ratio) return false;
+      phase = 0;
+
+      for (std::size_t i = 0; i < order; ++i)
+      {
+         const auto difference = input - delays[i];
+         delays[i] = input;
+         input = difference;
+      }
+
+      value = static_cast<double>(static_cast<std::int64_t>(input)) / gain / RESOLUTION +
+         static_cast<double>(offset) / RESOLUTION;
+      return true;
+   }
+
+   /********************************************************************************
+   * delay: Returns the group delay of the decimator in samples.
+   ********************************************************************************/
+   double delay(void) const
+   {
+      return order * (ratio - 1) / 2.0;
+   }
+};
+
+#endif /* DECIMATOR_HPP_ */
\ No newline at end of file
@@ -0,0 +1,199 @@
+/********************************************************************************
+* dual.hpp: Contains dual numbers for forward mode automatic differentiation.
+*           A dual number holds a value along with the derivatives of the value
+*           with respect to N variables. Every arithmetic operation updates
+*           the derivatives with the chain rule, so that running the servo
+*           loop with dual numbers instead of doubles yields the derivatives
+*           of the result with respect to the variables in the same run.
+*
+*           Comparisons only use the value, so clamping and other branches
+*           select the derivatives of the taken branch, i.e. a clamped value
+*           has zero derivatives.
+********************************************************************************/
+#ifndef DUAL_HPP_
+#define DUAL_HPP_
+
+/* Include directives: */
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+/********************************************************************************
+* dual: Struct for implementation of dual numbers with derivatives with respect
+*       to N variables. Conversion from double creates a constant, i.e. a
+*       number with zero derivatives.
+********************************************************************************/
+template<std::size_t N>
+struct dual
+{
+   double val = 0;             /* Value of the number. */
+   std::array<double, N> der{}; /* Derivatives with respect to each variable. */
+
+   /********************************************************************************
+   * dual: Initiates a constant with specified value.
+   *
+   *       - value: Value of the constant (default = 0).
+   ********************************************************************************/
+   dual(const double value = 0)
+      : val(value) { }
+
+   /********************************************************************************
+   * variable: Returns a variable with specified value and index, i.e. a number
+   *           with derivative 1 with respect to itself and 0 with respect to
+   *           the other variables.
+   *
+   *           - value: Value of the variable.
+   *           - index: Index of the variable.
+   ********************************************************************************/
+   static dual variable(const double value,
+                        const std::size_t index)
+   {
+      dual self(value);
+      self.der[index] = 1.0;
+      return self;
+   }
+
+   /********************************************************************************
+   * Compound assignment operators: Update the value and the derivatives with
+   *                                the sum, difference, product and quotient
+   *                                rules.
+   ********************************************************************************/
+   dual& operator+=(const dual& other)
+   {
+      val += other.val;
+      for (std::size_t i = 0; i < N; ++i) der[i] += other.der[i];
+      return *this;
+   }
+
+   dual& operator-=(const dual& other)
+   {
+      val -= other.val;
+      for (std::size_t i = 0; i < N; ++i) der[i] -= other.der[i];
+      return *this;
+   }
+
+   dual& operator*=(const dual& other)
+   {
+      for (std::size_t i = 0; i < N; ++i) der[i] = der[i] * other.val + val * other.der[i];
+      val *= other.val;
+      return *this;
+   }
+
+   dual& operator/=(const dual& other)
+   {
+      const auto inverse = 1.0 / other.val;
+      val *= inverse;
+      for (std::size_t i = 0; i < N; ++i) der[i] = (der[i] - val * other.der[i]) * inverse;
+      return *this;
+   }
+
+   dual& operator+=(const double term)
+   {
+      val += term;
+      return *this;
+   }
+
+   dual& operator-=(const double term)
+   {
+      val -= term;
+      return *this;
+   }
+
+   dual& operator*=(const double factor)
+   {
+      val *= factor;
+      for (std::size_t i = 0; i < N; ++i) der[i] *= factor;
+      return *this;
+   }
+
+   dual& operator/=(const double divisor)
+   {
+      return *this *= 1.0 / divisor;
+   }
+
+   /********************************************************************************
+   * Arithmetic operators: Return the result of the operation along with its
+   *                       derivatives. Operations with doubles are
+   *                       overloaded, since they are common in the loop and
+   *                       skip the derivatives of the constant.
+   ********************************************************************************/
+   friend dual operator-(dual number)
+   {
+      return number *= -1.0;
+   }
+
+   friend dual operator+(dual a, const dual& b) { return a += b; }
+   friend dual operator-(dual a, const dual& b) { return a -= b; }
+   friend dual operator*(dual a, const dual& b) { return a *= b; }
+   friend dual operator/(dual a, const dual& b) { return a /= b; }
+   friend dual operator+(dual a, const double b) { return a += b; }
+   friend dual operator+(const double a, dual b) { return b += a; }
+   friend dual operator-(dual a, const double b) { return a -= b; }
+   friend dual operator-(const double a, dual b) { return (b *= -1.0) += a; }
+   friend dual operator*(dual a, const double b) { return a *= b; }
+   friend dual operator*(const double a, dual b) { return b *= a; }
+   friend dual operator/(dual a, const double b) { return a /= b; }
+
+   /********************************************************************************
+   * Comparison operators: Compare the values of the numbers only.
+   ********************************************************************************/
+   friend bool operator<(const dual& a, const dual& b) { return a.val < b.val; }
+   friend bool operator>(const dual& a, const dual& b) { return a.val > b.val; }
+   friend bool operator<=(const dual& a, const dual& b) { return a.val <= b.val; }
+   friend bool operator>=(const dual& a, const dual& b) { return a.val >= b.val; }
+   friend bool operator==(const dual& a, const dual& b) { return a.val == b.val; }
+   friend bool operator!=(const dual& a, const dual& b) { return a.val != b.val; }
+   friend bool operator<(const dual& a, const double b) { return a.val < b; }
+   friend bool operator>(const dual& a, const double b) { return a.val > b; }
+   friend bool operator<(const double a, const dual& b) { return a < b.val; }
+   friend bool operator>(const double a, const dual& b) { return a > b.val; }
+
+   /********************************************************************************
+   * fabs: Returns the absolute value of specified number. The derivatives at
+   *       zero are set to zero.
+   *
+   *       - number: Number to take the absolute value of.
+   ********************************************************************************/
+   friend dual fabs(const dual& number)
+   {
+      return number.val < 0 ? -number : (number.val > 0 ? number : dual(0));
+   }
+
+   /********************************************************************************
+   * sqrt: Returns the square root of specified number.
+   *
+   *       - number: Number to take the square root of.
+   ********************************************************************************/
+   friend dual sqrt(const dual& number)
+   {
+      dual self(std::sqrt(number.val));
+      const auto factor = self.val > 0 ? 0.5 / self.val : 0.0;
+      for (std::size_t i = 0; i < N; ++i) self.der[i] = number.der[i] * factor;
+      return self;
+   }
+
+   /********************************************************************************
+   * numeric_value: Returns the value of specified number without derivatives.
+   *
+   *                - number: Number to convert.
+   ********************************************************************************/
+   friend double numeric_value(const dual& number)
+   {
+      return number.val;
+   }
+
+   /********************************************************************************
+   * operator<<: Prints the value of specified number, so that dual numbers
+   *             can be printed like doubles.
+   *
+   *             - ostream: Reference to output stream used.
+   *             - number : Number to print.
+   ********************************************************************************/
+   friend std::ostream& operator<<(std::ostream& ostream, const dual& number)
+   {
+      return ostream << number.val;
+   }
+};
+
+#endif /* DUAL_HPP_ */
\ No newline at end of file
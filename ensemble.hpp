@@ -0,0 +1,374 @@
+/********************************************************************************
+* ensemble.hpp: Contains robust evaluation of PID parameters across an ensemble
+*               of plant variations. Real servos differ in inertia, friction
+*               and sensor noise, so a candidate is run against every variant
+*               of the ensemble and scored by its mean, percentile and worst
+*               case cost rather than by the cost on the nominal plant only.
+*
+*               The variants are stored as a struct of arrays, one array per
+*               plant parameter, and a candidate is evaluated against the
+*               whole ensemble in blocks of variants run side by side by the
+*               lane kernel, see lane_kernel.hpp, with the plant constants of
+*               each variant in its own lane. The results equal running the
+*               scalar simulation against each variant.
+********************************************************************************/
+#ifndef ENSEMBLE_HPP_
+#define ENSEMBLE_HPP_
+
+/* Include directives: */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "lane_kernel.hpp"
+#include "simulation.hpp"
+
+/********************************************************************************
+* plant_ensemble: Struct holding plant model variants as a struct of arrays,
+*                 where index i of every array belongs to variant i.
+********************************************************************************/
+struct plant_ensemble
+{
+   std::vector<double> inertia;      /* Moment of inertia of each variant. */
+   std::vector<double> stiffness;    /* Gain of the internal position loop of each variant. */
+   std::vector<double> damping;      /* Viscous damping of each variant. */
+   std::vector<double> friction;     /* Coulomb friction of each variant. */
+   std::vector<double> rate_limit;   /* Maximum angular velocity of each variant. */
+   std::vector<double> sensor_noise; /* Standard deviation of the sensor noise of each variant. */
+   std::vector<std::uint64_t> seed;  /* Noise generator seed of each variant. */
+
+   /********************************************************************************
+   * size: Returns the number of variants in the ensemble.
+   ********************************************************************************/
+   std::size_t size(void) const
+   {
+      return inertia.size();
+   }
+
+   /********************************************************************************
+   * add: Adds referenced plant model as a new variant.
+   *
+   *      - model: Reference to plant model to add.
+   ********************************************************************************/
+   void add(const plant_model& model)
+   {
+      inertia.push_back(model.inertia);
+      stiffness.push_back(model.stiffness);
+      damping.push_back(model.damping);
+      friction.push_back(model.friction);
+      rate_limit.push_back(model.rate_limit);
+      sensor_noise.push_back(model.sensor_noise);
+      seed.push_back(model.seed);
+      return;
+   }
+
+   /********************************************************************************
+   * variant: Returns variant at specified index as a plant model.
+   *
+   *          - index: Index of the variant.
+   ********************************************************************************/
+   plant_model variant(const std::size_t index) const
+   {
+      plant_model model;
+      model.inertia = inertia[index];
+      model.stiffness = stiffness[index];
+      model.damping = damping[index];
+      model.friction = friction[index];
+      model.rate_limit = rate_limit[index];
+      model.sensor_noise = sensor_noise[index];
+      model.seed = seed[index];
+      return model;
+   }
+
+   /********************************************************************************
+   * perturbed: Returns an ensemble of specified size around referenced nominal
+   *            model. The first variant is the nominal model, while the
+   *            inertia of the others is spread uniformly by the relative
+   *            spread and friction and sensor noise are added uniformly up to
+   *            the specified maximum values. Every variant has its own seed.
+   *
+   *            - nominal     : Reference to nominal plant model.
+   *            - count       : Number of variants.
+   *            - spread      : Relative spread of the inertia (default = 0.5).
+   *            - max_friction: Largest added friction (default = 0.5).
+   *            - max_noise   : Largest added sensor noise (default = 2.0).
+   ********************************************************************************/
+   static plant_ensemble perturbed(const plant_model& nominal,
+                                   const std::size_t count,
+                                   const double spread = 0.5,
+                                   const double max_friction = 0.5,
+                                   const double max_noise = 2.0)
+   {
+      std::uint64_t state = 0x2545f4914f6cdd1dull;
+      plant_ensemble self;
+
+      auto random = [&](void)
+      {
+         state ^= state << 13;
+         state ^= state >> 7;
+         state ^= state << 17;
+         return static_cast<double>(state >> 11) * (1.0 / 9007199254740992.0);
+      };
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+         auto model = nominal;
+         model.seed = nominal.seed + i;
+
+         if (i > 0)
+         {
+            model.inertia *= 1.0 + spread * (2.0 * random() - 1.0);
+            model.friction += max_friction * random();
+            model.sensor_noise += max_noise * random();
+         }
+
+         self.add(model);
+      }
+      return self;
+   }
+};
+
+/********************************************************************************
+* ensemble_score: Struct holding the costs of a candidate across an ensemble.
+********************************************************************************/
+struct ensemble_score
+{
+   double mean               = 0; /* Mean cost across the variants. */
+   double percentile         = 0; /* Cost at the selected percentile of the variants. */
+   double worst              = 0; /* Highest cost of any variant. */
+   std::size_t worst_variant = 0; /* Index of the variant with the highest cost. */
+};
+
+/********************************************************************************
+* ensemble_evaluator: Struct for evaluating PID parameters against every
+*                     variant of an ensemble in one vectorized pass per
+*                     scenario, one variant per lane of the lane kernel.
+********************************************************************************/
+struct ensemble_evaluator
+{
+   /********************************************************************************
+   * objective: Enumeration of the scores a tuner can minimize.
+   ********************************************************************************/
+   enum class objective { mean, percentile, worst };
+
+   static constexpr std::size_t LANES = 8; /* Number of variants run side by side. */
+
+   servo config;                           /* Servo configuration shared by all variants. */
+   plant_ensemble ensemble;                /* Plant variants to evaluate against. */
+   std::vector<scenario> suite;            /* Scenarios each candidate is evaluated with. */
+   cost_function cost;                     /* Cost function for weighting the metrics. */
+   double percentile = 0.9;                /* Share of variants at or below the percentile cost. */
+   objective goal = objective::percentile; /* Score returned by cost_of. */
+
+   /********************************************************************************
+   * ensemble_evaluator: Initiates evaluator with specified servo configuration,
+   *                     ensemble and scenario suite.
+   *
+   *                     - config  : Reference to servo configuration.
+   *                     - ensemble: Reference to plant variants.
+   *                     - suite   : Reference to scenario suite (default = default suite).
+   ********************************************************************************/
+   ensemble_evaluator(const servo& config,
+                      const plant_ensemble& ensemble,
+                      const std::vector<scenario>& suite = scenario::default_suite())
+      : config(config), ensemble(ensemble), suite(suite) { }
+
+   /********************************************************************************
+   * evaluate: Runs every scenario of the suite with specified PID parameters
+   *           against every variant and stores the combined metrics of each
+   *           variant in referenced vector.
+   *
+   *           - gains  : Reference to PID parameters.
+   *           - results: Reference to vector for storage of the metrics.
+   ********************************************************************************/
+   void evaluate(const pid_gains& gains,
+                 std::vector<metrics>& results) const
+   {
+      results.assign(ensemble.size(), metrics());
+
+      for (const auto& i : suite)
+      {
+         run(gains, i, results);
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * score: Returns the mean, percentile and worst case cost of specified PID
+   *        parameters across the ensemble. The metrics of each variant are
+   *        stored in referenced vector if specified.
+   *
+   *        - gains  : Reference to PID parameters.
+   *        - results: Pointer to vector for storage of the metrics (default = nullptr).
+   ********************************************************************************/
+   ensemble_score score(const pid_gains& gains,
+                        std::vector<metrics>* results = nullptr) const
+   {
+      std::vector<metrics> variants;
+      evaluate(gains, variants);
+      std::vector<double> costs(variants.size());
+      ensemble_score self;
+
+      for (std::size_t i = 0; i < variants.size(); ++i)
+      {
+         costs[i] = cost(variants[i]);
+         self.mean += costs[i] / variants.size();
+
+         if (costs[i] > self.worst)
+         {
+            self.worst = costs[i];
+            self.worst_variant = i;
+         }
+      }
+
+      if (!costs.empty())
+      {
+         const auto rank = static_cast<std::size_t>(std::ceil(percentile * costs.size()));
+         const auto nth = costs.begin() + (rank > 0 ? rank - 1 : 0);
+         std::nth_element(costs.begin(), nth, costs.end());
+         self.percentile = *nth;
+      }
+
+      if (results) *results = variants;
+      return self;
+   }
+
+   /********************************************************************************
+   * cost_of: Returns the score of specified PID parameters selected as goal.
+   *
+   *          - gains : Reference to PID parameters.
+   *          - result: Pointer to storage for the metrics of the worst variant
+   *                    (default = nullptr).
+   ********************************************************************************/
+   double cost_of(const pid_gains& gains,
+                  metrics* result = nullptr) const
+   {
+      std::vector<metrics> variants;
+      const auto self = score(gains, &variants);
+      if (result && !variants.empty()) *result = variants[self.worst_variant];
+      if (goal == objective::mean) return self.mean;
+      return goal == objective::worst ? self.worst : self.percentile;
+   }
+
+   /********************************************************************************
+   * run: Runs referenced scenario with specified PID parameters against every
+   *      variant and adds the metrics of each variant to referenced results.
+   *      The variants are run in blocks of LANES variants with the lane
+   *      kernel. A servo configuration the kernel does not cover is run with
+   *      the scalar simulation against each variant instead.
+   *
+   *      - gains  : Reference to PID parameters.
+   *      - test   : Reference to scenario to run.
+   *      - results: Reference to metrics of each variant, added to.
+   ********************************************************************************/
+   void run(const pid_gains& gains,
+            const scenario& test,
+            std::vector<metrics>& results) const
+   {
+      if (!lane_kernel<LANES>::supports(config))
+      {
+         auto candidate = config;
+         candidate.pid.set_gains(gains);
+
+         for (std::size_t i = 0; i < ensemble.size(); ++i)
+         {
+            results[i].combine(simulate(candidate, ensemble.variant(i), test));
+         }
+         return;
+      }
+
+      for (std::size_t first = 0; first < ensemble.size(); first += LANES)
+      {
+         run_block(gains, test, first, &results[first]);
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * run_block: Runs referenced scenario against the variants starting at
+   *            specified index, at most LANES variants, and adds the metrics
+   *            of each variant to referenced results. Unused lanes repeat
+   *            the last variant and are not stored. The sensor values of
+   *            every lane are generated like basic_simulation::sensor_values,
+   *            including the noise generator of each variant, so the results
+   *            are the same as for the scalar simulation.
+   *
+   *            - gains  : Reference to PID parameters.
+   *            - test   : Reference to scenario to run.
+   *            - first  : Index of the first variant of the block.
+   *            - results: Pointer to metrics of the variants, added to.
+   ********************************************************************************/
+   void run_block(const pid_gains& gains,
+                  const scenario& test,
+                  const std::size_t first,
+                  metrics* results) const
+   {
+      constexpr auto N = LANES;
+      lane_kernel<N> lanes;
+      alignas(64) double deviation[N], left[N], right[N];
+      std::uint64_t seed[N];
+
+      const auto count = std::min(N, ensemble.size() - first);
+      const auto target = config.target();
+      const auto range = config.input_range();
+      const auto middle = config.left_sensor.min + range / 2.0;
+      lanes.start(config);
+
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         const auto i = first + (l < count ? l : count - 1);
+         lanes.set_gains(l, gains);
+         lanes.set_plant(l, ensemble.variant(i));
+         deviation[l] = ensemble.sensor_noise[i];
+         seed[l] = ensemble.seed[i] ? ensemble.seed[i] : 1;
+      }
+
+      for (const auto disturbance : test.disturbance)
+      {
+         lanes.measure(disturbance);
+
+         for (std::size_t l = 0; l < N; ++l)
+         {
+            const auto difference = range * ((lanes.angle[l] + disturbance) / target - 1.0);
+            left[l] = middle + difference / 2.0 + (deviation[l] != 0 ? noise(seed[l], deviation[l]) : 0.0);
+            right[l] = middle - difference / 2.0 + (deviation[l] != 0 ? noise(seed[l], deviation[l]) : 0.0);
+         }
+
+         lanes.regulate(left, right);
+         lanes.actuate();
+      }
+
+      for (std::size_t l = 0; l < count; ++l)
+      {
+         results[l].combine(lanes.result(l));
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * noise: Returns a new sensor noise sample with specified standard deviation
+   *        from referenced generator state, the same way as plant_model::noise.
+   *
+   *        - seed     : Reference to the generator state of the variant.
+   *        - deviation: Standard deviation of the noise.
+   ********************************************************************************/
+   static double noise(std::uint64_t& seed,
+                       const double deviation)
+   {
+      auto sum = 0.0;
+
+      for (auto i = 0; i < 4; ++i)
+      {
+         seed ^= seed << 13;
+         seed ^= seed >> 7;
+         seed ^= seed << 17;
+         sum += static_cast<double>(seed >> 11) * (1.0 / 9007199254740992.0);
+      }
+      return (sum - 2.0) * std::sqrt(3.0) * deviation;
+   }
+};
+
+#endif /* ENSEMBLE_HPP_ */
\ No newline at end of file
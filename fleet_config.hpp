@@ -0,0 +1,833 @@
+/********************************************************************************
+* fleet_config.hpp: Contains the configuration file of a fleet of servos and
+*                   its hot reloading. The file defines servo models, i.e. the
+*                   angle range, sensor range and PID parameters, named
+*                   calibration files, and the model, target angle and
+*                   calibration of every servo. Lines starting with # are
+*                   comments, and a servo line may cover a range of servos,
+*                   where a later line overrides an earlier one:
+*
+*                   # Models: name, angle range, sensor range, kp, ki and kd.
+*                   model standard 30 150 0 1023 1 0.01 0.1
+*                   model fast 30 150 0 1023 2 0.02 0.15
+*                   # Calibrations: name and path, relative to this file.
+*                   calibration wide calibration.txt
+*                   # Servos: index or range, model, target and calibration.
+*                   servo 0-99999 standard 90
+*                   servo 17 fast 45 wide
+*
+*                   The file is read in one go and split into words in place,
+*                   with the numbers converted directly from the buffer, so
+*                   10^5 servo lines parse in a few tens of milliseconds. A
+*                   model or calibration must be defined before it is used,
+*                   and every servo from 0 to the highest index must be
+*                   defined.
+*
+*                   While the fleet runs, the file is watched with inotify on
+*                   Linux and by polling its modification time elsewhere. An
+*                   edited file is parsed anew and resolved into the settings
+*                   of every servo, which are compared with the settings in
+*                   use, so only the servos affected by the edit are updated,
+*                   for instance the servos of a model whose gains changed.
+*                   An invalid file is rejected and the running settings are
+*                   kept. The changes are handed to the control thread
+*                   through an atomic sequence number, and the control thread
+*                   applies them at its next tick boundary without locks.
+*                   The calibration files are reloaded by their calibration
+*                   stores, see calibration.hpp, which publish new tables to
+*                   the sensors directly and free the replaced tables once
+*                   the control thread has passed its next tick boundary.
+********************************************************************************/
+#ifndef FLEET_CONFIG_HPP_
+#define FLEET_CONFIG_HPP_
+
+/* Include directives: */
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "calibration.hpp"
+#include "servo.hpp"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/********************************************************************************
+* servo_model: Struct holding a servo model of the configuration file.
+********************************************************************************/
+struct servo_model
+{
+   std::string name;        /* Name of the model. */
+   double angle_min = 0;    /* Minimum servo angle. */
+   double angle_max = 180;  /* Maximum servo angle. */
+   double input_min = 0;    /* Minimum sensor value. */
+   double input_max = 1023; /* Maximum sensor value. */
+   pid_gains gains;         /* PID parameters. */
+};
+
+/********************************************************************************
+* servo_settings: Struct holding the resolved settings of a single servo, i.e.
+*                 the values of its model, its target and its calibration.
+********************************************************************************/
+struct servo_settings
+{
+   double angle_min                     = 0;       /* Minimum servo angle. */
+   double angle_max                     = 180;     /* Maximum servo angle. */
+   double input_min                     = 0;       /* Minimum sensor value. */
+   double input_max                     = 1023;    /* Maximum sensor value. */
+   pid_gains gains;                                /* PID parameters. */
+   double target                        = 90;      /* Target angle. */
+   const calibration_store* calibration = nullptr; /* Calibration of both sensors, none if nullptr. */
+
+   /********************************************************************************
+   * same: Indicates if referenced settings equal these settings.
+   *
+   *       - other: Reference to the settings to compare with.
+   ********************************************************************************/
+   bool same(const servo_settings& other) const
+   {
+      return angle_min == other.angle_min && angle_max == other.angle_max && input_min == other.input_min &&
+         input_max == other.input_max && gains.kp == other.gains.kp && gains.ki == other.gains.ki &&
+         gains.kd == other.gains.kd && target == other.target && calibration == other.calibration;
+   }
+
+   /********************************************************************************
+   * apply: Applies the settings to referenced servo, where the integral and
+   *        derivate values of the PID controller are kept.
+   *
+   *        - device: Reference to the servo.
+   ********************************************************************************/
+   template<class T>
+   void apply(basic_servo<T>& device) const
+   {
+      device.pid.output_min = angle_min;
+      device.pid.output_max = angle_max;
+      device.pid.set_gains(gains);
+      device.pid.target = target;
+      device.left_sensor.init(input_min, input_max);
+      device.right_sensor.init(input_min, input_max);
+
+      if (calibration)
+      {
+         device.set_calibration(*calibration);
+      }
+      else
+      {
+         device.left_sensor.calibration = nullptr;
+         device.right_sensor.calibration = nullptr;
+      }
+      return;
+   }
+};
+
+/********************************************************************************
+* fleet_config: Struct holding a parsed fleet configuration file, where the
+*               servos refer to their model and calibration by index.
+********************************************************************************/
+struct fleet_config
+{
+   static constexpr std::uint32_t NONE       = 0xffffffff; /* Index of no model or calibration. */
+   static constexpr std::uint32_t MAX_SERVOS = 1 << 24;    /* Largest number of servos. */
+   static constexpr std::size_t MAX_WORDS    = 9;          /* Largest number of words per line. */
+
+   /********************************************************************************
+   * calibration_file: Struct holding a named calibration file.
+   ********************************************************************************/
+   struct calibration_file
+   {
+      std::string name; /* Name of the calibration. */
+      std::string path; /* Path to the calibration file. */
+   };
+
+   /********************************************************************************
+   * servo_entry: Struct holding the definition of a single servo.
+   ********************************************************************************/
+   struct servo_entry
+   {
+      std::uint32_t model       = NONE; /* Index of the model, NONE if undefined. */
+      std::uint32_t calibration = NONE; /* Index of the calibration, NONE if none. */
+      double target             = 90;   /* Target angle. */
+   };
+
+   std::vector<servo_model> models;            /* Models in order of definition. */
+   std::vector<calibration_file> calibrations; /* Calibrations in order of definition. */
+   std::vector<servo_entry> servos;            /* Definition of every servo. */
+   std::string error;                          /* Description of the last parse error. */
+
+   /********************************************************************************
+   * load: Reads and parses the configuration file at specified path. Returns
+   *       false if the file can't be read or is invalid, where the reason is
+   *       stored in error.
+   *
+   *       - filepath: Path to the configuration file.
+   ********************************************************************************/
+   bool load(const std::string& filepath)
+   {
+      std::ifstream file(filepath, std::ios::binary);
+      std::string text;
+
+      if (!file)
+      {
+         clear();
+         error = "Could not open " + filepath;
+         return false;
+      }
+
+      file.seekg(0, std::ios::end);
+      const auto size = static_cast<std::streamoff>(file.tellg());
+      file.seekg(0, std::ios::beg);
+      text.resize(size > 0 ? static_cast<std::size_t>(size) : 0);
+      if (!text.empty()) file.read(&text[0], size);
+
+      if (!parse(text, directory(filepath)))
+      {
+         error += " in " + filepath;
+         return false;
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * parse: Parses specified configuration text. Returns false if the text is
+   *        invalid, where the reason is stored in error.
+   *
+   *        - text  : Text of the configuration file.
+   *        - folder: Folder relative calibration paths are resolved against.
+   ********************************************************************************/
+   bool parse(const std::string& text,
+              const std::string& folder)
+   {
+      const char* words[MAX_WORDS + 1];
+      std::size_t lengths[MAX_WORDS + 1];
+      const auto* position = text.c_str();
+      const auto* const end = position + text.size();
+      std::size_t line_number = 0;
+      clear();
+
+      while (position < end)
+      {
+         const auto remaining = static_cast<std::size_t>(end - position);
+         auto line_end = static_cast<const char*>(std::memchr(position, '\n', remaining));
+         if (!line_end) line_end = end;
+         line_number++;
+         const auto count = split(position, line_end, words, lengths);
+         position = line_end + 1;
+         if (count == 0) continue;
+
+         if (!parse_line(words, lengths, count, folder))
+         {
+            error += " on line " + std::to_string(line_number);
+            return false;
+         }
+      }
+
+      for (std::size_t i = 0; i < servos.size(); ++i)
+      {
+         if (servos[i].model != NONE) continue;
+         error = "Servo " + std::to_string(i) + " is undefined";
+         return false;
+      }
+
+      if (servos.empty())
+      {
+         error = "No servos defined";
+         return false;
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * clear: Removes every model, calibration and servo.
+   ********************************************************************************/
+   void clear(void)
+   {
+      models.clear();
+      calibrations.clear();
+      servos.clear();
+      error.clear();
+      return;
+   }
+
+   /********************************************************************************
+   * parse_line: Parses the words of a single line. Returns false if the line is
+   *             invalid, where the reason is stored in error.
+   *
+   *             - words  : Pointers to the first character of each word.
+   *             - lengths: Length of each word.
+   *             - count  : Number of words, at least 1.
+   *             - folder : Folder relative calibration paths are resolved against.
+   ********************************************************************************/
+   bool parse_line(const char* const* words,
+                   const std::size_t* lengths,
+                   const std::size_t count,
+                   const std::string& folder)
+   {
+      const std::string keyword(words[0], lengths[0]);
+
+      if (keyword == "model")
+      {
+         servo_model model;
+         double values[7];
+         auto valid = count == 9;
+
+         for (std::size_t i = 0; valid && i < 7; ++i)
+         {
+            valid = number(words[i + 2], lengths[i + 2], values[i]);
+         }
+
+         if (!valid) return fail("Invalid model");
+         model.name.assign(words[1], lengths[1]);
+         if (find(models, words[1], lengths[1]) != NONE) return fail("Duplicate model " + model.name);
+         if (values[1] <= values[0] || values[3] <= values[2]) return fail("Invalid range of model " + model.name);
+         model.angle_min = values[0];
+         model.angle_max = values[1];
+         model.input_min = values[2];
+         model.input_max = values[3];
+         model.gains = pid_gains{ values[4], values[5], values[6] };
+         models.push_back(model);
+      }
+      else if (keyword == "calibration")
+      {
+         if (count != 3) return fail("Invalid calibration");
+         if (find(calibrations, words[1], lengths[1]) != NONE) return fail("Duplicate calibration");
+         const std::string path(words[2], lengths[2]);
+         calibrations.push_back(calibration_file{ std::string(words[1], lengths[1]), resolve(folder, path) });
+      }
+      else if (keyword == "servo")
+      {
+         std::uint32_t first = 0, last = 0;
+         servo_entry entry;
+         if (count < 4 || count > 5 || !range(words[1], lengths[1], first, last)) return fail("Invalid servo");
+         entry.model = find(models, words[2], lengths[2]);
+         if (entry.model == NONE) return fail("Unknown model " + std::string(words[2], lengths[2]));
+         if (!number(words[3], lengths[3], entry.target)) return fail("Invalid target");
+
+         if (count == 5)
+         {
+            entry.calibration = find(calibrations, words[4], lengths[4]);
+            if (entry.calibration == NONE) return fail("Unknown calibration " + std::string(words[4], lengths[4]));
+         }
+
+         if (servos.size() <= last) servos.resize(static_cast<std::size_t>(last) + 1);
+
+         for (auto i = static_cast<std::size_t>(first); i <= last; ++i)
+         {
+            servos[i] = entry;
+         }
+      }
+      else
+      {
+         return fail("Unknown keyword " + keyword);
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * fail: Stores specified reason in error and returns false.
+   *
+   *       - reason: Reason of the parse error.
+   ********************************************************************************/
+   bool fail(const std::string& reason)
+   {
+      error = reason;
+      return false;
+   }
+
+   /********************************************************************************
+   * split: Splits specified line into words separated by spaces or tabs, up to
+   *        a comment. Returns the number of words, where more than MAX_WORDS
+   *        words return MAX_WORDS + 1, which no line kind accepts.
+   *
+   *        - begin  : Pointer to the first character of the line.
+   *        - end    : Pointer past the last character of the line.
+   *        - words  : Array of MAX_WORDS + 1 pointers to the words.
+   *        - lengths: Array of MAX_WORDS + 1 lengths of the words.
+   ********************************************************************************/
+   static std::size_t split(const char* begin,
+                            const char* end,
+                            const char** words,
+                            std::size_t* lengths)
+   {
+      std::size_t count = 0;
+
+      while (begin < end)
+      {
+         while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r')) begin++;
+         if (begin == end || *begin == '#') break;
+         const auto* word = begin;
+         while (begin < end && *begin != ' ' && *begin != '\t' && *begin != '\r') begin++;
+         if (count > MAX_WORDS) break;
+         words[count] = word;
+         lengths[count++] = static_cast<std::size_t>(begin - word);
+      }
+      return count;
+   }
+
+   /********************************************************************************
+   * number: Converts specified word to a finite number. Returns false if the
+   *         word is not a number.
+   *
+   *         - word  : Pointer to the first character of the word.
+   *         - length: Length of the word.
+   *         - value : Reference to storage for the number.
+   ********************************************************************************/
+   static bool number(const char* word,
+                      const std::size_t length,
+                      double& value)
+   {
+      char* end = nullptr;
+      value = std::strtod(word, &end);
+      return end == word + length && std::isfinite(value);
+   }
+
+   /********************************************************************************
+   * range: Converts specified word, a servo index or a range of indexes such as
+   *        0-99, to the first and last index. Returns false if the word is not
+   *        an index or range below MAX_SERVOS.
+   *
+   *        - word  : Pointer to the first character of the word.
+   *        - length: Length of the word.
+   *        - first : Reference to storage for the first index.
+   *        - last  : Reference to storage for the last index.
+   ********************************************************************************/
+   static bool range(const char* word,
+                     const std::size_t length,
+                     std::uint32_t& first,
+                     std::uint32_t& last)
+   {
+      char* end = nullptr;
+      if (!std::isdigit(static_cast<unsigned char>(word[0]))) return false;
+      const auto begin_index = std::strtoull(word, &end, 10);
+      auto end_index = begin_index;
+
+      if (end < word + length && *end == '-')
+      {
+         const auto* second = end + 1;
+         if (!std::isdigit(static_cast<unsigned char>(*second))) return false;
+         end_index = std::strtoull(second, &end, 10);
+      }
+
+      if (end != word + length || end_index < begin_index || end_index >= MAX_SERVOS) return false;
+      first = static_cast<std::uint32_t>(begin_index);
+      last = static_cast<std::uint32_t>(end_index);
+      return true;
+   }
+
+   /********************************************************************************
+   * find: Returns the index of the entry of referenced list with specified name,
+   *       or NONE if there is none. The lists are short, so they are searched
+   *       linearly without building a string of the name.
+   *
+   *       - list  : Reference to the models or calibrations.
+   *       - name  : Pointer to the first character of the name.
+   *       - length: Length of the name.
+   ********************************************************************************/
+   template<class Entry>
+   static std::uint32_t find(const std::vector<Entry>& list,
+                             const char* name,
+                             const std::size_t length)
+   {
+      for (std::size_t i = 0; i < list.size(); ++i)
+      {
+         const auto& entry = list[i].name;
+         if (entry.size() != length || std::memcmp(entry.data(), name, length) != 0) continue;
+         return static_cast<std::uint32_t>(i);
+      }
+      return NONE;
+   }
+
+   /********************************************************************************
+   * directory: Returns the folder of specified path including its separator,
+   *            or an empty string for a file in the working directory.
+   *
+   *            - filepath: Path to a file.
+   ********************************************************************************/
+   static std::string directory(const std::string& filepath)
+   {
+      const auto separator = filepath.find_last_of("/\\");
+      return separator == std::string::npos ? std::string() : filepath.substr(0, separator + 1);
+   }
+
+   /********************************************************************************
+   * resolve: Returns specified path resolved against specified folder, unless
+   *          the path is absolute.
+   *
+   *          - folder: Folder of the configuration file, see directory.
+   *          - path  : Path as written in the configuration file.
+   ********************************************************************************/
+   static std::string resolve(const std::string& folder,
+                              const std::string& path)
+   {
+      const auto absolute = path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':');
+      return absolute ? path : folder + path;
+   }
+};
+
+/********************************************************************************
+* file_watcher: Struct for implementation of a watcher of a single file. On
+*               Linux the folder of the file is watched with inotify for the
+*               file being written and closed or moved into place, which is
+*               how most editors save. Elsewhere, or if inotify is
+*               unavailable, the modification time is polled instead.
+********************************************************************************/
+struct file_watcher
+{
+   std::string filepath;      /* Path to the watched file. */
+   std::string name;          /* Name of the file within its folder. */
+   std::int64_t stamp = -1;   /* Modification time seen last while polling. */
+   bool polling       = true; /* Indicates if the modification time is polled. */
+   int descriptor     = -1;   /* Descriptor of the inotify instance, -1 if none. */
+
+   file_watcher(void) = default;
+   file_watcher(const file_watcher&) = delete;
+   file_watcher& operator=(const file_watcher&) = delete;
+
+   /********************************************************************************
+   * ~file_watcher: Closes the inotify instance, if any.
+   ********************************************************************************/
+   ~file_watcher(void)
+   {
+      close();
+      return;
+   }
+
+   /********************************************************************************
+   * watch: Starts watching the file at specified path. Returns true if the file
+   *        is watched with inotify and false if its modification time is
+   *        polled.
+   *
+   *        - path         : Path to the file.
+   *        - force_polling: Polls the modification time if true (default = false).
+   ********************************************************************************/
+   bool watch(const std::string& path,
+              const bool force_polling = false)
+   {
+      close();
+      filepath = path;
+      const auto folder = fleet_config::directory(path);
+      name = path.substr(folder.size());
+      stamp = calibration_store::modification_time(path);
+      polling = true;
+#ifdef __linux__
+      if (force_polling) return false;
+      descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (descriptor < 0) return false;
+
+      if (inotify_add_watch(descriptor, folder.empty() ? "." : folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+      {
+         close();
+         return false;
+      }
+      polling = false;
+#else
+      (void)force_polling;
+#endif
+      return !polling;
+   }
+
+   /********************************************************************************
+   * wait: Waits up to specified time for the file to change. Returns true if
+   *       the file changed since the last call.
+   *
+   *       - timeout_ms: Longest time to wait in milliseconds.
+   ********************************************************************************/
+   bool wait(const int timeout_ms)
+   {
+#ifdef __linux__
+      if (!polling)
+      {
+         pollfd entry{ descriptor, POLLIN, 0 };
+         if (::poll(&entry, 1, timeout_ms) <= 0) return false;
+         alignas(inotify_event) char buffer[4096];
+         auto changed = false;
+         ssize_t size = 0;
+
+         while ((size = ::read(descriptor, buffer, sizeof(buffer))) > 0)
+         {
+            for (auto i = buffer; i < buffer + size; )
+            {
+               const auto event = reinterpret_cast<const inotify_event*>(i);
+               if (event->len && name == event->name) changed = true;
+               i += sizeof(inotify_event) + event->len;
+            }
+         }
+         return changed;
+      }
+#endif
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+      const auto current = calibration_store::modification_time(filepath);
+      if (current == stamp) return false;
+      stamp = current;
+      return true;
+   }
+
+   /********************************************************************************
+   * close: Stops watching the file.
+   ********************************************************************************/
+   void close(void)
+   {
+#ifdef __linux__
+      if (descriptor >= 0) ::close(descriptor);
+#endif
+      descriptor = -1;
+      polling = true;
+      return;
+   }
+};
+
+/********************************************************************************
+* fleet_store: Struct for loading the configuration file of a fleet and handing
+*              the changes of every reload to the control thread. The file is
+*              watched and reloaded by one thread, see poll, while a single
+*              control thread applies the changes, see apply. A reload is
+*              deferred until the control thread has applied the previous
+*              one, so the changes of a reload always relate to the settings
+*              the fleet runs with, and the changes of an applied reload are
+*              freed by the next one. The number of servos is fixed by the
+*              first load, since the control loop doesn't allocate.
+********************************************************************************/
+struct fleet_store
+{
+   /********************************************************************************
+   * servo_change: Struct holding the new settings of a single servo.
+   ********************************************************************************/
+   struct servo_change
+   {
+      std::uint32_t index;     /* Index of the servo. */
+      servo_settings settings; /* New settings of the servo. */
+   };
+
+   /********************************************************************************
+   * update: Struct holding the changes of a reload.
+   ********************************************************************************/
+   struct update
+   {
+      std::uint64_t generation = 0;      /* Number of the reload. */
+      std::vector<servo_change> changes; /* Servos affected by the reload. */
+   };
+
+   std::string filepath;                                         /* Path to the configuration file. */
+   std::string error;                                            /* Description of the last load error. */
+   std::vector<servo_settings> settings;                         /* Settings of every servo as last loaded. */
+   std::vector<std::unique_ptr<calibration_store>> calibrations; /* Calibration stores, kept for the sensors. */
+   std::unique_ptr<update> current;                              /* Changes of the last reload. */
+   std::atomic<const update*> pending{ nullptr };                /* Changes handed to the control thread. */
+   std::atomic<std::uint64_t> published{ 0 };                    /* Generation of the changes handed over. */
+   std::atomic<std::uint64_t> acknowledged{ 0 };                 /* Generation applied by the control thread. */
+   std::atomic<std::uint64_t> ticks{ 0 };                        /* Tick boundaries passed by the control thread. */
+   std::uint64_t generation = 0;                                 /* Number of reloads with changes. */
+   std::size_t reloads      = 0;                                 /* Number of reloads attempted. */
+   std::size_t rejected     = 0;                                 /* Number of reloads rejected. */
+   bool deferred            = false;                             /* Indicates if a reload waits to be applied. */
+   file_watcher watcher;                                         /* Watcher of the configuration file. */
+
+   fleet_store(void) = default;
+   fleet_store(const fleet_store&) = delete;
+   fleet_store& operator=(const fleet_store&) = delete;
+
+   /********************************************************************************
+   * load: Loads the configuration file at specified path, which fixes the
+   *       number of servos, and starts watching it. Returns false if the file
+   *       can't be read or is invalid, where the reason is stored in error.
+   *
+   *       - path         : Path to the configuration file.
+   *       - force_polling: Polls the modification time if true (default = false).
+   ********************************************************************************/
+   bool load(const std::string& path,
+             const bool force_polling = false)
+   {
+      fleet_config config;
+      std::vector<servo_settings> resolved;
+      filepath = path;
+      watcher.watch(path, force_polling);
+
+      if (!config.load(path))
+      {
+         error = config.error;
+         return false;
+      }
+
+      if (!resolve(config, resolved)) return false;
+      settings.swap(resolved);
+      error.clear();
+      return true;
+   }
+
+   /********************************************************************************
+   * size: Returns the number of servos of the fleet.
+   ********************************************************************************/
+   std::size_t size(void) const
+   {
+      return settings.size();
+   }
+
+   /********************************************************************************
+   * poll: Waits up to specified time for the configuration file to change and
+   *       reloads it if so, or if a deferred reload is due. The calibration
+   *       files are reloaded if changed as well. Returns true if changes were
+   *       handed to the control thread.
+   *
+   *       - timeout_ms: Longest time to wait in milliseconds.
+   ********************************************************************************/
+   bool poll(const int timeout_ms)
+   {
+      const auto changed = watcher.wait(timeout_ms);
+
+      for (auto& i : calibrations)
+      {
+         if (!i->reload_if_changed()) i->collect();
+      }
+      return changed || deferred ? reload() : false;
+   }
+
+   /********************************************************************************
+   * reload: Parses the configuration file anew and hands the servos whose
+   *         settings changed to the control thread. The reload is deferred
+   *         if the control thread hasn't applied the previous changes yet,
+   *         and rejected, keeping the current settings, if the file is
+   *         invalid or the number of servos changed. Returns true if changes
+   *         were handed to the control thread.
+   ********************************************************************************/
+   bool reload(void)
+   {
+      fleet_config config;
+      std::vector<servo_settings> resolved;
+      std::unique_ptr<update> next(new update());
+      deferred = published.load(std::memory_order_acquire) != acknowledged.load(std::memory_order_acquire);
+      if (deferred) return false;
+      reloads++;
+
+      if (!config.load(filepath) || !resolve(config, resolved))
+      {
+         if (!config.error.empty()) error = config.error;
+         rejected++;
+         return false;
+      }
+
+      if (resolved.size() != settings.size())
+      {
+         error = "Number of servos changed from " + std::to_string(settings.size()) + " to " +
+            std::to_string(resolved.size()) + " in " + filepath;
+         rejected++;
+         return false;
+      }
+
+      for (std::size_t i = 0; i < resolved.size(); ++i)
+      {
+         if (resolved[i].same(settings[i])) continue;
+         next->changes.push_back(servo_change{ static_cast<std::uint32_t>(i), resolved[i] });
+      }
+
+      settings.swap(resolved);
+      error.clear();
+      if (next->changes.empty()) return false;
+      next->generation = ++generation;
+      pending.store(next.get(), std::memory_order_relaxed);
+      published.store(generation, std::memory_order_release);
+      current = std::move(next);
+      return true;
+   }
+
+   /********************************************************************************
+   * apply: Calls referenced function with the index and new settings of every
+   *        servo changed by a reload not applied yet, at a tick boundary of
+   *        the control thread. Every call counts a tick boundary, at which no
+   *        sensor applies a calibration table, so that the calibration
+   *        stores can free the tables replaced before. The control thread
+   *        must therefore call apply every tick. An unchanged configuration
+   *        costs an increment and two loads. Returns the number of servos
+   *        changed.
+   *
+   *        - function: Function to call with each index and reference to the
+   *                    new settings.
+   ********************************************************************************/
+   template<class Function>
+   std::size_t apply(Function&& function)
+   {
+      ticks.fetch_add(1, std::memory_order_seq_cst);
+      const auto latest = published.load(std::memory_order_acquire);
+      if (latest == acknowledged.load(std::memory_order_relaxed)) return 0;
+      const auto changes = pending.load(std::memory_order_relaxed);
+
+      for (const auto& i : changes->changes)
+      {
+         function(static_cast<std::size_t>(i.index), i.settings);
+      }
+
+      acknowledged.store(latest, std::memory_order_release);
+      return changes->changes.size();
+   }
+
+   /********************************************************************************
+   * resolve: Resolves the servos of referenced configuration into their
+   *          settings, where the calibration files are loaded into stores.
+   *          A store is shared by every calibration with the same path and
+   *          kept for good, since sensors may still read its tables. Returns
+   *          false if a calibration file can't be loaded.
+   *
+   *          - config  : Reference to the parsed configuration.
+   *          - resolved: Reference to storage for the settings of every servo.
+   ********************************************************************************/
+   bool resolve(const fleet_config& config,
+                std::vector<servo_settings>& resolved)
+   {
+      std::vector<const calibration_store*> stores;
+
+      for (const auto& i : config.calibrations)
+      {
+         const calibration_store* found = nullptr;
+
+         for (const auto& j : calibrations)
+         {
+            if (j->filepath == i.path) found = j.get();
+         }
+
+         if (!found)
+         {
+            std::unique_ptr<calibration_store> store(new calibration_store());
+            store->ticks = &ticks;
+
+            if (!store->load(i.path))
+            {
+               error = store->error;
+               return false;
+            }
+
+            found = store.get();
+            calibrations.push_back(std::move(store));
+         }
+         stores.push_back(found);
+      }
+
+      resolved.resize(config.servos.size());
+
+      for (std::size_t i = 0; i < config.servos.size(); ++i)
+      {
+         const auto& entry = config.servos[i];
+         const auto& model = config.models[entry.model];
+         auto& result = resolved[i];
+         result.angle_min = model.angle_min;
+         result.angle_max = model.angle_max;
+         result.input_min = model.input_min;
+         result.input_max = model.input_max;
+         result.gains = model.gains;
+         result.target = entry.target;
+         result.calibration = entry.calibration == fleet_config::NONE ? nullptr : stores[entry.calibration];
+      }
+      return true;
+   }
+};
+
+#endif /* FLEET_CONFIG_HPP_ */
\ No newline at end of file
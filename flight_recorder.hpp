@@ -0,0 +1,251 @@
+/********************************************************************************
+* flight_recorder.hpp: Contains a flight recorder keeping the last cycles of a
+*                      servo in memory, so that the cycles leading up to an
+*                      anomaly can be inspected afterwards. Each cycle is a
+*                      compact binary record written into a ring allocated
+*                      once at start, so recording a cycle is a handful of
+*                      stores without any allocation.
+*
+*                      The ring is dumped to a file on a trigger, after a
+*                      number of further cycles so that the aftermath is
+*                      included too. The triggers are a streak of saturated
+*                      outputs, a newly raised sensor fault and, on POSIX
+*                      systems, the signal SIGUSR1, which requests a dump from
+*                      every recorder. A dump holds a header followed by the
+*                      records from the oldest to the newest.
+********************************************************************************/
+#ifndef FLIGHT_RECORDER_HPP_
+#define FLIGHT_RECORDER_HPP_
+
+/* Include directives: */
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/********************************************************************************
+* cycle_record: Struct holding a recorded control cycle in 32 bytes. The values
+*               are stored as floats, which is plenty for inspection.
+********************************************************************************/
+struct cycle_record
+{
+   static constexpr std::uint32_t SATURATED = 1 << 8; /* Flag of a saturated output. */
+
+   std::uint32_t cycle = 0; /* Number of the cycle since the recorder started. */
+   float left          = 0; /* Value of the left sensor. */
+   float right         = 0; /* Value of the right sensor. */
+   float input         = 0; /* Mapped input the servo regulated on. */
+   float target        = 0; /* Target angle. */
+   float output        = 0; /* Commanded angle. */
+   float error         = 0; /* Error of the PID controller. */
+   std::uint32_t flags = 0; /* Health faults in the low byte and SATURATED. */
+};
+
+/********************************************************************************
+* flight_recorder: Struct for implementation of a flight recorder of a single
+*                  servo. The servo adds a record every cycle through its
+*                  recorder pointer, so a recorder must only be attached to
+*                  one servo.
+********************************************************************************/
+struct flight_recorder
+{
+   static constexpr std::uint64_t MAGIC   = 0x31524447494c4653ull; /* Dump identifier. */
+   static constexpr std::uint32_t VERSION = 1;                     /* Dump layout version. */
+
+   /********************************************************************************
+   * trigger: Enumeration of the reasons for a dump.
+   ********************************************************************************/
+   enum class trigger : std::uint32_t { none, saturation, fault, signal, manual };
+
+   /********************************************************************************
+   * header: Struct holding the header of a dump.
+   ********************************************************************************/
+   struct header
+   {
+      std::uint64_t magic;         /* Dump identifier. */
+      std::uint32_t version;       /* Dump layout version. */
+      std::uint32_t record_size;   /* Size of a record in bytes. */
+      std::uint32_t count;         /* Number of records in the dump. */
+      std::uint32_t reason;        /* Reason for the dump, see trigger. */
+      std::uint64_t trigger_cycle; /* Cycle at which the dump was triggered. */
+   };
+
+   std::unique_ptr<cycle_record[]> records;        /* Ring of records, a power of two long. */
+   std::size_t mask               = 0;             /* Capacity of the ring minus one. */
+   std::uint64_t cycles           = 0;             /* Number of cycles recorded. */
+   std::string prefix             = "flight";      /* Path prefix of the dump files. */
+   std::size_t saturation_streak  = 0;             /* Saturated cycles triggering a dump, 0 = never. */
+   bool on_fault                  = true;          /* Triggers a dump on a new sensor fault if true. */
+   std::size_t post_cycles        = 0;             /* Cycles recorded after a trigger before the dump. */
+   std::size_t max_dumps          = 8;             /* Largest number of dumps written. */
+   std::size_t dumps              = 0;             /* Number of dumps written. */
+   std::size_t streak             = 0;             /* Saturated cycles in a row. */
+   std::uint32_t last_flags       = 0;             /* Flags of the last record. */
+   std::size_t remaining          = 0;             /* Cycles left until a pending dump. */
+   trigger pending                = trigger::none; /* Reason of a pending dump. */
+   std::uint64_t trigger_cycle    = 0;             /* Cycle of the pending trigger. */
+   std::sig_atomic_t signals_seen = 0;             /* Number of dump signals handled. */
+   std::string last_dump;                          /* Path of the last dump written. */
+
+   /********************************************************************************
+   * init: Allocates the ring with room for at least specified number of cycles
+   *       and clears the recorder. The dumps are written to files named by the
+   *       prefix and the number of the dump, i.e. prefix_0.bin and so on.
+   *
+   *       - capacity   : Number of cycles kept, rounded up to a power of two.
+   *       - path_prefix: Path prefix of the dump files.
+   *       - post       : Cycles recorded after a trigger.
+   ********************************************************************************/
+   void init(const std::size_t capacity,
+             const std::string& path_prefix,
+             const std::size_t post)
+   {
+      std::size_t size = 1;
+      while (size < capacity) size <<= 1;
+      records.reset(new cycle_record[size]);
+      mask = size - 1;
+      prefix = path_prefix;
+      post_cycles = post < size ? post : size - 1;
+      cycles = 0;
+      dumps = 0;
+      streak = 0;
+      last_flags = 0;
+      pending = trigger::none;
+      signals_seen = signal_count();
+      return;
+   }
+
+   /********************************************************************************
+   * init: Allocates the ring, see above, where a quarter of the ring is
+   *       recorded after a trigger.
+   *
+   *       - capacity   : Number of cycles kept, rounded up to a power of two.
+   *       - path_prefix: Path prefix of the dump files.
+   ********************************************************************************/
+   void init(const std::size_t capacity,
+             const std::string& path_prefix)
+   {
+      init(capacity, path_prefix, capacity / 4);
+      return;
+   }
+
+   /********************************************************************************
+   * record: Adds the record of a cycle and checks the triggers. A pending dump
+   *         is written once the cycles after the trigger have been recorded.
+   *         Returns true if a dump was written during this cycle.
+   *
+   *         - entry: Record of the cycle, where the cycle number is set here.
+   ********************************************************************************/
+   bool record(cycle_record entry)
+   {
+      if (!records) return false;
+      entry.cycle = static_cast<std::uint32_t>(cycles);
+      records[cycles++ & mask] = entry;
+      streak = entry.flags & cycle_record::SATURATED ? streak + 1 : 0;
+      const auto faults = entry.flags & 0xff;
+      const auto new_fault = faults & ~last_flags;
+      last_flags = faults;
+
+      if (pending == trigger::none)
+      {
+         if (saturation_streak && streak == saturation_streak) request(trigger::saturation);
+         else if (on_fault && new_fault) request(trigger::fault);
+         else if (signal_count() != signals_seen) request(trigger::signal);
+      }
+      else if (remaining > 0)
+      {
+         remaining--;
+      }
+      return pending != trigger::none && remaining == 0 ? dump() : false;
+   }
+
+   /********************************************************************************
+   * request: Requests a dump for specified reason after the post trigger cycles,
+   *          unless a dump is already pending.
+   *
+   *          - reason: Reason for the dump.
+   ********************************************************************************/
+   void request(const trigger reason)
+   {
+      if (pending != trigger::none) return;
+      pending = reason;
+      trigger_cycle = cycles ? cycles - 1 : 0;
+      remaining = post_cycles;
+      signals_seen = signal_count();
+      return;
+   }
+
+   /********************************************************************************
+   * dump: Writes the records in the ring, oldest first, to the next dump file
+   *       and clears the pending trigger. Nothing is written once max_dumps
+   *       dumps have been written. Returns true if the dump was written.
+   ********************************************************************************/
+   bool dump(void)
+   {
+      const auto reason = pending == trigger::none ? trigger::manual : pending;
+      pending = trigger::none;
+      if (!records || dumps >= max_dumps) return false;
+
+      const auto count = cycles < mask + 1 ? cycles : mask + 1;
+      const header head{ MAGIC, VERSION, sizeof(cycle_record), static_cast<std::uint32_t>(count),
+                         static_cast<std::uint32_t>(reason), reason == trigger::manual ? cycles : trigger_cycle };
+      last_dump = prefix + "_" + std::to_string(dumps++) + ".bin";
+      std::ofstream file(last_dump, std::ios::binary);
+      file.write(reinterpret_cast<const char*>(&head), sizeof(head));
+
+      for (auto i = cycles - count; i < cycles; ++i)
+      {
+         file.write(reinterpret_cast<const char*>(&records[i & mask]), sizeof(cycle_record));
+      }
+      return static_cast<bool>(file);
+   }
+
+   /********************************************************************************
+   * load: Reads the dump at specified path into referenced header and records.
+   *       Returns false if the file can't be read or is not a dump of this
+   *       layout.
+   *
+   *       - filepath: Path to the dump file.
+   *       - head    : Reference to storage for the header.
+   *       - entries : Reference to storage for the records.
+   ********************************************************************************/
+   static bool load(const std::string& filepath,
+                    header& head,
+                    std::vector<cycle_record>& entries)
+   {
+      std::ifstream file(filepath, std::ios::binary);
+      if (!file.read(reinterpret_cast<char*>(&head), sizeof(head))) return false;
+      if (head.magic != MAGIC || head.version != VERSION || head.record_size != sizeof(cycle_record)) return false;
+      entries.resize(head.count);
+      return static_cast<bool>(file.read(reinterpret_cast<char*>(entries.data()), head.count * sizeof(cycle_record)));
+   }
+
+   /********************************************************************************
+   * signal_count: Returns a reference to the number of dump signals received,
+   *               incremented by the signal handler.
+   ********************************************************************************/
+   static volatile std::sig_atomic_t& signal_count(void)
+   {
+      static volatile std::sig_atomic_t count = 0;
+      return count;
+   }
+
+   /********************************************************************************
+   * install_signal_handler: Makes SIGUSR1 request a dump from every recorder at
+   *                         its next cycle. Returns false where the signal
+   *                         doesn't exist, i.e. on Windows.
+   ********************************************************************************/
+   static bool install_signal_handler(void)
+   {
+#ifdef SIGUSR1
+      return std::signal(SIGUSR1, [](int) { signal_count() = signal_count() + 1; }) != SIG_ERR;
+#else
+      return false;
+#endif
+   }
+};
+
+#endif /* FLIGHT_RECORDER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,286 @@
+/********************************************************************************
+* frequency_response.hpp: Contains a frequency response analyzer for the
+*                         simulated servo loop. The loop is excited with a sine
+*                         of one test frequency at a time, either on the target
+*                         angle or on the bearing seen by the sensors, and the
+*                         gain and phase of the shaft angle relative to the
+*                         excitation are detected with Goertzel filters. The
+*                         filters are updated once per sample while the loop
+*                         runs, so no sample buffers or FFTs are needed.
+*
+*                         Every combination of servo and test frequency is an
+*                         independent run, so a sweep of many frequencies and
+*                         servos is spread across all cores.
+********************************************************************************/
+#ifndef FREQUENCY_RESPONSE_HPP_
+#define FREQUENCY_RESPONSE_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "loop_analysis.hpp"
+#include "parallel.hpp"
+
+/********************************************************************************
+* goertzel_filter: Struct for implementation of a Goertzel filter, which
+*                  calculates a single DFT bin incrementally. Each sample costs
+*                  one multiplication and two additions, and the state is two
+*                  values regardless of the number of samples.
+********************************************************************************/
+struct goertzel_filter
+{
+   double omega       = 0; /* Detected frequency in radians per sample. */
+   double coefficient = 0; /* Filter coefficient, 2 * cos(omega). */
+   double s1          = 0; /* Filter state of the last sample. */
+   double s2          = 0; /* Filter state of the sample before the last. */
+
+   /********************************************************************************
+   * goertzel_filter: Initiates filter for specified frequency.
+   *
+   *                  - frequency: Detected frequency in radians per sample.
+   ********************************************************************************/
+   goertzel_filter(const double frequency = 0)
+   {
+      reset(frequency);
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the filter state and sets specified frequency.
+   *
+   *        - frequency: Detected frequency in radians per sample.
+   ********************************************************************************/
+   void reset(const double frequency)
+   {
+      omega = frequency;
+      coefficient = 2.0 * std::cos(frequency);
+      s1 = 0;
+      s2 = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * add: Updates the filter with a new sample.
+   *
+   *      - sample: New sample.
+   ********************************************************************************/
+   void add(const double sample)
+   {
+      const auto s0 = sample + coefficient * s1 - s2;
+      s2 = s1;
+      s1 = s0;
+      return;
+   }
+
+   /********************************************************************************
+   * result: Returns the DFT bin of the samples added so far, up to a phase
+   *         factor that only depends on the number of samples. The factor
+   *         cancels when two filters run over the same samples are divided.
+   ********************************************************************************/
+   std::complex<double> result(void) const
+   {
+      return std::complex<double>(s1, 0.0) - std::polar(s2, -omega);
+   }
+};
+
+/********************************************************************************
+* frequency_point: Struct holding the measured response at a test frequency.
+********************************************************************************/
+struct frequency_point
+{
+   double frequency = 0;          /* Test frequency in radians per cycle. */
+   std::complex<double> response; /* Response of the shaft angle to the excitation. */
+
+   /********************************************************************************
+   * gain: Returns the gain of the response in dB.
+   ********************************************************************************/
+   double gain(void) const
+   {
+      return 20.0 * std::log10(std::abs(response));
+   }
+
+   /********************************************************************************
+   * phase: Returns the phase of the response in degrees, within +-180 degrees.
+   ********************************************************************************/
+   double phase(void) const
+   {
+      return std::arg(response) * 180.0 / 3.14159265358979323846;
+   }
+};
+
+/********************************************************************************
+* frequency_analyzer: Struct for measuring the frequency response of servos in
+*                     closed loop with a stepped sine sweep. Each frequency is
+*                     run for a number of settling periods, after which the
+*                     excitation and the shaft angle are fed to a Goertzel
+*                     filter each over a whole number of periods.
+********************************************************************************/
+struct frequency_analyzer
+{
+   /********************************************************************************
+   * input: Enumeration of the inputs the excitation can be fed to.
+   ********************************************************************************/
+   enum class input { target, sensor };
+
+   input excitation            = input::target; /* Input fed with the excitation. */
+   double amplitude            = 2.0;           /* Excitation amplitude in degrees. */
+   std::size_t settle_periods  = 4;             /* Periods run before measuring. */
+   std::size_t measure_periods = 8;             /* Periods measured at each frequency. */
+   plant_model plant;                           /* Plant model to simulate against. */
+   std::size_t num_threads = parallel::num_threads(); /* Number of threads used. */
+
+   /********************************************************************************
+   * measure: Runs referenced servo with a sine excitation of specified frequency
+   *          and returns the response of the shaft angle, measured at the
+   *          cycle the sensors are read. The frequency is adjusted slightly,
+   *          so that the measurement covers a whole number of periods.
+   *
+   *          - config   : Reference to servo holding configuration and gains.
+   *          - frequency: Test frequency in radians per cycle.
+   ********************************************************************************/
+   frequency_point measure(const servo& config,
+                           const double frequency) const
+   {
+      const auto pi = 3.14159265358979323846;
+      const auto period = 2.0 * pi / frequency;
+      const auto samples = static_cast<std::size_t>(std::ceil(measure_periods * period));
+      const auto settle = static_cast<std::size_t>(std::ceil(settle_periods * period));
+      const auto omega = 2.0 * pi * measure_periods / samples;
+      const auto base = config.target();
+      simulation run(config, plant);
+      goertzel_filter excitation_filter(omega), angle_filter(omega);
+      frequency_point self;
+
+      for (std::size_t k = 0; k < settle + samples; ++k)
+      {
+         const auto value = amplitude * std::sin(omega * k);
+
+         if (k >= settle)
+         {
+            excitation_filter.add(value);
+            angle_filter.add(run.plant.angle - base);
+         }
+
+         if (excitation == input::target)
+         {
+            run.device.pid.target = base + value;
+            run.step(0.0);
+         }
+         else
+         {
+            run.step(value);
+         }
+      }
+
+      self.frequency = omega;
+      self.response = angle_filter.result() / excitation_filter.result();
+      return self;
+   }
+
+   /********************************************************************************
+   * sweep: Measures the response of every referenced servo at every specified
+   *        frequency in parallel and returns the responses per servo.
+   *
+   *        - servos     : Reference to servos to measure.
+   *        - frequencies: Reference to test frequencies in radians per cycle.
+   ********************************************************************************/
+   std::vector<std::vector<frequency_point>> sweep(const std::vector<servo>& servos,
+                                                   const std::vector<double>& frequencies) const
+   {
+      std::vector<std::vector<frequency_point>> responses(servos.size(),
+         std::vector<frequency_point>(frequencies.size()));
+
+      parallel::for_each_index(servos.size() * frequencies.size(), [&](const std::size_t i)
+         {
+            const auto s = i / frequencies.size();
+            const auto f = i % frequencies.size();
+            responses[s][f] = measure(servos[s], frequencies[f]);
+         }, num_threads);
+      return responses;
+   }
+
+   /********************************************************************************
+   * expected: Returns the response predicted by the z-domain analysis for the
+   *           selected input. The bearing only acts through the controller,
+   *           i.e. -C * P / (1 + C * P). The target is also added to the
+   *           output of the controller, so it reaches the plant both directly
+   *           and through the controller, i.e. (1 + C) * P / (1 + C * P).
+   *
+   *           - analysis : Reference to analysis of the servo loop.
+   *           - frequency: Frequency in radians per cycle.
+   ********************************************************************************/
+   std::complex<double> expected(const loop_analysis& analysis,
+                                 const double frequency) const
+   {
+      const auto open = analysis.open_loop(frequency);
+      const auto control = analysis.controller(frequency);
+
+      if (excitation == input::target)
+      {
+         return (1.0 + control) * (open / control) / (1.0 + open);
+      }
+      return -open / (1.0 + open);
+   }
+
+   /********************************************************************************
+   * frequencies: Returns specified number of logarithmically spaced frequencies
+   *              between specified lowest and highest frequency.
+   *
+   *              - lowest : Lowest frequency in radians per cycle.
+   *              - highest: Highest frequency in radians per cycle.
+   *              - count  : Number of frequencies.
+   ********************************************************************************/
+   static std::vector<double> frequencies(const double lowest,
+                                          const double highest,
+                                          const std::size_t count)
+   {
+      std::vector<double> self(count, lowest);
+
+      for (std::size_t i = 1; i < count; ++i)
+      {
+         self[i] = lowest * std::pow(highest / lowest, static_cast<double>(i) / (count - 1));
+      }
+      return self;
+   }
+
+   /********************************************************************************
+   * print: Prints referenced responses as a Bode table along with the response
+   *        predicted by referenced analysis. The phases are unwrapped along
+   *        the sweep.
+   *
+   *        - responses: Reference to responses of a servo.
+   *        - analysis : Reference to analysis of the same servo loop.
+   *        - ostream  : Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(const std::vector<frequency_point>& responses,
+              const loop_analysis& analysis,
+              std::ostream& ostream = std::cout) const
+   {
+      auto phase = 0.0, predicted_phase = 0.0;
+      ostream << "--------------------------------------------------------------------------------\n";
+      ostream << "Frequency\tGain\t\tPhase\t\tPredicted gain\tPredicted phase\n";
+      ostream << "[rad/cycle]\t[dB]\t\t[degrees]\t[dB]\t\t[degrees]\n";
+
+      for (std::size_t i = 0; i < responses.size(); ++i)
+      {
+         const auto& point = responses[i];
+         const auto prediction = expected(analysis, point.frequency);
+         const auto degrees = std::arg(prediction) * 180.0 / 3.14159265358979323846;
+         phase = i > 0 ? loop_analysis::unwrap(point.phase(), phase) : point.phase();
+         predicted_phase = i > 0 ? loop_analysis::unwrap(degrees, predicted_phase) : degrees;
+
+         ostream << std::fixed << std::setprecision(4) << point.frequency << "\t\t";
+         ostream << std::setprecision(2) << point.gain() << "\t\t" << phase << "\t\t"
+                 << 20.0 * std::log10(std::abs(prediction)) << "\t\t" << predicted_phase << "\n";
+      }
+
+      ostream << "--------------------------------------------------------------------------------\n\n";
+      return;
+   }
+};
+
+#endif /* FREQUENCY_RESPONSE_HPP_ */
\ No newline at end of file
@@ -0,0 +1,415 @@
+/********************************************************************************
+* gradient_tuner.hpp: Contains a gradient based tuner for PID parameters.
+*                     The derivatives of the cost with respect to the PID
+*                     parameters are calculated by running the servo loop
+*                     with dual numbers, which propagate the derivatives
+*                     through the controller, the output clamping, the
+*                     sensors and the plant in the same pass as the cost
+*                     itself. For comparison, the derivatives can instead be
+*                     estimated with central finite differences, which needs
+*                     two extra simulations per parameter.
+*
+*                     The dual servo is converted field by field from the
+*                     servo configuration, so the filters, fusion, sensor
+*                     array, health monitor and every other stage of the
+*                     cost being minimized are part of the derivative. Stages
+*                     that cannot carry derivatives, i.e. the fixed point
+*                     decimators of an oversampled servo, an active relay
+*                     autotuner and a control plane replacing the gains, make
+*                     the tuner fall back to finite differences.
+********************************************************************************/
+#ifndef GRADIENT_TUNER_HPP_
+#define GRADIENT_TUNER_HPP_
+
+/* Include directives: */
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "dual.hpp"
+#include "tuner.hpp"
+
+/********************************************************************************
+* gradient_tuner: Struct for implementation of a gradient descent optimizer of
+*                 PID parameters. Like the tuner, the parameters are searched
+*                 in logarithmic scale. Each iteration steps against the
+*                 normalized gradient, where the step length grows after an
+*                 improvement and is halved after a failed step.
+********************************************************************************/
+struct gradient_tuner
+{
+   using number = dual<3>;                       /* Numeric type carrying d/dkp, d/dki and d/dkd. */
+   using gradient = std::array<double, 3>;       /* Derivatives of the cost in logarithmic scale. */
+   static constexpr auto DIFFERENCE_STEP = 1e-4; /* Finite difference step in decades. */
+   static constexpr auto INITIAL_STEP    = 0.25; /* Initial step length in decades. */
+   static constexpr auto MAX_STEP        = 1.0;  /* Largest step length in decades. */
+   static constexpr auto MIN_STEP        = 1e-4; /* Step length at which the search stops. */
+
+   servo config;                    /* Servo configuration to tune. */
+   plant_model plant;               /* Plant model to simulate against. */
+   std::vector<scenario> suite;     /* Scenarios each candidate is evaluated with. */
+   cost_function cost;              /* Cost function for weighting the metrics. */
+   bool finite_differences = false; /* Estimates the gradient with finite differences if true. */
+
+   /********************************************************************************
+   * gradient_tuner: Initiates tuner with specified servo configuration, plant
+   *                 model and scenario suite.
+   *
+   *                 - config: Reference to servo configuration to tune.
+   *                 - plant : Reference to plant model (default = default model).
+   *                 - suite : Reference to scenario suite (default = default suite).
+   ********************************************************************************/
+   gradient_tuner(const servo& config,
+                  const plant_model& plant = plant_model(),
+                  const std::vector<scenario>& suite = scenario::default_suite())
+      : config(config), plant(plant), suite(suite) { }
+
+   /********************************************************************************
+   * evaluate: Returns the cost of the PID parameters at specified point. The
+   *           metrics of the run are stored in referenced metrics if specified.
+   *
+   *           - x     : Reference to PID parameters in logarithmic scale.
+   *           - result: Pointer to storage for metrics (default = nullptr).
+   ********************************************************************************/
+   double evaluate(const tuner::point& x,
+                   metrics* result = nullptr) const
+   {
+      auto candidate = config;
+      candidate.pid.set_gains(tuner::to_gains(x));
+      const auto total = simulate(candidate, plant, suite);
+      if (result) *result = total;
+      return cost(total);
+   }
+
+   /********************************************************************************
+   * differentiate: Returns the cost of the PID parameters at specified point
+   *                and stores the derivatives of the cost with respect to the
+   *                logarithmic parameters in referenced gradient, calculated
+   *                with dual numbers or finite differences. Finite
+   *                differences are used if selected or if the servo
+   *                configuration is not differentiable.
+   *
+   *                - x    : Reference to PID parameters in logarithmic scale.
+   *                - slope: Reference to storage for the gradient.
+   ********************************************************************************/
+   double differentiate(const tuner::point& x,
+                        gradient& slope) const
+   {
+      return finite_differences || !differentiable() ? difference(x, slope) : derivative(x, slope);
+   }
+
+   /********************************************************************************
+   * differentiable: Returns true if the servo configuration can be run with
+   *                 dual numbers, i.e. if no stage drops the derivatives or
+   *                 replaces the gains being differentiated.
+   ********************************************************************************/
+   bool differentiable(void) const
+   {
+      return config.oversampling() == 1 && !config.autotuner.active() && !config.control.plane;
+   }
+
+   /********************************************************************************
+   * derivative: Returns the cost at specified point and stores the exact
+   *             gradient in referenced gradient, calculated in a single run
+   *             with dual numbers. The gains are seeded as the variables, so
+   *             the derivatives with respect to the gains are converted to
+   *             logarithmic scale via d/dlog10(k) = k * ln(10) * d/dk. The
+   *             servo configuration must be differentiable.
+   *
+   *             - x    : Reference to PID parameters in logarithmic scale.
+   *             - slope: Reference to storage for the gradient.
+   ********************************************************************************/
+   double derivative(const tuner::point& x,
+                     gradient& slope) const
+   {
+      const auto gains = tuner::to_gains(x);
+      const double values[3]{ gains.kp, gains.ki, gains.kd };
+      auto device = dual_servo();
+      device.pid.kp = number::variable(gains.kp, 0);
+      device.pid.ki = number::variable(gains.ki, 1);
+      device.pid.kd = number::variable(gains.kd, 2);
+      const auto total = cost(simulate(device, dual_plant(), suite));
+
+      for (std::size_t i = 0; i < slope.size(); ++i)
+      {
+         slope[i] = total.der[i] * values[i] * std::log(10.0);
+      }
+      return total.val;
+   }
+
+   /********************************************************************************
+   * difference: Returns the cost at specified point and stores the gradient
+   *             estimated with central finite differences in referenced
+   *             gradient, which takes seven simulation runs.
+   *
+   *             - x    : Reference to PID parameters in logarithmic scale.
+   *             - slope: Reference to storage for the gradient.
+   ********************************************************************************/
+   double difference(const tuner::point& x,
+                     gradient& slope) const
+   {
+      for (std::size_t i = 0; i < slope.size(); ++i)
+      {
+         auto forward = x, backward = x;
+         forward[i] += DIFFERENCE_STEP;
+         backward[i] -= DIFFERENCE_STEP;
+         slope[i] = (evaluate(forward) - evaluate(backward)) / (2.0 * DIFFERENCE_STEP);
+      }
+      return evaluate(x);
+   }
+
+   /********************************************************************************
+   * optimize: Searches for the PID parameters with the lowest cost with
+   *           gradient descent, starting from specified parameters. Only the
+   *           cost of a trial step is simulated, the gradient is calculated
+   *           once the step is taken.
+   *
+   *           - start         : Reference to start parameters.
+   *           - max_iterations: Maximum number of iterations (default = 100).
+   *           - tolerance     : Gradient length at which the search is
+   *                             considered converged (default = 1e-6).
+   ********************************************************************************/
+   tuner_result optimize(const pid_gains& start,
+                         const std::size_t max_iterations = 100,
+                         const double tolerance = 1e-6) const
+   {
+      const auto t0 = std::chrono::steady_clock::now();
+      auto x = tuner::to_point(start);
+      auto step = INITIAL_STEP;
+      gradient slope{};
+      tuner_result best;
+
+      best.cost = differentiate(x, slope);
+      best.evaluations += finite_differences || !differentiable() ? 7 : 1;
+
+      for (best.iterations = 0; best.iterations < max_iterations && step >= MIN_STEP; ++best.iterations)
+      {
+         const auto length = std::sqrt(slope[0] * slope[0] + slope[1] * slope[1] + slope[2] * slope[2]);
+         if (length < tolerance) break;
+         auto trial = x;
+
+         for (std::size_t i = 0; i < trial.size(); ++i)
+         {
+            trial[i] = tuner::clamp(x[i] - step * slope[i] / length);
+         }
+
+         const auto trial_cost = evaluate(trial);
+         best.evaluations++;
+
+         if (trial_cost < best.cost)
+         {
+            differentiate(trial, slope);
+            best.evaluations += finite_differences || !differentiable() ? 7 : 1;
+            x = trial;
+            best.cost = trial_cost;
+            step = step * 1.5 < MAX_STEP ? step * 1.5 : MAX_STEP;
+         }
+         else
+         {
+            step /= 2.0;
+         }
+      }
+
+      best.gains = tuner::to_gains(x);
+      best.cost = evaluate(x, &best.result);
+      best.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      return best;
+   }
+
+   /********************************************************************************
+   * dual_plant: Returns the plant model converted to dual numbers, where every
+   *             parameter is a constant.
+   ********************************************************************************/
+   basic_plant_model<number> dual_plant(void) const
+   {
+      basic_plant_model<number> model;
+      model.inertia = plant.inertia;
+      model.stiffness = plant.stiffness;
+      model.damping = plant.damping;
+      model.friction = plant.friction;
+      model.rate_limit = plant.rate_limit;
+      model.sensor_noise = plant.sensor_noise;
+      model.angle = plant.angle;
+      model.velocity = plant.velocity;
+      model.seed = plant.seed;
+      return model;
+   }
+
+   /********************************************************************************
+   * dual_servo: Returns the servo configuration converted to dual numbers,
+   *             where every value is a constant. The flight recorder is not
+   *             carried over, so the dual runs are not recorded.
+   ********************************************************************************/
+   basic_servo<number> dual_servo(void) const
+   {
+      basic_servo<number> device;
+      convert(config.pid, device.pid);
+      convert(config.left_sensor, device.left_sensor);
+      convert(config.right_sensor, device.right_sensor);
+      device.left_decimator = config.left_decimator;
+      device.right_decimator = config.right_decimator;
+      convert(config.left_filter, device.left_filter);
+      convert(config.right_filter, device.right_filter);
+      convert(config.fusion, device.fusion);
+      convert(config.array, device.array);
+      device.health = config.health;
+      convert(config.healthy_pid, device.healthy_pid);
+      device.recorder = nullptr;
+      device.autotuner = config.autotuner;
+      device.oscillation = config.oscillation;
+      device.rate = config.rate;
+      device.control = config.control;
+      return device;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced PID controller to dual numbers.
+   *
+   *          - from: Reference to the controller to convert.
+   *          - to  : Reference to the converted controller.
+   ********************************************************************************/
+   static void convert(const pid_controller& from,
+                       basic_pid_controller<number>& to)
+   {
+      to.target = from.target;
+      to.output = from.output;
+      to.input = from.input;
+      to.kp = from.kp;
+      to.ki = from.ki;
+      to.kd = from.kd;
+      to.integrate = from.integrate;
+      to.derivate = from.derivate;
+      to.last_error = from.last_error;
+      to.output_min = from.output_min;
+      to.output_max = from.output_max;
+      to.saturation = from.saturation;
+      return;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced TOF sensor to dual numbers.
+   *
+   *          - from: Reference to the sensor to convert.
+   *          - to  : Reference to the converted sensor.
+   ********************************************************************************/
+   static void convert(const tof_sensor& from,
+                       basic_tof_sensor<number>& to)
+   {
+      to.min = from.min;
+      to.max = from.max;
+      to.val = from.val;
+      to.calibration = from.calibration;
+      to.clamping = from.clamping;
+      return;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced running median to dual numbers.
+   *
+   *          - from: Reference to the running median to convert.
+   *          - to  : Reference to the converted running median.
+   ********************************************************************************/
+   static void convert(const basic_running_median<double>& from,
+                       basic_running_median<number>& to)
+   {
+      to.window = from.window;
+      to.count = from.count;
+      to.next = from.next;
+
+      for (std::size_t i = 0; i < basic_running_median<double>::MAX_WINDOW; ++i)
+      {
+         to.history[i] = from.history[i];
+         to.sorted[i] = from.sorted[i];
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced sensor filter pipeline to dual numbers.
+   *
+   *          - from: Reference to the filter pipeline to convert.
+   *          - to  : Reference to the converted filter pipeline.
+   ********************************************************************************/
+   static void convert(const basic_sensor_filter<double>& from,
+                       basic_sensor_filter<number>& to)
+   {
+      to.stages = from.stages;
+      convert(from.outliers.window, to.outliers.window);
+      to.outliers.threshold = from.outliers.threshold;
+      to.outliers.min_deviation = from.outliers.min_deviation;
+      convert(from.median, to.median);
+      to.average.alpha = from.average.alpha;
+      to.average.average = from.average.average;
+      to.average.started = from.average.started;
+      return;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced bearing fusion to dual numbers, where the
+   *          covariance and model matrices of the filter stay doubles.
+   *
+   *          - from: Reference to the fusion to convert.
+   *          - to  : Reference to the converted fusion.
+   ********************************************************************************/
+   static void convert(const bearing_fusion& from,
+                       basic_bearing_fusion<number>& to)
+   {
+      for (std::size_t i = 0; i < 3; ++i)
+      {
+         to.filter.x[i] = from.filter.x[i];
+         to.filter.b[i] = from.filter.b[i];
+         to.filter.q[i] = from.filter.q[i];
+
+         for (std::size_t j = 0; j < 3; ++j)
+         {
+            to.filter.p[i][j] = from.filter.p[i][j];
+            to.filter.f[i][j] = from.filter.f[i][j];
+         }
+
+         for (std::size_t m = 0; m < 2; ++m)
+         {
+            to.filter.h[m][i] = from.filter.h[m][i];
+         }
+      }
+
+      to.filter.r[0] = from.filter.r[0];
+      to.filter.r[1] = from.filter.r[1];
+      to.enabled = from.enabled;
+      to.started = from.started;
+      to.inertia = from.inertia;
+      to.stiffness = from.stiffness;
+      to.damping = from.damping;
+      to.left_noise = from.left_noise;
+      to.right_noise = from.right_noise;
+      to.velocity_step = from.velocity_step;
+      to.offset_step = from.offset_step;
+      return;
+   }
+
+   /********************************************************************************
+   * convert: Converts referenced sensor array to dual numbers.
+   *
+   *          - from: Reference to the sensor array to convert.
+   *          - to  : Reference to the converted sensor array.
+   ********************************************************************************/
+   static void convert(const basic_sensor_array<double>& from,
+                       basic_sensor_array<number>& to)
+   {
+      to.count = from.count;
+      to.offset = from.offset;
+
+      for (std::size_t i = 0; i < basic_sensor_array<double>::MAX_SENSORS; ++i)
+      {
+         to.values[i] = from.values[i];
+         to.weights[i] = from.weights[i];
+         to.sensitivity[i] = from.sensitivity[i];
+         to.deviation[i] = from.deviation[i];
+      }
+      return;
+   }
+};
+
+#endif /* GRADIENT_TUNER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,292 @@
+/********************************************************************************
+* health_monitor.hpp: Contains streaming health monitoring of the TOF sensors.
+*                     A dead sensor typically reads a constant value or a value
+*                     outside its range, which check_sensor_value clamps to the
+*                     minimum or maximum, so the servo drives hard to one side
+*                     without noticing. Each sensor is therefore checked for:
+*
+*                     - stuck values: The reading hasn't changed for a number
+*                       of samples. Real TOF sensors always carry some noise,
+*                       so this is only meaningful with noisy readings.
+*                     - rail clamping: The value has been clamped to the
+*                       minimum or maximum for a number of samples.
+*                     - dropouts: Readings that are not finite numbers, i.e.
+*                       missing samples, for a number of samples in a row.
+*
+*                     Since the left and right sensor see the bearing from
+*                     opposite sides, their deviations from the middle of the
+*                     range cancel. The pair is therefore also checked for
+*                     disagreement, i.e. a sum of deviations beyond a limit for
+*                     a number of samples.
+*
+*                     Every check is a counter of samples in a row, so a sample
+*                     costs a constant number of comparisons. A fault is raised
+*                     once a counter reaches its limit and cleared by the first
+*                     sample passing the check again.
+********************************************************************************/
+#ifndef HEALTH_MONITOR_HPP_
+#define HEALTH_MONITOR_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+/********************************************************************************
+* health_limits: Struct holding the number of samples in a row and the
+*                tolerances raising each fault.
+********************************************************************************/
+struct health_limits
+{
+   std::size_t stuck_samples    = 50;    /* Unchanged readings raising a stuck fault. */
+   std::size_t rail_samples     = 3;     /* Clamped values raising a rail fault. */
+   std::size_t dropout_samples  = 3;     /* Missing readings raising a dropout fault. */
+   std::size_t disagree_samples = 10;    /* Disagreeing pairs raising a disagreement fault. */
+   double stuck_tolerance       = 0.0;   /* Largest change treated as unchanged in sensor units. */
+   double disagree_tolerance    = 100.0; /* Largest sum of deviations in sensor units. */
+};
+
+/********************************************************************************
+* sensor_health: Struct for implementation of the health checks of a single
+*                sensor. The state flags of the active faults and counters of
+*                raised faults are exposed for monitoring.
+********************************************************************************/
+struct sensor_health
+{
+   static constexpr unsigned STUCK   = 1; /* Flag of a stuck reading. */
+   static constexpr unsigned RAIL    = 2; /* Flag of a value clamped to a limit. */
+   static constexpr unsigned DROPOUT = 4; /* Flag of missing readings. */
+
+   unsigned flags             = 0;     /* Active faults, combined flags. */
+   bool started               = false; /* Indicates if a reading has been seen. */
+   double last                = 0;     /* Last finite reading. */
+   std::size_t stuck_run      = 0;     /* Unchanged readings in a row. */
+   std::size_t rail_run       = 0;     /* Clamped values in a row. */
+   std::size_t dropout_run    = 0;     /* Missing readings in a row. */
+   std::size_t samples        = 0;     /* Number of readings checked. */
+   std::size_t missing        = 0;     /* Number of missing readings. */
+   std::size_t stuck_faults   = 0;     /* Number of stuck faults raised. */
+   std::size_t rail_faults    = 0;     /* Number of rail faults raised. */
+   std::size_t dropout_faults = 0;     /* Number of dropout faults raised. */
+
+   /********************************************************************************
+   * reset: Clears the active faults and the counters of samples in a row,
+   *        while the counters of raised faults are kept.
+   ********************************************************************************/
+   void reset(void)
+   {
+      flags = 0;
+      started = false;
+      stuck_run = 0;
+      rail_run = 0;
+      dropout_run = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * add: Checks a new reading and the sensor value it resulted in and returns
+   *      the active faults. A missing reading is only counted as such, since
+   *      the sensor value is then not updated.
+   *
+   *      - raw   : New raw reading.
+   *      - value : Sensor value after calibration and clamping.
+   *      - min   : Minimum sensor value.
+   *      - max   : Maximum sensor value.
+   *      - limits: Reference to the limits raising each fault.
+   ********************************************************************************/
+   unsigned add(const double raw,
+                const double value,
+                const double min,
+                const double max,
+                const health_limits& limits)
+   {
+      samples++;
+
+      if (!std::isfinite(raw))
+      {
+         missing++;
+         raise(DROPOUT, ++dropout_run >= limits.dropout_samples, dropout_faults);
+         return flags;
+      }
+
+      dropout_run = 0;
+      flags &= ~DROPOUT;
+      stuck_run = started && std::fabs(raw - last) <= limits.stuck_tolerance ? stuck_run + 1 : 0;
+      rail_run = value <= min || value >= max ? rail_run + 1 : 0;
+      raise(STUCK, stuck_run >= limits.stuck_samples, stuck_faults);
+      raise(RAIL, rail_run >= limits.rail_samples, rail_faults);
+      started = true;
+      last = raw;
+      return flags;
+   }
+
+   /********************************************************************************
+   * clean: Indicates if the last reading passed every check, i.e. no fault is
+   *        active or building up.
+   ********************************************************************************/
+   bool clean(void) const
+   {
+      return flags == 0 && stuck_run == 0 && rail_run == 0 && dropout_run == 0;
+   }
+
+   /********************************************************************************
+   * raise: Sets specified flag if the fault condition holds, counting the fault
+   *        when it is newly raised, otherwise clears the flag.
+   *
+   *        - flag     : Flag of the fault.
+   *        - condition: Indicates if the fault condition holds.
+   *        - counter  : Reference to the counter of raised faults.
+   ********************************************************************************/
+   void raise(const unsigned flag,
+              const bool condition,
+              std::size_t& counter)
+   {
+      if (condition && !(flags & flag)) counter++;
+      flags = condition ? flags | flag : flags & ~flag;
+      return;
+   }
+};
+
+/********************************************************************************
+* health_monitor: Struct for implementation of the health monitoring of the
+*                 left and right sensor and the pair. The monitor is disabled
+*                 by default. When enabled with hold, the servo returns to the
+*                 output of the last cycle with clean readings, i.e. before the
+*                 fault started building up, and keeps it while any fault is
+*                 active instead of regulating on suspect values.
+********************************************************************************/
+struct health_monitor
+{
+   static constexpr unsigned DISAGREE = 8; /* Flag of disagreeing sensors. */
+
+   bool enabled                = false; /* Indicates if the sensors are monitored. */
+   bool hold                   = false; /* Holds the servo output on a fault if true. */
+   health_limits limits;                /* Limits raising each fault. */
+   sensor_health left;                  /* Health of the left sensor. */
+   sensor_health right;                 /* Health of the right sensor. */
+   unsigned pair_flags         = 0;     /* Active faults of the pair, combined flags. */
+   std::size_t disagree_run    = 0;     /* Disagreeing pairs in a row. */
+   std::size_t disagree_faults = 0;     /* Number of disagreement faults raised. */
+   std::size_t held_cycles     = 0;     /* Number of cycles the output was held. */
+
+   /********************************************************************************
+   * init: Enables the monitor with specified limits and clears the state.
+   *
+   *       - hold_output: Holds the servo output on a fault if true.
+   *       - new_limits : Limits raising each fault (default = health_limits()).
+   ********************************************************************************/
+   void init(const bool hold_output,
+             const health_limits& new_limits = health_limits())
+   {
+      enabled = true;
+      hold = hold_output;
+      limits = new_limits;
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the active faults and the counters of samples in a row.
+   ********************************************************************************/
+   void reset(void)
+   {
+      left.reset();
+      right.reset();
+      pair_flags = 0;
+      disagree_run = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * add: Checks new readings of both sensors and returns the active faults of
+   *      both sensors and the pair, combined flags. The pair is only checked
+   *      when both readings are present.
+   *
+   *      - left_raw   : New raw reading of the left sensor.
+   *      - right_raw  : New raw reading of the right sensor.
+   *      - left_value : Left sensor value after calibration and clamping.
+   *      - right_value: Right sensor value after calibration and clamping.
+   *      - min        : Minimum sensor value.
+   *      - max        : Maximum sensor value.
+   ********************************************************************************/
+   unsigned add(const double left_raw,
+                const double right_raw,
+                const double left_value,
+                const double right_value,
+                const double min,
+                const double max)
+   {
+      left.add(left_raw, left_value, min, max, limits);
+      right.add(right_raw, right_value, min, max, limits);
+
+      if (std::isfinite(left_raw) && std::isfinite(right_raw))
+      {
+         const auto deviation = std::fabs(left_value + right_value - (min + max));
+         disagree_run = deviation > limits.disagree_tolerance ? disagree_run + 1 : 0;
+         const auto condition = disagree_run >= limits.disagree_samples;
+         if (condition && !(pair_flags & DISAGREE)) disagree_faults++;
+         pair_flags = condition ? DISAGREE : 0;
+      }
+      return flags();
+   }
+
+   /********************************************************************************
+   * flags: Returns the active faults of both sensors and the pair, combined
+   *        flags.
+   ********************************************************************************/
+   unsigned flags(void) const
+   {
+      return left.flags | right.flags | pair_flags;
+   }
+
+   /********************************************************************************
+   * healthy: Indicates if no fault is active.
+   ********************************************************************************/
+   bool healthy(void) const
+   {
+      return flags() == 0;
+   }
+
+   /********************************************************************************
+   * clean: Indicates if the last readings of both sensors passed every check,
+   *        so that the servo state of this cycle can be trusted.
+   ********************************************************************************/
+   bool clean(void) const
+   {
+      return left.clean() && right.clean() && pair_flags == 0 && disagree_run == 0;
+   }
+
+   /********************************************************************************
+   * print: Prints the active faults and the counters of raised faults.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      const auto print_flags = [&](const unsigned value)
+         {
+            if (!value) ostream << " ok";
+            if (value & sensor_health::STUCK) ostream << " stuck";
+            if (value & sensor_health::RAIL) ostream << " rail";
+            if (value & sensor_health::DROPOUT) ostream << " dropout";
+            if (value & DISAGREE) ostream << " disagree";
+         };
+      const auto print_sensor = [&](const char* name, const sensor_health& sensor)
+         {
+            ostream << name;
+            print_flags(sensor.flags);
+            ostream << "\n\t\t\t" << sensor.samples << " samples, " << sensor.missing << " missing, "
+                    << sensor.stuck_faults << " stuck, " << sensor.rail_faults << " rail, "
+                    << sensor.dropout_faults << " dropout faults\n";
+         };
+
+      print_sensor("Left sensor:\t\t", left);
+      print_sensor("Right sensor:\t\t", right);
+      ostream << "Sensor pair:\t\t";
+      print_flags(pair_flags);
+      ostream << "\n\t\t\t" << disagree_faults << " disagreement faults, " << held_cycles << " cycles held\n";
+      return;
+   }
+};
+
+#endif /* HEALTH_MONITOR_HPP_ */
\ No newline at end of file
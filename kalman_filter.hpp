@@ -0,0 +1,304 @@
+/********************************************************************************
+* kalman_filter.hpp: Contains a fixed-size linear Kalman filter and the fusion
+*                    of the two TOF sensors into a bearing estimate. The state
+*                    and covariance are plain arrays sized by template
+*                    parameters, so an update never allocates memory. The
+*                    measurement noise is uncorrelated between measurements,
+*                    so the measurements are processed one at a time, which
+*                    avoids inverting the innovation covariance. The
+*                    covariance is corrected in Joseph form, which keeps it
+*                    symmetric and positive semidefinite when a noiseless
+*                    measurement collapses it, and the noise of every
+*                    measurement is floored to MIN_VARIANCE, so a second
+*                    noiseless measurement of the same state never divides
+*                    zero by zero.
+*
+*                    The covariance and gains of a linear Kalman filter do not
+*                    depend on the measurements, so they are held as doubles
+*                    while the state uses the numeric type of the servo.
+********************************************************************************/
+#ifndef KALMAN_FILTER_HPP_
+#define KALMAN_FILTER_HPP_
+
+/* Include directives: */
+#include <cstddef>
+#include "pid_controller.hpp"
+
+/********************************************************************************
+* kalman_filter: Struct for implementation of a linear Kalman filter with N
+*                states, M measurements and a single input, i.e.
+*
+*                x[k + 1] = F * x[k] + B * u[k] + w, w ~ N(0, diag(q))
+*                z[k]     = H * x[k] + v,            v ~ N(0, diag(r))
+********************************************************************************/
+template<std::size_t N, std::size_t M, class T = double>
+struct kalman_filter
+{
+   static constexpr double MIN_VARIANCE = 1e-12; /* Smallest noise variance of a measurement. */
+
+   T x[N]{};         /* State estimate. */
+   double p[N][N]{}; /* Covariance of the state estimate. */
+   double f[N][N]{}; /* State transition matrix. */
+   double b[N]{};    /* Input gain of each state. */
+   double h[M][N]{}; /* Measurement matrix. */
+   double q[N]{};    /* Process noise variance of each state. */
+   double r[M]{};    /* Noise variance of each measurement. */
+
+   /********************************************************************************
+   * predict: Propagates the state estimate and its covariance one step with
+   *          specified input.
+   *
+   *          - input: Input applied during the step.
+   ********************************************************************************/
+   void predict(const T input)
+   {
+      T state[N]{};
+      double product[N][N]{};
+
+      for (std::size_t i = 0; i < N; ++i)
+      {
+         state[i] = b[i] * input;
+         for (std::size_t j = 0; j < N; ++j) state[i] += f[i][j] * x[j];
+      }
+
+      for (std::size_t i = 0; i < N; ++i)
+      {
+         x[i] = state[i];
+
+         for (std::size_t j = 0; j < N; ++j)
+         {
+            for (std::size_t k = 0; k < N; ++k) product[i][j] += f[i][k] * p[k][j];
+         }
+      }
+
+      for (std::size_t i = 0; i < N; ++i)
+      {
+         for (std::size_t j = 0; j < N; ++j)
+         {
+            auto sum = i == j ? q[i] : 0.0;
+            for (std::size_t k = 0; k < N; ++k) sum += product[i][k] * f[j][k];
+            p[i][j] = sum;
+         }
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * correct: Corrects the state estimate with specified measurements, one
+   *          measurement at a time, where the covariance is updated in Joseph
+   *          form, i.e. P = (I - K * h) * P * (I - K * h)' + K * r * K'. A
+   *          measurement without variance left to correct is skipped.
+   *
+   *          - z: Measurements.
+   ********************************************************************************/
+   void correct(const T (&z)[M])
+   {
+      for (std::size_t m = 0; m < M; ++m)
+      {
+         double column[N]{}, gain[N]{}, keep[N][N]{}, product[N][N]{};
+         const auto noise = r[m] > MIN_VARIANCE ? r[m] : MIN_VARIANCE;
+         auto variance = noise;
+         T innovation = z[m];
+
+         for (std::size_t i = 0; i < N; ++i)
+         {
+            for (std::size_t j = 0; j < N; ++j) column[i] += p[i][j] * h[m][j];
+            variance += h[m][i] * column[i];
+            innovation -= h[m][i] * x[i];
+         }
+
+         if (!(variance > 0)) continue;
+
+         for (std::size_t i = 0; i < N; ++i)
+         {
+            gain[i] = column[i] / variance;
+            x[i] += gain[i] * innovation;
+         }
+
+         for (std::size_t i = 0; i < N; ++i)
+         {
+            for (std::size_t j = 0; j < N; ++j) keep[i][j] = (i == j ? 1.0 : 0.0) - gain[i] * h[m][j];
+         }
+
+         for (std::size_t i = 0; i < N; ++i)
+         {
+            for (std::size_t j = 0; j < N; ++j)
+            {
+               for (std::size_t k = 0; k < N; ++k) product[i][j] += keep[i][k] * p[k][j];
+            }
+         }
+
+         for (std::size_t i = 0; i < N; ++i)
+         {
+            for (std::size_t j = 0; j < N; ++j)
+            {
+               auto sum = gain[i] * noise * gain[j];
+               for (std::size_t k = 0; k < N; ++k) sum += product[i][k] * keep[j][k];
+               p[i][j] = sum;
+            }
+         }
+      }
+      return;
+   }
+};
+
+/********************************************************************************
+* basic_bearing_fusion: Struct for fusing the bearings measured by the left and
+*                       right TOF sensor with the commanded servo angle. The
+*                       state is the shaft angle, the shaft velocity and the
+*                       offset between the bearing and the shaft angle, i.e.
+*                       the disturbance. The shaft is predicted with a linear
+*                       model of the servo shaft driven by the commanded angle,
+*                       while both sensors measure the bearing, i.e. the sum of
+*                       the shaft angle and the offset, with their own noise.
+*                       The numeric type is a template parameter, see
+*                       basic_pid_controller.
+********************************************************************************/
+template<class T = double>
+struct basic_bearing_fusion
+{
+   static constexpr auto START_VARIANCE = 100.0; /* Variance of the offset at start in degrees squared. */
+   static constexpr auto STEP_GATE      = 5.0;   /* Prediction error treated as a step in deviations. */
+   kalman_filter<3, 2, T> filter;                /* Filter with states angle, velocity and offset. */
+   bool enabled         = false;                 /* Indicates if the servo uses the estimate. */
+   bool started         = false;                 /* Indicates if the filter holds a measurement. */
+   double inertia       = 1.0;                   /* Moment of inertia of the shaft model. */
+   double stiffness     = 0.4;                   /* Gain of the position loop of the shaft model. */
+   double damping       = 0.6;                   /* Viscous damping of the shaft model. */
+   double left_noise    = 2.0;                   /* Noise of the left sensor in sensor units. */
+   double right_noise   = 2.0;                   /* Noise of the right sensor in sensor units. */
+   double velocity_step = 0.05;                  /* Unmodelled velocity change per cycle in degrees. */
+   double offset_step   = 1.0;                   /* Disturbance change per cycle in degrees. */
+
+   /********************************************************************************
+   * init: Enables the fusion with specified sensor noise and clears the state.
+   *
+   *       - left_deviation : Noise of the left sensor in sensor units.
+   *       - right_deviation: Noise of the right sensor in sensor units.
+   ********************************************************************************/
+   void init(const double left_deviation,
+             const double right_deviation)
+   {
+      enabled = true;
+      left_noise = left_deviation;
+      right_noise = right_deviation;
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the state, so the next measurements start a new estimate.
+   ********************************************************************************/
+   void reset(void)
+   {
+      started = false;
+      return;
+   }
+
+   /********************************************************************************
+   * update: Predicts the state with the angle commanded last cycle, corrects it
+   *         with specified bearings and returns the bearing estimate. The
+   *         first update starts the estimate at the commanded angle at rest,
+   *         with the mean of the bearings giving the offset.
+   *
+   *         - left_bearing : Bearing measured by the left sensor in degrees.
+   *         - right_bearing: Bearing measured by the right sensor in degrees.
+   *         - command      : Angle commanded last cycle in degrees.
+   *         - scale        : Degrees per sensor unit.
+   ********************************************************************************/
+   T update(const T left_bearing,
+            const T right_bearing,
+            const T command,
+            const double scale)
+   {
+      const T z[2]{ left_bearing, right_bearing };
+
+      if (!started)
+      {
+         start(command, (left_bearing + right_bearing) * 0.5);
+      }
+      else
+      {
+         filter.predict(command);
+      }
+
+      filter.r[0] = scale * scale * left_noise * left_noise;
+      filter.r[1] = scale * scale * right_noise * right_noise;
+      detect_step((left_bearing + right_bearing) * 0.5);
+      filter.correct(z);
+      return estimate();
+   }
+
+   /********************************************************************************
+   * detect_step: Treats a mean bearing further from the prediction than
+   *              STEP_GATE standard deviations as a step of the disturbance,
+   *              where the squared deviation is added to the variance of the
+   *              offset. The estimate then jumps to the new bearing instead
+   *              of approaching it at the modelled rate of change.
+   *
+   *              - bearing: Mean of the measured bearings in degrees.
+   ********************************************************************************/
+   void detect_step(const T bearing)
+   {
+      const auto deviation = numeric_value(bearing - estimate());
+      const auto expected = variance() + (filter.r[0] + filter.r[1]) / 4.0;
+      if (deviation * deviation > STEP_GATE * STEP_GATE * expected) filter.p[2][2] += deviation * deviation;
+      return;
+   }
+
+   /********************************************************************************
+   * estimate: Returns the current bearing estimate in degrees.
+   ********************************************************************************/
+   T estimate(void) const
+   {
+      return filter.x[0] + filter.x[2];
+   }
+
+   /********************************************************************************
+   * variance: Returns the variance of the current bearing estimate in degrees
+   *           squared, where rounding below zero is clamped to zero.
+   ********************************************************************************/
+   double variance(void) const
+   {
+      const auto sum = filter.p[0][0] + 2.0 * filter.p[0][2] + filter.p[2][2];
+      return sum > 0 ? sum : 0.0;
+   }
+
+   /********************************************************************************
+   * start: Sets up the model matrices and starts the estimate at specified
+   *        angle at rest with specified bearing. The shaft angle is assumed
+   *        known, while the offset starts out uncertain, so that it is given
+   *        by the first measurements.
+   *
+   *        - angle  : Start angle of the shaft in degrees.
+   *        - bearing: Measured bearing in degrees.
+   ********************************************************************************/
+   void start(const T angle,
+              const T bearing)
+   {
+      filter = kalman_filter<3, 2, T>();
+      filter.f[0][0] = 1.0 - stiffness / inertia;
+      filter.f[0][1] = 1.0 - damping / inertia;
+      filter.f[1][0] = -stiffness / inertia;
+      filter.f[1][1] = 1.0 - damping / inertia;
+      filter.f[2][2] = 1.0;
+      filter.b[0] = stiffness / inertia;
+      filter.b[1] = stiffness / inertia;
+      filter.h[0][0] = filter.h[0][2] = 1.0;
+      filter.h[1][0] = filter.h[1][2] = 1.0;
+      filter.q[0] = filter.q[1] = velocity_step * velocity_step;
+      filter.q[2] = offset_step * offset_step;
+      filter.x[0] = angle;
+      filter.x[2] = bearing - angle;
+      filter.p[2][2] = START_VARIANCE;
+      started = true;
+      return;
+   }
+};
+
+/********************************************************************************
+* bearing_fusion: Bearing fusion using doubles, used by the emulator.
+********************************************************************************/
+using bearing_fusion = basic_bearing_fusion<double>;
+
+#endif /* KALMAN_FILTER_HPP_ */
\ No newline at end of file
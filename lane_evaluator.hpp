@@ -0,0 +1,238 @@
+/********************************************************************************
+* lane_evaluator.hpp: Contains an engine for evaluating many PID parameter
+*                     sets against the same recorded sensor trace at once.
+*                     Each parameter set is run in its own lane, where the
+*                     lanes are stored as arrays that the compiler turns into
+*                     SIMD instructions. The disturbance of each sample is
+*                     decoded from the trace only once and shared by all
+*                     lanes, while the sensors, controller, shaft and cost of
+*                     each lane are updated side by side, see lane_kernel.hpp.
+********************************************************************************/
+#ifndef LANE_EVALUATOR_HPP_
+#define LANE_EVALUATOR_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "lane_kernel.hpp"
+#include "simulation.hpp"
+
+/********************************************************************************
+* sensor_trace: Struct holding recorded left and right sensor values, sampled
+*               once per control cycle with the servo held at the target angle.
+********************************************************************************/
+struct sensor_trace
+{
+   std::string name;          /* Name of the trace, used for printing. */
+   std::vector<double> left;  /* Recorded values of the left sensor. */
+   std::vector<double> right; /* Recorded values of the right sensor. */
+
+   /********************************************************************************
+   * size: Returns the number of samples in the trace.
+   ********************************************************************************/
+   std::size_t size(void) const
+   {
+      return left.size() < right.size() ? left.size() : right.size();
+   }
+
+   /********************************************************************************
+   * record: Returns a trace of the sensor values seen during referenced scenario
+   *         with the servo held at the target angle, including sensor noise
+   *         of referenced plant model.
+   *
+   *         - config: Reference to servo configuration.
+   *         - model : Reference to plant model.
+   *         - test  : Reference to scenario to record.
+   ********************************************************************************/
+   static sensor_trace record(const servo& config,
+                              const plant_model& model,
+                              const scenario& test)
+   {
+      simulation recorder(config, model);
+      sensor_trace self;
+      self.name = test.name;
+      self.left.resize(test.disturbance.size());
+      self.right.resize(test.disturbance.size());
+
+      for (std::size_t i = 0; i < test.disturbance.size(); ++i)
+      {
+         recorder.sensor_values(config.target() + test.disturbance[i], self.left[i], self.right[i]);
+      }
+      return self;
+   }
+
+   /********************************************************************************
+   * load: Loads a trace from specified file, where each line holds the left and
+   *       right sensor value separated by whitespace. Returns false if the file
+   *       could not be opened or holds no samples.
+   *
+   *       - filepath: Path to the trace file.
+   ********************************************************************************/
+   bool load(const std::string& filepath)
+   {
+      std::ifstream file(filepath);
+      if (!file) return false;
+      auto left_value = 0.0, right_value = 0.0;
+      name = filepath;
+      left.clear();
+      right.clear();
+
+      while (file >> left_value >> right_value)
+      {
+         left.push_back(left_value);
+         right.push_back(right_value);
+      }
+      return !left.empty();
+   }
+};
+
+/********************************************************************************
+* replay: Replays referenced trace in closed loop with a single servo and
+*         returns the resulting metrics. The recorded sensor values are
+*         shifted with the deviation of the shaft from the target, so the
+*         servo sees the trace as if its sensors were mounted on the shaft.
+*         This is the scalar reference for the lane evaluator, where the
+*         sensor values are decoded again for every candidate.
+*
+*         - config: Reference to servo holding configuration and gains.
+*         - model : Reference to plant model.
+*         - trace : Reference to trace to replay.
+********************************************************************************/
+inline metrics replay(const servo& config,
+                      const plant_model& model,
+                      const sensor_trace& trace)
+{
+   simulation run(config, model);
+   auto decoder = config;
+
+   for (std::size_t i = 0; i < trace.size(); ++i)
+   {
+      const auto shift = run.device.input_range() *
+         (run.plant.angle / run.device.target() - 1.0) / 2.0;
+      decoder.left_sensor.val = trace.left[i];
+      decoder.right_sensor.val = trace.right[i];
+      run.step(decoder.input_mapped() - config.target(), trace.left[i] + shift, trace.right[i] - shift);
+   }
+   return run.result;
+}
+
+/********************************************************************************
+* lane_evaluator: Struct for evaluating N sets of PID parameters against the
+*                 same sensor trace in one pass, one set per lane, with the
+*                 lane kernel. The recorded sensor values of each lane are
+*                 shifted with the deviation of the lane's shaft and then
+*                 clamped by the kernel like the sensors of the scalar
+*                 replay, so the results match the replay up to rounding.
+********************************************************************************/
+template<std::size_t N = 8>
+struct lane_evaluator
+{
+   static constexpr std::size_t LANES = N; /* Number of parameter sets per pass. */
+
+   servo config;      /* Servo configuration (target, ranges) shared by all lanes. */
+   plant_model plant; /* Plant model shared by all lanes. */
+
+   /********************************************************************************
+   * lane_evaluator: Initiates lane evaluator with specified servo configuration
+   *                 and plant model.
+   *
+   *                 - config: Reference to servo configuration.
+   *                 - plant : Reference to plant model (default = default model).
+   ********************************************************************************/
+   lane_evaluator(const servo& config,
+                  const plant_model& plant = plant_model())
+      : config(config), plant(plant) { }
+
+   /********************************************************************************
+   * evaluate: Replays referenced trace with N sets of PID parameters at once
+   *           and adds the metrics of each lane to referenced results.
+   *           Unused lanes can be filled with any parameters. A servo
+   *           configuration the lane kernel does not cover is replayed one
+   *           set at a time with the scalar replay instead.
+   *
+   *           - gains  : Pointer to N sets of PID parameters.
+   *           - trace  : Reference to trace to replay.
+   *           - results: Pointer to N metrics, to which the results are added.
+   ********************************************************************************/
+   void evaluate(const pid_gains* gains,
+                 const sensor_trace& trace,
+                 metrics* results) const
+   {
+      if (!lane_kernel<N>::supports(config))
+      {
+         for (std::size_t l = 0; l < N; ++l)
+         {
+            auto candidate = config;
+            candidate.pid.set_gains(gains[l]);
+            results[l].combine(replay(candidate, plant, trace));
+         }
+         return;
+      }
+
+      lane_kernel<N> lanes;
+      alignas(64) double left[N], right[N];
+      const auto target = config.target();
+      const auto range = config.input_range();
+      auto decoder = config;
+      lanes.start(config);
+
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         lanes.set_gains(l, gains[l]);
+         lanes.set_plant(l, plant);
+      }
+
+      for (std::size_t i = 0; i < trace.size(); ++i)
+      {
+         decoder.left_sensor.val = trace.left[i];
+         decoder.right_sensor.val = trace.right[i];
+         lanes.measure(decoder.input_mapped() - target);
+
+         for (std::size_t l = 0; l < N; ++l)
+         {
+            const auto shift = range * (lanes.angle[l] / target - 1.0) / 2.0;
+            left[l] = trace.left[i] + shift;
+            right[l] = trace.right[i] - shift;
+         }
+
+         lanes.regulate(left, right);
+         lanes.actuate();
+      }
+
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         results[l].combine(lanes.result(l));
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * evaluate: Replays every trace of referenced suite with N sets of PID
+   *           parameters at once and stores the combined metrics of each lane
+   *           in referenced results.
+   *
+   *           - gains  : Pointer to N sets of PID parameters.
+   *           - traces : Reference to traces to replay.
+   *           - results: Pointer to storage for N metrics.
+   ********************************************************************************/
+   void evaluate(const pid_gains* gains,
+                 const std::vector<sensor_trace>& traces,
+                 metrics* results) const
+   {
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         results[l] = metrics();
+      }
+
+      for (const auto& i : traces)
+      {
+         evaluate(gains, i, results);
+      }
+      return;
+   }
+};
+
+#endif /* LANE_EVALUATOR_HPP_ */
\ No newline at end of file
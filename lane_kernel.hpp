@@ -0,0 +1,245 @@
+/********************************************************************************
+* lane_kernel.hpp: Contains the control loop of the servo against the simulated
+*                  plant for N lanes side by side, shared by the lane evaluator
+*                  and the ensemble evaluator. Every lane has its own PID
+*                  parameters and plant constants, and its state is stored as
+*                  arrays of N values, so that every step of a cycle is a
+*                  short fixed length loop without branches, which the
+*                  compiler vectorizes. The evaluators only differ in how the
+*                  sensor values of each lane are produced.
+*
+*                  The operations match basic_simulation::step with a servo
+*                  regulated every cycle, so the results equal the scalar
+*                  simulation. The kernel covers the servo with its sensor
+*                  pair clamped to the sensor range and the PID controller
+*                  only. A servo using any further stage, see supports, must
+*                  be run with the scalar simulation instead.
+********************************************************************************/
+#ifndef LANE_KERNEL_HPP_
+#define LANE_KERNEL_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include "simulation.hpp"
+
+/********************************************************************************
+* lane_kernel: Struct for implementation of N servo control loops run side by
+*              side against N plants, one cycle at a time. A cycle is run by
+*              measure, regulate and actuate, like a scalar simulation.
+********************************************************************************/
+template<std::size_t N = 8>
+struct lane_kernel
+{
+   static constexpr std::size_t LANES = N; /* Number of lanes. */
+
+   alignas(64) double kp[N];         /* Proportional constant of each lane. */
+   alignas(64) double ki[N];         /* Integrate constant of each lane. */
+   alignas(64) double kd[N];         /* Derivate constant of each lane. */
+   alignas(64) double inertia[N];    /* Moment of inertia of the plant of each lane. */
+   alignas(64) double stiffness[N];  /* Gain of the internal position loop of each lane. */
+   alignas(64) double damping[N];    /* Viscous damping of the plant of each lane. */
+   alignas(64) double friction[N];   /* Coulomb friction of the plant of each lane. */
+   alignas(64) double rate_limit[N]; /* Maximum angular velocity of each lane. */
+   alignas(64) double integrate[N];  /* Integral value of the controller of each lane. */
+   alignas(64) double last_error[N]; /* Last error of the controller of each lane. */
+   alignas(64) double output[N];     /* Commanded angle of each lane. */
+   alignas(64) double angle[N];      /* Shaft angle of each lane. */
+   alignas(64) double velocity[N];   /* Shaft velocity of each lane. */
+   alignas(64) double sign[N];       /* Sign of the error directly after the last step. */
+   alignas(64) double iae[N];        /* Integral of absolute error of each lane. */
+   alignas(64) double ise[N];        /* Integral of squared error of each lane. */
+   alignas(64) double itae[N];       /* Integral of time weighted absolute error of each lane. */
+   alignas(64) double overshoot[N];  /* Largest excursion past the target of each lane. */
+   alignas(64) double settling[N];   /* Longest settling time of each lane. */
+   alignas(64) double effort[N];     /* Total travel of the commanded angle of each lane. */
+
+   double target           = 90;   /* Target angle shared by all lanes. */
+   double output_min       = 0;    /* Minimum servo angle. */
+   double output_max       = 180;  /* Maximum servo angle. */
+   double sensor_min       = 0;    /* Minimum sensor value. */
+   double sensor_max       = 1023; /* Maximum sensor value. */
+   double range            = 1023; /* Range of the sensor values. */
+   double last_disturbance = 0;    /* Disturbance of last cycle, used for step detection. */
+   std::size_t step_cycle  = 0;    /* Cycle of the last step. */
+   std::size_t cycles      = 0;    /* Number of cycles run. */
+
+   /********************************************************************************
+   * supports: Returns true if referenced servo configuration is covered by the
+   *           kernel, i.e. if it uses no stage beyond the sensor pair and the
+   *           PID controller regulated every cycle.
+   *
+   *           - config: Reference to servo configuration.
+   ********************************************************************************/
+   static bool supports(const servo& config)
+   {
+      return config.oversampling() == 1 && !config.left_filter.stages && !config.right_filter.stages &&
+         !config.fusion.enabled && !config.array.count && !config.health.enabled &&
+         !config.oscillation.enabled && !config.rate.enabled && !config.control.plane &&
+         !config.autotuner.active() && !config.left_sensor.calibration && !config.right_sensor.calibration;
+   }
+
+   /********************************************************************************
+   * start: Starts a new run of every lane with the target and ranges of
+   *        referenced servo configuration, the servo reset and the shaft at
+   *        rest at the target angle. The gains and plant constants of the
+   *        lanes are set separately.
+   *
+   *        - config: Reference to servo configuration.
+   ********************************************************************************/
+   void start(const servo& config)
+   {
+      target = config.target();
+      output_min = config.pid.output_min;
+      output_max = config.pid.output_max;
+      sensor_min = config.left_sensor.min;
+      sensor_max = config.left_sensor.max;
+      range = config.input_range();
+      last_disturbance = 0;
+      step_cycle = 0;
+      cycles = 0;
+      const auto reset = target < output_min ? output_min : (target > output_max ? output_max : target);
+
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         integrate[l] = last_error[l] = velocity[l] = sign[l] = 0;
+         output[l] = reset;
+         angle[l] = target;
+         iae[l] = ise[l] = itae[l] = overshoot[l] = settling[l] = effort[l] = 0;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * set_gains: Sets the PID parameters of specified lane.
+   *
+   *            - lane : Index of the lane.
+   *            - gains: Reference to PID parameters.
+   ********************************************************************************/
+   void set_gains(const std::size_t lane,
+                  const pid_gains& gains)
+   {
+      kp[lane] = gains.kp;
+      ki[lane] = gains.ki;
+      kd[lane] = gains.kd;
+      return;
+   }
+
+   /********************************************************************************
+   * set_plant: Sets the plant constants of specified lane.
+   *
+   *            - lane : Index of the lane.
+   *            - model: Reference to plant model.
+   ********************************************************************************/
+   void set_plant(const std::size_t lane,
+                  const plant_model& model)
+   {
+      inertia[lane] = model.inertia;
+      stiffness[lane] = model.stiffness;
+      damping[lane] = model.damping;
+      friction[lane] = model.friction;
+      rate_limit[lane] = model.rate_limit;
+      return;
+   }
+
+   /********************************************************************************
+   * measure: Updates the metrics of every lane with the error of this cycle,
+   *          ahead of the regulation, see basic_simulation::measure.
+   *
+   *          - disturbance: Bearing disturbance of this cycle in degrees.
+   ********************************************************************************/
+   void measure(const double disturbance)
+   {
+      const auto step = cycles == 0 || std::fabs(disturbance - last_disturbance) > simulation::STEP_THRESHOLD;
+      if (step) step_cycle = cycles;
+      const auto reset = step ? 1.0 : 0.0;
+      const auto elapsed = static_cast<double>(cycles - step_cycle);
+      const auto band = simulation::SETTLING_BAND;
+
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         const auto error = target - (angle[l] + disturbance);
+         const auto abs_error = std::fabs(error);
+         const auto error_sign = (error > 0 ? 1.0 : 0.0) - (error < 0 ? 1.0 : 0.0);
+         sign[l] = reset * error_sign + (1.0 - reset) * sign[l];
+         iae[l] += abs_error;
+         ise[l] += error * error;
+         itae[l] += elapsed * abs_error;
+         overshoot[l] = -sign[l] * error > overshoot[l] ? -sign[l] * error : overshoot[l];
+         settling[l] = abs_error > band && elapsed + 1 > settling[l] ? elapsed + 1 : settling[l];
+      }
+
+      last_disturbance = disturbance;
+      return;
+   }
+
+   /********************************************************************************
+   * regulate: Clamps specified sensor values of every lane to the sensor range,
+   *           maps them to the input of the servo and regulates the output of
+   *           the controller of every lane, see basic_servo::sample.
+   *
+   *           - left : Pointer to the left sensor value of each lane.
+   *           - right: Pointer to the right sensor value of each lane.
+   ********************************************************************************/
+   void regulate(const double* left,
+                 const double* right)
+   {
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         const auto left_value = left[l] < sensor_min ? sensor_min : (left[l] > sensor_max ? sensor_max : left[l]);
+         const auto right_value = right[l] < sensor_min ? sensor_min :
+            (right[l] > sensor_max ? sensor_max : right[l]);
+         const auto input = ((left_value - right_value) + range) / 2.0 / range * (target * 2);
+         const auto error = target - input;
+         integrate[l] += error;
+         auto new_output = target + kp[l] * error + ki[l] * integrate[l] + kd[l] * (error - last_error[l]);
+         new_output = new_output < output_min ? output_min : (new_output > output_max ? output_max : new_output);
+         last_error[l] = error;
+         effort[l] += std::fabs(new_output - output[l]);
+         output[l] = new_output;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * actuate: Drives the shaft of every lane towards its commanded angle and
+   *          completes the cycle, see basic_plant_model::step.
+   ********************************************************************************/
+   void actuate(void)
+   {
+      for (std::size_t l = 0; l < N; ++l)
+      {
+         const auto direction = (velocity[l] > 0 ? 1.0 : 0.0) - (velocity[l] < 0 ? 1.0 : 0.0);
+         auto acceleration = (stiffness[l] * (output[l] - angle[l]) - damping[l] * velocity[l]) / inertia[l];
+         acceleration -= direction * (friction[l] / inertia[l]);
+         auto new_velocity = velocity[l] + acceleration;
+         new_velocity = new_velocity > rate_limit[l] ? rate_limit[l] : new_velocity;
+         new_velocity = new_velocity < -rate_limit[l] ? -rate_limit[l] : new_velocity;
+         velocity[l] = new_velocity;
+         angle[l] += new_velocity;
+      }
+
+      cycles++;
+      return;
+   }
+
+   /********************************************************************************
+   * result: Returns the metrics accumulated by specified lane so far.
+   *
+   *         - lane: Index of the lane.
+   ********************************************************************************/
+   metrics result(const std::size_t lane) const
+   {
+      metrics self;
+      self.iae = iae[lane];
+      self.ise = ise[lane];
+      self.itae = itae[lane];
+      self.overshoot = overshoot[lane];
+      self.settling_time = settling[lane];
+      self.effort = effort[lane];
+      self.cycles = cycles;
+      return self;
+   }
+};
+
+#endif /* LANE_KERNEL_HPP_ */
\ No newline at end of file
@@ -0,0 +1,379 @@
+/********************************************************************************
+* loop_analysis.hpp: Contains analytic analysis of the servo loop in the z-domain.
+*                    The PID controller and the linear part of the plant
+*                    model are described by their discrete transfer
+*                    functions, from which the closed-loop poles, the gain
+*                    and phase margins and the error response to a step of
+*                    the bearing are calculated without running the servo.
+*
+*                    The controller transfer function matches the update of
+*                    pid_controller::regulate, where the integral includes
+*                    the current error and the derivate is the difference to
+*                    the last error:
+*
+*                       C(z) = kp + ki * z / (z - 1) + kd * (z - 1) / z
+*
+*                    The plant transfer function from commanded angle to
+*                    shaft angle matches plant_model::step, with s and d as
+*                    stiffness and damping divided by the inertia:
+*
+*                       P(z) = s * z / ((z - 1) * (z - 1 + d) + s * z)
+*
+*                    The commanded angle acts on the shaft angle one cycle
+*                    later, since the sensors are read before the shaft is
+*                    moved. Output clamping, rate limit and friction are not
+*                    part of the analysis, so the predictions hold as long as
+*                    the servo stays within its limits.
+********************************************************************************/
+#ifndef LOOP_ANALYSIS_HPP_
+#define LOOP_ANALYSIS_HPP_
+
+/* Include directives: */
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include "simulation.hpp"
+
+/********************************************************************************
+* loop_analysis: Struct for analysis of the closed servo loop with specified
+*                PID parameters and plant model. The analysis is done when
+*                the struct is created and takes a few microseconds.
+********************************************************************************/
+struct loop_analysis
+{
+   using complex = std::complex<double>;               /* Complex number for poles and frequency responses. */
+   using quadratic = std::array<double, 3>;            /* Polynomial of degree 2 in descending powers of z. */
+   using quartic = std::array<double, 5>;              /* Polynomial of degree 4 in descending powers of z. */
+   static constexpr std::size_t NUM_FREQUENCIES = 64;  /* Frequencies scanned for the margins. */
+
+   quadratic controller_numerator{};     /* Numerator of C(z). */
+   quadratic controller_denominator{};   /* Denominator of C(z), i.e. z * (z - 1). */
+   quadratic plant_numerator{};          /* Numerator of P(z). */
+   quadratic plant_denominator{};        /* Denominator of P(z). */
+   quartic characteristic{};             /* Characteristic polynomial of the closed loop. */
+   std::array<complex, 4> poles{};       /* Closed-loop poles. */
+   double spectral_radius = 0;           /* Largest magnitude of the closed-loop poles. */
+   double gain_margin     = 0;           /* Gain margin as a factor, infinite without phase crossover. */
+   double phase_margin    = 0;           /* Phase margin in degrees, infinite without gain crossover. */
+   double crossover       = 0;           /* Gain crossover frequency in radians per cycle. */
+
+   /********************************************************************************
+   * loop_analysis: Analyzes the servo loop with specified PID parameters and
+   *                plant model. The poles take well below a microsecond,
+   *                while the margins need a scan of the frequency response
+   *                and can be skipped when only the stability is of interest.
+   *
+   *                - gains       : Reference to PID parameters.
+   *                - plant       : Reference to plant model (default = default model).
+   *                - with_margins: Calculates the margins if true (default = true).
+   ********************************************************************************/
+   loop_analysis(const pid_gains& gains,
+                 const plant_model& plant = plant_model(),
+                 const bool with_margins = true)
+   {
+      const auto stiffness = plant.stiffness / plant.inertia;
+      const auto damping = plant.damping / plant.inertia;
+
+      controller_numerator = quadratic{ gains.kp + gains.ki + gains.kd, -gains.kp - 2.0 * gains.kd, gains.kd };
+      controller_denominator = quadratic{ 1.0, -1.0, 0.0 };
+      plant_numerator = quadratic{ 0.0, stiffness, 0.0 };
+      plant_denominator = quadratic{ 1.0, stiffness + damping - 2.0, 1.0 - damping };
+
+      const auto open = multiply(controller_numerator, plant_numerator);
+      const auto closed = multiply(controller_denominator, plant_denominator);
+
+      for (std::size_t i = 0; i < characteristic.size(); ++i)
+      {
+         characteristic[i] = closed[i] + open[i];
+      }
+
+      find_poles();
+      if (with_margins) find_margins();
+      return;
+   }
+
+   /********************************************************************************
+   * stable: Returns true if every closed-loop pole is inside the unit circle.
+   ********************************************************************************/
+   bool stable(void) const
+   {
+      return spectral_radius < 1.0;
+   }
+
+   /********************************************************************************
+   * open_loop: Returns the open loop frequency response C * P at specified
+   *            frequency.
+   *
+   *            - omega: Frequency in radians per cycle.
+   ********************************************************************************/
+   complex open_loop(const double omega) const
+   {
+      const auto z = complex(std::cos(omega), std::sin(omega));
+      const auto denominator = evaluate(controller_denominator, z) * evaluate(plant_denominator, z);
+      return evaluate(controller_numerator, z) * evaluate(plant_numerator, z) *
+         std::conj(denominator) / std::norm(denominator);
+   }
+
+   /********************************************************************************
+   * controller: Returns the frequency response C of the PID controller at
+   *             specified frequency.
+   *
+   *             - omega: Frequency in radians per cycle.
+   ********************************************************************************/
+   complex controller(const double omega) const
+   {
+      const auto z = complex(std::cos(omega), std::sin(omega));
+      return evaluate(controller_numerator, z) / evaluate(controller_denominator, z);
+   }
+
+   /********************************************************************************
+   * predict_step: Returns the metrics predicted for a step of the bearing with
+   *               specified amplitude, starting from a settled servo. The error
+   *               and commanded angle are calculated with the difference
+   *               equations of the closed-loop transfer functions from the
+   *               disturbance, E = -S and U = -C * S, where S = 1 / (1 + C * P).
+   *
+   *               - amplitude: Size of the step in degrees.
+   *               - cycles   : Number of cycles to predict.
+   ********************************************************************************/
+   metrics predict_step(const double amplitude,
+                        const std::size_t cycles) const
+   {
+      const auto error_numerator = multiply(controller_denominator, plant_denominator);
+      const auto output_numerator = multiply(controller_numerator, plant_denominator);
+      const auto sign = amplitude > 0 ? 1.0 : (amplitude < 0 ? -1.0 : 0.0);
+      std::array<double, 4> errors{}, outputs{};
+      metrics result;
+
+      for (std::size_t k = 0; k < cycles; ++k)
+      {
+         auto error = 0.0, output = 0.0;
+
+         for (std::size_t i = 0; i < 5; ++i)
+         {
+            const auto disturbance = k >= i ? amplitude : 0.0;
+            error -= error_numerator[i] * disturbance;
+            output -= output_numerator[i] * disturbance;
+
+            if (i > 0)
+            {
+               error -= characteristic[i] * errors[i - 1];
+               output -= characteristic[i] * outputs[i - 1];
+            }
+         }
+
+         const auto abs_error = std::fabs(error);
+         result.iae += abs_error;
+         result.ise += error * error;
+         result.itae += k * abs_error;
+         result.effort += std::fabs(output - outputs[0]);
+         if (sign * error > result.overshoot) result.overshoot = sign * error;
+         if (abs_error > simulation::SETTLING_BAND) result.settling_time = static_cast<double>(k + 1);
+
+         for (std::size_t i = 3; i > 0; --i)
+         {
+            errors[i] = errors[i - 1];
+            outputs[i] = outputs[i - 1];
+         }
+
+         errors[0] = error;
+         outputs[0] = output;
+      }
+
+      result.cycles = cycles;
+      return result;
+   }
+
+   /********************************************************************************
+   * print: Prints the closed-loop poles and the stability margins.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      ostream << std::fixed << std::setprecision(4);
+      ostream << "Closed-loop poles:\t\t";
+
+      for (std::size_t i = 0; i < poles.size(); ++i)
+      {
+         ostream << (i > 0 ? ", " : "") << poles[i].real() << (poles[i].imag() < 0 ? " - " : " + ")
+                 << std::fabs(poles[i].imag()) << "i";
+      }
+
+      ostream << "\nSpectral radius:\t\t" << spectral_radius << (stable() ? " (stable)\n" : " (unstable)\n");
+      ostream << std::setprecision(2);
+      ostream << "Gain margin:\t\t\t" << gain_margin << " (" << 20.0 * std::log10(gain_margin) << " dB)\n";
+      ostream << "Phase margin:\t\t\t" << phase_margin << " degrees\n";
+      ostream << std::setprecision(4);
+      ostream << "Crossover frequency:\t\t" << crossover << " rad/cycle\n";
+      return;
+   }
+
+   /********************************************************************************
+   * find_poles: Calculates the roots of the characteristic polynomial. Both
+   *             C(z) * P(z) and the denominators share a factor z, so one
+   *             pole is always at the origin and the rest are the roots of a
+   *             cubic, which are calculated in closed form (Cardano).
+   ********************************************************************************/
+   void find_poles(void)
+   {
+      const auto pi = 3.14159265358979323846;
+      const auto a = characteristic[1], b = characteristic[2], c = characteristic[3];
+      const auto p = b - a * a / 3.0;
+      const auto q = 2.0 * a * a * a / 27.0 - a * b / 3.0 + c;
+      const auto discriminant = q * q / 4.0 + p * p * p / 27.0;
+
+      if (discriminant >= 0)
+      {
+         const auto root = std::sqrt(discriminant);
+         const auto real = std::cbrt(-q / 2.0 + root) + std::cbrt(-q / 2.0 - root) - a / 3.0;
+         const auto linear = a + real;
+         const auto constant = b + linear * real;
+         const auto offset = std::sqrt(complex(linear * linear / 4.0 - constant, 0.0));
+         poles[0] = complex(real, 0.0);
+         poles[1] = -linear / 2.0 + offset;
+         poles[2] = -linear / 2.0 - offset;
+      }
+      else
+      {
+         const auto radius = 2.0 * std::sqrt(-p / 3.0);
+         const auto angle = std::acos(3.0 * q / (p * radius)) / 3.0;
+
+         for (std::size_t k = 0; k < 3; ++k)
+         {
+            poles[k] = complex(radius * std::cos(angle - 2.0 * pi * k / 3.0) - a / 3.0, 0.0);
+         }
+      }
+
+      poles[3] = complex(0.0, 0.0);
+      spectral_radius = 0;
+
+      for (const auto& i : poles)
+      {
+         spectral_radius = std::max(spectral_radius, std::abs(i));
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * find_margins: Scans the open loop frequency response from low frequencies
+   *               up to the Nyquist frequency for the gain crossover, where
+   *               |C * P| = 1, and the phase crossover, where the phase passes
+   *               -180 degrees. The phase is unwrapped along the scan, and each
+   *               crossover found is refined with bisection.
+   ********************************************************************************/
+   void find_margins(void)
+   {
+      const auto pi = 3.14159265358979323846;
+      const auto lowest = 1e-3;
+      const auto ratio = std::pow(pi / lowest, 1.0 / (NUM_FREQUENCIES - 1));
+      auto last_omega = lowest;
+      auto last_magnitude = std::abs(open_loop(lowest));
+      auto last_phase = std::arg(open_loop(lowest)) * 180.0 / pi;
+      gain_margin = std::numeric_limits<double>::infinity();
+      phase_margin = std::numeric_limits<double>::infinity();
+      crossover = 0;
+
+      for (std::size_t i = 1; i < NUM_FREQUENCIES; ++i)
+      {
+         const auto omega = i + 1 < NUM_FREQUENCIES ? last_omega * ratio : pi;
+         const auto response = open_loop(omega);
+         const auto magnitude = std::abs(response);
+         const auto phase = unwrap(std::arg(response) * 180.0 / pi, last_phase);
+
+         if (crossover == 0 && last_magnitude >= 1.0 && magnitude < 1.0)
+         {
+            auto low = last_omega, high = omega;
+
+            for (auto j = 0; j < 12; ++j)
+            {
+               const auto middle = (low + high) / 2.0;
+               (std::abs(open_loop(middle)) >= 1.0 ? low : high) = middle;
+            }
+
+            crossover = (low + high) / 2.0;
+            phase_margin = 180.0 + unwrap(std::arg(open_loop(crossover)) * 180.0 / pi, last_phase);
+         }
+
+         if (std::isinf(gain_margin) && last_phase > -180.0 && phase <= -180.0)
+         {
+            auto low = last_omega, high = omega;
+
+            for (auto j = 0; j < 12; ++j)
+            {
+               const auto middle = (low + high) / 2.0;
+               (unwrap(std::arg(open_loop(middle)) * 180.0 / pi, last_phase) > -180.0 ? low : high) = middle;
+            }
+
+            gain_margin = 1.0 / std::abs(open_loop((low + high) / 2.0));
+         }
+
+         last_omega = omega;
+         last_magnitude = magnitude;
+         last_phase = phase;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * unwrap: Returns specified phase shifted by whole turns to lie within half a
+   *         turn of a reference phase.
+   *
+   *         - phase    : Phase in degrees.
+   *         - reference: Reference phase in degrees.
+   ********************************************************************************/
+   static double unwrap(double phase,
+                        const double reference)
+   {
+      while (phase - reference > 180.0) phase -= 360.0;
+      while (phase - reference < -180.0) phase += 360.0;
+      return phase;
+   }
+
+   /********************************************************************************
+   * multiply: Returns the product of two polynomials of degree 2.
+   *
+   *           - a: Reference to first polynomial.
+   *           - b: Reference to second polynomial.
+   ********************************************************************************/
+   static quartic multiply(const quadratic& a,
+                           const quadratic& b)
+   {
+      quartic product{};
+
+      for (std::size_t i = 0; i < a.size(); ++i)
+      {
+         for (std::size_t j = 0; j < b.size(); ++j)
+         {
+            product[i + j] += a[i] * b[j];
+         }
+      }
+      return product;
+   }
+
+   /********************************************************************************
+   * evaluate: Returns the value of specified polynomial at specified point,
+   *           calculated with Horner's method.
+   *
+   *           - polynomial: Reference to coefficients in descending powers.
+   *           - z         : Point to evaluate the polynomial at.
+   ********************************************************************************/
+   template<std::size_t N>
+   static complex evaluate(const std::array<double, N>& polynomial,
+                           const complex z)
+   {
+      auto value = complex(0.0, 0.0);
+
+      for (const auto i : polynomial)
+      {
+         value = value * z + i;
+      }
+      return value;
+   }
+};
+
+#endif /* LOOP_ANALYSIS_HPP_ */
\ No newline at end of file
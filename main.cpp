@@ -11,14 +11,23 @@
 *           keep the servo heading towards the target. The target angle and 
 *           current servo angle is printed in the terminal along with mapped
 *           input value read from the sensors.
+*
+*           If a command line argument is passed, the corresponding tool in
+*           commands.hpp is run instead, for instance the offline PID tuner.
 ********************************************************************************/
 #include "servo.hpp"
+#include "commands.hpp"
 
 /********************************************************************************
-* main: Initates a new servo and runs it continuously.
+* main: Initates a new servo and runs it continuously. If a command line
+*       argument is passed, the selected tool is run instead.
+*
+*       - argc: Number of command line arguments.
+*       - argv: Command line arguments.
 ********************************************************************************/
-int main(void)
+int main(int argc, char** argv)
 {
+   if (argc > 1) return commands::run(argc, argv);
    servo servo1(90, 30, 150, 0, 1023);
    
    while (1)
@@ -0,0 +1,168 @@
+/********************************************************************************
+* oscillation_detector.hpp: Contains an online detector of sustained
+*                           oscillation of a PID controlled loop, i.e. a limit
+*                           cycle caused by too aggressive gains. The error is
+*                           split into half cycles at its zero crossings, with
+*                           a hysteresis band so that noise around zero does
+*                           not count as crossings. A half cycle counts towards
+*                           an oscillation if its peak error exceeds a smallest
+*                           amplitude and it ends within a longest half period.
+*                           A number of such half cycles in a row flags a
+*                           sustained oscillation.
+*
+*                           The detector only holds a few counters and running
+*                           values, so a cycle costs a few comparisons. When
+*                           enabled with backoff, the proportional and derivate
+*                           constants are scaled back in bounded steps while
+*                           the oscillation persists.
+********************************************************************************/
+#ifndef OSCILLATION_DETECTOR_HPP_
+#define OSCILLATION_DETECTOR_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include "pid_controller.hpp"
+
+/********************************************************************************
+* oscillation_detector: Struct for implementation of zero crossing based
+*                       oscillation detection with optional gain backoff.
+********************************************************************************/
+struct oscillation_detector
+{
+   bool enabled                = false; /* Indicates if the error is monitored. */
+   bool backoff                = false; /* Scales back the gains on oscillation if true. */
+   double hysteresis           = 0.5;   /* Error hysteresis of a zero crossing in degrees. */
+   double min_amplitude        = 2.0;   /* Smallest peak error of an oscillation in degrees. */
+   std::size_t max_half_period = 50;    /* Longest half period of an oscillation in cycles. */
+   std::size_t min_half_cycles = 8;     /* Half cycles in a row flagging an oscillation. */
+   double backoff_factor       = 0.8;   /* Factor scaling kp and kd per backoff step. */
+   double min_scale            = 0.25;  /* Smallest total scale of kp and kd. */
+
+   bool oscillating        = false; /* Indicates if a sustained oscillation is flagged. */
+   double sign             = 0;     /* Sign of the error in the current half cycle. */
+   double peak             = 0;     /* Largest absolute error of the current half cycle. */
+   std::size_t length      = 0;     /* Cycles in the current half cycle. */
+   std::size_t half_cycles = 0;     /* Oscillating half cycles in a row. */
+   double amplitude        = 0;     /* Mean peak error of the oscillation in degrees. */
+   double period           = 0;     /* Mean period of the oscillation in cycles. */
+   double scale            = 1;     /* Total scale applied to kp and kd. */
+   std::size_t cycles      = 0;     /* Number of cycles monitored. */
+   std::size_t detections  = 0;     /* Number of oscillations flagged. */
+   std::size_t backoffs    = 0;     /* Number of backoff steps taken. */
+
+   /********************************************************************************
+   * init: Enables the detector with specified backoff setting and clears the
+   *       state.
+   *
+   *       - scale_back: Scales back the gains on oscillation if true.
+   ********************************************************************************/
+   void init(const bool scale_back)
+   {
+      enabled = true;
+      backoff = scale_back;
+      scale = 1;
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the current half cycle and the oscillation flag, while the
+   *        counters and the applied scale are kept.
+   ********************************************************************************/
+   void reset(void)
+   {
+      oscillating = false;
+      sign = 0;
+      peak = 0;
+      length = 0;
+      half_cycles = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * update: Adds the error of a new cycle and returns true if a sustained
+   *         oscillation is flagged. An error beyond the hysteresis band on the
+   *         other side of zero ends the current half cycle, which counts
+   *         towards an oscillation if it was large and short enough. A half
+   *         cycle running longer than the longest half period clears the
+   *         count, so a settled loop stops being flagged.
+   *
+   *         - error: Error of the PID controller in degrees.
+   ********************************************************************************/
+   bool update(const double error)
+   {
+      cycles++;
+      length++;
+      const auto magnitude = std::fabs(error);
+      if (magnitude > peak) peak = magnitude;
+
+      if ((sign >= 0 && error < -hysteresis) || (sign <= 0 && error > hysteresis))
+      {
+         if (sign != 0 && peak >= min_amplitude && length <= max_half_period)
+         {
+            half_cycles++;
+            amplitude = half_cycles == 1 ? peak : amplitude + 0.25 * (peak - amplitude);
+            period = half_cycles == 1 ? 2.0 * length : period + 0.25 * (2.0 * length - period);
+         }
+         else
+         {
+            half_cycles = 0;
+         }
+
+         sign = error > 0 ? 1.0 : -1.0;
+         peak = magnitude;
+         length = 0;
+      }
+      else if (length > max_half_period)
+      {
+         half_cycles = 0;
+      }
+
+      if (half_cycles >= min_half_cycles && !oscillating) detections++;
+      oscillating = half_cycles >= min_half_cycles;
+      return oscillating;
+   }
+
+   /********************************************************************************
+   * back_off: Scales back kp and kd of referenced controller by the backoff
+   *           factor if an oscillation is flagged, backoff is enabled and the
+   *           total scale stays above its minimum. The half cycles are then
+   *           counted anew, so the next step needs another sustained
+   *           oscillation. Returns true if the gains were scaled.
+   *
+   *           - pid: Reference to the PID controller.
+   ********************************************************************************/
+   template<class T>
+   bool back_off(basic_pid_controller<T>& pid)
+   {
+      if (!oscillating || !backoff || scale * backoff_factor < min_scale) return false;
+      pid.kp *= backoff_factor;
+      pid.kd *= backoff_factor;
+      scale *= backoff_factor;
+      backoffs++;
+      half_cycles = 0;
+      oscillating = false;
+      return true;
+   }
+
+   /********************************************************************************
+   * print: Prints the state of the detector in the terminal.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      ostream << std::fixed << std::setprecision(2);
+      ostream << "Oscillating:\t\t\t" << (oscillating ? "yes" : "no") << "\n";
+      ostream << "Amplitude:\t\t\t" << amplitude << " degrees\n";
+      ostream << "Period:\t\t\t\t" << period << " cycles\n";
+      ostream << "Gain scale:\t\t\t" << scale << " (" << backoffs << " backoff steps)\n";
+      ostream << "Detections:\t\t\t" << detections << " in " << cycles << " cycles\n";
+      return;
+   }
+};
+
+#endif /* OSCILLATION_DETECTOR_HPP_ */
\ No newline at end of file
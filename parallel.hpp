@@ -0,0 +1,91 @@
+/********************************************************************************
+* parallel.hpp: Contains miscellaneous functions for spreading independent
+*               work items, such as simulations of candidate PID parameters,
+*               across all available CPU cores.
+********************************************************************************/
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+/* Include directives: */
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/********************************************************************************
+* parallel: Namespace containing functions for parallel execution.
+********************************************************************************/
+namespace parallel
+{
+   /********************************************************************************
+   * num_threads: Returns the number of hardware threads available. If the
+   *              number cannot be determined, 1 is returned.
+   ********************************************************************************/
+   inline std::size_t num_threads(void)
+   {
+      const auto count = std::thread::hardware_concurrency();
+      return count > 0 ? static_cast<std::size_t>(count) : 1;
+   }
+
+   /********************************************************************************
+   * for_each_index: Calls referenced function once for every index between 0
+   *                 and specified count. The indexes are handed out to the
+   *                 worker threads in small chunks from a shared counter, so
+   *                 that work items of different length are balanced between
+   *                 the threads. The calling thread takes part in the work.
+   *                 The function must be safe to call from several threads
+   *                 at once for different indexes.
+   *
+   *                 - count      : Number of work items.
+   *                 - function   : Function to call with each index.
+   *                 - threads    : Maximum number of threads to use
+   *                                (default = all hardware threads).
+   *                 - chunk_size : Number of indexes fetched at a time
+   *                                (default = 1).
+   ********************************************************************************/
+   template<class Function>
+   void for_each_index(const std::size_t count,
+                       Function&& function,
+                       const std::size_t threads = num_threads(),
+                       const std::size_t chunk_size = 1)
+   {
+      std::atomic<std::size_t> next{ 0 };
+      const auto chunk = chunk_size > 0 ? chunk_size : 1;
+
+      auto worker = [&](void)
+      {
+         while (1)
+         {
+            const auto begin = next.fetch_add(chunk);
+            if (begin >= count) return;
+            const auto end = begin + chunk < count ? begin + chunk : count;
+
+            for (auto i = begin; i < end; ++i)
+            {
+               function(i);
+            }
+         }
+      };
+
+      auto num_workers = threads > 0 ? threads : 1;
+      if (num_workers > count) num_workers = count > 0 ? count : 1;
+
+      std::vector<std::thread> workers;
+      workers.reserve(num_workers - 1);
+
+      for (std::size_t i = 1; i < num_workers; ++i)
+      {
+         workers.emplace_back(worker);
+      }
+
+      worker();
+
+      for (auto& i : workers)
+      {
+         i.join();
+      }
+      return;
+   }
+}
+
+#endif /* PARALLEL_HPP_ */
\ No newline at end of file
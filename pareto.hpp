@@ -0,0 +1,435 @@
+/********************************************************************************
+* pareto.hpp: Contains a multi-objective search (NSGA-II) for PID parameters.
+*             Instead of weighting the metrics into a single cost, the search
+*             keeps every candidate that is not beaten on all objectives at
+*             once by another candidate, i.e. the non-dominated set, so that
+*             the trade-off between settling time, overshoot and actuator
+*             effort can be chosen afterwards.
+*
+*             The populations are evaluated in parallel on all cores. The
+*             genes are rounded to a fixed grid in logarithmic scale, so that
+*             candidates recurring across generations hit a cache keyed by
+*             the gain set instead of being simulated again.
+********************************************************************************/
+#ifndef PARETO_HPP_
+#define PARETO_HPP_
+
+/* Include directives: */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include "parallel.hpp"
+#include "tuner.hpp"
+
+/********************************************************************************
+* pareto_point: Struct holding a candidate of the multi-objective search.
+********************************************************************************/
+struct pareto_point
+{
+   static constexpr std::size_t NUM_OBJECTIVES = 3; /* Settling time, overshoot, effort. */
+
+   tuner::point genes{};                             /* Gains in logarithmic scale. */
+   pid_gains gains;                                  /* PID parameters of the candidate. */
+   metrics result;                                   /* Metrics of the candidate. */
+   std::array<double, NUM_OBJECTIVES> objectives{};  /* Objectives, lower is better. */
+   std::size_t rank = 0;                             /* Index of the front of the candidate. */
+   double crowding  = 0;                             /* Crowding distance within the front. */
+
+   /********************************************************************************
+   * dominates: Returns true if the candidate is at least as good as referenced
+   *            candidate on every objective and better on at least one.
+   *
+   *            - other: Reference to the other candidate.
+   ********************************************************************************/
+   bool dominates(const pareto_point& other) const
+   {
+      auto better = false;
+
+      for (std::size_t i = 0; i < NUM_OBJECTIVES; ++i)
+      {
+         if (objectives[i] > other.objectives[i]) return false;
+         if (objectives[i] < other.objectives[i]) better = true;
+      }
+      return better;
+   }
+};
+
+/********************************************************************************
+* pareto_search: Struct for implementation of NSGA-II over PID parameters,
+*                evaluated on a simulated servo.
+********************************************************************************/
+struct pareto_search
+{
+   static constexpr auto GENE_RESOLUTION = 1e-2; /* Gene grid in decades. */
+
+   servo config;                   /* Servo configuration to tune. */
+   plant_model plant;              /* Plant model to simulate against. */
+   std::vector<scenario> suite;    /* Scenarios each candidate is evaluated with. */
+   std::size_t population_size = 64;  /* Number of candidates per generation. */
+   std::size_t generations     = 40;  /* Number of generations. */
+   double crossover_eta        = 15;  /* Distribution index of SBX crossover. */
+   double mutation_eta         = 20;  /* Distribution index of polynomial mutation. */
+   double mutation_probability = 1.0 / 3.0; /* Probability of mutating each gene. */
+   std::size_t num_threads = parallel::num_threads(); /* Number of threads used. */
+   result_cache* persistent_cache = nullptr; /* Result cache across runs, or nullptr. */
+
+   std::unordered_map<std::uint64_t, metrics> cache; /* Metrics keyed by gain set. */
+   std::size_t evaluations = 0;   /* Number of simulated candidates. */
+   std::size_t cache_hits  = 0;   /* Number of candidates found in the cache. */
+   double seconds          = 0;   /* Duration of the last search in seconds. */
+   std::uint64_t seed      = 0x2545f4914f6cdd1dull; /* State of the random generator. */
+
+   /********************************************************************************
+   * pareto_search: Initiates search with specified servo configuration, plant
+   *                model and scenario suite.
+   *
+   *                - config: Reference to servo configuration to tune.
+   *                - plant : Reference to plant model (default = default model).
+   *                - suite : Reference to scenario suite (default = default suite).
+   ********************************************************************************/
+   pareto_search(const servo& config,
+                 const plant_model& plant = plant_model(),
+                 const std::vector<scenario>& suite = scenario::default_suite())
+      : config(config), plant(plant), suite(suite) { }
+
+   /********************************************************************************
+   * run: Runs the search and returns the non-dominated set of the last
+   *      generation, sorted in ascending order of settling time.
+   ********************************************************************************/
+   std::vector<pareto_point> run(void)
+   {
+      const auto t0 = std::chrono::steady_clock::now();
+      std::vector<pareto_point> population(population_size);
+
+      for (auto& i : population)
+      {
+         for (auto& j : i.genes)
+         {
+            j = tuner::MIN_EXPONENT + random() * (tuner::MAX_EXPONENT - tuner::MIN_EXPONENT);
+         }
+      }
+
+      evaluate(population);
+      sort_fronts(population);
+
+      for (std::size_t generation = 0; generation < generations; ++generation)
+      {
+         std::vector<pareto_point> offspring;
+         offspring.reserve(population_size);
+
+         while (offspring.size() < population_size)
+         {
+            auto a = tournament(population);
+            auto b = tournament(population);
+            crossover(a, b);
+            mutate(a);
+            mutate(b);
+            offspring.push_back(a);
+            if (offspring.size() < population_size) offspring.push_back(b);
+         }
+
+         evaluate(offspring);
+         population.insert(population.end(), offspring.begin(), offspring.end());
+         sort_fronts(population);
+         select(population);
+      }
+
+      std::vector<pareto_point> front;
+
+      for (const auto& i : population)
+      {
+         if (i.rank > 0) continue;
+         auto duplicate = false;
+
+         for (const auto& j : front)
+         {
+            if (j.genes == i.genes) duplicate = true;
+         }
+         if (!duplicate) front.push_back(i);
+      }
+
+      std::sort(front.begin(), front.end(), [](const pareto_point& a, const pareto_point& b)
+         {
+            return a.objectives[0] < b.objectives[0];
+         });
+
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      return front;
+   }
+
+   /********************************************************************************
+   * evaluate: Sets the metrics and objectives of referenced candidates. Genes
+   *           are rounded to the gene grid first. Candidates found in the cache
+   *           are not simulated, the rest are simulated in parallel and added
+   *           to the cache.
+   *
+   *           - candidates: Reference to candidates to evaluate.
+   ********************************************************************************/
+   void evaluate(std::vector<pareto_point>& candidates)
+   {
+      std::vector<std::size_t> misses;
+      std::vector<std::uint64_t> keys(candidates.size());
+
+      for (std::size_t i = 0; i < candidates.size(); ++i)
+      {
+         auto& candidate = candidates[i];
+
+         for (auto& j : candidate.genes)
+         {
+            j = tuner::clamp(std::round(j / GENE_RESOLUTION) * GENE_RESOLUTION);
+         }
+
+         candidate.gains = tuner::to_gains(candidate.genes);
+         keys[i] = key(candidate.genes);
+
+         auto known = cache.find(keys[i]) != cache.end();
+
+         for (const auto j : misses)
+         {
+            if (keys[j] == keys[i]) known = true;
+         }
+
+         if (known) cache_hits++;
+         else misses.push_back(i);
+      }
+
+      parallel::for_each_index(misses.size(), [&](const std::size_t i)
+         {
+            auto candidate = config;
+            candidate.pid.set_gains(candidates[misses[i]].gains);
+            candidates[misses[i]].result = simulate_cached(persistent_cache, candidate, plant, suite);
+         }, num_threads);
+
+      evaluations += misses.size();
+
+      for (const auto i : misses)
+      {
+         cache[keys[i]] = candidates[i].result;
+      }
+
+      for (std::size_t i = 0; i < candidates.size(); ++i)
+      {
+         auto& candidate = candidates[i];
+         candidate.result = cache.at(keys[i]);
+         const auto n = candidate.result.cycles > 0 ? static_cast<double>(candidate.result.cycles) : 1.0;
+         candidate.objectives[0] = candidate.result.settling_time;
+         candidate.objectives[1] = candidate.result.overshoot;
+         candidate.objectives[2] = candidate.result.effort / n;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * hit_rate: Returns the share of candidates found in the cache.
+   ********************************************************************************/
+   double hit_rate(void) const
+   {
+      const auto total = evaluations + cache_hits;
+      return total > 0 ? static_cast<double>(cache_hits) / total : 0;
+   }
+
+   /********************************************************************************
+   * key: Returns the cache key of specified genes, where each gene is stored as
+   *      its index on the gene grid in 21 bits of the key.
+   *
+   *      - genes: Reference to genes rounded to the gene grid.
+   ********************************************************************************/
+   static std::uint64_t key(const tuner::point& genes)
+   {
+      std::uint64_t result = 0;
+
+      for (const auto& i : genes)
+      {
+         const auto index = static_cast<std::int64_t>(std::llround((i - tuner::MIN_EXPONENT) / GENE_RESOLUTION));
+         result = (result << 21) | (static_cast<std::uint64_t>(index) & 0x1fffff);
+      }
+      return result;
+   }
+
+   /********************************************************************************
+   * sort_fronts: Sets the rank and crowding distance of referenced candidates
+   *              with fast non-dominated sorting.
+   *
+   *              - candidates: Reference to candidates to sort.
+   ********************************************************************************/
+   static void sort_fronts(std::vector<pareto_point>& candidates)
+   {
+      const auto n = candidates.size();
+      std::vector<std::vector<std::size_t>> dominated(n);
+      std::vector<std::size_t> num_dominating(n, 0);
+      std::vector<std::size_t> front;
+
+      for (std::size_t i = 0; i < n; ++i)
+      {
+         for (std::size_t j = 0; j < n; ++j)
+         {
+            if (candidates[i].dominates(candidates[j]))
+            {
+               dominated[i].push_back(j);
+            }
+            else if (candidates[j].dominates(candidates[i]))
+            {
+               num_dominating[i]++;
+            }
+         }
+
+         if (num_dominating[i] == 0)
+         {
+            candidates[i].rank = 0;
+            front.push_back(i);
+         }
+      }
+
+      for (std::size_t rank = 0; !front.empty(); ++rank)
+      {
+         std::vector<std::size_t> next;
+         set_crowding(candidates, front);
+
+         for (const auto i : front)
+         {
+            for (const auto j : dominated[i])
+            {
+               if (--num_dominating[j] == 0)
+               {
+                  candidates[j].rank = rank + 1;
+                  next.push_back(j);
+               }
+            }
+         }
+         front = next;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * set_crowding: Sets the crowding distance of the candidates of a front, i.e.
+   *               the normalized size of the box spanned by the neighbours of
+   *               each candidate. The outermost candidates get infinite
+   *               distance, so that the extremes of the front are kept.
+   *
+   *               - candidates: Reference to all candidates.
+   *               - front     : Reference to indexes of the front.
+   ********************************************************************************/
+   static void set_crowding(std::vector<pareto_point>& candidates,
+                            std::vector<std::size_t> front)
+   {
+      for (const auto i : front)
+      {
+         candidates[i].crowding = 0;
+      }
+
+      for (std::size_t k = 0; k < pareto_point::NUM_OBJECTIVES; ++k)
+      {
+         std::sort(front.begin(), front.end(), [&](const std::size_t a, const std::size_t b)
+            {
+               return candidates[a].objectives[k] < candidates[b].objectives[k];
+            });
+
+         const auto low = candidates[front.front()].objectives[k];
+         const auto high = candidates[front.back()].objectives[k];
+         candidates[front.front()].crowding = std::numeric_limits<double>::infinity();
+         candidates[front.back()].crowding = std::numeric_limits<double>::infinity();
+         if (high <= low) continue;
+
+         for (std::size_t i = 1; i + 1 < front.size(); ++i)
+         {
+            candidates[front[i]].crowding += (candidates[front[i + 1]].objectives[k] -
+               candidates[front[i - 1]].objectives[k]) / (high - low);
+         }
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * select: Keeps the best candidates of referenced population, ordered by rank
+   *         and then by descending crowding distance.
+   *
+   *         - population: Reference to the combined parent and offspring population.
+   ********************************************************************************/
+   void select(std::vector<pareto_point>& population) const
+   {
+      std::sort(population.begin(), population.end(), [](const pareto_point& a, const pareto_point& b)
+         {
+            return a.rank != b.rank ? a.rank < b.rank : a.crowding > b.crowding;
+         });
+      if (population.size() > population_size) population.resize(population_size);
+      return;
+   }
+
+   /********************************************************************************
+   * tournament: Returns the better of two random candidates of referenced
+   *             population, compared by rank and then crowding distance.
+   *
+   *             - population: Reference to the population.
+   ********************************************************************************/
+   pareto_point tournament(const std::vector<pareto_point>& population)
+   {
+      const auto& a = population[static_cast<std::size_t>(random() * population.size()) % population.size()];
+      const auto& b = population[static_cast<std::size_t>(random() * population.size()) % population.size()];
+      if (a.rank != b.rank) return a.rank < b.rank ? a : b;
+      return a.crowding > b.crowding ? a : b;
+   }
+
+   /********************************************************************************
+   * crossover: Recombines the genes of two candidates with simulated binary
+   *            crossover (SBX).
+   *
+   *            - a: Reference to the first candidate.
+   *            - b: Reference to the second candidate.
+   ********************************************************************************/
+   void crossover(pareto_point& a,
+                  pareto_point& b)
+   {
+      for (std::size_t i = 0; i < a.genes.size(); ++i)
+      {
+         if (random() > 0.5) continue;
+         const auto u = random();
+         const auto beta = u <= 0.5 ? std::pow(2 * u, 1.0 / (crossover_eta + 1)) :
+            std::pow(1.0 / (2 * (1 - u)), 1.0 / (crossover_eta + 1));
+         const auto x = a.genes[i], y = b.genes[i];
+         a.genes[i] = tuner::clamp(0.5 * ((1 + beta) * x + (1 - beta) * y));
+         b.genes[i] = tuner::clamp(0.5 * ((1 - beta) * x + (1 + beta) * y));
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * mutate: Mutates the genes of referenced candidate with polynomial mutation.
+   *
+   *         - candidate: Reference to the candidate.
+   ********************************************************************************/
+   void mutate(pareto_point& candidate)
+   {
+      const auto range = tuner::MAX_EXPONENT - tuner::MIN_EXPONENT;
+
+      for (auto& i : candidate.genes)
+      {
+         if (random() > mutation_probability) continue;
+         const auto u = random();
+         const auto delta = u < 0.5 ? std::pow(2 * u, 1.0 / (mutation_eta + 1)) - 1 :
+            1 - std::pow(2 * (1 - u), 1.0 / (mutation_eta + 1));
+         i = tuner::clamp(i + delta * range);
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * random: Returns a pseudo random number between 0 and 1 (xorshift).
+   ********************************************************************************/
+   double random(void)
+   {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      return static_cast<double>(seed >> 11) * (1.0 / 9007199254740992.0);
+   }
+};
+
+#endif /* PARETO_HPP_ */
\ No newline at end of file
@@ -7,46 +7,77 @@
 /* Include directives: */
 #include <iostream>
 #include <iomanip>
+#include "stats.hpp"
 
 /********************************************************************************
-* pid_controller: Struct for implementation of PID controllers with adjustable
-*                 PID parameters, minimum and maximum output values etc.
+* pid_gains: Struct holding the parameters of a PID controller, used to pass
+*            candidate parameter sets between tuners and controllers.
 ********************************************************************************/
-struct pid_controller
+struct pid_gains
 {
-   double target     = 0; /* Desired output value. */
-   double output     = 0; /* Real output value. */
-   double input      = 0; /* Input value from sensor (used for printing only). */
-   double kp         = 0; /* Proportional constant. */
-   double ki         = 0; /* Integrate constant. */
-   double kd         = 0; /* Derivate constant */
-   double integrate  = 0; /* Integral value, multiplied with ki when setting new output. */
-   double derivate   = 0; /* Delta value, multiplied with kd when setting new output. */
-   double last_error = 0; /* Last measured error. */
-   double output_min = 0; /* Minimum output value. */
-   double output_max = 0; /* Maximum output value. */
+   double kp = 1.0;  /* Proportional constant. */
+   double ki = 0.01; /* Integrate constant. */
+   double kd = 0.1;  /* Derivate constant. */
+};
+
+/********************************************************************************
+* numeric_value: Returns the value of specified number as a double. Overloads
+*                for other numeric types, such as dual numbers, return the
+*                value without derivatives.
+*
+*                - number: Number to convert.
+********************************************************************************/
+inline double numeric_value(const double number)
+{
+   return number;
+}
+
+/********************************************************************************
+* basic_pid_controller: Struct for implementation of PID controllers with
+*                       adjustable PID parameters, minimum and maximum output
+*                       values etc. The numeric type is a template parameter,
+*                       so that derivatives can be propagated through the
+*                       controller with dual numbers. The controller is used
+*                       with doubles via the pid_controller alias.
+********************************************************************************/
+template<class T = double>
+struct basic_pid_controller
+{
+   T target     = 0; /* Desired output value. */
+   T output     = 0; /* Real output value. */
+   T input      = 0; /* Input value from sensor (used for printing only). */
+   T kp         = 0; /* Proportional constant. */
+   T ki         = 0; /* Integrate constant. */
+   T kd         = 0; /* Derivate constant */
+   T integrate  = 0; /* Integral value, multiplied with ki when setting new output. */
+   T derivate   = 0; /* Delta value, multiplied with kd when setting new output. */
+   T last_error = 0; /* Last measured error. */
+   T output_min = 0; /* Minimum output value. */
+   T output_max = 0; /* Maximum output value. */
+
+   clamp_counter saturation; /* Counter of output saturation, disabled by default. */
 
    /********************************************************************************
-   * pid_controller: Default constructor, creates empty pid controller.
+   * basic_pid_controller: Default constructor, creates empty pid controller.
    ********************************************************************************/
-   pid_controller(void) { }
+   basic_pid_controller(void) { }
 
    /********************************************************************************
-   * pid_controller: Initiates PID controller with specified parameters.
+   * basic_pid_controller: Initiates PID controller with specified parameters.
    * 
-   *                 - target    : Desired output value.
-   *                 - output_min: Minimum output value (default = 0).
-   *                 - output_max: Maximum output value (default = 180).
-   *                 - kp        : Proportional constant (default = 1.0).
-   *                 - ki        : Integrate constant (default = 0.01).
-   *                 - kd        : Derivate constant (default = 0.1).
+   *                       - target    : Desired output value.
+   *                       - output_min: Minimum output value (default = 0).
+   *                       - output_max: Maximum output value (default = 180).
+   *                       - kp        : Proportional constant (default = 1.0).
+   *                       - ki        : Integrate constant (default = 0.01).
+   *                       - kd        : Derivate constant (default = 0.1).
    ********************************************************************************/
-   pid_controller(const double target,
-                  const double output_min = 0,
-                  const double output_max = 180,
-                  const double kp = 1.0,
-                  const double ki = 0.01,
-                  const double kd = 0.1)
+   basic_pid_controller(const T target,
+                        const T output_min = 0,
+                        const T output_max = 180,
+                        const T kp = 1.0,
+                        const T ki = 0.01,
+                        const T kd = 0.1)
    {
       this->init(target, output_min, output_max, kp, ki, kd);
       return;
@@ -62,12 +93,12 @@ struct pid_controller
    *       - ki        : Integrate constant (default = 0.01).
    *       - kd        : Derivate constant (default = 0.1).
    ********************************************************************************/
-   void init(const double target,
-             const double output_min = 0,
-             const double output_max = 180,
-             const double kp = 1.0,
-             const double ki = 0.01,
-             const double kd = 0.1)
+   void init(const T target,
+             const T output_min = 0,
+             const T output_max = 180,
+             const T kp = 1.0,
+             const T ki = 0.01,
+             const T kd = 0.1)
    {
       this->target = target;
       this->output_min = output_min;
@@ -78,17 +109,73 @@ struct pid_controller
       return;
    }
 
+   /********************************************************************************
+   * gains: Returns the current PID parameters of the controller.
+   ********************************************************************************/
+   pid_gains gains(void) const
+   {
+      return pid_gains{ numeric_value(kp), numeric_value(ki), numeric_value(kd) };
+   }
+
+   /********************************************************************************
+   * set_gains: Sets new PID parameters for the controller. The integral and
+   *            derivate values are kept, so the gains can be changed during
+   *            operation.
+   *
+   *            - new_gains: New PID parameters.
+   ********************************************************************************/
+   void set_gains(const pid_gains& new_gains)
+   {
+      kp = new_gains.kp;
+      ki = new_gains.ki;
+      kd = new_gains.kd;
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the integral and derivate values of the controller and sets
+   *        the input and output to the target value, i.e. the controller
+   *        starts from a settled state.
+   ********************************************************************************/
+   void reset(void)
+   {
+      input = target;
+      output = target;
+      integrate = 0;
+      derivate = 0;
+      last_error = 0;
+      check_output();
+      return;
+   }
+
    /********************************************************************************
    * regulate: Regulates output value of PID controller on the basis of new input. 
    *         
    *           - new_input: New input value of PID controller.
    ********************************************************************************/
-   void regulate(const double new_input)
+   void regulate(const T new_input)
+   {
+      regulate(new_input, 1.0);
+      return;
+   }
+
+   /********************************************************************************
+   * regulate: Regulates output value of PID controller on the basis of new input
+   *           after specified time step, measured in control cycles. The error
+   *           is integrated over the time step and its change divided by it,
+   *           so the controller behaves the same whatever its update rate.
+   *           With a time step of one cycle, this equals the regulation above.
+   *
+   *           - new_input: New input value of PID controller.
+   *           - dt       : Time since the last regulation in control cycles.
+   ********************************************************************************/
+   void regulate(const T new_input,
+                 const double dt)
    {
       const auto error = target - new_input;
       input = new_input;
-      integrate += error;
-      derivate = error - last_error;
+      integrate += error * dt;
+      derivate = (error - last_error) / dt;
       output = target + kp * error + ki * integrate + kd * derivate;
       last_error = error;
       check_output();
@@ -99,17 +186,24 @@ struct pid_controller
    * check_output: Checks if the PID controller output value is within specified
    *               minimum and maximum output value. If the output value is
    *               out of this range, the value is set to nearest boundary.
+   *               Saturation is counted if the counter is enabled.
    ********************************************************************************/
    void check_output(void)
    {
       if (output < output_min)
       {
+         if (saturation.enabled) saturation.clamp(numeric_value(output_min - output));
          output = output_min;
       }
       else if (output > output_max)
       {
+         if (saturation.enabled) saturation.clamp(numeric_value(output - output_max));
          output = output_max;
       }
+      else if (saturation.enabled)
+      {
+         saturation.pass();
+      }
       return;
    }
 
@@ -135,4 +229,9 @@ struct pid_controller
    }
 };
 
+/********************************************************************************
+* pid_controller: PID controller using doubles, used by the emulator.
+********************************************************************************/
+using pid_controller = basic_pid_controller<double>;
+
 #endif /* PID_CONTROLLER_HPP_ */
\ No newline at end of file
@@ -0,0 +1,273 @@
+/********************************************************************************
+* prefix_cache.hpp: Contains prefix sharing for scenario suites where several
+*                   scenarios start with the same segment, for instance a
+*                   common warm-up. Instead of simulating every scenario from
+*                   a fresh servo, the shared prefix is simulated once and the
+*                   complete simulation state (controller, sensors, shaft,
+*                   noise generator and metrics) is copied at the point where
+*                   the scenarios branch off, after which each branch is run
+*                   from its own copy. The results are identical to running
+*                   every scenario from the start.
+*
+*                   The states at the branch points can also be saved to a
+*                   snapshot file, keyed by a hash of the servo configuration,
+*                   plant model and prefix, so that later sweep runs restore
+*                   the prefix instead of simulating it.
+********************************************************************************/
+#ifndef PREFIX_CACHE_HPP_
+#define PREFIX_CACHE_HPP_
+
+/* Include directives: */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "result_cache.hpp"
+
+static_assert(std::is_trivially_copyable<simulation>::value,
+              "The simulation state must be trivially copyable to be forked and saved as bytes!");
+
+/********************************************************************************
+* snapshot_store: Struct for implementation of a file of simulation states
+*                 keyed by prefix hash. The file is read into memory when
+*                 opened and new snapshots are appended to the file, so that
+*                 they are available to later runs. A snapshot is only valid
+*                 for the binary layout of the simulation it was saved with,
+*                 which is checked with the size of the state.
+********************************************************************************/
+struct snapshot_store
+{
+   static constexpr std::uint64_t MAGIC = 0x31504e5350525053ull; /* Record identifier. */
+
+   std::string filepath;                                 /* Path to the snapshot file. */
+   std::unordered_map<std::uint64_t, simulation> states; /* Snapshots keyed by prefix hash. */
+   std::mutex lock;                                      /* Guards the snapshots and the file. */
+
+   /********************************************************************************
+   * open: Reads every valid snapshot of specified file into memory. Returns
+   *       false if the file does not exist yet, in which case it is created
+   *       when the first snapshot is saved.
+   *
+   *       - new_filepath: Path to the snapshot file.
+   ********************************************************************************/
+   bool open(const std::string& new_filepath)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      filepath = new_filepath;
+      states.clear();
+      std::ifstream file(filepath, std::ios::binary);
+      if (!file) return false;
+      std::uint64_t head[3]{};
+
+      while (file.read(reinterpret_cast<char*>(head), sizeof(head)))
+      {
+         if (head[0] != MAGIC || head[2] != sizeof(simulation)) break;
+         simulation state{ servo(), plant_model() };
+         if (!file.read(reinterpret_cast<char*>(&state), sizeof(state))) break;
+         states.emplace(head[1], state);
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * find: Copies the snapshot of specified key to referenced state if found.
+   *       The calibration slots of the sensors, the flight recorder and the
+   *       control link to the control plane are addresses in the process
+   *       that saved the snapshot, so those of referenced state are kept.
+   *       Returns true on a hit.
+   *
+   *       - key  : Hash of servo configuration, plant model and prefix.
+   *       - state: Reference to storage for the simulation state.
+   ********************************************************************************/
+   bool find(const std::uint64_t key,
+             simulation& state)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      const auto snapshot = states.find(key);
+      if (snapshot == states.end()) return false;
+      const auto left = state.device.left_sensor.calibration;
+      const auto right = state.device.right_sensor.calibration;
+      const auto recorder = state.device.recorder;
+      const auto control = state.device.control;
+      state = snapshot->second;
+      state.device.left_sensor.calibration = left;
+      state.device.right_sensor.calibration = right;
+      state.device.recorder = recorder;
+      state.device.control = control;
+      return true;
+   }
+
+   /********************************************************************************
+   * save: Stores referenced state under specified key and appends it to the
+   *       snapshot file, unless the key is already stored.
+   *
+   *       - key  : Hash of servo configuration, plant model and prefix.
+   *       - state: Reference to the simulation state.
+   ********************************************************************************/
+   void save(const std::uint64_t key,
+             const simulation& state)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!states.emplace(key, state).second || filepath.empty()) return;
+      std::ofstream file(filepath, std::ios::binary | std::ios::app);
+      const std::uint64_t head[3]{ MAGIC, key, sizeof(simulation) };
+      file.write(reinterpret_cast<const char*>(head), sizeof(head));
+      file.write(reinterpret_cast<const char*>(&state), sizeof(state));
+      return;
+   }
+};
+
+/********************************************************************************
+* prefix_runner: Struct for running a scenario suite with shared prefixes
+*                simulated only once. The number of simulated cycles is
+*                counted along with the number of cycles a plain run of
+*                every scenario from the start would have simulated.
+********************************************************************************/
+struct prefix_runner
+{
+   snapshot_store* store = nullptr;  /* Snapshots across runs, not used if nullptr. */
+   std::size_t simulated_cycles = 0; /* Cycles actually simulated. */
+   std::size_t restored_cycles  = 0; /* Cycles skipped by restoring snapshots. */
+   std::size_t total_cycles     = 0; /* Cycles of a plain run of every scenario. */
+
+   /********************************************************************************
+   * run: Runs every scenario of referenced suite and returns the metrics of
+   *      each scenario, in the order of the suite.
+   *
+   *      - config: Reference to servo holding configuration and gains.
+   *      - model : Reference to plant model.
+   *      - suite : Reference to scenarios to run.
+   ********************************************************************************/
+   std::vector<metrics> run(const servo& config,
+                            const plant_model& model,
+                            const std::vector<scenario>& suite)
+   {
+      std::vector<metrics> results(suite.size());
+      std::vector<std::size_t> members;
+      content_hash hash;
+      hash.add(config);
+      hash.add(model);
+
+      for (std::size_t i = 0; i < suite.size(); ++i)
+      {
+         members.push_back(i);
+         total_cycles += suite[i].disturbance.size();
+      }
+
+      run_group(simulation(config, model), hash, suite, members, 0, results);
+      return results;
+   }
+
+   /********************************************************************************
+   * shared_fraction: Returns the share of cycles that were not simulated.
+   ********************************************************************************/
+   double shared_fraction(void) const
+   {
+      return total_cycles > 0 ? 1.0 - static_cast<double>(simulated_cycles) / total_cycles : 0;
+   }
+
+   /********************************************************************************
+   * run_group: Runs a group of scenarios that share every cycle before specified
+   *            offset, where referenced state holds the simulation at the
+   *            offset. The group is run as far as the scenarios agree, after
+   *            which the finished scenarios store their results and the rest
+   *            are split into new groups by their next disturbance value, each
+   *            continuing from its own copy of the state.
+   *
+   *            - state  : Simulation state at the offset.
+   *            - hash   : Hash of configuration, model and the prefix.
+   *            - suite  : Reference to all scenarios.
+   *            - members: Indexes of the scenarios in the group.
+   *            - offset : Number of cycles already run.
+   *            - results: Reference to storage for the metrics of each scenario.
+   ********************************************************************************/
+   void run_group(simulation state,
+                  content_hash hash,
+                  const std::vector<scenario>& suite,
+                  const std::vector<std::size_t>& members,
+                  std::size_t offset,
+                  std::vector<metrics>& results)
+   {
+      const auto& first = suite[members.front()].disturbance;
+      auto end = offset;
+
+      while (end < first.size())
+      {
+         auto shared = true;
+
+         for (const auto i : members)
+         {
+            const auto& disturbance = suite[i].disturbance;
+            if (end >= disturbance.size() || disturbance[end] != first[end]) shared = false;
+         }
+
+         if (!shared) break;
+         end++;
+      }
+
+      if (end > offset)
+      {
+         hash.add(first.data() + offset, (end - offset) * sizeof(double));
+      }
+
+      const auto branching = members.size() > 1 && end > offset;
+
+      if (branching && store && store->find(hash.value, state))
+      {
+         restored_cycles += end - offset;
+      }
+      else
+      {
+         for (auto i = offset; i < end; ++i)
+         {
+            state.step(first[i]);
+         }
+
+         simulated_cycles += end - offset;
+         if (branching && store) store->save(hash.value, state);
+      }
+
+      offset = end;
+      std::vector<std::size_t> remaining;
+
+      for (const auto i : members)
+      {
+         if (suite[i].disturbance.size() == offset)
+         {
+            results[i] = state.result;
+         }
+         else
+         {
+            remaining.push_back(i);
+         }
+      }
+
+      std::sort(remaining.begin(), remaining.end(), [&](const std::size_t a, const std::size_t b)
+         {
+            return suite[a].disturbance[offset] < suite[b].disturbance[offset];
+         });
+
+      for (std::size_t begin = 0; begin < remaining.size();)
+      {
+         auto stop = begin + 1;
+
+         while (stop < remaining.size() &&
+                suite[remaining[stop]].disturbance[offset] == suite[remaining[begin]].disturbance[offset])
+         {
+            stop++;
+         }
+
+         const std::vector<std::size_t> group(remaining.begin() + begin, remaining.begin() + stop);
+         run_group(state, hash, suite, group, offset, results);
+         begin = stop;
+      }
+      return;
+   }
+};
+
+#endif /* PREFIX_CACHE_HPP_ */
\ No newline at end of file
@@ -0,0 +1,352 @@
+/********************************************************************************
+* realtime.hpp: Contains an opt-in real-time setup of the control threads and
+*               a paced control loop measuring its wake-up lateness. On a
+*               general purpose box the tail latency of a paced loop is
+*               dominated by page faults, when memory is first touched or
+*               reclaimed, and by the scheduler, when the thread is migrated
+*               or preempted by ordinary work.
+*
+*               The setup pins the calling thread to chosen cores, raises it
+*               to the SCHED_FIFO policy, locks the current and future pages
+*               of the process in memory and prefaults the stack of the
+*               thread. Memory used by the loop, such as the state of the
+*               fleet and the telemetry rings, is prefaulted by touching
+*               every page once. Each step needs a privilege the process may
+*               lack, i.e. CAP_SYS_NICE or an RLIMIT_RTPRIO for the priority
+*               and CAP_IPC_LOCK or a large RLIMIT_MEMLOCK for the locking,
+*               so a refused step is recorded in the report rather than
+*               failing the setup. On Windows the thread is pinned and
+*               raised to time critical priority, while memory locking is
+*               reported as unsupported.
+********************************************************************************/
+#ifndef REALTIME_HPP_
+#define REALTIME_HPP_
+
+/* Include directives: */
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stats.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/********************************************************************************
+* realtime_setup: Struct for implementation of the real-time setup of a control
+*                 thread. Every step is disabled by default, so the setup is
+*                 opt-in, and the outcome of each step is kept for the report.
+********************************************************************************/
+struct realtime_setup
+{
+   static constexpr std::size_t STACK_BYTES = 256 * 1024; /* Stack prefaulted by apply. */
+
+   std::vector<int> cpus;    /* Cores the thread is pinned to, any core if empty. */
+   int priority     = 0;     /* SCHED_FIFO priority, 0 = keep the scheduler. */
+   bool lock_memory = false; /* Locks current and future pages if true. */
+
+   bool pinned            = false;  /* Indicates if the thread was pinned. */
+   bool prioritized       = false;  /* Indicates if the priority was raised. */
+   bool locked            = false;  /* Indicates if the memory was locked. */
+   std::size_t prefaulted = 0;      /* Number of bytes prefaulted. */
+   std::vector<std::string> denied; /* Description of every step refused. */
+
+   /********************************************************************************
+   * apply: Applies the enabled steps to the calling thread, i.e. pins it,
+   *        raises its priority, locks the memory and prefaults its stack.
+   *        Returns true if no step was refused, see denied otherwise.
+   ********************************************************************************/
+   bool apply(void)
+   {
+      denied.clear();
+      if (!cpus.empty()) pin();
+      if (priority > 0) raise_priority();
+      if (lock_memory) lock();
+      prefault_stack();
+      return denied.empty();
+   }
+
+   /********************************************************************************
+   * pin: Pins the calling thread to the chosen cores. Returns true if pinned.
+   ********************************************************************************/
+   bool pin(void)
+   {
+#ifdef _WIN32
+      DWORD_PTR mask = 0;
+
+      for (const auto i : cpus)
+      {
+         if (i >= 0 && i < static_cast<int>(8 * sizeof(mask))) mask |= static_cast<DWORD_PTR>(1) << i;
+      }
+
+      pinned = mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+      if (!pinned) deny("affinity", "SetThreadAffinityMask failed with error " + std::to_string(GetLastError()));
+#elif defined(__linux__)
+      cpu_set_t set;
+      CPU_ZERO(&set);
+
+      for (const auto i : cpus)
+      {
+         if (i >= 0 && i < CPU_SETSIZE) CPU_SET(i, &set);
+      }
+
+      const auto error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      pinned = error == 0;
+      if (!pinned) deny("affinity", std::strerror(error));
+#else
+      deny("affinity", "not supported on this platform");
+#endif
+      return pinned;
+   }
+
+   /********************************************************************************
+   * raise_priority: Raises the calling thread to the SCHED_FIFO policy with the
+   *                 chosen priority, limited to the range of the policy.
+   *                 Returns true if raised.
+   ********************************************************************************/
+   bool raise_priority(void)
+   {
+#ifdef _WIN32
+      prioritized = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+      if (!prioritized) deny("priority", "SetThreadPriority failed with error " + std::to_string(GetLastError()));
+#elif defined(__linux__)
+      const auto lowest = sched_get_priority_min(SCHED_FIFO);
+      const auto highest = sched_get_priority_max(SCHED_FIFO);
+      sched_param param{};
+      param.sched_priority = priority < lowest ? lowest : (priority > highest ? highest : priority);
+      const auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      prioritized = error == 0;
+
+      if (!prioritized)
+      {
+         deny("SCHED_FIFO priority " + std::to_string(param.sched_priority), std::strerror(error) +
+              std::string(error == EPERM ? " (needs CAP_SYS_NICE or an RLIMIT_RTPRIO)" : ""));
+      }
+#else
+      deny("priority", "not supported on this platform");
+#endif
+      return prioritized;
+   }
+
+   /********************************************************************************
+   * lock: Locks the current and future pages of the process in memory, so
+   *       that they are never paged out and new mappings are faulted in when
+   *       made. Returns true if locked.
+   ********************************************************************************/
+   bool lock(void)
+   {
+#ifdef __linux__
+      locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+
+      if (!locked)
+      {
+         const auto error = errno;
+         deny("mlockall", std::strerror(error) + std::string(error == ENOMEM || error == EPERM ?
+              " (needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK)" : ""));
+      }
+#else
+      deny("memory locking", "not supported on this platform, pages are only prefaulted");
+#endif
+      return locked;
+   }
+
+   /********************************************************************************
+   * unlock: Unlocks the pages of the process locked by lock, if any.
+   ********************************************************************************/
+   void unlock(void)
+   {
+#ifdef __linux__
+      if (locked) munlockall();
+#endif
+      locked = false;
+      return;
+   }
+
+   /********************************************************************************
+   * prefault: Touches every page of specified memory, reading and writing back
+   *           a byte per page, so that the pages are present before the loop
+   *           runs. The values are left unchanged, but the memory must not be
+   *           written by other threads meanwhile.
+   *
+   *           - data: Pointer to the memory.
+   *           - size: Size of the memory in bytes.
+   ********************************************************************************/
+   void prefault(void* data,
+                 const std::size_t size)
+   {
+      auto bytes = static_cast<volatile unsigned char*>(data);
+      const auto page = page_size();
+
+      for (std::size_t i = 0; i < size; i += page)
+      {
+         bytes[i] = bytes[i];
+      }
+
+      if (size) bytes[size - 1] = bytes[size - 1];
+      prefaulted += size;
+      return;
+   }
+
+   /********************************************************************************
+   * prefault: Touches every page of the elements of referenced vector, see
+   *           above.
+   *
+   *           - values: Reference to the vector.
+   ********************************************************************************/
+   template<class T>
+   void prefault(std::vector<T>& values)
+   {
+      prefault(values.data(), values.size() * sizeof(T));
+      return;
+   }
+
+   /********************************************************************************
+   * prefault_stack: Touches STACK_BYTES of the stack below the caller, so that
+   *                 the stack pages used by the loop are present.
+   ********************************************************************************/
+   void prefault_stack(void)
+   {
+      volatile unsigned char stack[STACK_BYTES];
+      const auto page = page_size();
+
+      for (std::size_t i = 0; i < sizeof(stack); i += page)
+      {
+         stack[i] = 0;
+      }
+
+      prefaulted += sizeof(stack);
+      return;
+   }
+
+   /********************************************************************************
+   * page_size: Returns the size of a memory page in bytes.
+   ********************************************************************************/
+   static std::size_t page_size(void)
+   {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return static_cast<std::size_t>(info.dwPageSize);
+#elif defined(__linux__)
+      const auto size = sysconf(_SC_PAGESIZE);
+      return size > 0 ? static_cast<std::size_t>(size) : 4096;
+#else
+      return 4096;
+#endif
+   }
+
+   /********************************************************************************
+   * page_faults: Returns the number of page faults of the calling thread so far,
+   *              or -1 where unknown.
+   ********************************************************************************/
+   static std::int64_t page_faults(void)
+   {
+#ifdef __linux__
+      rusage usage;
+      if (getrusage(RUSAGE_THREAD, &usage) != 0) return -1;
+      return static_cast<std::int64_t>(usage.ru_minflt + usage.ru_majflt);
+#else
+      return -1;
+#endif
+   }
+
+   /********************************************************************************
+   * print: Prints the outcome of every step in the terminal, with the reason of
+   *        each refused step.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      ostream << "Pinned:\t\t\t" << (pinned ? "yes" : "no") << "\n";
+      ostream << "SCHED_FIFO:\t\t" << (prioritized ? "yes" : "no") << "\n";
+      ostream << "Memory locked:\t\t" << (locked ? "yes" : "no") << "\n";
+      ostream << "Prefaulted:\t\t" << prefaulted / 1024 << " KiB\n";
+
+      for (const auto& i : denied)
+      {
+         ostream << "Denied:\t\t\t" << i << "\n";
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * deny: Records a refused step with specified name and reason.
+   *
+   *       - step  : Name of the step.
+   *       - reason: Reason the step was refused.
+   ********************************************************************************/
+   void deny(const std::string& step,
+             const std::string& reason)
+   {
+      denied.push_back(step + ": " + reason);
+      return;
+   }
+};
+
+/********************************************************************************
+* paced_loop: Struct for implementation of a control loop paced at a fixed
+*             period, which sleeps until the start of each cycle and records
+*             how late it woke up. A cycle running past the start of the next
+*             one counts as an overrun, after which the loop is paced anew
+*             from the end of the late cycle rather than catching up.
+********************************************************************************/
+struct paced_loop
+{
+   std::chrono::nanoseconds period{ 1000000 }; /* Period of a cycle. */
+   latency_histogram lateness;                 /* Wake-up lateness of every cycle. */
+   std::uint64_t overruns = 0;                 /* Number of cycles running late. */
+
+   /********************************************************************************
+   * run: Runs specified number of cycles, calling referenced function with the
+   *      number of each cycle at its start.
+   *
+   *      - cycles  : Number of cycles.
+   *      - function: Function to call every cycle.
+   ********************************************************************************/
+   template<class Function>
+   void run(const std::size_t cycles,
+            Function&& function)
+   {
+      using clock = std::chrono::steady_clock;
+      auto next = clock::now() + period;
+
+      for (std::size_t i = 0; i < cycles; ++i)
+      {
+         std::this_thread::sleep_until(next);
+         const auto woke = clock::now();
+         lateness.add(woke > next ? static_cast<std::uint64_t>(
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(woke - next).count()) : 0);
+         function(i);
+         next += period;
+         const auto done = clock::now();
+
+         if (done > next)
+         {
+            overruns++;
+            next = done + period;
+         }
+      }
+      return;
+   }
+};
+
+#endif /* REALTIME_HPP_ */
\ No newline at end of file
@@ -0,0 +1,823 @@
+/********************************************************************************
+* result_cache.hpp: Contains a persistent, content-addressed cache for metrics
+*                   of simulation runs. Each run is identified by a 64-bit hash
+*                   of the servo configuration, the PID parameters, the plant
+*                   model and the bytes of the scenario. The metrics are stored
+*                   in an open addressing hash table in a memory-mapped file,
+*                   so that repeated sweeps and optimizations across program
+*                   runs skip combinations that are already simulated.
+*
+*                   Every record also holds the time it took to simulate the
+*                   run, so that the time saved by each hit can be reported.
+*
+*                   Several processes may share a cache file. Lookups take a
+*                   shared and inserts an exclusive advisory lock of the file,
+*                   and a process remaps the file when another process has
+*                   grown it. On Windows, the file is opened without write
+*                   sharing, so a second process can't open it and runs
+*                   without cache instead.
+********************************************************************************/
+#ifndef RESULT_CACHE_HPP_
+#define RESULT_CACHE_HPP_
+
+/* Include directives: */
+#include <chrono>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "simulation.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/********************************************************************************
+* content_hash: Struct for calculating 64-bit FNV-1a hashes of arbitrary bytes.
+********************************************************************************/
+struct content_hash
+{
+   std::uint64_t value = 14695981039346656037ull; /* Current hash value. */
+
+   /********************************************************************************
+   * add: Adds specified bytes to the hash.
+   *
+   *      - data: Pointer to the bytes.
+   *      - size: Number of bytes.
+   ********************************************************************************/
+   void add(const void* data,
+            const std::size_t size)
+   {
+      const auto bytes = static_cast<const unsigned char*>(data);
+
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         value ^= bytes[i];
+         value *= 1099511628211ull;
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds specified number to the hash.
+   *
+   *      - number: Number to add.
+   ********************************************************************************/
+   void add(const double number)
+   {
+      add(&number, sizeof(number));
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the configuration and PID parameters of referenced servo to the
+   *      hash. The run-time state of the servo is not included.
+   *
+   *      - config: Reference to the servo.
+   ********************************************************************************/
+   void add(const servo& config)
+   {
+      add(config.pid.target);
+      add(config.pid.output_min);
+      add(config.pid.output_max);
+      add(config.pid.kp);
+      add(config.pid.ki);
+      add(config.pid.kd);
+      add(config.left_sensor.min);
+      add(config.left_sensor.max);
+      add(config.right_sensor.min);
+      add(config.right_sensor.max);
+      add(config.left_sensor.calibration);
+      add(config.right_sensor.calibration);
+      add(static_cast<double>(config.left_decimator.ratio));
+      add(static_cast<double>(config.left_decimator.order));
+      add(config.left_filter);
+      add(config.right_filter);
+      add(config.fusion);
+      add(config.array);
+      add(config.health);
+      add(config.oscillation);
+      add(config.rate);
+      add(config.control);
+      add(config.autotuner);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the settings and state of referenced relay autotuner to the hash
+   *      while it is running, since it then sets the servo angle every cycle
+   *      and installs new PID parameters when done. An idle or finished
+   *      autotuner doesn't affect a run, so only its status is added.
+   *
+   *      - autotuner: Reference to the relay autotuner.
+   ********************************************************************************/
+   void add(const relay_autotuner& autotuner)
+   {
+      add(autotuner.active() ? 1.0 : 0.0);
+      if (!autotuner.active()) return;
+      add(autotuner.amplitude);
+      add(autotuner.hysteresis);
+      add(static_cast<double>(autotuner.max_cycles));
+      add(static_cast<double>(autotuner.skip_periods));
+      add(static_cast<double>(autotuner.num_periods));
+      add(static_cast<double>(autotuner.tuning_rule));
+      add(static_cast<double>(autotuner.cycles));
+      add(static_cast<double>(autotuner.periods));
+      add(static_cast<double>(autotuner.measured));
+      add(static_cast<double>(autotuner.last_rise));
+      add(autotuner.relay_sign);
+      add(autotuner.input_max);
+      add(autotuner.input_min);
+      add(autotuner.period_sum);
+      add(autotuner.amplitude_sum);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the parameter set currently published to the control plane of
+   *      referenced link to the hash, since the servo applies it at its first
+   *      regulation. Nothing is added without a plane or published set.
+   *
+   *      - control: Reference to the control link of a servo.
+   ********************************************************************************/
+   void add(const control_link& control)
+   {
+      control_setpoint setpoint;
+      if (!control.plane || !control.plane->read(setpoint)) return;
+      add(setpoint.gains.kp);
+      add(setpoint.gains.ki);
+      add(setpoint.gains.kd);
+      add(setpoint.target);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the settings of referenced oscillation detector to the hash. The
+   *      state of the detector is not included.
+   *
+   *      - detector: Reference to the oscillation detector.
+   ********************************************************************************/
+   void add(const oscillation_detector& detector)
+   {
+      add(detector.enabled ? 1.0 : 0.0);
+      add(detector.backoff ? 1.0 : 0.0);
+      add(detector.hysteresis);
+      add(detector.min_amplitude);
+      add(static_cast<double>(detector.max_half_period));
+      add(static_cast<double>(detector.min_half_cycles));
+      add(detector.backoff_factor);
+      add(detector.min_scale);
+      add(detector.scale);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the settings of referenced adaptive rate to the hash. The state
+   *      of the rate is not included.
+   *
+   *      - rate: Reference to the adaptive rate.
+   ********************************************************************************/
+   void add(const adaptive_rate& rate)
+   {
+      add(rate.enabled ? 1.0 : 0.0);
+      add(rate.deadband);
+      add(static_cast<double>(rate.settle_cycles));
+      add(static_cast<double>(rate.max_period));
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the settings and limits of referenced health monitor to the hash.
+   *      The faults and counters are not included.
+   *
+   *      - health: Reference to the health monitor.
+   ********************************************************************************/
+   void add(const health_monitor& health)
+   {
+      add(health.enabled ? 1.0 : 0.0);
+      add(health.hold ? 1.0 : 0.0);
+      add(static_cast<double>(health.limits.stuck_samples));
+      add(static_cast<double>(health.limits.rail_samples));
+      add(static_cast<double>(health.limits.dropout_samples));
+      add(static_cast<double>(health.limits.disagree_samples));
+      add(health.limits.stuck_tolerance);
+      add(health.limits.disagree_tolerance);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the sensors of referenced sensor array to the hash. The readings
+   *      are not included.
+   *
+   *      - array: Reference to the sensor array.
+   ********************************************************************************/
+   void add(const sensor_array& array)
+   {
+      add(static_cast<double>(array.count));
+      if (!array.count) return;
+      add(array.weights, sizeof(array.weights));
+      add(array.sensitivity, sizeof(array.sensitivity));
+      add(array.offset);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the parameters of referenced bearing fusion to the hash. The
+   *      run-time state of the fusion is not included.
+   *
+   *      - fusion: Reference to the bearing fusion.
+   ********************************************************************************/
+   void add(const bearing_fusion& fusion)
+   {
+      add(fusion.enabled ? 1.0 : 0.0);
+      add(fusion.inertia);
+      add(fusion.stiffness);
+      add(fusion.damping);
+      add(fusion.left_noise);
+      add(fusion.right_noise);
+      add(fusion.velocity_step);
+      add(fusion.offset_step);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the calibration table currently published in referenced slot to
+   *      the hash, so that results of different calibrations are kept apart.
+   *      Nothing is added without a slot or table.
+   *
+   *      - slot: Pointer to the calibration slot of a sensor.
+   ********************************************************************************/
+   void add(const std::atomic<const calibration_table*>* slot)
+   {
+      const auto table = slot ? slot->load(std::memory_order_acquire) : nullptr;
+      if (table) add(table, sizeof(calibration_table));
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the enabled stages and parameters of referenced sensor filter to
+   *      the hash. The run-time state of the filter is not included.
+   *
+   *      - filter: Reference to the sensor filter.
+   ********************************************************************************/
+   void add(const sensor_filter& filter)
+   {
+      add(static_cast<double>(filter.stages));
+      add(static_cast<double>(filter.median.window));
+      add(filter.average.alpha);
+      add(filter.outliers.threshold);
+      add(filter.outliers.min_deviation);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the parameters of referenced plant model to the hash.
+   *
+   *      - model: Reference to the plant model.
+   ********************************************************************************/
+   void add(const plant_model& model)
+   {
+      add(model.inertia);
+      add(model.stiffness);
+      add(model.damping);
+      add(model.friction);
+      add(model.rate_limit);
+      add(model.sensor_noise);
+      add(&model.seed, sizeof(model.seed));
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the disturbance of referenced scenario to the hash. The name of
+   *      the scenario is not included, so equal scenarios share results.
+   *
+   *      - test: Reference to the scenario.
+   ********************************************************************************/
+   void add(const scenario& test)
+   {
+      const auto size = static_cast<std::uint64_t>(test.disturbance.size());
+      add(&size, sizeof(size));
+      if (size > 0) add(test.disturbance.data(), test.disturbance.size() * sizeof(double));
+      return;
+   }
+};
+
+/********************************************************************************
+* result_cache: Struct for implementation of a persistent cache of metrics in a
+*               memory-mapped file. The file holds a header followed by a hash
+*               table of fixed size records, which is doubled in size when it
+*               gets more than 70 % full. All operations are guarded by a
+*               mutex, so that the cache can be shared by parallel workers,
+*               and by an advisory lock of the file, so that it can be shared
+*               by several processes.
+********************************************************************************/
+struct result_cache
+{
+   static constexpr std::uint64_t MAGIC   = 0x3148434f56524553ull; /* File identifier. */
+   static constexpr std::uint64_t VERSION = 1;                     /* Record layout version. */
+   static constexpr std::uint64_t INITIAL_CAPACITY = 1 << 14;      /* Records of a new file. */
+
+   /********************************************************************************
+   * header: Struct holding the header of the cache file.
+   ********************************************************************************/
+   struct header
+   {
+      std::uint64_t magic;    /* File identifier. */
+      std::uint64_t version;  /* Record layout version. */
+      std::uint64_t capacity; /* Number of record slots, a power of two. */
+      std::uint64_t count;    /* Number of used record slots. */
+   };
+
+   /********************************************************************************
+   * file_lock: Struct holding an advisory lock of the cache file for its
+   *            lifetime, shared or exclusive. No lock is taken on Windows,
+   *            where the file is not shared for writing anyway.
+   ********************************************************************************/
+   struct file_lock
+   {
+      int file; /* Descriptor holding the lock, none if negative. */
+
+      /********************************************************************************
+      * file_lock: Locks the file of specified descriptor, unless negative.
+      *
+      *            - descriptor: Descriptor of the file to lock.
+      *            - exclusive : Takes an exclusive lock if true, otherwise shared.
+      ********************************************************************************/
+      file_lock(const int descriptor,
+                const bool exclusive)
+         : file(descriptor)
+      {
+#ifndef _WIN32
+         while (file >= 0 && flock(file, exclusive ? LOCK_EX : LOCK_SH) != 0 && errno == EINTR) { }
+#else
+         (void)exclusive;
+#endif
+         return;
+      }
+
+      /********************************************************************************
+      * ~file_lock: Releases the lock.
+      ********************************************************************************/
+      ~file_lock(void)
+      {
+#ifndef _WIN32
+         if (file >= 0) flock(file, LOCK_UN);
+#endif
+         return;
+      }
+
+      file_lock(const file_lock&) = delete;
+      file_lock& operator=(const file_lock&) = delete;
+   };
+
+   /********************************************************************************
+   * record: Struct holding a cached simulation result, where key 0 marks an
+   *         empty slot.
+   ********************************************************************************/
+   struct record
+   {
+      std::uint64_t key;     /* Hash of the simulated combination. */
+      double iae;            /* Integral of absolute error. */
+      double ise;            /* Integral of squared error. */
+      double itae;           /* Integral of time weighted absolute error. */
+      double overshoot;      /* Overshoot in degrees. */
+      double settling_time;  /* Settling time in cycles. */
+      double effort;         /* Actuator travel in degrees. */
+      std::uint64_t cycles;  /* Number of simulated cycles. */
+      double seconds;        /* Time it took to simulate the run. */
+   };
+
+   std::string filepath;           /* Path to the cache file. */
+   unsigned char* data = nullptr;  /* Start of the mapped file. */
+   std::size_t mapped_size = 0;    /* Size of the mapped file in bytes. */
+   std::size_t hits        = 0;    /* Number of lookups found in the cache. */
+   std::size_t misses      = 0;    /* Number of lookups not found in the cache. */
+   double seconds_saved    = 0;    /* Simulation time saved by the hits. */
+   double seconds_spent    = 0;    /* Simulation time spent on the misses. */
+   std::mutex lock;                /* Guards the mapping and the statistics. */
+#ifdef _WIN32
+   HANDLE file = INVALID_HANDLE_VALUE; /* Handle of the cache file. */
+   HANDLE mapping = nullptr;           /* Handle of the file mapping. */
+#else
+   int file = -1;                      /* Descriptor of the cache file. */
+#endif
+   int lock_file = -1;                 /* Descriptor holding the advisory lock, none on Windows. */
+
+   /********************************************************************************
+   * result_cache: Default constructor, creates a closed cache.
+   ********************************************************************************/
+   result_cache(void) { }
+
+   /********************************************************************************
+   * result_cache: Opens the cache stored in specified file, which is created
+   *               if it doesn't exist.
+   *
+   *               - filepath: Path to the cache file.
+   ********************************************************************************/
+   result_cache(const std::string& filepath)
+   {
+      open(filepath);
+      return;
+   }
+
+   /********************************************************************************
+   * ~result_cache: Closes the cache, whereby the records are kept in the file.
+   ********************************************************************************/
+   ~result_cache(void)
+   {
+      close();
+      return;
+   }
+
+   result_cache(const result_cache&) = delete;
+   result_cache& operator=(const result_cache&) = delete;
+
+   /********************************************************************************
+   * open: Opens the cache stored in specified file, which is created if it
+   *       doesn't exist. If the file holds records of another layout, it is
+   *       cleared. The file is locked exclusively while it is set up. Returns
+   *       true if the file could be mapped.
+   *
+   *       - new_filepath: Path to the cache file.
+   ********************************************************************************/
+   bool open(const std::string& new_filepath)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      unmap();
+      unlock();
+      filepath = new_filepath;
+#ifndef _WIN32
+      lock_file = ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+#endif
+      file_lock exclusive(lock_file, true);
+      if (!map(0)) return false;
+
+      if (table_header().magic != MAGIC || table_header().version != VERSION ||
+          mapped_size != file_size(table_header().capacity))
+      {
+         unmap();
+         if (!map(file_size(INITIAL_CAPACITY))) return false;
+         std::memset(data, 0, mapped_size);
+         table_header() = header{ MAGIC, VERSION, INITIAL_CAPACITY, 0 };
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * close: Unmaps and closes the cache file.
+   ********************************************************************************/
+   void close(void)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      unmap();
+      unlock();
+      return;
+   }
+
+   /********************************************************************************
+   * is_open: Returns true if a cache file is mapped.
+   ********************************************************************************/
+   bool is_open(void) const
+   {
+      return data != nullptr;
+   }
+
+   /********************************************************************************
+   * size: Returns the number of cached results.
+   ********************************************************************************/
+   std::size_t size(void)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      file_lock shared(lock_file, false);
+      return refresh() ? static_cast<std::size_t>(table_header().count) : 0;
+   }
+
+   /********************************************************************************
+   * find: Looks up specified key and stores the cached metrics in referenced
+   *       metrics if found. Returns true on a hit.
+   *
+   *       - key   : Hash of the simulated combination.
+   *       - result: Reference to storage for the metrics.
+   ********************************************************************************/
+   bool find(const std::uint64_t key,
+             metrics& result)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      file_lock shared(lock_file, false);
+      if (!refresh()) return false;
+      const auto& slot = slot_of(key == 0 ? 1 : key);
+
+      if (slot.key == 0)
+      {
+         misses++;
+         return false;
+      }
+
+      result.iae = slot.iae;
+      result.ise = slot.ise;
+      result.itae = slot.itae;
+      result.overshoot = slot.overshoot;
+      result.settling_time = slot.settling_time;
+      result.effort = slot.effort;
+      result.cycles = static_cast<std::size_t>(slot.cycles);
+      seconds_saved += slot.seconds;
+      hits++;
+      return true;
+   }
+
+   /********************************************************************************
+   * insert: Stores specified metrics under specified key along with the time
+   *         it took to simulate them. The table is doubled when it gets more
+   *         than 70 % full.
+   *
+   *         - key    : Hash of the simulated combination.
+   *         - result : Reference to the metrics.
+   *         - seconds: Time it took to simulate the run.
+   ********************************************************************************/
+   void insert(const std::uint64_t key,
+               const metrics& result,
+               const double seconds)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      file_lock exclusive(lock_file, true);
+      seconds_spent += seconds;
+      if (!refresh()) return;
+
+      if ((table_header().count + 1) * 10 > table_header().capacity * 7 && !grow())
+      {
+         return;
+      }
+
+      auto& slot = slot_of(key == 0 ? 1 : key);
+      if (slot.key == 0) table_header().count++;
+      slot = record{ key == 0 ? 1 : key, result.iae, result.ise, result.itae, result.overshoot,
+                     result.settling_time, result.effort, static_cast<std::uint64_t>(result.cycles), seconds };
+      return;
+   }
+
+   /********************************************************************************
+   * hit_rate: Returns the share of lookups found in the cache.
+   ********************************************************************************/
+   double hit_rate(void) const
+   {
+      const auto total = hits + misses;
+      return total > 0 ? static_cast<double>(hits) / total : 0;
+   }
+
+   /********************************************************************************
+   * print: Prints the hit rate and the simulation time saved by the cache.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout)
+   {
+      const auto cached = size();
+      ostream << "--------------------------------------------------------------------------------\n";
+      ostream << "Result cache:\t\t\t" << filepath << " (" << cached << " results)\n";
+      ostream << "Lookups:\t\t\t" << hits + misses << " (" << hits << " hits, " << misses << " misses)\n";
+      ostream << std::fixed << std::setprecision(1);
+      ostream << "Hit rate:\t\t\t" << hit_rate() * 100 << " %\n";
+      ostream << std::setprecision(3);
+      ostream << "Simulation time spent:\t\t" << seconds_spent << " s\n";
+      ostream << "Simulation time saved:\t\t" << seconds_saved << " s\n";
+      ostream << "--------------------------------------------------------------------------------\n\n";
+      return;
+   }
+
+   /********************************************************************************
+   * file_size: Returns the size in bytes of a cache file with specified number
+   *            of record slots.
+   *
+   *            - capacity: Number of record slots.
+   ********************************************************************************/
+   static std::size_t file_size(const std::uint64_t capacity)
+   {
+      return sizeof(header) + static_cast<std::size_t>(capacity) * sizeof(record);
+   }
+
+   /********************************************************************************
+   * table_header: Returns a reference to the header of the mapped file.
+   ********************************************************************************/
+   header& table_header(void)
+   {
+      return *reinterpret_cast<header*>(data);
+   }
+
+   /********************************************************************************
+   * records: Returns a pointer to the first record slot of the mapped file.
+   ********************************************************************************/
+   record* records(void)
+   {
+      return reinterpret_cast<record*>(data + sizeof(header));
+   }
+
+   /********************************************************************************
+   * slot_of: Returns a reference to the slot holding specified key, or the empty
+   *          slot where the key is to be inserted (linear probing).
+   *
+   *          - key: Hash of the simulated combination (not 0).
+   ********************************************************************************/
+   record& slot_of(const std::uint64_t key)
+   {
+      const auto mask = table_header().capacity - 1;
+      auto index = (key ^ (key >> 29)) & mask;
+
+      while (records()[index].key != 0 && records()[index].key != key)
+      {
+         index = (index + 1) & mask;
+      }
+      return records()[index];
+   }
+
+   /********************************************************************************
+   * refresh: Remaps the cache file if another process has grown it since it
+   *          was mapped, i.e. if the capacity in the header doesn't match the
+   *          mapped size. The file lock must be held. Returns true if the
+   *          file is mapped in full.
+   ********************************************************************************/
+   bool refresh(void)
+   {
+      if (!data) return false;
+      if (mapped_size == file_size(table_header().capacity)) return true;
+      unmap();
+      return map(0) && mapped_size == file_size(table_header().capacity);
+   }
+
+   /********************************************************************************
+   * grow: Doubles the number of record slots of the file and rehashes the
+   *       records. Returns false if the file could not be resized.
+   ********************************************************************************/
+   bool grow(void)
+   {
+      const auto capacity = table_header().capacity;
+      std::vector<record> saved;
+
+      for (std::uint64_t i = 0; i < capacity; ++i)
+      {
+         if (records()[i].key != 0) saved.push_back(records()[i]);
+      }
+
+      unmap();
+      if (!map(file_size(capacity * 2))) return false;
+      std::memset(data, 0, mapped_size);
+      table_header() = header{ MAGIC, VERSION, capacity * 2, saved.size() };
+
+      for (const auto& i : saved)
+      {
+         slot_of(i.key) = i;
+      }
+      return true;
+   }
+
+   /********************************************************************************
+   * map: Opens the cache file and maps it into memory. If a size is specified,
+   *      the file is resized first, otherwise the current size is mapped and
+   *      an empty file is left unmapped. Returns true if the file is mapped.
+   *
+   *      - size: New size of the file in bytes, or 0 to keep the current size.
+   ********************************************************************************/
+   bool map(const std::size_t size)
+   {
+#ifdef _WIN32
+      file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                         OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (file == INVALID_HANDLE_VALUE) return false;
+      LARGE_INTEGER current{};
+      GetFileSizeEx(file, &current);
+      mapped_size = size > 0 ? size : static_cast<std::size_t>(current.QuadPart);
+
+      if (mapped_size < sizeof(header))
+      {
+         mapped_size = file_size(INITIAL_CAPACITY);
+      }
+
+      const auto high = static_cast<DWORD>(static_cast<std::uint64_t>(mapped_size) >> 32);
+      const auto low = static_cast<DWORD>(mapped_size & 0xffffffff);
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, high, low, nullptr);
+
+      if (!mapping)
+      {
+         unmap();
+         return false;
+      }
+
+      data = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mapped_size));
+#else
+      file = ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+      if (file < 0) return false;
+      struct stat status {};
+      fstat(file, &status);
+      mapped_size = size > 0 ? size : static_cast<std::size_t>(status.st_size);
+
+      if (mapped_size < sizeof(header))
+      {
+         mapped_size = file_size(INITIAL_CAPACITY);
+      }
+
+      if (static_cast<std::size_t>(status.st_size) != mapped_size &&
+          ftruncate(file, static_cast<off_t>(mapped_size)) != 0)
+      {
+         unmap();
+         return false;
+      }
+
+      auto address = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+      data = address == MAP_FAILED ? nullptr : static_cast<unsigned char*>(address);
+#endif
+      if (data) return true;
+      unmap();
+      return false;
+   }
+
+   /********************************************************************************
+   * unmap: Unmaps and closes the cache file, whereby the records are written
+   *        back to the file by the operating system.
+   ********************************************************************************/
+   void unmap(void)
+   {
+#ifdef _WIN32
+      if (data) UnmapViewOfFile(data);
+      if (mapping) CloseHandle(mapping);
+      if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+      mapping = nullptr;
+      file = INVALID_HANDLE_VALUE;
+#else
+      if (data) munmap(data, mapped_size);
+      if (file >= 0) ::close(file);
+      file = -1;
+#endif
+      data = nullptr;
+      mapped_size = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * unlock: Closes the descriptor holding the advisory lock of the cache file.
+   ********************************************************************************/
+   void unlock(void)
+   {
+#ifndef _WIN32
+      if (lock_file >= 0) ::close(lock_file);
+#endif
+      lock_file = -1;
+      return;
+   }
+};
+
+/********************************************************************************
+* simulate_cached: Returns the combined metrics of every scenario of referenced
+*                  suite, where each scenario is taken from referenced cache if
+*                  found and otherwise simulated and added to the cache.
+*                  Without cache, every scenario is simulated.
+*
+*                  - cache : Pointer to result cache, or nullptr.
+*                  - config: Reference to servo holding configuration and gains.
+*                  - model : Reference to plant model.
+*                  - suite : Reference to scenarios to run.
+********************************************************************************/
+inline metrics simulate_cached(result_cache* cache,
+                               const servo& config,
+                               const plant_model& model,
+                               const std::vector<scenario>& suite)
+{
+   if (!cache) return simulate(config, model, suite);
+   metrics total;
+
+   for (const auto& i : suite)
+   {
+      content_hash hash;
+      metrics result;
+      hash.add(config);
+      hash.add(model);
+      hash.add(i);
+
+      if (!cache->find(hash.value, result))
+      {
+         const auto t0 = std::chrono::steady_clock::now();
+         result = simulate(config, model, i);
+         cache->insert(hash.value, result, std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count());
+      }
+      total.combine(result);
+   }
+   return total;
+}
+
+#endif /* RESULT_CACHE_HPP_ */
\ No newline at end of file
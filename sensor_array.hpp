@@ -0,0 +1,127 @@
+/********************************************************************************
+* sensor_array.hpp: Contains an array of TOF sensors mounted in a fan, which
+*                   generalizes the left and right sensor pair to up to
+*                   MAX_SENSORS sensors. Each sensor sees the bearing with its
+*                   own sensitivity, i.e. the change of its reading relative
+*                   to the left sensor of a left and right sensor pair, so
+*                   the left sensor has sensitivity 1 and the right sensor -1.
+*                   The difference is estimated with weighted least squares,
+*                   which reduces to a dot product of fixed weights and the
+*                   readings.
+*
+*                   The readings and weights are stored contiguously in arrays
+*                   where unused sensors have zero weight and reading, so the
+*                   dot product runs over whole vectors of NUM_LANES sensors
+*                   and the compiler turns it into SIMD instructions. Since
+*                   the padding only adds exact zeros, an array of a left
+*                   and a right sensor gives exactly the difference left -
+*                   right of the pair.
+********************************************************************************/
+#ifndef SENSOR_ARRAY_HPP_
+#define SENSOR_ARRAY_HPP_
+
+/* Include directives: */
+#include <cstddef>
+
+/********************************************************************************
+* basic_sensor_array: Struct for implementation of an array of TOF sensors with
+*                     a shared range. The numeric type is a template
+*                     parameter, see basic_pid_controller. Without sensors,
+*                     the servo uses its left and right sensor instead.
+********************************************************************************/
+template<class T = double>
+struct basic_sensor_array
+{
+   static constexpr std::size_t MAX_SENSORS = 16; /* Largest supported number of sensors. */
+   static constexpr std::size_t NUM_LANES   = 4;  /* Number of partial sums of the dot product. */
+
+   std::size_t count = 0;                       /* Number of sensors, 0 = not used. */
+   double offset     = 0;                       /* Constant term of the estimate. */
+   T values[MAX_SENSORS]{};                     /* Current reading of each sensor. */
+   double weights[MAX_SENSORS]{};               /* Weight of each reading in the estimate. */
+   double sensitivity[MAX_SENSORS]{};           /* Sensitivity, 1 = left sensor, -1 = right sensor. */
+   double deviation[MAX_SENSORS]{};             /* Noise of each sensor in sensor units. */
+
+   /********************************************************************************
+   * init: Sets up specified number of sensors spread evenly across the fan,
+   *       with sensitivities from 1 for the leftmost sensor to -1 for the
+   *       rightmost sensor and equal noise. Two sensors form the left and
+   *       right sensor pair. No sensors disables the array.
+   *
+   *       - num_sensors: Number of sensors, at most MAX_SENSORS.
+   *       - middle     : Reading of every sensor at zero difference.
+   ********************************************************************************/
+   void init(const std::size_t num_sensors,
+             const double middle)
+   {
+      count = num_sensors < MAX_SENSORS ? num_sensors : MAX_SENSORS;
+
+      for (std::size_t i = 0; i < MAX_SENSORS; ++i)
+      {
+         sensitivity[i] = i < count ? (count > 1 ? 1.0 - 2.0 * i / (count - 1) : 1.0) : 0.0;
+         deviation[i] = 1.0;
+         values[i] = 0;
+      }
+
+      compile(middle);
+      return;
+   }
+
+   /********************************************************************************
+   * compile: Calculates the weights of the weighted least squares estimate
+   *          from the sensitivity and noise of each sensor, where a sensor
+   *          with twice the noise gets a quarter of the weight. The readings
+   *          at zero difference are equal to specified middle, which is
+   *          subtracted through the constant term.
+   *
+   *          - middle: Reading of every sensor at zero difference.
+   ********************************************************************************/
+   void compile(const double middle)
+   {
+      auto information = 0.0, sum = 0.0;
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+         information += sensitivity[i] * sensitivity[i] / (deviation[i] * deviation[i]);
+      }
+
+      for (std::size_t i = 0; i < MAX_SENSORS; ++i)
+      {
+         weights[i] = i < count && information > 0 ?
+            2.0 * sensitivity[i] / (deviation[i] * deviation[i]) / information : 0.0;
+         sum += weights[i];
+      }
+
+      offset = -middle * sum;
+      return;
+   }
+
+   /********************************************************************************
+   * difference: Returns the estimated difference between the readings of a
+   *             left and right sensor pair at the current bearing, i.e. the
+   *             dot product of the weights and the readings plus the
+   *             constant term. The products are summed in NUM_LANES partial
+   *             sums, which are independent and run side by side, so the
+   *             cost grows with the number of sensors in steps of NUM_LANES.
+   ********************************************************************************/
+   T difference(void) const
+   {
+      T lanes[NUM_LANES]{};
+
+      for (std::size_t i = 0; i < count; i += NUM_LANES)
+      {
+         for (std::size_t j = 0; j < NUM_LANES; ++j)
+         {
+            lanes[j] += weights[i + j] * values[i + j];
+         }
+      }
+      return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + offset;
+   }
+};
+
+/********************************************************************************
+* sensor_array: Sensor array using doubles, used by the emulator.
+********************************************************************************/
+using sensor_array = basic_sensor_array<double>;
+
+#endif /* SENSOR_ARRAY_HPP_ */
\ No newline at end of file
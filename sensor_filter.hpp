@@ -0,0 +1,321 @@
+/********************************************************************************
+* sensor_filter.hpp: Contains streaming filters for the TOF sensor values, run
+*                    on every new reading before the servo maps the sensor
+*                    difference to its input. Each filter keeps its window in
+*                    fixed arrays, so a new sample never allocates memory and
+*                    costs a number of operations bounded by the window size:
+*
+*                    - running median: Outputs the median of the last samples,
+*                      which removes single-sample spikes.
+*                    - exponential moving average: Smooths the noise with a
+*                      single value of state.
+*                    - Hampel filter: Replaces samples deviating more than a
+*                      number of scaled median absolute deviations from the
+*                      median of the window with the median, while samples
+*                      within the band pass unchanged.
+*
+*                    The filters are chained per sensor by basic_sensor_filter.
+*                    The numeric type is a template parameter, see
+*                    basic_pid_controller.
+********************************************************************************/
+#ifndef SENSOR_FILTER_HPP_
+#define SENSOR_FILTER_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+
+/********************************************************************************
+* basic_running_median: Struct for implementation of a running median over a
+*                       window of at most MAX_WINDOW samples. The samples are
+*                       kept both in arrival order and sorted, so each new
+*                       sample replaces the oldest one in the sorted array
+*                       with a single insertion step.
+********************************************************************************/
+template<class T = double>
+struct basic_running_median
+{
+   static constexpr std::size_t MAX_WINDOW = 9; /* Largest supported window size. */
+   std::size_t window = 5;                      /* Number of samples in a full window. */
+   std::size_t count  = 0;                      /* Number of samples in the window so far. */
+   std::size_t next   = 0;                      /* Index in history of the oldest sample. */
+   T history[MAX_WINDOW]{};                     /* Samples of the window in arrival order. */
+   T sorted[MAX_WINDOW]{};                      /* Samples of the window in ascending order. */
+
+   /********************************************************************************
+   * init: Sets specified window size, limited to 1 - MAX_WINDOW samples, and
+   *       clears the window.
+   *
+   *       - window_size: Number of samples in a full window.
+   ********************************************************************************/
+   void init(const std::size_t window_size)
+   {
+      window = window_size < 1 ? 1 : (window_size > MAX_WINDOW ? MAX_WINDOW : window_size);
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the window, so the next sample starts a new one.
+   ********************************************************************************/
+   void reset(void)
+   {
+      count = 0;
+      next = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds a new sample to the window and returns the new median. Once the
+   *      window is full, the new sample takes the place of the oldest sample
+   *      in the sorted array and is moved towards its sorted position, so
+   *      only the samples between the two positions are shifted.
+   *
+   *      - sample: New sample.
+   ********************************************************************************/
+   T add(const T sample)
+   {
+      auto i = count;
+
+      if (count == window)
+      {
+         const auto oldest = history[next];
+         i = 0;
+         while (i + 1 < count && sorted[i] != oldest) ++i;
+
+         while (i + 1 < count && sorted[i + 1] < sample)
+         {
+            sorted[i] = sorted[i + 1];
+            i++;
+         }
+      }
+      else
+      {
+         count++;
+      }
+
+      while (i > 0 && sample < sorted[i - 1])
+      {
+         sorted[i] = sorted[i - 1];
+         i--;
+      }
+
+      sorted[i] = sample;
+      history[next] = sample;
+      next = next + 1 < window ? next + 1 : 0;
+      return value();
+   }
+
+   /********************************************************************************
+   * value: Returns the median of the window, where the two middle samples are
+   *        averaged while the window holds an even number of samples.
+   ********************************************************************************/
+   T value(void) const
+   {
+      if (count == 0) return T(0);
+      if (count % 2) return sorted[count / 2];
+      return (sorted[count / 2 - 1] + sorted[count / 2]) * 0.5;
+   }
+
+   /********************************************************************************
+   * deviation: Returns the median absolute deviation of the window. The
+   *            deviations below and above the median are each ascending in
+   *            the sorted array, so the smallest deviations are merged
+   *            outwards from the median until the middle one is reached.
+   ********************************************************************************/
+   T deviation(void) const
+   {
+      const auto center = value();
+      std::size_t lower = (count + 1) / 2, upper = lower;
+      T previous = 0, current = 0;
+
+      for (std::size_t i = 0; i <= count / 2 && count > 0; ++i)
+      {
+         previous = current;
+
+         if (lower > 0 && (upper >= count || center - sorted[lower - 1] <= sorted[upper] - center))
+         {
+            current = center - sorted[--lower];
+         }
+         else
+         {
+            current = sorted[upper++] - center;
+         }
+      }
+      return count % 2 ? current : (previous + current) * 0.5;
+   }
+};
+
+/********************************************************************************
+* basic_ema_filter: Struct for implementation of an exponential moving average,
+*                   where the first sample initiates the average.
+********************************************************************************/
+template<class T = double>
+struct basic_ema_filter
+{
+   double alpha = 0.5;   /* Weight of a new sample, between 0 and 1. */
+   T average    = 0;     /* Current average. */
+   bool started = false; /* Indicates if the average holds a sample. */
+
+   /********************************************************************************
+   * init: Sets specified weight of new samples, limited to 0 - 1, and clears
+   *       the average.
+   *
+   *       - weight: Weight of a new sample.
+   ********************************************************************************/
+   void init(const double weight)
+   {
+      alpha = weight < 0 ? 0.0 : (weight > 1 ? 1.0 : weight);
+      reset();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the average, so the next sample starts a new one.
+   ********************************************************************************/
+   void reset(void)
+   {
+      started = false;
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds a new sample to the average and returns the new average.
+   *
+   *      - sample: New sample.
+   ********************************************************************************/
+   T add(const T sample)
+   {
+      average = started ? average + alpha * (sample - average) : sample;
+      started = true;
+      return average;
+   }
+};
+
+/********************************************************************************
+* basic_hampel_filter: Struct for implementation of a causal Hampel filter. The
+*                      median absolute deviation is scaled to the standard
+*                      deviation of normal noise and floored by a smallest
+*                      deviation, so that small changes after a run of equal
+*                      readings are not rejected.
+********************************************************************************/
+template<class T = double>
+struct basic_hampel_filter
+{
+   static constexpr auto MAD_SCALE = 1.4826; /* Median absolute deviation to standard deviation. */
+   basic_running_median<T> window;           /* Running median of the raw samples. */
+   double threshold     = 3.0;               /* Rejection threshold in standard deviations. */
+   double min_deviation = 2.0;               /* Smallest standard deviation in sensor units. */
+
+   /********************************************************************************
+   * init: Sets specified window size and rejection threshold and clears the
+   *       window.
+   *
+   *       - window_size   : Number of samples in a full window.
+   *       - num_deviations: Rejection threshold in standard deviations.
+   ********************************************************************************/
+   void init(const std::size_t window_size,
+             const double num_deviations)
+   {
+      window.init(window_size);
+      threshold = num_deviations;
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the window, so the next sample starts a new one.
+   ********************************************************************************/
+   void reset(void)
+   {
+      window.reset();
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds a new sample to the window and returns the sample, or the median
+   *      of the window if the sample is rejected as an outlier.
+   *
+   *      - sample: New sample.
+   ********************************************************************************/
+   T add(const T sample)
+   {
+      using std::fabs;
+      const auto center = window.add(sample);
+      const auto deviation = MAD_SCALE * window.deviation();
+      const auto limit = threshold * (deviation > min_deviation ? deviation : T(min_deviation));
+      return fabs(sample - center) > limit ? center : sample;
+   }
+};
+
+/********************************************************************************
+* basic_sensor_filter: Struct for implementation of the filter pipeline of a
+*                      sensor. The enabled stages are selected with flags and
+*                      run in the order outlier rejection, median and moving
+*                      average. Without enabled stages, the samples pass
+*                      unchanged.
+********************************************************************************/
+template<class T = double>
+struct basic_sensor_filter
+{
+   static constexpr unsigned HAMPEL = 1; /* Flag enabling outlier rejection. */
+   static constexpr unsigned MEDIAN = 2; /* Flag enabling the running median. */
+   static constexpr unsigned EMA    = 4; /* Flag enabling the moving average. */
+
+   unsigned stages = 0;                  /* Enabled stages, combined flags. */
+   basic_hampel_filter<T> outliers;      /* Outlier rejection stage. */
+   basic_running_median<T> median;       /* Running median stage. */
+   basic_ema_filter<T> average;          /* Moving average stage. */
+
+   /********************************************************************************
+   * init: Enables specified stages with specified parameters and clears the
+   *       state of every stage.
+   *
+   *       - enabled_stages: Enabled stages, combined flags.
+   *       - window_size   : Window size of the median stages (default = 5).
+   *       - alpha         : Weight of a new sample in the average (default = 0.5).
+   *       - threshold     : Outlier threshold in standard deviations (default = 3).
+   ********************************************************************************/
+   void init(const unsigned enabled_stages,
+             const std::size_t window_size = 5,
+             const double alpha = 0.5,
+             const double threshold = 3.0)
+   {
+      stages = enabled_stages;
+      outliers.init(window_size, threshold);
+      median.init(window_size);
+      average.init(alpha);
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the state of every stage.
+   ********************************************************************************/
+   void reset(void)
+   {
+      outliers.reset();
+      median.reset();
+      average.reset();
+      return;
+   }
+
+   /********************************************************************************
+   * add: Runs a new sample through the enabled stages and returns the result.
+   *
+   *      - sample: New sample.
+   ********************************************************************************/
+   T add(const T sample)
+   {
+      auto value = sample;
+      if (stages & HAMPEL) value = outliers.add(value);
+      if (stages & MEDIAN) value = median.add(value);
+      if (stages & EMA) value = average.add(value);
+      return value;
+   }
+};
+
+/********************************************************************************
+* sensor_filter: Sensor filter using doubles, used by the emulator.
+********************************************************************************/
+using sensor_filter = basic_sensor_filter<double>;
+
+#endif /* SENSOR_FILTER_HPP_ */
\ No newline at end of file
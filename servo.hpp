@@ -7,47 +7,75 @@
 #define SERVO_HPP_
 
 /* Include directives: */
+#include "adaptive_rate.hpp"
+#include "autotuner.hpp"
+#include "control_plane.hpp"
+#include "decimator.hpp"
+#include "flight_recorder.hpp"
+#include "health_monitor.hpp"
+#include "kalman_filter.hpp"
+#include "oscillation_detector.hpp"
 #include "pid_controller.hpp"
+#include "sensor_array.hpp"
+#include "sensor_filter.hpp"
 #include "tof_sensor.hpp"
 
 /********************************************************************************
-* servo: Struct for implementation of PID controlled servos.
-*        Two TOF (Time Of Flight) sensors are used to read the relative 
-*        angle of the servo. The PID controller regulates the servo angle
-*        according to the sensor input to steer towards specified target angle.
+* basic_servo: Struct for implementation of PID controlled servos.
+*              Two TOF (Time Of Flight) sensors are used to read the relative
+*              angle of the servo. The PID controller regulates the servo angle
+*              according to the sensor input to steer towards specified target
+*              angle. The numeric type is a template parameter, see
+*              basic_pid_controller. The servo is used with doubles via the
+*              servo alias.
 ********************************************************************************/
-struct servo
+template<class T = double>
+struct basic_servo
 {
-   pid_controller pid;      /* PID controller for regulating the servo angle. */
-   tof_sensor left_sensor;  /* Left TOF sensor, indicates relative distance to the left. */
-   tof_sensor right_sensor; /* Right TOF sensor, indicates relative distance to the right.  */
+   basic_pid_controller<T> pid;         /* PID controller for regulating the servo angle. */
+   basic_tof_sensor<T> left_sensor;     /* Left TOF sensor, indicates relative distance to the left. */
+   basic_tof_sensor<T> right_sensor;    /* Right TOF sensor, indicates relative distance to the right.  */
+   cic_decimator left_decimator;        /* Decimator of the left sensor, used when oversampling. */
+   cic_decimator right_decimator;       /* Decimator of the right sensor, used when oversampling. */
+   basic_sensor_filter<T> left_filter;  /* Filter pipeline of the left sensor, disabled by default. */
+   basic_sensor_filter<T> right_filter; /* Filter pipeline of the right sensor, disabled by default. */
+   basic_bearing_fusion<T> fusion;      /* Kalman fusion of both sensors, disabled by default. */
+   basic_sensor_array<T> array;         /* Array of sensors replacing the pair, not used by default. */
+   health_monitor health;               /* Health monitor of both sensors, disabled by default. */
+   basic_pid_controller<T> healthy_pid; /* PID controller at the last cycle with clean readings. */
+   flight_recorder* recorder = nullptr; /* Flight recorder of the servo, none if nullptr. */
+   relay_autotuner autotuner;           /* Relay autotuner, replaces the PID regulation while active. */
+   oscillation_detector oscillation;    /* Oscillation detector with gain backoff, disabled by default. */
+   adaptive_rate rate;                  /* Adaptive control rate, regulated every tick by default. */
+   control_link control;                /* Control plane of the PID parameters and target, none by default. */
 
 
    /********************************************************************************
-   * servo: Initiates servo with specified parameters. As default, the target
-   *        angle is set to 90 degrees (center), with a range of 0 - 180 degrees,
-   *        where 0 means all the way to the left and 180 means all the way to
-   *        the right. The TOF sensor boundary values are set to 0 as minimum and
-   *        1023 as maximum. Finally the PID parameters are set to default values
-   *        suitable for most applications.
+   * basic_servo: Initiates servo with specified parameters. As default, the
+   *              target angle is set to 90 degrees (center), with a range of
+   *              0 - 180 degrees, where 0 means all the way to the left and 180
+   *              means all the way to the right. The TOF sensor boundary values
+   *              are set to 0 as minimum and 1023 as maximum. Finally the PID
+   *              parameters are set to default values suitable for most
+   *              applications.
    *        
-   *        - target_angle: Target angle for servo.
-   *        - angle_min   : Minimum servo angle (default = 0, i.e full left).
-   *        - angle_max   : Maximum servo angle (default = 180, i.e full right).
-   *        - input_min   : Minimum input value for sensors (default = 0).
-   *        - input_max   : Maximum input value for sensors (default = 1023).
-   *        - kp          : Proportional constant for PID controller (default = 1).
-   *        - ki          : Integrate constant for PID controller (default = 0.01).
-   *        - kd          : Derivate constant for PID controller (default = 0.1).
-   ********************************************************************************/
-   servo(const double target_angle = 90,
-         const double angle_min = 0,
-         const double angle_max = 180,
-         const double input_min = 0,
-         const double input_max = 1023,
-         const double kp = 1,
-         const double ki = 0.01,
-         const double kd = 0.1)
+   *              - target_angle: Target angle for servo.
+   *              - angle_min   : Minimum servo angle (default = 0, i.e full left).
+   *              - angle_max   : Maximum servo angle (default = 180, i.e full right).
+   *              - input_min   : Minimum input value for sensors (default = 0).
+   *              - input_max   : Maximum input value for sensors (default = 1023).
+   *              - kp          : Proportional constant for PID controller (default = 1).
+   *              - ki          : Integrate constant for PID controller (default = 0.01).
+   *              - kd          : Derivate constant for PID controller (default = 0.1).
+   ********************************************************************************/
+   basic_servo(const T target_angle = 90,
+               const T angle_min = 0,
+               const T angle_max = 180,
+               const T input_min = 0,
+               const T input_max = 1023,
+               const T kp = 1,
+               const T ki = 0.01,
+               const T kd = 0.1)
    {
       init(target_angle, angle_min, angle_max, input_min, input_max, kp, ki, kd);
       return;
@@ -70,14 +98,14 @@ struct servo
    *       - ki          : Integrate constant for PID controller (default = 0.01).
    *       - kd          : Derivate constant for PID controller (default = 0.1).
    ********************************************************************************/
-   void init(const double target_angle = 90,
-             const double angle_min = 0,
-             const double angle_max = 180,
-             const double input_min = 0,
-             const double input_max = 1023,
-             const double kp = 1,
-             const double ki = 0.01,
-             const double kd = 0.1)
+   void init(const T target_angle = 90,
+             const T angle_min = 0,
+             const T angle_max = 180,
+             const T input_min = 0,
+             const T input_max = 1023,
+             const T kp = 1,
+             const T ki = 0.01,
+             const T kd = 0.1)
    {
       pid.init(target_angle, angle_min, angle_max, kp, ki, kd);
       left_sensor.init(input_min, input_max);
@@ -88,7 +116,7 @@ struct servo
    /********************************************************************************
    * target: Returns the target angle of the servo.
    ********************************************************************************/
-   double target(void) const
+   T target(void) const
    {
       return pid.target;
    }
@@ -96,7 +124,7 @@ struct servo
    /********************************************************************************
    * output: Returns the current output angle of the servo.
    ********************************************************************************/
-   double output(void) const
+   T output(void) const
    {
       return pid.output;
    }
@@ -105,7 +133,7 @@ struct servo
    * input_range: Returns the range of the input values, i.e. the difference
    *              between specified max and min values.
    ********************************************************************************/
-   double input_range(void) const
+   T input_range(void) const
    {
       return left_sensor.input_range();
    }
@@ -117,10 +145,13 @@ struct servo
    *                   For example, if the left sensor reads 500 while the right 
    *                   sensor reads 700, the difference between the input signals 
    *                   is 500 - 700 = -200, which is returned.
+   *
+   *                   If the servo uses a sensor array, the difference is
+   *                   instead estimated from every sensor of the array.
    ********************************************************************************/
-   double input_difference(void) const
+   T input_difference(void) const
    {
-      return left_sensor.val - right_sensor.val;
+      return array.count ? array.difference() : left_sensor.val - right_sensor.val;
    }
 
    /********************************************************************************
@@ -128,11 +159,21 @@ struct servo
    *               right TOF sensor, mapped to scale with the servo angle and
    *               centered to the target.
    ********************************************************************************/
-   double input_mapped(void) const
+   T input_mapped(void) const
    {
       return input_ratio() * (target() * 2);
    }
 
+   /********************************************************************************
+   * input_bearing: Returns the bearing the servo regulates on, i.e. the Kalman
+   *                estimate fusing both sensors if the fusion is enabled for
+   *                the sensor pair, otherwise the mapped input.
+   ********************************************************************************/
+   T input_bearing(void) const
+   {
+      return fusion.enabled && !array.count ? fusion.estimate() : input_mapped();
+   }
+
    /********************************************************************************
    * input_ratio: Returns the ratio of the difference between the input values
    *              for left and right sensor as a number between 0 to 1. 
@@ -151,7 +192,7 @@ struct servo
    *              input ratio is 411.5 / 1023 = 0.4, i.e 40 % of max. 
    *              This ratio is returned after calculation.
    ********************************************************************************/
-   double input_ratio(void) const
+   T input_ratio(void) const
    {
       const auto scaled_input = (input_difference() + input_range()) / 2.0;
       return scaled_input / input_range();
@@ -212,19 +253,412 @@ struct servo
    /********************************************************************************
    * run: Reads input values for left and right TOF sensor, regulates the servo
    *      angle according to the input and prints the result in the terminal.
+   *      When oversampling, as many values as the decimation ratio are read
+   *      for each sensor before regulating.
    ********************************************************************************/
    void run(void)
    {
-      std::cout << "Enter input for left sensor:\n";
-      left_sensor.read_from_terminal();
-      std::cout << "Enter input for right sensor:\n";
-      right_sensor.read_from_terminal();
+      do
+      {
+         std::cout << "Enter input for left sensor:\n";
+         left_sensor.read_from_terminal();
+         std::cout << "Enter input for right sensor:\n";
+         right_sensor.read_from_terminal();
+      } while (!decimate_inputs());
 
-      pid.regulate(input_mapped());
+      filter_inputs();
+      fuse_inputs();
+      regulate();
       print();
       return;
    }
 
+   /********************************************************************************
+   * update: Sets new input values for left and right TOF sensor and regulates
+   *         the servo angle according to the new input. Used when the sensor
+   *         values are provided by a simulation rather than the terminal.
+   *
+   *         - left_input : New input value for the left sensor.
+   *         - right_input: New input value for the right sensor.
+   ********************************************************************************/
+   void update(const T left_input,
+               const T right_input)
+   {
+      if (!update_sensors(left_input, right_input)) return;
+      filter_inputs();
+      fuse_inputs();
+      regulate();
+      return;
+   }
+
+   /********************************************************************************
+   * sample: Adds a new sample of the left and right TOF sensor, read at the
+   *         sensor rate. When oversampling, the samples are decimated and the
+   *         servo angle is only regulated once every decimation ratio
+   *         samples, otherwise every sample is regulated on like in update.
+   *         The decimators run in fixed point, so derivatives of dual numbers
+   *         do not pass through them. Returns true if the servo regulated,
+   *         which is not the case while the output is held on a sensor fault.
+   *
+   *         - left_input : New sample of the left sensor.
+   *         - right_input: New sample of the right sensor.
+   ********************************************************************************/
+   bool sample(const T left_input,
+               const T right_input)
+   {
+      if (!update_sensors(left_input, right_input)) return false;
+      if (!decimate_inputs()) return false;
+      filter_inputs();
+      fuse_inputs();
+      regulate();
+      return true;
+   }
+
+   /********************************************************************************
+   * update_sensors: Sets new input values for left and right TOF sensor and
+   *                 checks the health of the sensors, see check_health. A
+   *                 missing reading, i.e. a value that is not a finite number,
+   *                 leaves the sensor at its last value. Returns false if the
+   *                 servo should not regulate.
+   *
+   *                 - left_input : New input value for the left sensor.
+   *                 - right_input: New input value for the right sensor.
+   ********************************************************************************/
+   bool update_sensors(const T left_input,
+                       const T right_input)
+   {
+      if (std::isfinite(numeric_value(left_input))) left_sensor.update(left_input);
+      if (std::isfinite(numeric_value(right_input))) right_sensor.update(right_input);
+      return check_health(left_input, right_input, left_sensor.val, right_sensor.val);
+   }
+
+   /********************************************************************************
+   * check_health: Checks specified readings and the sensor values they resulted
+   *               in if the health is monitored. On an active fault with hold
+   *               enabled, the PID controller is restored to the last cycle
+   *               with clean readings, so neither the output nor the integral
+   *               keeps what was regulated on suspect values, and false is
+   *               returned, since the servo should not regulate. The
+   *               saturation counter of the controller is kept.
+   *
+   *               - left_input : New reading of the left sensor.
+   *               - right_input: New reading of the right sensor.
+   *               - left_value : Left sensor value after calibration and clamping.
+   *               - right_value: Right sensor value after calibration and clamping.
+   ********************************************************************************/
+   bool check_health(const T left_input,
+                     const T right_input,
+                     const T left_value,
+                     const T right_value)
+   {
+      if (!health.enabled) return true;
+      if (health.clean()) healthy_pid = pid;
+
+      health.add(numeric_value(left_input), numeric_value(right_input), numeric_value(left_value),
+                 numeric_value(right_value), numeric_value(left_sensor.min), numeric_value(left_sensor.max));
+      if (!health.hold || health.healthy()) return true;
+      const auto saturation = pid.saturation;
+      pid = healthy_pid;
+      pid.saturation = saturation;
+      control.restore(pid);
+      health.held_cycles++;
+      if (rate.enabled) rate.fast();
+      record_cycle();
+      return false;
+   }
+
+   /********************************************************************************
+   * update_array: Sets new readings of every sensor of the array and regulates
+   *               the servo angle according to the difference estimated from
+   *               the array. The sensors on the left half of the fan read
+   *               through the left sensor and the others through the right
+   *               sensor, i.e. with its calibration table, range and clamp
+   *               counter, see basic_tof_sensor::read. A missing reading
+   *               leaves the sensor at its last value. The health monitor
+   *               checks the outermost sensors, which see the bearing like
+   *               the left and right sensor of the pair.
+   *
+   *               - readings: New readings, one per sensor of the array.
+   ********************************************************************************/
+   void update_array(const T* readings)
+   {
+      const auto last = array.count - 1;
+
+      for (std::size_t i = 0; i < array.count; ++i)
+      {
+         auto& sensor = array.sensitivity[i] < 0 ? right_sensor : left_sensor;
+         if (std::isfinite(numeric_value(readings[i]))) array.values[i] = sensor.read(readings[i]);
+      }
+
+      if (!check_health(readings[0], readings[last], array.values[0], array.values[last])) return;
+      regulate();
+      return;
+   }
+
+   /********************************************************************************
+   * set_sensors: Replaces the left and right sensor with an array of specified
+   *              number of sensors spread across a fan, see
+   *              basic_sensor_array::init, sharing the range of the left
+   *              sensor. An array of two sensors estimates exactly the same
+   *              difference as the pair, while no sensors returns to the pair.
+   *              The decimators, filters and fusion belong to the sensor pair,
+   *              so an array is rejected if any of them is enabled, and they
+   *              must stay disabled while the array is used. Returns true if
+   *              the sensors were set.
+   *
+   *              - num_sensors: Number of sensors, 0 = left and right sensor.
+   ********************************************************************************/
+   bool set_sensors(const std::size_t num_sensors)
+   {
+      if (num_sensors && (oversampling() != 1 || left_filter.stages || right_filter.stages || fusion.enabled))
+      {
+         return false;
+      }
+
+      array.init(num_sensors, numeric_value(left_sensor.min + input_range() / 2.0));
+      return true;
+   }
+
+   /********************************************************************************
+   * due: Counts a tick of the fleet and returns true if the servo is due for
+   *      regulation. Without an adaptive rate, the servo is due every tick.
+   *      With an adaptive rate, every tick must pass through here and the
+   *      servo is only read and regulated on the ticks it is due, while its
+   *      output is held in between.
+   ********************************************************************************/
+   bool due(void)
+   {
+      return !rate.enabled || rate.tick();
+   }
+
+   /********************************************************************************
+   * set_stats: Enables or disables the counters of output saturation and of
+   *            clamped sensor values, see clamp_counter. The counts are kept.
+   *
+   *            - enabled: Enables the counters if true.
+   ********************************************************************************/
+   void set_stats(const bool enabled)
+   {
+      pid.saturation.enabled = enabled;
+      left_sensor.clamping.enabled = enabled;
+      right_sensor.clamping.enabled = enabled;
+      return;
+   }
+
+   /********************************************************************************
+   * set_calibration: Attaches the calibration tables of referenced store to the
+   *                  left and right sensor, so that tables reloaded by the
+   *                  store are used from the next reading.
+   *
+   *                  - store: Reference to calibration store, must outlive the servo.
+   ********************************************************************************/
+   void set_calibration(const calibration_store& store)
+   {
+      left_sensor.calibration = &store.left;
+      right_sensor.calibration = &store.right;
+      return;
+   }
+
+   /********************************************************************************
+   * set_control: Attaches the servo to referenced control plane, so that the
+   *              PID parameters and target published to the plane are applied
+   *              from the next regulation.
+   *
+   *              - plane: Reference to control plane, must outlive the servo.
+   ********************************************************************************/
+   void set_control(const control_plane& plane)
+   {
+      control = control_link();
+      control.plane = &plane;
+      return;
+   }
+
+   /********************************************************************************
+   * set_oversampling: Sets the sensor rate to specified multiple of the control
+   *                   rate, where the samples of each sensor are decimated by
+   *                   a CIC decimator with specified number of stages.
+   *
+   *                   - ratio : Number of sensor samples per control cycle.
+   *                   - stages: Number of decimator stages, 1 = boxcar (default = 1).
+   ********************************************************************************/
+   void set_oversampling(const std::size_t ratio,
+                         const std::size_t stages = 1)
+   {
+      left_decimator.init(ratio, stages);
+      right_decimator.init(ratio, stages);
+      return;
+   }
+
+   /********************************************************************************
+   * oversampling: Returns the number of sensor samples per control cycle.
+   ********************************************************************************/
+   std::size_t oversampling(void) const
+   {
+      return left_decimator.ratio;
+   }
+
+   /********************************************************************************
+   * decimate_inputs: Adds the current sensor values to the decimators and
+   *                  replaces them with the decimated values once a control
+   *                  cycle is complete. Returns true if the cycle is complete,
+   *                  which is always the case without oversampling.
+   ********************************************************************************/
+   bool decimate_inputs(void)
+   {
+      if (oversampling() == 1) return true;
+      left_decimator.add(numeric_value(left_sensor.val));
+      if (!right_decimator.add(numeric_value(right_sensor.val))) return false;
+      left_sensor.val = left_decimator.value;
+      right_sensor.val = right_decimator.value;
+      return true;
+   }
+
+   /********************************************************************************
+   * set_filter: Enables specified filter stages for both sensors with specified
+   *             parameters, see basic_sensor_filter::init.
+   *
+   *             - stages     : Enabled stages, combined flags (0 = no filtering).
+   *             - window_size: Window size of the median stages (default = 5).
+   *             - alpha      : Weight of a new sample in the average (default = 0.5).
+   *             - threshold  : Outlier threshold in standard deviations (default = 3).
+   ********************************************************************************/
+   void set_filter(const unsigned stages,
+                   const std::size_t window_size = 5,
+                   const double alpha = 0.5,
+                   const double threshold = 3.0)
+   {
+      left_filter.init(stages, window_size, alpha, threshold);
+      right_filter.init(stages, window_size, alpha, threshold);
+      return;
+   }
+
+   /********************************************************************************
+   * filter_inputs: Runs the current sensor values through the filter pipeline of
+   *                each sensor, ahead of the mapping to the servo input.
+   ********************************************************************************/
+   void filter_inputs(void)
+   {
+      left_sensor.val = left_filter.add(left_sensor.val);
+      right_sensor.val = right_filter.add(right_sensor.val);
+      return;
+   }
+
+   /********************************************************************************
+   * fuse_inputs: Updates the bearing estimate with the current sensor values if
+   *              the fusion is enabled. Each sensor is mapped to a bearing on
+   *              its own, so that the fusion can weight the sensors by their
+   *              noise, and the angle commanded last cycle drives the model.
+   ********************************************************************************/
+   void fuse_inputs(void)
+   {
+      if (!fusion.enabled) return;
+      const auto middle = left_sensor.min + input_range() / 2.0;
+      const auto scale = 2.0 * numeric_value(target()) / numeric_value(input_range());
+      fusion.update(target() + (left_sensor.val - middle) * scale,
+                    target() - (right_sensor.val - middle) * scale, output(), scale);
+      return;
+   }
+
+   /********************************************************************************
+   * regulate: Regulates the servo angle according to the current sensor values.
+   *           While autotuning, the servo angle is set by the relay autotuner
+   *           instead, which installs new PID parameters when done. Otherwise
+   *           the error is monitored for sustained oscillation if enabled,
+   *           where the gains are scaled back if backoff is enabled. With an
+   *           adaptive rate, the PID controller is updated with the ticks
+   *           elapsed since the last regulation and the error adapts the
+   *           period. While slowed down with an error within the deadband,
+   *           only the input and error of the controller are updated and the
+   *           output is held. Autotuning runs at the fast rate. A parameter
+   *           set newly published to the control plane, if any, is applied
+   *           first. The cycle is added to the flight recorder, if any.
+   ********************************************************************************/
+   void regulate(void)
+   {
+      if (control.plane) control.apply(pid);
+
+      if (autotuner.active())
+      {
+         autotuner.regulate(pid, input_bearing());
+         if (rate.enabled) rate.fast();
+      }
+      else if (rate.enabled && rate.settled(numeric_value(target() - input_bearing())))
+      {
+         pid.input = input_bearing();
+         pid.last_error = target() - pid.input;
+         rate.update(numeric_value(pid.last_error));
+      }
+      else
+      {
+         pid.regulate(input_bearing(), rate.enabled ? rate.dt() : 1.0);
+         if (oscillation.enabled && oscillation.update(numeric_value(pid.last_error))) oscillation.back_off(pid);
+         if (rate.enabled) rate.update(numeric_value(pid.last_error));
+      }
+
+      record_cycle();
+      return;
+   }
+
+   /********************************************************************************
+   * record_cycle: Adds the sensor values, the input, the target, the output and
+   *               the error of this cycle to the flight recorder, if any, along
+   *               with the active sensor faults and whether the output is
+   *               saturated.
+   ********************************************************************************/
+   void record_cycle(void)
+   {
+      if (!recorder) return;
+      cycle_record entry;
+      entry.left = static_cast<float>(numeric_value(left_sensor.val));
+      entry.right = static_cast<float>(numeric_value(right_sensor.val));
+      entry.input = static_cast<float>(numeric_value(input_bearing()));
+      entry.target = static_cast<float>(numeric_value(target()));
+      entry.output = static_cast<float>(numeric_value(output()));
+      entry.error = static_cast<float>(numeric_value(pid.last_error));
+      entry.flags = health.flags() | (output() <= pid.output_min || output() >= pid.output_max ?
+         cycle_record::SATURATED : 0);
+      recorder->record(entry);
+      return;
+   }
+
+   /********************************************************************************
+   * autotune: Starts relay autotuning of the PID parameters, which is run during
+   *           the following calls to regulate. The servo should be started at
+   *           the target with steady surroundings, for instance at startup.
+   ********************************************************************************/
+   void autotune(void)
+   {
+      pid.reset();
+      autotuner.start();
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Resets the PID controller, the decimators, the sensor filters, the
+   *        bearing fusion, the active faults of the health monitor, the
+   *        oscillation detector and the adaptive rate, so the servo starts at
+   *        the target angle at the fast rate with no accumulated integral
+   *        value.
+   ********************************************************************************/
+   void reset(void)
+   {
+      pid.reset();
+      left_decimator.reset();
+      right_decimator.reset();
+      left_filter.reset();
+      right_filter.reset();
+      fusion.reset();
+      health.reset();
+      oscillation.reset();
+      rate.reset();
+      return;
+   }
+
 };
 
+/********************************************************************************
+* servo: Servo using doubles, used by the emulator.
+********************************************************************************/
+using servo = basic_servo<double>;
+
 #endif /* SERVO_HPP_ */
\ No newline at end of file
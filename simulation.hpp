@@ -0,0 +1,622 @@
+/********************************************************************************
+* simulation.hpp: Contains a simulated plant for the PID controlled servo,
+*                 scenarios describing how the bearing seen by the TOF sensors
+*                 is disturbed over time and metrics for evaluating how well
+*                 the servo follows its target during a scenario.
+*
+*                 The servo shaft is modelled as an inertia driven towards the
+*                 commanded angle by the servo's internal position loop. The
+*                 TOF sensors are mounted on the shaft, so the bearing seen by
+*                 the sensors is the shaft angle relative to the target plus
+*                 the disturbance of the scenario. The sensor values are
+*                 generated so that the mapped input of the servo equals the
+*                 bearing mapped around the target angle.
+********************************************************************************/
+#ifndef SIMULATION_HPP_
+#define SIMULATION_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "servo.hpp"
+
+/********************************************************************************
+* basic_plant_model: Struct for implementation of a simulated servo shaft with
+*                    adjustable inertia, damping, friction, rate limit and
+*                    sensor noise. The model is updated once per control cycle.
+*                    The numeric type is a template parameter, see
+*                    basic_pid_controller.
+********************************************************************************/
+template<class T = double>
+struct basic_plant_model
+{
+   T inertia          = 1.0;  /* Moment of inertia of the shaft (relative). */
+   T stiffness        = 0.4;  /* Gain of the servo's internal position loop. */
+   T damping          = 0.6;  /* Viscous damping of the shaft. */
+   T friction         = 0.0;  /* Coulomb friction, opposes the shaft velocity. */
+   T rate_limit       = 10.0; /* Maximum angular velocity in degrees per cycle. */
+   T sensor_noise     = 0.0;  /* Standard deviation of sensor noise in sensor units. */
+   T angle            = 90.0; /* Current shaft angle in degrees. */
+   T velocity         = 0.0;  /* Current shaft velocity in degrees per cycle. */
+   std::uint64_t seed = 1;    /* State of the noise generator. */
+
+   /********************************************************************************
+   * reset: Places the shaft at specified angle at rest and reseeds the noise
+   *        generator, so that every run of a scenario is reproducible.
+   *
+   *        - start_angle: Start angle of the shaft.
+   *        - noise_seed : Seed for the noise generator (default = 1).
+   ********************************************************************************/
+   void reset(const T start_angle,
+              const std::uint64_t noise_seed = 1)
+   {
+      angle = start_angle;
+      velocity = 0;
+      seed = noise_seed ? noise_seed : 1;
+      return;
+   }
+
+   /********************************************************************************
+   * step: Updates the shaft angle one control cycle, where the shaft is driven
+   *       towards specified commanded angle. The new shaft angle is returned.
+   *
+   *       - command: Angle commanded by the PID controller.
+   ********************************************************************************/
+   T step(const T command)
+   {
+      auto acceleration = (stiffness * (command - angle) - damping * velocity) / inertia;
+
+      if (velocity > 0)
+      {
+         acceleration -= friction / inertia;
+      }
+      else if (velocity < 0)
+      {
+         acceleration += friction / inertia;
+      }
+
+      velocity += acceleration;
+
+      if (velocity > rate_limit)
+      {
+         velocity = rate_limit;
+      }
+      else if (velocity < -rate_limit)
+      {
+         velocity = -rate_limit;
+      }
+
+      angle += velocity;
+      return angle;
+   }
+
+   /********************************************************************************
+   * noise: Returns a new sensor noise sample with the standard deviation of the
+   *        model. The sample is approximately normal distributed (sum of four
+   *        uniform samples), which is sufficient for sensor noise and keeps
+   *        the generator state to a single integer.
+   ********************************************************************************/
+   double noise(void)
+   {
+      const auto deviation = numeric_value(sensor_noise);
+      if (deviation == 0) return 0;
+      auto sum = 0.0;
+
+      for (auto i = 0; i < 4; ++i)
+      {
+         seed ^= seed << 13;
+         seed ^= seed >> 7;
+         seed ^= seed << 17;
+         sum += static_cast<double>(seed >> 11) * (1.0 / 9007199254740992.0);
+      }
+      return (sum - 2.0) * std::sqrt(3.0) * deviation;
+   }
+};
+
+/********************************************************************************
+* plant_model: Plant model using doubles, used by the emulator.
+********************************************************************************/
+using plant_model = basic_plant_model<double>;
+
+/********************************************************************************
+* scenario: Struct holding the disturbance of the bearing seen by the sensors
+*           for every control cycle of a simulation run.
+********************************************************************************/
+struct scenario
+{
+   std::string name;                /* Name of the scenario, used for printing. */
+   std::vector<double> disturbance; /* Bearing disturbance in degrees per cycle. */
+
+   /********************************************************************************
+   * step: Returns a scenario where the bearing is stepped at specified cycle.
+   *
+   *       - name      : Name of the scenario.
+   *       - cycles    : Length of the scenario in control cycles.
+   *       - step_cycle: Cycle at which the step occurs.
+   *       - amplitude : Size of the step in degrees.
+   ********************************************************************************/
+   static scenario step(const std::string& name,
+                        const std::size_t cycles,
+                        const std::size_t step_cycle,
+                        const double amplitude)
+   {
+      scenario self;
+      self.name = name;
+      self.disturbance.resize(cycles);
+
+      for (std::size_t i = 0; i < cycles; ++i)
+      {
+         self.disturbance[i] = i < step_cycle ? 0 : amplitude;
+      }
+      return self;
+   }
+
+   /********************************************************************************
+   * ramp: Returns a scenario where the bearing drifts linearly between specified
+   *       cycles and is then held.
+   *
+   *       - name      : Name of the scenario.
+   *       - cycles    : Length of the scenario in control cycles.
+   *       - start     : Cycle at which the ramp starts.
+   *       - end       : Cycle at which the ramp ends.
+   *       - amplitude : Total drift of the ramp in degrees.
+   ********************************************************************************/
+   static scenario ramp(const std::string& name,
+                        const std::size_t cycles,
+                        const std::size_t start,
+                        const std::size_t end,
+                        const double amplitude)
+   {
+      scenario self;
+      self.name = name;
+      self.disturbance.resize(cycles);
+
+      for (std::size_t i = 0; i < cycles; ++i)
+      {
+         if (i < start)
+         {
+            self.disturbance[i] = 0;
+         }
+         else if (i < end)
+         {
+            self.disturbance[i] = amplitude * (i - start) / static_cast<double>(end - start);
+         }
+         else
+         {
+            self.disturbance[i] = amplitude;
+         }
+      }
+      return self;
+   }
+
+   /********************************************************************************
+   * sine: Returns a scenario where the bearing oscillates with specified period.
+   *
+   *       - name      : Name of the scenario.
+   *       - cycles    : Length of the scenario in control cycles.
+   *       - period    : Period of the oscillation in control cycles.
+   *       - amplitude : Amplitude of the oscillation in degrees.
+   ********************************************************************************/
+   static scenario sine(const std::string& name,
+                        const std::size_t cycles,
+                        const double period,
+                        const double amplitude)
+   {
+      const auto pi = 3.14159265358979323846;
+      scenario self;
+      self.name = name;
+      self.disturbance.resize(cycles);
+
+      for (std::size_t i = 0; i < cycles; ++i)
+      {
+         self.disturbance[i] = amplitude * std::sin(2 * pi * i / period);
+      }
+      return self;
+   }
+
+   /********************************************************************************
+   * join: Returns a scenario where the disturbance of the second scenario
+   *       follows the disturbance of the first, for instance to put a common
+   *       warm-up segment in front of a test.
+   *
+   *       - name  : Name of the scenario.
+   *       - first : Reference to the first scenario.
+   *       - second: Reference to the second scenario.
+   ********************************************************************************/
+   static scenario join(const std::string& name,
+                        const scenario& first,
+                        const scenario& second)
+   {
+      scenario self;
+      self.name = name;
+      self.disturbance = first.disturbance;
+      self.disturbance.insert(self.disturbance.end(), second.disturbance.begin(), second.disturbance.end());
+      return self;
+   }
+
+   /********************************************************************************
+   * default_suite: Returns the scenario suite used for tuning as default,
+   *                containing steps to both sides, a slow drift and a sine
+   *                shaped disturbance.
+   ********************************************************************************/
+   static std::vector<scenario> default_suite(void)
+   {
+      std::vector<scenario> suite;
+      suite.push_back(step("Step 20 degrees right", 300, 20, 20));
+      suite.push_back(step("Step 40 degrees left", 300, 20, -40));
+      suite.push_back(ramp("Drift 30 degrees right", 400, 20, 220, 30));
+      suite.push_back(sine("Sine 15 degrees, period 80", 400, 80, 15));
+      return suite;
+   }
+};
+
+/********************************************************************************
+* basic_metrics: Struct holding performance measures of a simulation run. The
+*                error is the difference between the target angle and the true
+*                (noise free) bearing of the servo in degrees. The numeric type
+*                is a template parameter, see basic_pid_controller.
+********************************************************************************/
+template<class T = double>
+struct basic_metrics
+{
+   T iae              = 0; /* Integral of absolute error. */
+   T ise              = 0; /* Integral of squared error. */
+   T itae             = 0; /* Integral of absolute error weighted with time since last step. */
+   T overshoot        = 0; /* Largest excursion past the target after a step, in degrees. */
+   T settling_time    = 0; /* Longest time in cycles before the error stays within the band. */
+   T effort           = 0; /* Total travel of the commanded angle in degrees. */
+   std::size_t cycles = 0; /* Number of simulated cycles. */
+
+   /********************************************************************************
+   * combine: Combines the metrics with the metrics of another run. The integrals
+   *          are summed, while overshoot and settling time are set to the worst
+   *          of the two runs.
+   *
+   *          - other: Reference to metrics of the other run.
+   ********************************************************************************/
+   void combine(const basic_metrics& other)
+   {
+      iae += other.iae;
+      ise += other.ise;
+      itae += other.itae;
+      effort += other.effort;
+      cycles += other.cycles;
+      if (other.overshoot > overshoot) overshoot = other.overshoot;
+      if (other.settling_time > settling_time) settling_time = other.settling_time;
+      return;
+   }
+
+   /********************************************************************************
+   * print: Prints the metrics in the terminal with two decimals as default.
+   *        The integrals are printed as averages per cycle.
+   *
+   *        - ostream     : Reference to output stream used (default = std::cout).
+   *        - num_decimals: Number of printed decimals per parameter (default = 2).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout,
+              const int num_decimals = 2) const
+   {
+      const auto n = cycles > 0 ? static_cast<double>(cycles) : 1.0;
+      ostream << std::fixed << std::setprecision(num_decimals);
+      ostream << "Mean absolute error:\t\t" << iae / n << " degrees\n";
+      ostream << "Mean squared error:\t\t" << ise / n << " degrees^2\n";
+      ostream << "Mean time weighted error:\t" << itae / n << " degrees * cycles\n";
+      ostream << "Overshoot:\t\t\t" << overshoot << " degrees\n";
+      ostream << "Settling time:\t\t\t" << settling_time << " cycles\n";
+      ostream << "Actuator travel:\t\t" << effort << " degrees\n";
+      return;
+   }
+};
+
+/********************************************************************************
+* metrics: Metrics using doubles, used by the emulator.
+********************************************************************************/
+using metrics = basic_metrics<double>;
+
+/********************************************************************************
+* cost_function: Struct for weighting metrics of a simulation run into a single
+*                cost, used for comparing candidate PID parameters.
+*                The integrals are normalized with the number of cycles, so
+*                that scenarios of different length are weighted equally.
+********************************************************************************/
+struct cost_function
+{
+   double iae_weight       = 1.0;  /* Weight of mean absolute error. */
+   double ise_weight       = 0.0;  /* Weight of mean squared error. */
+   double itae_weight      = 0.01; /* Weight of mean time weighted absolute error. */
+   double overshoot_weight = 0.5;  /* Weight of overshoot in degrees. */
+
+   /********************************************************************************
+   * operator(): Returns the cost of referenced metrics, with the derivatives of
+   *             the cost if the metrics hold dual numbers.
+   *
+   *             - result: Reference to metrics of a simulation run.
+   ********************************************************************************/
+   template<class T>
+   T operator()(const basic_metrics<T>& result) const
+   {
+      const auto n = result.cycles > 0 ? static_cast<double>(result.cycles) : 1.0;
+      return iae_weight * result.iae / n + ise_weight * result.ise / n +
+         itae_weight * result.itae / n + overshoot_weight * result.overshoot;
+   }
+};
+
+/********************************************************************************
+* basic_simulation: Struct for running a servo in closed loop against a
+*                   simulated plant, one control cycle at a time. The metrics
+*                   are accumulated incrementally, so that the whole state of
+*                   a run is held in the struct and can be copied at any cycle.
+*                   The numeric type is a template parameter, so that the
+*                   derivatives of the metrics with respect to the PID
+*                   parameters can be calculated with dual numbers in the same
+*                   run.
+********************************************************************************/
+template<class T = double>
+struct basic_simulation
+{
+   static constexpr auto STEP_THRESHOLD = 0.5; /* Disturbance change treated as a step. */
+   static constexpr auto SETTLING_BAND  = 1.0; /* Error band for settling time in degrees. */
+
+   basic_servo<T> device;       /* Simulated servo. */
+   basic_plant_model<T> plant;  /* Simulated servo shaft. */
+   basic_metrics<T> result;     /* Metrics accumulated so far. */
+   double last_disturbance = 0; /* Disturbance of last cycle, used for step detection. */
+   T last_output           = 0; /* Commanded angle of last cycle, used for effort. */
+   double reference_sign   = 0; /* Sign of the error directly after the last step. */
+   std::size_t step_cycle  = 0; /* Cycle of the last step. */
+
+   /********************************************************************************
+   * basic_simulation: Initiates a new simulation run with specified servo
+   *                   configuration and plant model. The servo is reset and
+   *                   the shaft is placed at the target angle.
+   *
+   *                   - config: Reference to servo holding configuration and gains.
+   *                   - model : Reference to plant model.
+   ********************************************************************************/
+   basic_simulation(const basic_servo<T>& config,
+                    const basic_plant_model<T>& model)
+      : device(config), plant(model)
+   {
+      device.reset();
+      plant.reset(device.target(), model.seed);
+      last_output = device.output();
+      return;
+   }
+
+   /********************************************************************************
+   * sensor_values: Generates left and right sensor values for specified bearing
+   *                mapped around the target angle, such that the mapped input of
+   *                the servo equals the bearing. Noise is added to each sensor.
+   *
+   *                - mapped_input: Mapped bearing of the servo.
+   *                - left_value  : Reference to storage for left sensor value.
+   *                - right_value : Reference to storage for right sensor value.
+   ********************************************************************************/
+   void sensor_values(const T mapped_input,
+                      T& left_value,
+                      T& right_value)
+   {
+      const auto range = device.input_range();
+      const auto middle = device.left_sensor.min + range / 2.0;
+      const auto difference = range * (mapped_input / device.target() - 1.0);
+      left_value = middle + difference / 2.0 + plant.noise();
+      right_value = middle - difference / 2.0 + plant.noise();
+      return;
+   }
+
+   /********************************************************************************
+   * array_values: Generates a value for each sensor of the servo's sensor array
+   *               for specified bearing, such that each sensor sees the
+   *               difference of a left and right sensor pair scaled by its
+   *               sensitivity. Noise is added to each sensor in order, so an
+   *               array of two sensors gets exactly the values of the pair.
+   *
+   *               - mapped_input: Mapped bearing of the servo.
+   *               - values      : Pointer to storage for one value per sensor.
+   ********************************************************************************/
+   void array_values(const T mapped_input,
+                     T* values)
+   {
+      const auto range = device.input_range();
+      const auto middle = device.left_sensor.min + range / 2.0;
+      const auto difference = range * (mapped_input / device.target() - 1.0);
+
+      for (std::size_t i = 0; i < device.array.count; ++i)
+      {
+         values[i] = middle + device.array.sensitivity[i] * difference / 2.0 + plant.noise();
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * step: Runs one control cycle with specified disturbance. The sensors are
+   *       read at the current shaft angle, the servo regulates its output and
+   *       the shaft is driven towards the new output. When the servo
+   *       oversamples, the earlier samples of the cycle are read while the
+   *       shaft moves from its previous angle, interpolated linearly. A servo
+   *       with a sensor array reads every sensor of the array once per cycle.
+   *       A servo with an adaptive rate is neither read nor regulated on the
+   *       cycles it is not due, so its output is held while the shaft moves.
+   *
+   *       - disturbance: Bearing disturbance of this cycle in degrees.
+   ********************************************************************************/
+   void step(const double disturbance)
+   {
+      if (!device.due())
+      {
+         measure(disturbance);
+         actuate(disturbance);
+         return;
+      }
+      else if (device.array.count)
+      {
+         T values[basic_sensor_array<T>::MAX_SENSORS];
+         array_values(plant.angle + disturbance, values);
+         step(disturbance, values);
+         return;
+      }
+
+      const auto ratio = device.oversampling();
+      T left_value = 0, right_value = 0;
+
+      for (std::size_t i = 1; i < ratio; ++i)
+      {
+         const auto lag = static_cast<double>(ratio - i) / ratio;
+         sensor_values(plant.angle - plant.velocity * lag + disturbance, left_value, right_value);
+         device.sample(left_value, right_value);
+      }
+
+      sensor_values(plant.angle + disturbance, left_value, right_value);
+      step(disturbance, left_value, right_value);
+      return;
+   }
+
+   /********************************************************************************
+   * step: Runs one control cycle with specified disturbance and sensor values,
+   *       for instance values replayed from a recording. The metrics are
+   *       updated, the servo regulates its output and the shaft is driven
+   *       towards the new output. When the servo oversamples, the values are
+   *       the last sample of the cycle.
+   *
+   *       - disturbance: Bearing disturbance of this cycle in degrees.
+   *       - left_value : Value of the left sensor.
+   *       - right_value: Value of the right sensor.
+   ********************************************************************************/
+   void step(const double disturbance,
+             const T left_value,
+             const T right_value)
+   {
+      measure(disturbance);
+      device.sample(left_value, right_value);
+      actuate(disturbance);
+      return;
+   }
+
+   /********************************************************************************
+   * step: Runs one control cycle with specified disturbance and values of
+   *       every sensor of the servo's sensor array, see above.
+   *
+   *       - disturbance: Bearing disturbance of this cycle in degrees.
+   *       - values     : Pointer to one value per sensor of the array.
+   ********************************************************************************/
+   void step(const double disturbance,
+             const T* values)
+   {
+      measure(disturbance);
+      device.update_array(values);
+      actuate(disturbance);
+      return;
+   }
+
+   /********************************************************************************
+   * measure: Updates the metrics with the error of this cycle, ahead of the
+   *          regulation of the servo.
+   *
+   *          - disturbance: Bearing disturbance of this cycle in degrees.
+   ********************************************************************************/
+   void measure(const double disturbance)
+   {
+      using std::fabs;
+      const auto cycle = result.cycles;
+      const auto error = device.target() - (plant.angle + disturbance);
+
+      if (cycle == 0 || fabs(disturbance - last_disturbance) > STEP_THRESHOLD)
+      {
+         step_cycle = cycle;
+         reference_sign = error > 0 ? 1.0 : (error < 0 ? -1.0 : 0.0);
+      }
+
+      const auto abs_error = fabs(error);
+      result.iae += abs_error;
+      result.ise += error * error;
+      result.itae += static_cast<double>(cycle - step_cycle) * abs_error;
+      if (-reference_sign * error > result.overshoot) result.overshoot = -reference_sign * error;
+      if (abs_error > SETTLING_BAND && static_cast<double>(cycle - step_cycle + 1) > result.settling_time)
+      {
+         result.settling_time = static_cast<double>(cycle - step_cycle + 1);
+      }
+      return;
+   }
+
+   /********************************************************************************
+   * actuate: Drives the shaft towards the output of the servo, regulated this
+   *          cycle, and completes the cycle.
+   *
+   *          - disturbance: Bearing disturbance of this cycle in degrees.
+   ********************************************************************************/
+   void actuate(const double disturbance)
+   {
+      using std::fabs;
+      plant.step(device.output());
+      result.effort += fabs(device.output() - last_output);
+      last_output = device.output();
+      last_disturbance = disturbance;
+      result.cycles++;
+      return;
+   }
+
+   /********************************************************************************
+   * run: Runs every cycle of referenced scenario and returns the metrics
+   *      accumulated so far.
+   *
+   *      - test: Reference to scenario to run.
+   ********************************************************************************/
+   const basic_metrics<T>& run(const scenario& test)
+   {
+      for (const auto& i : test.disturbance)
+      {
+         step(i);
+      }
+      return result;
+   }
+};
+
+/********************************************************************************
+* simulation: Simulation using doubles, used by the emulator.
+********************************************************************************/
+using simulation = basic_simulation<double>;
+
+/********************************************************************************
+* simulate: Runs referenced scenario from a freshly reset servo and plant and
+*           returns the resulting metrics.
+*
+*           - config: Reference to servo holding configuration and gains.
+*           - model : Reference to plant model.
+*           - test  : Reference to scenario to run.
+********************************************************************************/
+template<class T>
+basic_metrics<T> simulate(const basic_servo<T>& config,
+                          const basic_plant_model<T>& model,
+                          const scenario& test)
+{
+   basic_simulation<T> run(config, model);
+   return run.run(test);
+}
+
+/********************************************************************************
+* simulate: Runs every scenario of referenced suite from a freshly reset servo
+*           and plant and returns the combined metrics.
+*
+*           - config: Reference to servo holding configuration and gains.
+*           - model : Reference to plant model.
+*           - suite : Reference to scenarios to run.
+********************************************************************************/
+template<class T>
+basic_metrics<T> simulate(const basic_servo<T>& config,
+                          const basic_plant_model<T>& model,
+                          const std::vector<scenario>& suite)
+{
+   basic_metrics<T> total;
+
+   for (const auto& i : suite)
+   {
+      total.combine(simulate(config, model, i));
+   }
+   return total;
+}
+
+#endif /* SIMULATION_HPP_ */
\ No newline at end of file
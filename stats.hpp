@@ -0,0 +1,418 @@
+/********************************************************************************
+* stats.hpp: Contains run-time statistics of the servos and the surface they
+*            are exported through. Clamp counters record how often a value is
+*            limited to its range, i.e. the output of a PID controller
+*            saturating or a TOF sensor value clamped to the sensor range,
+*            which point to bad tuning and sensor problems respectively. A
+*            counter is updated on the branch that already checks the limits,
+*            so a disabled counter costs a single test of a flag.
+*
+*            The statistics are exported by stats_report as one line per
+*            value, with the name of the value followed by the value:
+*
+*            output_saturation_events 12
+*            output_saturation_worst 3.75
+*            ...
+*
+*            Latency histograms, for instance of the wake-up lateness of a
+*            paced control loop, count samples in buckets that grow
+*            geometrically, four per power of two, so that nanoseconds and
+*            seconds fit in a few hundred bytes with a resolution of a
+*            quarter of an octave.
+********************************************************************************/
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+/* Include directives: */
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/********************************************************************************
+* clamp_counter: Struct for implementation of a counter of clamped values. A
+*                run of consecutive clamped samples counts as one event, so
+*                the events, their total and longest duration and the worst
+*                excursion beyond the limits are known. Counters of several
+*                instances are combined into an aggregated view.
+********************************************************************************/
+struct clamp_counter
+{
+   bool enabled          = false; /* Indicates if samples are counted. */
+   std::uint64_t samples = 0;     /* Number of samples checked. */
+   std::uint64_t clamped = 0;     /* Number of samples clamped. */
+   std::uint64_t events  = 0;     /* Number of runs of clamped samples. */
+   std::uint64_t run     = 0;     /* Clamped samples in the current run. */
+   std::uint64_t longest = 0;     /* Longest run of clamped samples. */
+   double worst          = 0;     /* Largest excursion beyond the limits. */
+
+   /********************************************************************************
+   * pass: Counts a sample within the limits, which ends the current run.
+   ********************************************************************************/
+   void pass(void)
+   {
+      samples++;
+      run = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * clamp: Counts a clamped sample with specified excursion beyond the limits.
+   *
+   *        - excursion: Distance from the sample to the nearest limit.
+   ********************************************************************************/
+   void clamp(const double excursion)
+   {
+      samples++;
+      clamped++;
+      if (run++ == 0) events++;
+      if (run > longest) longest = run;
+      if (excursion > worst) worst = excursion;
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears the counts, while the counter stays enabled or disabled.
+   ********************************************************************************/
+   void reset(void)
+   {
+      const auto was_enabled = enabled;
+      *this = clamp_counter();
+      enabled = was_enabled;
+      return;
+   }
+
+   /********************************************************************************
+   * combine: Adds the counts of referenced counter, where the longest run and
+   *          the worst excursion are the largest of both counters.
+   *
+   *          - other: Reference to the counter to add.
+   ********************************************************************************/
+   void combine(const clamp_counter& other)
+   {
+      samples += other.samples;
+      clamped += other.clamped;
+      events += other.events;
+      if (other.longest > longest) longest = other.longest;
+      if (other.worst > worst) worst = other.worst;
+      return;
+   }
+
+   /********************************************************************************
+   * ratio: Returns the share of samples clamped, between 0 and 1.
+   ********************************************************************************/
+   double ratio(void) const
+   {
+      return samples ? static_cast<double>(clamped) / samples : 0.0;
+   }
+
+   /********************************************************************************
+   * mean_duration: Returns the mean number of samples per event.
+   ********************************************************************************/
+   double mean_duration(void) const
+   {
+      return events ? static_cast<double>(clamped) / events : 0.0;
+   }
+};
+
+/********************************************************************************
+* saturation_stats: Struct for aggregating the clamp counters of a fleet of
+*                   servos, i.e. the output saturation of every PID controller
+*                   and the clamping of every TOF sensor.
+********************************************************************************/
+struct saturation_stats
+{
+   clamp_counter output;             /* Saturation of the servo outputs. */
+   clamp_counter sensors;            /* Clamping of the sensor values. */
+   std::size_t servos           = 0; /* Number of servos added. */
+   std::size_t saturated_servos = 0; /* Number of servos with a saturation event. */
+   std::size_t clamped_servos   = 0; /* Number of servos with a clamping event. */
+
+   /********************************************************************************
+   * add: Adds the counters of referenced servo, for instance a basic_servo.
+   *
+   *      - device: Reference to the servo.
+   ********************************************************************************/
+   template<class Servo>
+   void add(const Servo& device)
+   {
+      output.combine(device.pid.saturation);
+      sensors.combine(device.left_sensor.clamping);
+      sensors.combine(device.right_sensor.clamping);
+      servos++;
+      if (device.pid.saturation.events) saturated_servos++;
+      if (device.left_sensor.clamping.events || device.right_sensor.clamping.events) clamped_servos++;
+      return;
+   }
+
+   /********************************************************************************
+   * combine: Adds the counters of referenced fleet statistics.
+   *
+   *          - other: Reference to the statistics to add.
+   ********************************************************************************/
+   void combine(const saturation_stats& other)
+   {
+      output.combine(other.output);
+      sensors.combine(other.sensors);
+      servos += other.servos;
+      saturated_servos += other.saturated_servos;
+      clamped_servos += other.clamped_servos;
+      return;
+   }
+};
+
+/********************************************************************************
+* latency_histogram: Struct for implementation of a histogram of latencies in
+*                    nanoseconds. The first four buckets hold 0 to 3 ns and
+*                    the others split each power of two into four equal
+*                    parts, so a percentile is known within a quarter of an
+*                    octave. Adding a sample costs a few shifts.
+********************************************************************************/
+struct latency_histogram
+{
+   static constexpr std::size_t SUB_BITS = 2;             /* Bits of the bucket within an octave. */
+   static constexpr std::size_t SUB      = 1 << SUB_BITS; /* Buckets per octave. */
+   static constexpr std::size_t OCTAVES  = 40;            /* Octaves covered, i.e. below 2^41 ns. */
+   static constexpr std::size_t BUCKETS  = SUB * OCTAVES; /* Number of buckets. */
+
+   std::uint64_t counts[BUCKETS]{}; /* Number of samples of each bucket. */
+   std::uint64_t samples = 0;       /* Number of samples added. */
+   std::uint64_t worst   = 0;       /* Largest latency added in ns. */
+   double sum            = 0;       /* Sum of the latencies in ns. */
+
+   /********************************************************************************
+   * add: Adds a sample of specified latency.
+   *
+   *      - ns: Latency in nanoseconds.
+   ********************************************************************************/
+   void add(const std::uint64_t ns)
+   {
+      counts[bucket(ns)]++;
+      samples++;
+      sum += static_cast<double>(ns);
+      if (ns > worst) worst = ns;
+      return;
+   }
+
+   /********************************************************************************
+   * reset: Clears every sample.
+   ********************************************************************************/
+   void reset(void)
+   {
+      *this = latency_histogram();
+      return;
+   }
+
+   /********************************************************************************
+   * combine: Adds the samples of referenced histogram.
+   *
+   *          - other: Reference to the histogram to add.
+   ********************************************************************************/
+   void combine(const latency_histogram& other)
+   {
+      for (std::size_t i = 0; i < BUCKETS; ++i)
+      {
+         counts[i] += other.counts[i];
+      }
+
+      samples += other.samples;
+      sum += other.sum;
+      if (other.worst > worst) worst = other.worst;
+      return;
+   }
+
+   /********************************************************************************
+   * mean: Returns the mean latency in ns.
+   ********************************************************************************/
+   double mean(void) const
+   {
+      return samples ? sum / samples : 0.0;
+   }
+
+   /********************************************************************************
+   * percentile: Returns the upper bound in ns of the bucket holding specified
+   *             fraction of the samples, limited to the largest latency.
+   *
+   *             - fraction: Fraction of the samples between 0 and 1, for
+   *                         instance 0.99 for the 99th percentile.
+   ********************************************************************************/
+   std::uint64_t percentile(const double fraction) const
+   {
+      const auto rank = static_cast<std::uint64_t>(std::ceil(fraction * samples));
+      std::uint64_t seen = 0;
+
+      for (std::size_t i = 0; i < BUCKETS; ++i)
+      {
+         seen += counts[i];
+         if (seen >= rank && seen > 0) return upper(i) < worst ? upper(i) : worst;
+      }
+      return worst;
+   }
+
+   /********************************************************************************
+   * bucket: Returns the index of the bucket of specified latency, where
+   *         latencies beyond the last octave go to the last bucket.
+   *
+   *         - ns: Latency in nanoseconds.
+   ********************************************************************************/
+   static std::size_t bucket(const std::uint64_t ns)
+   {
+      if (ns < SUB) return static_cast<std::size_t>(ns);
+      if (ns >> (OCTAVES + 1)) return BUCKETS - 1;
+      std::size_t octave = SUB_BITS;
+      while (ns >> (octave + 1)) octave++;
+      return SUB * (octave - SUB_BITS + 1) + ((ns >> (octave - SUB_BITS)) & (SUB - 1));
+   }
+
+   /********************************************************************************
+   * lower: Returns the smallest latency in ns of specified bucket.
+   *
+   *        - index: Index of the bucket.
+   ********************************************************************************/
+   static std::uint64_t lower(const std::size_t index)
+   {
+      if (index < SUB) return index;
+      const auto octave = index / SUB + SUB_BITS - 1;
+      return static_cast<std::uint64_t>(SUB + index % SUB) << (octave - SUB_BITS);
+   }
+
+   /********************************************************************************
+   * upper: Returns the latency in ns just above specified bucket.
+   *
+   *        - index: Index of the bucket.
+   ********************************************************************************/
+   static std::uint64_t upper(const std::size_t index)
+   {
+      return index + 1 < BUCKETS ? lower(index + 1) : lower(index) * 2;
+   }
+
+   /********************************************************************************
+   * print: Prints the percentiles and a bar of every non-empty bucket in the
+   *        terminal, where the latencies are given in microseconds.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      std::uint64_t most = 1;
+
+      for (const auto i : counts)
+      {
+         if (i > most) most = i;
+      }
+
+      ostream << std::fixed << std::setprecision(1);
+      ostream << "Latency, mean:\t\t" << mean() / 1e3 << " us (" << samples << " samples)\n";
+      ostream << "Latency, p50/p99/p99.9:\t" << percentile(0.5) / 1e3 << " / " << percentile(0.99) / 1e3
+              << " / " << percentile(0.999) / 1e3 << " us\n";
+      ostream << "Latency, worst:\t\t" << worst / 1e3 << " us\n";
+
+      for (std::size_t i = 0; i < BUCKETS; ++i)
+      {
+         if (!counts[i]) continue;
+         const auto width = static_cast<std::size_t>(40.0 * counts[i] / most + 0.5);
+         ostream << std::setprecision(3) << std::setw(10) << lower(i) / 1e3 << " us\t" << std::setw(8) << counts[i]
+                 << " " << std::string(width > 0 ? width : 1, '#') << "\n";
+      }
+      return;
+   }
+};
+
+/********************************************************************************
+* stats_report: Struct for collecting named statistics and writing them as one
+*               line per value, so that every kind of statistics is exported
+*               the same way.
+********************************************************************************/
+struct stats_report
+{
+   static constexpr int PRECISION = 12;                /* Significant digits of written values. */
+   std::vector<std::pair<std::string, double>> values; /* Name and value of each statistic. */
+
+   /********************************************************************************
+   * add: Adds a statistic with specified name and value.
+   *
+   *      - name : Name of the statistic.
+   *      - value: Value of the statistic.
+   ********************************************************************************/
+   void add(const std::string& name,
+            const double value)
+   {
+      values.emplace_back(name, value);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the counts of referenced clamp counter, named by specified prefix.
+   *
+   *      - prefix : Prefix of the names.
+   *      - counter: Reference to the clamp counter.
+   ********************************************************************************/
+   void add(const std::string& prefix,
+            const clamp_counter& counter)
+   {
+      add(prefix + "_samples", static_cast<double>(counter.samples));
+      add(prefix + "_clamped", static_cast<double>(counter.clamped));
+      add(prefix + "_events", static_cast<double>(counter.events));
+      add(prefix + "_longest", static_cast<double>(counter.longest));
+      add(prefix + "_mean_duration", counter.mean_duration());
+      add(prefix + "_worst", counter.worst);
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the percentiles of referenced latency histogram in ns, named by
+   *      specified prefix.
+   *
+   *      - prefix   : Prefix of the names.
+   *      - histogram: Reference to the latency histogram.
+   ********************************************************************************/
+   void add(const std::string& prefix,
+            const latency_histogram& histogram)
+   {
+      add(prefix + "_samples", static_cast<double>(histogram.samples));
+      add(prefix + "_mean_ns", histogram.mean());
+      add(prefix + "_p50_ns", static_cast<double>(histogram.percentile(0.5)));
+      add(prefix + "_p99_ns", static_cast<double>(histogram.percentile(0.99)));
+      add(prefix + "_p999_ns", static_cast<double>(histogram.percentile(0.999)));
+      add(prefix + "_worst_ns", static_cast<double>(histogram.worst));
+      return;
+   }
+
+   /********************************************************************************
+   * add: Adds the aggregated counters of referenced fleet statistics.
+   *
+   *      - stats: Reference to the fleet statistics.
+   ********************************************************************************/
+   void add(const saturation_stats& stats)
+   {
+      add("fleet_servos", static_cast<double>(stats.servos));
+      add("fleet_saturated_servos", static_cast<double>(stats.saturated_servos));
+      add("fleet_clamped_servos", static_cast<double>(stats.clamped_servos));
+      add("output_saturation", stats.output);
+      add("sensor_clamping", stats.sensors);
+      return;
+   }
+
+   /********************************************************************************
+   * write: Writes every statistic to specified stream, one per line, with up
+   *        to PRECISION significant digits.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void write(std::ostream& ostream = std::cout) const
+   {
+      ostream << std::defaultfloat << std::setprecision(PRECISION);
+
+      for (const auto& i : values)
+      {
+         ostream << i.first << " " << i.second << "\n";
+      }
+      return;
+   }
+};
+
+#endif /* STATS_HPP_ */
\ No newline at end of file
@@ -0,0 +1,261 @@
+/********************************************************************************
+* timer_wheel.hpp: Contains a hierarchical timer wheel for running a fleet of
+*                  servos with different loop periods, for instance 1 kHz,
+*                  200 Hz and 20 Hz servos, from a single tick of the fastest
+*                  rate. Each servo is a periodic timer, identified by its
+*                  index in the fleet, that is dispatched every period ticks.
+*
+*                  The wheel has NUM_LEVELS levels of SLOTS slots, where a
+*                  slot of level 0 spans one tick and a slot of each higher
+*                  level spans a whole revolution of the level below. A timer
+*                  is placed in the lowest level whose span covers its expiry
+*                  tick and moved down a level, i.e. cascaded, when the level
+*                  below wraps around to it. Every slot is a contiguous list
+*                  of timers holding their expiry and period, so adding a
+*                  timer is an append, rescheduling an expired timer reads
+*                  one list and appends to another without touching per
+*                  timer state elsewhere, and each timer is cascaded at most
+*                  NUM_LEVELS - 1 times per period. The lists keep their
+*                  capacity, so a running wheel doesn't allocate.
+*
+*                  The timers expiring in a tick are the list of a single
+*                  slot of level 0, which is collected into a contiguous
+*                  batch of indexes and handed out to the worker threads in
+*                  chunks, see parallel::for_each_index.
+********************************************************************************/
+#ifndef TIMER_WHEEL_HPP_
+#define TIMER_WHEEL_HPP_
+
+/* Include directives: */
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "parallel.hpp"
+
+/********************************************************************************
+* timer_wheel: Struct for implementation of a hierarchical timer wheel of
+*              periodic timers. The timers are numbered in the order added.
+********************************************************************************/
+struct timer_wheel
+{
+   static constexpr std::size_t LEVEL_BITS  = 8;               /* Bits of the slot index per level. */
+   static constexpr std::size_t SLOTS       = 1 << LEVEL_BITS; /* Number of slots per level. */
+   static constexpr std::size_t NUM_LEVELS  = 4;               /* Number of levels. */
+   static constexpr std::uint64_t MAX_DELAY = 1ull << 24;      /* Longest delay in ticks. */
+
+   /********************************************************************************
+   * timer: Struct holding a scheduled timer, stored in the list of its slot,
+   *        so that rescheduling a timer only reads and appends lists.
+   ********************************************************************************/
+   struct timer
+   {
+      std::uint64_t expiry; /* Expiry tick. */
+      std::uint32_t index;  /* Index of the timer. */
+      std::uint32_t period; /* Period in ticks. */
+   };
+
+   std::vector<timer> slots[NUM_LEVELS * SLOTS]; /* Timers of each slot. */
+   std::vector<std::uint8_t> active;             /* Indicates if each timer is scheduled. */
+   std::vector<std::uint32_t> due;               /* Timers expired in the last tick. */
+   std::vector<timer> moving;                    /* Timers of a slot being cascaded or expired. */
+   std::uint64_t now        = 0;                 /* Current tick. */
+   std::uint64_t cascades   = 0;                 /* Number of timers moved down a level. */
+   std::uint64_t dispatched = 0;                 /* Number of timers expired. */
+
+   /********************************************************************************
+   * clear: Removes every timer and returns to tick 0.
+   ********************************************************************************/
+   void clear(void)
+   {
+      for (auto& i : slots)
+      {
+         i.clear();
+      }
+
+      active.clear();
+      due.clear();
+      now = 0;
+      cascades = 0;
+      dispatched = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * reserve: Reserves room for specified number of timers, so that adding them
+   *          doesn't reallocate.
+   *
+   *          - count: Number of timers.
+   ********************************************************************************/
+   void reserve(const std::size_t count)
+   {
+      active.reserve(count);
+      due.reserve(count);
+      return;
+   }
+
+   /********************************************************************************
+   * size: Returns the number of timers added.
+   ********************************************************************************/
+   std::size_t size(void) const
+   {
+      return active.size();
+   }
+
+   /********************************************************************************
+   * add: Adds a periodic timer with specified period and delay until its first
+   *      expiry and returns its index. Periods and delays are limited to
+   *      between 1 and MAX_DELAY ticks. Spreading the delays of timers with
+   *      equal periods balances the batches of the ticks.
+   *
+   *      - period: Period of the timer in ticks.
+   *      - delay : Ticks until the first expiry (default = 1).
+   ********************************************************************************/
+   std::uint32_t add(const std::uint64_t period,
+                     const std::uint64_t delay = 1)
+   {
+      const auto index = static_cast<std::uint32_t>(active.size());
+      active.push_back(1);
+      schedule(timer{ now + limit(delay), index, static_cast<std::uint32_t>(limit(period)) });
+      return index;
+   }
+
+   /********************************************************************************
+   * remove: Removes specified timer, so that it no longer expires. The timer
+   *         is only marked as removed and dropped from its slot when the slot
+   *         is reached, so removing is a single store. The index stays taken.
+   *
+   *         - index: Index of the timer.
+   ********************************************************************************/
+   void remove(const std::uint32_t index)
+   {
+      active[index] = 0;
+      return;
+   }
+
+   /********************************************************************************
+   * tick: Advances the wheel one tick and returns the batch of indexes of the
+   *       timers expiring in this tick, which are rescheduled one period
+   *       later. The slots of the higher levels reached by the tick are
+   *       cascaded first.
+   ********************************************************************************/
+   const std::vector<std::uint32_t>& tick(void)
+   {
+      now++;
+      std::size_t level = 1;
+
+      while (level < NUM_LEVELS && (now & ((1ull << (LEVEL_BITS * level)) - 1)) == 0)
+      {
+         level++;
+      }
+
+      for (auto i = level - 1; i > 0; --i)
+      {
+         cascade(i);
+      }
+
+      due.clear();
+      moving.clear();
+      moving.swap(slots[now & (SLOTS - 1)]);
+
+      for (auto i : moving)
+      {
+         if (!active[i.index]) continue;
+         due.push_back(i.index);
+         i.expiry += i.period;
+         schedule(i);
+      }
+
+      dispatched += due.size();
+      return due;
+   }
+
+   /********************************************************************************
+   * dispatch: Advances the wheel one tick and calls referenced function with
+   *           the index of every timer expiring, where the batch is handed
+   *           out to the worker threads in chunks of specified size. Returns
+   *           the number of timers dispatched.
+   *
+   *           - function: Function to call with each index, safe to call from
+   *                       several threads at once for different indexes.
+   *           - threads : Maximum number of threads to use (default = 1).
+   *           - chunk   : Number of timers per work item (default = 1024).
+   ********************************************************************************/
+   template<class Function>
+   std::size_t dispatch(Function&& function,
+                        const std::size_t threads = 1,
+                        const std::size_t chunk = 1024)
+   {
+      const auto& batch = tick();
+      const auto* indexes = batch.data();
+
+      if (threads <= 1)
+      {
+         for (const auto i : batch)
+         {
+            function(i);
+         }
+      }
+      else
+      {
+         parallel::for_each_index(batch.size(), [&](const std::size_t i) { function(indexes[i]); },
+                                  threads, chunk);
+      }
+      return batch.size();
+   }
+
+   /********************************************************************************
+   * limit: Returns specified number of ticks limited to between 1 and
+   *        MAX_DELAY.
+   *
+   *        - ticks: Number of ticks.
+   ********************************************************************************/
+   static std::uint64_t limit(const std::uint64_t ticks)
+   {
+      return ticks < 1 ? 1 : (ticks > MAX_DELAY ? MAX_DELAY : ticks);
+   }
+
+   /********************************************************************************
+   * schedule: Appends referenced timer to the slot of its expiry tick. The
+   *           level is the lowest where the expiry tick and the current tick
+   *           share every higher slot index, so the timer is cascaded when
+   *           the current tick reaches the slot.
+   *
+   *           - entry: Reference to the timer, expiring after the current tick.
+   ********************************************************************************/
+   void schedule(const timer& entry)
+   {
+      std::size_t level = 0;
+
+      while (level < NUM_LEVELS - 1 &&
+             (entry.expiry >> (LEVEL_BITS * (level + 1))) != (now >> (LEVEL_BITS * (level + 1))))
+      {
+         level++;
+      }
+
+      slots[level * SLOTS + ((entry.expiry >> (LEVEL_BITS * level)) & (SLOTS - 1))].push_back(entry);
+      return;
+   }
+
+   /********************************************************************************
+   * cascade: Moves the timers of the slot of specified level reached by the
+   *          current tick to the levels below, where removed timers are
+   *          dropped.
+   *
+   *          - level: Level of the slot, at least 1.
+   ********************************************************************************/
+   void cascade(const std::size_t level)
+   {
+      moving.clear();
+      moving.swap(slots[level * SLOTS + ((now >> (LEVEL_BITS * level)) & (SLOTS - 1))]);
+
+      for (const auto& i : moving)
+      {
+         if (!active[i.index]) continue;
+         schedule(i);
+         cascades++;
+      }
+      return;
+   }
+};
+
+#endif /* TIMER_WHEEL_HPP_ */
\ No newline at end of file
@@ -8,36 +8,45 @@
 #define TOF_SENSOR_HPP_
 
 /* Include directives: */
+#include <atomic>
 #include <iostream>
+#include "calibration.hpp"
 #include "input.hpp"
+#include "stats.hpp"
 
 /********************************************************************************
-* tof_sensor: Struct for implementation of TOF sensors with adjustable min and
-*             max values.
+* basic_tof_sensor: Struct for implementation of TOF sensors with adjustable
+*                   min and max values. The numeric type is a template
+*                   parameter, see basic_pid_controller. The sensor is used
+*                   with doubles via the tof_sensor alias.
 ********************************************************************************/
-struct tof_sensor
+template<class T = double>
+struct basic_tof_sensor
 {
    static constexpr auto DEFAULT_MIN = 0.0;    /* Default minimum sensor value. */
    static constexpr auto DEFAULT_MAX = 1023.0; /* Default maximum sensor value. */
-   double min = DEFAULT_MIN;                   /* Minimum sensor value. */
-   double max = DEFAULT_MAX;                   /* Maximum sensor value. */
-   double val  = 0;                            /* Input sensor value. */
+   T min = DEFAULT_MIN;                        /* Minimum sensor value. */
+   T max = DEFAULT_MAX;                        /* Maximum sensor value. */
+   T val  = 0;                                 /* Input sensor value. */
+   const std::atomic<const calibration_table*>* calibration = nullptr; /* Calibration slot, none if nullptr. */
+   clamp_counter clamping;                     /* Counter of clamped values, disabled by default. */
 
    /********************************************************************************
-   * tof_sensor: Default constructor, initiates TOF sensor with default parameters.
+   * basic_tof_sensor: Default constructor, initiates TOF sensor with default
+   *                   parameters.
    ********************************************************************************/
-   tof_sensor(void) { }
+   basic_tof_sensor(void) { }
 
    /********************************************************************************
-   * tof_sensor: Initiates TOF sensor with specified minimum and maximum sensor
-   *             values, provided that the maximum value is higher than the 
-   *             minimum value.
+   * basic_tof_sensor: Initiates TOF sensor with specified minimum and maximum
+   *                   sensor values, provided that the maximum value is higher
+   *                   than the minimum value.
    * 
-   *             - sensor_min: Minimum sensor value.
-   *             - sensor_max: Maximum sensor value.
+   *                   - sensor_min: Minimum sensor value.
+   *                   - sensor_max: Maximum sensor value.
    ********************************************************************************/
-   tof_sensor(const double sensor_min, 
-              const double sensor_max)
+   basic_tof_sensor(const T sensor_min, 
+                    const T sensor_max)
    {
       init(sensor_min, sensor_max);
       return;
@@ -50,11 +59,11 @@ struct tof_sensor
    *       - sensor_min: Minimum sensor value.
    *       - sensor_max: Maximum sensor value.
    ********************************************************************************/
-   void init(const double sensor_min,
-             const double sensor_max)
+   void init(const T sensor_min,
+             const T sensor_max)
    {
-      min = sensor_min >= 0 ? sensor_min : 0;
-      max = sensor_max > sensor_min ? sensor_max : 1023;
+      min = sensor_min >= 0 ? sensor_min : T(0);
+      max = sensor_max > sensor_min ? sensor_max : T(1023);
       return;
    }
 
@@ -64,37 +73,90 @@ struct tof_sensor
    ********************************************************************************/
    void read_from_terminal(void)
    {
-      val = input::get_double();
-      check_sensor_value();
+      update(input::get_double());
       return;
    }
 
+   /********************************************************************************
+   * update: Sets the sensor value from specified raw reading, linearized by the
+   *         current calibration table if a calibration slot is attached and
+   *         then limited to the minimum and maximum. The slot is read once per
+   *         reading, so a reloaded table is used from the next reading. The
+   *         load is sequentially consistent, so the store can tell when the
+   *         old table is no longer applied, see calibration_store::publish.
+   *
+   *         - raw: Raw sensor reading.
+   ********************************************************************************/
+   void update(const T raw)
+   {
+      val = read(raw);
+      return;
+   }
+
+   /********************************************************************************
+   * read: Returns the sensor value of specified raw reading, linearized and
+   *       limited like in update, without changing the value of the sensor.
+   *       Used by sensors of an array sharing the calibration and clamp
+   *       counter of this sensor.
+   *
+   *       - raw: Raw sensor reading.
+   ********************************************************************************/
+   T read(const T raw)
+   {
+      const auto table = calibration ? calibration->load(std::memory_order_seq_cst) : nullptr;
+      return limit(table ? table->apply(raw) : raw);
+   }
+
    /********************************************************************************
    * check_sensor_value: Checks if the specified sensor value is within set minimum
    *                     and maximum. If the sensor value is out of this range, 
-   *                     the value is set to nearest boundary. 
+   *                     the value is set to nearest boundary. Clamping is
+   *                     counted if the counter is enabled.
    ********************************************************************************/
    void check_sensor_value(void)
    {
-      if (val < min)
+      val = limit(val);
+      return;
+   }
+
+   /********************************************************************************
+   * limit: Returns specified value limited to the minimum and maximum, where
+   *        clamping is counted if the counter is enabled.
+   *
+   *        - value: Sensor value to limit.
+   ********************************************************************************/
+   T limit(const T value)
+   {
+      if (value < min)
       {
-         val = min;
+         if (clamping.enabled) clamping.clamp(numeric_value(min - value));
+         return min;
       }
-      else if (val > max)
+      else if (value > max)
       {
-         val = max;
+         if (clamping.enabled) clamping.clamp(numeric_value(value - max));
+         return max;
       }
-      return;
+      else if (clamping.enabled)
+      {
+         clamping.pass();
+      }
+      return value;
    }
 
    /********************************************************************************
    * input_range: Returns the range of the input values, i.e. the difference
    *              between specified max and min values.
    ********************************************************************************/
-   double input_range(void) const
+   T input_range(void) const
    {
       return max - min;
    }
 };
 
+/********************************************************************************
+* tof_sensor: TOF sensor using doubles, used by the emulator.
+********************************************************************************/
+using tof_sensor = basic_tof_sensor<double>;
+
 #endif /* TOF_SENSOR_HPP_ */
\ No newline at end of file
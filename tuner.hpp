@@ -0,0 +1,448 @@
+/********************************************************************************
+* tuner.hpp: Contains an offline tuner for finding PID parameters of a servo.
+*            Candidate parameters are evaluated by simulating a suite of
+*            scenarios against a plant model and weighting the resulting
+*            metrics with a cost function. The search is done with several
+*            Nelder-Mead simplexes at once, where all candidates of an
+*            iteration are evaluated in parallel on all CPU cores.
+********************************************************************************/
+#ifndef TUNER_HPP_
+#define TUNER_HPP_
+
+/* Include directives: */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "ensemble.hpp"
+#include "loop_analysis.hpp"
+#include "parallel.hpp"
+#include "result_cache.hpp"
+
+/********************************************************************************
+* tuner_result: Struct holding the outcome of a tuning run.
+********************************************************************************/
+struct tuner_result
+{
+   pid_gains gains;             /* Best PID parameters found. */
+   double cost = 0;             /* Cost of the best PID parameters. */
+   metrics result;              /* Metrics of the best PID parameters. */
+   std::size_t evaluations = 0; /* Number of evaluated candidates. */
+   std::size_t rejected    = 0; /* Number of candidates rejected without simulation. */
+   std::size_t iterations  = 0; /* Number of performed iterations. */
+   double seconds = 0;          /* Duration of the tuning in seconds. */
+
+   /********************************************************************************
+   * evaluations_per_second: Returns the number of candidates evaluated per second.
+   ********************************************************************************/
+   double evaluations_per_second(void) const
+   {
+      return seconds > 0 ? evaluations / seconds : 0;
+   }
+
+   /********************************************************************************
+   * print: Prints the best PID parameters along with its cost and metrics and
+   *        the evaluation rate achieved.
+   *
+   *        - ostream: Reference to output stream used (default = std::cout).
+   ********************************************************************************/
+   void print(std::ostream& ostream = std::cout) const
+   {
+      ostream << "--------------------------------------------------------------------------------\n";
+      ostream << std::fixed << std::setprecision(4);
+      ostream << "Best gains:\t\t\tkp = " << gains.kp << ", ki = " << gains.ki
+              << ", kd = " << gains.kd << "\n";
+      ostream << "Cost:\t\t\t\t" << cost << "\n";
+      result.print(ostream);
+      ostream << std::setprecision(3);
+      ostream << "Iterations:\t\t\t" << iterations << "\n";
+      ostream << "Evaluations:\t\t\t" << evaluations << "\n";
+      ostream << "Rejected by analysis:\t\t" << rejected << "\n";
+      ostream << "Duration:\t\t\t" << seconds << " s\n";
+      ostream << std::setprecision(0);
+      ostream << "Evaluations per second:\t\t" << evaluations_per_second() << "\n";
+      ostream << "--------------------------------------------------------------------------------\n\n";
+      return;
+   }
+};
+
+/********************************************************************************
+* tuner: Struct for implementation of a parallel PID parameter optimizer.
+*        The parameters are searched in logarithmic scale, so that all gains
+*        stay positive and are searched with the same relative resolution.
+*        Before a candidate is simulated, the closed loop is analyzed in the
+*        z-domain, and candidates whose linear loop is unstable are given a
+*        penalty cost growing with the spectral radius instead.
+********************************************************************************/
+struct tuner
+{
+   static constexpr auto MIN_EXPONENT = -4.0;  /* Smallest gain searched (10^-4). */
+   static constexpr auto MAX_EXPONENT = 1.5;   /* Largest gain searched (10^1.5). */
+   static constexpr auto REJECTED_COST = 1e6; /* Cost of a rejected candidate per spectral radius. */
+   using point = std::array<double, 3>;        /* Gains in logarithmic scale. */
+
+   servo config;                /* Servo configuration to tune. */
+   plant_model plant;           /* Plant model to simulate against. */
+   std::vector<scenario> suite; /* Scenarios each candidate is evaluated with. */
+   cost_function cost;          /* Cost function for weighting the metrics. */
+   std::size_t num_threads = parallel::num_threads(); /* Number of threads used. */
+   result_cache* cache = nullptr; /* Persistent result cache, not used if nullptr. */
+   bool prefilter = true;         /* Rejects candidates with unstable linear loop if true. */
+   const ensemble_evaluator* ensemble = nullptr; /* Plant ensemble to score on, not used if nullptr. */
+
+   /********************************************************************************
+   * tuner: Initiates tuner with specified servo configuration, plant model and
+   *        scenario suite.
+   *
+   *        - config: Reference to servo configuration to tune.
+   *        - plant : Reference to plant model (default = default model).
+   *        - suite : Reference to scenario suite (default = default suite).
+   ********************************************************************************/
+   tuner(const servo& config,
+         const plant_model& plant = plant_model(),
+         const std::vector<scenario>& suite = scenario::default_suite())
+      : config(config), plant(plant), suite(suite) { }
+
+   /********************************************************************************
+   * evaluate: Returns the cost of specified PID parameters. The metrics of the
+   *           run are stored in referenced metrics if specified. If the
+   *           candidate is rejected by the analysis, the penalty cost is
+   *           returned and the metrics are left untouched. With an ensemble,
+   *           the selected ensemble score is returned along with the metrics
+   *           of the worst variant.
+   *
+   *           - gains : Reference to PID parameters to evaluate.
+   *           - result: Pointer to storage for metrics (default = nullptr).
+   ********************************************************************************/
+   double evaluate(const pid_gains& gains,
+                   metrics* result = nullptr) const
+   {
+      if (prefilter)
+      {
+         const loop_analysis analysis(gains, plant, false);
+         if (!analysis.stable()) return REJECTED_COST * analysis.spectral_radius;
+      }
+
+      if (ensemble) return ensemble->cost_of(gains, result);
+
+      auto candidate = config;
+      candidate.pid.set_gains(gains);
+      const auto total = simulate_cached(cache, candidate, plant, suite);
+      if (result) *result = total;
+      return cost(total);
+   }
+
+   /********************************************************************************
+   * evaluate: Evaluates referenced candidates in parallel and stores the cost
+   *           of each candidate in referenced vector. Returns the number of
+   *           candidates rejected by the analysis.
+   *
+   *           - candidates: Reference to PID parameters to evaluate.
+   *           - costs     : Reference to vector for storage of the costs.
+   ********************************************************************************/
+   std::size_t evaluate(const std::vector<pid_gains>& candidates,
+                        std::vector<double>& costs) const
+   {
+      std::size_t rejected = 0;
+      costs.resize(candidates.size());
+      parallel::for_each_index(candidates.size(), [&](const std::size_t i)
+         {
+            costs[i] = evaluate(candidates[i]);
+         }, num_threads);
+
+      for (const auto i : costs)
+      {
+         if (i >= REJECTED_COST) rejected++;
+      }
+      return rejected;
+   }
+
+   /********************************************************************************
+   * optimize: Searches for the PID parameters with the lowest cost, starting
+   *           from specified parameters. Several Nelder-Mead simplexes are run
+   *           simultaneously, the first one around the start parameters and
+   *           the rest around pseudo random start points. In every iteration,
+   *           the reflected, expanded and both contracted points of every
+   *           simplex are evaluated speculatively in one parallel batch, so
+   *           that the cores are kept busy even though a single simplex only
+   *           needs one of the points.
+   *
+   *           - start         : Reference to start parameters.
+   *           - num_simplexes : Number of simultaneous simplexes (default = 8).
+   *           - max_iterations: Maximum number of iterations (default = 150).
+   *           - tolerance     : Cost difference within a simplex at which it is
+   *                             considered converged (default = 1e-6).
+   ********************************************************************************/
+   tuner_result optimize(const pid_gains& start,
+                         const std::size_t num_simplexes = 8,
+                         const std::size_t max_iterations = 150,
+                         const double tolerance = 1e-6) const
+   {
+      const auto t0 = std::chrono::steady_clock::now();
+      const auto count = num_simplexes > 0 ? num_simplexes : 1;
+      std::vector<std::array<point, 4>> vertices(count);
+      std::vector<std::array<double, 4>> values(count);
+      std::vector<bool> converged(count, false);
+      std::vector<pid_gains> batch;
+      std::vector<double> costs;
+      tuner_result best;
+      std::uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+      auto random = [&](void)
+      {
+         seed ^= seed << 13;
+         seed ^= seed >> 7;
+         seed ^= seed << 17;
+         return static_cast<double>(seed >> 11) * (1.0 / 9007199254740992.0);
+      };
+
+      for (std::size_t s = 0; s < count; ++s)
+      {
+         auto origin = to_point(start);
+
+         if (s > 0)
+         {
+            for (auto& i : origin)
+            {
+               i = clamp(i + 2.0 * random() - 1.0);
+            }
+         }
+
+         for (std::size_t v = 0; v < 4; ++v)
+         {
+            vertices[s][v] = origin;
+            if (v > 0) vertices[s][v][v - 1] = clamp(origin[v - 1] + (origin[v - 1] < MAX_EXPONENT - 0.5 ? 0.5 : -0.5));
+            batch.push_back(to_gains(vertices[s][v]));
+         }
+      }
+
+      best.rejected += evaluate(batch, costs);
+      best.evaluations += batch.size();
+
+      for (std::size_t s = 0; s < count; ++s)
+      {
+         for (std::size_t v = 0; v < 4; ++v)
+         {
+            values[s][v] = costs[s * 4 + v];
+         }
+      }
+
+      for (best.iterations = 0; best.iterations < max_iterations; ++best.iterations)
+      {
+         std::vector<std::size_t> active;
+         batch.clear();
+
+         for (std::size_t s = 0; s < count; ++s)
+         {
+            sort_simplex(vertices[s], values[s]);
+            if (converged[s]) continue;
+
+            if (values[s][3] - values[s][0] < tolerance)
+            {
+               converged[s] = true;
+               continue;
+            }
+
+            const auto centroid = centroid_of(vertices[s]);
+            active.push_back(s);
+            batch.push_back(to_gains(along(centroid, vertices[s][3], -1.0)));
+            batch.push_back(to_gains(along(centroid, vertices[s][3], -2.0)));
+            batch.push_back(to_gains(along(centroid, vertices[s][3], -0.5)));
+            batch.push_back(to_gains(along(centroid, vertices[s][3], 0.5)));
+         }
+
+         if (active.empty()) break;
+         best.rejected += evaluate(batch, costs);
+         best.evaluations += batch.size();
+
+         std::vector<std::size_t> shrinking;
+
+         for (std::size_t a = 0; a < active.size(); ++a)
+         {
+            const auto s = active[a];
+            const auto centroid = centroid_of(vertices[s]);
+            const auto reflected = costs[a * 4];
+            const auto expanded = costs[a * 4 + 1];
+            const auto outside = costs[a * 4 + 2];
+            const auto inside = costs[a * 4 + 3];
+            auto& worst = vertices[s][3];
+            auto& worst_value = values[s][3];
+
+            if (reflected < values[s][0])
+            {
+               if (expanded < reflected)
+               {
+                  worst = along(centroid, worst, -2.0);
+                  worst_value = expanded;
+               }
+               else
+               {
+                  worst = along(centroid, worst, -1.0);
+                  worst_value = reflected;
+               }
+            }
+            else if (reflected < values[s][2])
+            {
+               worst = along(centroid, worst, -1.0);
+               worst_value = reflected;
+            }
+            else if (reflected < worst_value && outside <= reflected)
+            {
+               worst = along(centroid, worst, -0.5);
+               worst_value = outside;
+            }
+            else if (reflected >= worst_value && inside < worst_value)
+            {
+               worst = along(centroid, worst, 0.5);
+               worst_value = inside;
+            }
+            else
+            {
+               shrinking.push_back(s);
+            }
+         }
+
+         if (!shrinking.empty())
+         {
+            batch.clear();
+
+            for (const auto s : shrinking)
+            {
+               for (std::size_t v = 1; v < 4; ++v)
+               {
+                  vertices[s][v] = along(vertices[s][0], vertices[s][v], 0.5);
+                  batch.push_back(to_gains(vertices[s][v]));
+               }
+            }
+
+            best.rejected += evaluate(batch, costs);
+            best.evaluations += batch.size();
+
+            for (std::size_t a = 0; a < shrinking.size(); ++a)
+            {
+               for (std::size_t v = 1; v < 4; ++v)
+               {
+                  values[shrinking[a]][v] = costs[a * 3 + v - 1];
+               }
+            }
+         }
+      }
+
+      best.cost = values[0][0];
+      best.gains = to_gains(vertices[0][0]);
+
+      for (std::size_t s = 0; s < count; ++s)
+      {
+         for (std::size_t v = 0; v < 4; ++v)
+         {
+            if (values[s][v] < best.cost)
+            {
+               best.cost = values[s][v];
+               best.gains = to_gains(vertices[s][v]);
+            }
+         }
+      }
+
+      evaluate(best.gains, &best.result);
+      best.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      return best;
+   }
+
+   /********************************************************************************
+   * clamp: Returns specified exponent limited to the searched range.
+   *
+   *        - exponent: Gain exponent to limit.
+   ********************************************************************************/
+   static double clamp(const double exponent)
+   {
+      return exponent < MIN_EXPONENT ? MIN_EXPONENT : (exponent > MAX_EXPONENT ? MAX_EXPONENT : exponent);
+   }
+
+   /********************************************************************************
+   * to_point: Returns referenced PID parameters in logarithmic scale.
+   *
+   *           - gains: Reference to PID parameters.
+   ********************************************************************************/
+   static point to_point(const pid_gains& gains)
+   {
+      const auto floor = std::pow(10.0, MIN_EXPONENT);
+      return point{ clamp(std::log10(std::max(gains.kp, floor))),
+                    clamp(std::log10(std::max(gains.ki, floor))),
+                    clamp(std::log10(std::max(gains.kd, floor))) };
+   }
+
+   /********************************************************************************
+   * to_gains: Returns PID parameters of specified point in logarithmic scale.
+   *
+   *           - x: Reference to point in logarithmic scale.
+   ********************************************************************************/
+   static pid_gains to_gains(const point& x)
+   {
+      return pid_gains{ std::pow(10.0, clamp(x[0])),
+                        std::pow(10.0, clamp(x[1])),
+                        std::pow(10.0, clamp(x[2])) };
+   }
+
+   /********************************************************************************
+   * along: Returns the point on the line from point a through point b at
+   *        specified relative distance, i.e. a + t * (b - a).
+   *
+   *        - a: Reference to first point.
+   *        - b: Reference to second point.
+   *        - t: Relative distance along the line.
+   ********************************************************************************/
+   static point along(const point& a,
+                      const point& b,
+                      const double t)
+   {
+      point x{};
+
+      for (std::size_t i = 0; i < x.size(); ++i)
+      {
+         x[i] = clamp(a[i] + t * (b[i] - a[i]));
+      }
+      return x;
+   }
+
+   /********************************************************************************
+   * centroid_of: Returns the centroid of the three best vertices of a simplex.
+   *
+   *              - simplex: Reference to sorted vertices of the simplex.
+   ********************************************************************************/
+   static point centroid_of(const std::array<point, 4>& simplex)
+   {
+      point x{};
+
+      for (std::size_t i = 0; i < x.size(); ++i)
+      {
+         x[i] = (simplex[0][i] + simplex[1][i] + simplex[2][i]) / 3.0;
+      }
+      return x;
+   }
+
+   /********************************************************************************
+   * sort_simplex: Sorts the vertices of a simplex in ascending order of cost.
+   *
+   *               - simplex: Reference to vertices of the simplex.
+   *               - costs  : Reference to the cost of each vertex.
+   ********************************************************************************/
+   static void sort_simplex(std::array<point, 4>& simplex,
+                            std::array<double, 4>& costs)
+   {
+      for (std::size_t i = 1; i < 4; ++i)
+      {
+         for (auto j = i; j > 0 && costs[j] < costs[j - 1]; --j)
+         {
+            std::swap(costs[j], costs[j - 1]);
+            std::swap(simplex[j], simplex[j - 1]);
+         }
+      }
+      return;
+   }
+};
+
+#endif /* TUNER_HPP_ */
\ No newline at end of file